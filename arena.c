@@ -0,0 +1,130 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t pad;
+} ArenaChunk;
+
+typedef struct ArenaLarge {
+    struct ArenaLarge *prev;
+    struct ArenaLarge *next;
+    size_t size;
+    size_t pad;
+} ArenaLarge;
+
+static const unsigned short class_size[ARENA_CLASSES] = {
+    16, 32, 48, 64, 80, 96, 128, 160, 192, 256, 384, 512, 768, 1024, 1536, 2048
+};
+
+static int class_of(size_t size) {
+    int c = 0;
+    while (class_size[c] < size) c++;
+    return c;
+}
+
+void arena_init(Arena *arena) {
+    memset(arena, 0, sizeof(Arena));
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    if (size > ARENA_MAX_SMALL) {
+        ArenaLarge *block = malloc(sizeof(ArenaLarge) + size);
+        if (!block) return NULL;
+        block->prev = NULL;
+        block->next = arena->large;
+        block->size = size;
+        if (arena->large) arena->large->prev = block;
+        arena->large = block;
+        arena->reserved += sizeof(ArenaLarge) + size;
+        arena->used += size;
+        return block + 1;
+    }
+    int c = class_of(size);
+    void *p = arena->free[c];
+    if (p) {
+        memcpy(&arena->free[c], p, sizeof(void *));
+    } else {
+        if (arena->left < class_size[c]) {
+            ArenaChunk *chunk = malloc(ARENA_CHUNK);
+            if (!chunk) return NULL;
+            chunk->next = arena->chunks;
+            arena->chunks = chunk;
+            arena->next = (char *)(chunk + 1);
+            arena->left = ARENA_CHUNK - sizeof(ArenaChunk);
+            arena->reserved += ARENA_CHUNK;
+        }
+        p = arena->next;
+        arena->next += class_size[c];
+        arena->left -= class_size[c];
+    }
+    arena->used += class_size[c];
+    return p;
+}
+
+void arena_free(Arena *arena, void *ptr, size_t size) {
+    if (!ptr) return;
+    if (size > ARENA_MAX_SMALL) {
+        ArenaLarge *block = (ArenaLarge *)ptr - 1;
+        if (block->prev) {
+            block->prev->next = block->next;
+        } else {
+            arena->large = block->next;
+        }
+        if (block->next) block->next->prev = block->prev;
+        arena->reserved -= sizeof(ArenaLarge) + block->size;
+        arena->used -= block->size;
+        free(block);
+        return;
+    }
+    int c = class_of(size);
+    memcpy(ptr, &arena->free[c], sizeof(void *));
+    arena->free[c] = ptr;
+    arena->used -= class_size[c];
+}
+
+void *arena_realloc(Arena *arena, void *ptr, size_t old_size, size_t size) {
+    void *grown;
+    if (!ptr) return arena_alloc(arena, size);
+    if (old_size <= ARENA_MAX_SMALL && size <= ARENA_MAX_SMALL &&
+        class_of(old_size) == class_of(size)) {
+        return ptr;
+    }
+    if (old_size > ARENA_MAX_SMALL && size > ARENA_MAX_SMALL) {
+        ArenaLarge *block = (ArenaLarge *)ptr - 1, *moved;
+        size_t was = block->size;
+        moved = realloc(block, sizeof(ArenaLarge) + size);
+        if (!moved) return NULL;
+        if (moved->prev) {
+            moved->prev->next = moved;
+        } else {
+            arena->large = moved;
+        }
+        if (moved->next) moved->next->prev = moved;
+        moved->size = size;
+        arena->reserved += size - was;
+        arena->used += size - was;
+        return moved + 1;
+    }
+    grown = arena_alloc(arena, size);
+    if (!grown) return NULL;
+    memcpy(grown, ptr, old_size < size ? old_size : size);
+    arena_free(arena, ptr, old_size);
+    return grown;
+}
+
+void arena_release(Arena *arena) {
+    while (arena->chunks) {
+        ArenaChunk *next = arena->chunks->next;
+        free(arena->chunks);
+        arena->chunks = next;
+    }
+    while (arena->large) {
+        ArenaLarge *next = arena->large->next;
+        free(arena->large);
+        arena->large = next;
+    }
+    arena_init(arena);
+}
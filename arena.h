@@ -0,0 +1,40 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_CHUNK (64u << 10)
+#define ARENA_CLASSES 16
+#define ARENA_MAX_SMALL 2048
+
+struct ArenaChunk;
+struct ArenaLarge;
+
+/*
+ * Memory owned by one buffer, undo log or highlight cache.  Blocks up to
+ * ARENA_MAX_SMALL bytes are carved from ARENA_CHUNK chunks in size classes
+ * and go back on their class's free list when freed; larger blocks are
+ * allocated one by one but stay linked to the arena.  The caller passes
+ * the size back on free, so small blocks carry no header.
+ *
+ * arena_release() frees the chunks and large blocks, never the small
+ * blocks one at a time, so throwing away a buffer does not walk its tree.
+ * An arena is used by one thread.
+ */
+typedef struct {
+    struct ArenaChunk *chunks;
+    char *next;
+    size_t left;
+    void *free[ARENA_CLASSES];
+    struct ArenaLarge *large;
+    size_t reserved;
+    size_t used;
+} Arena;
+
+void arena_init(Arena *arena);
+void *arena_alloc(Arena *arena, size_t size);
+void *arena_realloc(Arena *arena, void *ptr, size_t old_size, size_t size);
+void arena_free(Arena *arena, void *ptr, size_t size);
+void arena_release(Arena *arena);
+
+#endif
@@ -0,0 +1,571 @@
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "batch.h"
+
+typedef struct {
+    const BatchScript *script;
+    BatchStats *stats;
+    int in;
+    int out;
+    off_t size;
+    char *block;
+    size_t block_cap;
+    off_t block_pos;
+    size_t block_len;
+    off_t pos;
+    size_t line;
+    off_t copy_from;
+    char *out_buf;
+    size_t out_len;
+    char *scratch[2];
+    size_t scratch_cap[2];
+    int no_copy;
+} Batch;
+
+static const char *parse_line_number(const char *p, size_t *line, const char **error) {
+    char *end;
+    unsigned long long value = strtoull(p, &end, 10);
+    if (value == 0) {
+        *error = "line numbers start at 1";
+        return NULL;
+    }
+    *line = value;
+    return end;
+}
+
+/* Copies s-command text up to an unescaped delim; the regex keeps its other escapes. */
+static const char *parse_delimited(const char *p, char delim, int regex, char **out,
+                                   size_t *len) {
+    char *text = malloc(strlen(p) + 1);
+    size_t n = 0;
+    for (; *p && *p != delim; p++) {
+        if (*p == '\\' && p[1]) {
+            p++;
+            if (*p == delim || (!regex && *p == '\\')) {
+                text[n++] = *p;
+            } else if (!regex && *p == 'n') {
+                text[n++] = '\n';
+            } else {
+                text[n++] = '\\';
+                text[n++] = *p;
+            }
+        } else {
+            text[n++] = *p;
+        }
+    }
+    text[n] = '\0';
+    *out = text;
+    *len = n;
+    return *p == delim ? p + 1 : NULL;
+}
+
+static const char *parse_substitute(BatchCommand *cmd, const char *p, const char **error) {
+    char delim = *p++, *pattern;
+    size_t pattern_len;
+    int flags = 0;
+    if (!delim || delim == '\\' || delim == '\n' || isalnum((unsigned char)delim)) {
+        *error = "bad delimiter after s";
+        return NULL;
+    }
+    p = parse_delimited(p, delim, 1, &pattern, &pattern_len);
+    if (p) p = parse_delimited(p, delim, 0, &cmd->text, &cmd->text_len);
+    if (!p) {
+        free(pattern);
+        *error = "unterminated s command";
+        return NULL;
+    }
+    for (; *p == 'g' || *p == 'i'; p++) {
+        if (*p == 'g') cmd->global = 1;
+        if (*p == 'i') flags |= RE_IGNORE_CASE;
+    }
+    if (pattern_len == 0) {
+        *error = "empty regular expression";
+    } else {
+        cmd->regex = re_compile(pattern, flags, error);
+    }
+    free(pattern);
+    return cmd->regex ? p : NULL;
+}
+
+int batch_parse(BatchScript *script, const char *command, const char **error) {
+    BatchCommand cmd = { 0 };
+    const char *p = command;
+    cmd.first = 1;
+    cmd.last = BATCH_END;
+    while (isspace((unsigned char)*p)) p++;
+    if (*p == '$') {
+        cmd.at_last = 1;
+        p++;
+    } else if (isdigit((unsigned char)*p)) {
+        if (!(p = parse_line_number(p, &cmd.first, error))) return -1;
+        cmd.last = cmd.first;
+        if (*p == ',') {
+            p++;
+            if (*p == '$') {
+                cmd.last = BATCH_END;
+                p++;
+            } else if (!isdigit((unsigned char)*p)) {
+                *error = "missing end of range";
+                return -1;
+            } else if (!(p = parse_line_number(p, &cmd.last, error))) {
+                return -1;
+            } else if (cmd.last < cmd.first) {
+                *error = "range ends before it starts";
+                return -1;
+            }
+        }
+    }
+    while (isspace((unsigned char)*p)) p++;
+    switch (*p) {
+    case 'd':
+        cmd.type = BATCH_DELETE;
+        p++;
+        break;
+    case 'i':
+    case 'a':
+        cmd.type = *p == 'i' ? BATCH_INSERT : BATCH_APPEND;
+        p++;
+        while (*p == ' ' || *p == '\t') p++;
+        cmd.text_len = strcspn(p, "\r\n");
+        cmd.text = strndup(p, cmd.text_len);
+        p += cmd.text_len;
+        break;
+    case 's':
+        cmd.type = BATCH_SUBSTITUTE;
+        if (!(p = parse_substitute(&cmd, p + 1, error))) {
+            free(cmd.text);
+            return -1;
+        }
+        break;
+    default:
+        *error = *p ? "unknown command" : "missing command";
+        return -1;
+    }
+    while (isspace((unsigned char)*p)) p++;
+    if (*p) {
+        free(cmd.text);
+        re_free(cmd.regex);
+        *error = "unexpected text after command";
+        return -1;
+    }
+    if (script->count == script->capacity) {
+        script->capacity = script->capacity ? script->capacity * 2 : 8;
+        script->commands = realloc(script->commands, script->capacity * sizeof(BatchCommand));
+    }
+    script->commands[script->count++] = cmd;
+    return 0;
+}
+
+void batch_free(BatchScript *script) {
+    for (size_t i = 0; i < script->count; i++) {
+        free(script->commands[i].text);
+        re_free(script->commands[i].regex);
+    }
+    free(script->commands);
+    memset(script, 0, sizeof(BatchScript));
+}
+
+static int applies(const BatchCommand *cmd, size_t line, int last) {
+    return cmd->at_last ? last : cmd->first <= line && line <= cmd->last;
+}
+
+/* The first line after line where a command starts or stops applying. */
+static size_t next_event(const BatchScript *script, size_t line) {
+    size_t event = BATCH_END;
+    for (size_t i = 0; i < script->count; i++) {
+        const BatchCommand *cmd = &script->commands[i];
+        if (cmd->at_last) continue;
+        if (cmd->first > line) {
+            if (cmd->first < event) event = cmd->first;
+        } else if (cmd->last >= line && cmd->last != BATCH_END && cmd->last + 1 < event) {
+            event = cmd->last + 1;
+        }
+    }
+    return event;
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int flush(Batch *b) {
+    if (write_all(b->out, b->out_buf, b->out_len) < 0) return -1;
+    b->stats->written += b->out_len;
+    b->out_len = 0;
+    return 0;
+}
+
+static int emit(Batch *b, const char *data, size_t len) {
+    if (b->out_len + len > BATCH_OUT) {
+        if (flush(b) < 0) return -1;
+        if (len > BATCH_OUT) {
+            b->stats->written += len;
+            return write_all(b->out, data, len);
+        }
+    }
+    memcpy(b->out_buf + b->out_len, data, len);
+    b->out_len += len;
+    return 0;
+}
+
+/*
+ * Writes the unchanged input up to to.  Short stretches still in the
+ * block are buffered; longer ones are copied by the kernel, or through
+ * the output buffer where copy_file_range() is not supported.
+ */
+static int copy_to(Batch *b, off_t to) {
+    off_t from = b->copy_from;
+    if (to <= from) return 0;
+    b->copy_from = to;
+    if (to - from < BATCH_COPY_MIN && from >= b->block_pos &&
+        to <= b->block_pos + (off_t)b->block_len) {
+        return emit(b, b->block + (from - b->block_pos), to - from);
+    }
+    if (flush(b) < 0) return -1;
+    while (from < to && !b->no_copy) {
+        ssize_t n = copy_file_range(b->in, &from, b->out, NULL, to - from, 0);
+        if (n > 0) {
+            b->stats->copied += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n == 0 || errno == EXDEV || errno == ENOSYS || errno == EINVAL ||
+                   errno == EOPNOTSUPP) {
+            b->no_copy = 1;
+        } else {
+            return -1;
+        }
+    }
+    while (from < to) {
+        size_t want = to - from < BATCH_OUT ? to - from : BATCH_OUT;
+        ssize_t n = pread(b->in, b->out_buf, want, from);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n == 0) errno = EIO;
+            return -1;
+        }
+        if (write_all(b->out, b->out_buf, n) < 0) return -1;
+        b->stats->written += n;
+        from += n;
+    }
+    return 0;
+}
+
+/* Reads the block starting at pos; the input shrinking under us is an error. */
+static int load(Batch *b, off_t pos) {
+    size_t want = b->block_cap, got = 0;
+    if (b->size - pos < (off_t)want) want = b->size - pos;
+    while (got < want) {
+        ssize_t n = pread(b->in, b->block + got, want - got, pos + got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n == 0) errno = EIO;
+            return -1;
+        }
+        got += n;
+    }
+    b->block_pos = pos;
+    b->block_len = got;
+    return 0;
+}
+
+static const char *at(Batch *b, off_t pos, size_t *avail) {
+    if (pos < b->block_pos || pos >= b->block_pos + (off_t)b->block_len) {
+        if (load(b, pos) < 0) return NULL;
+    }
+    *avail = b->block_len - (pos - b->block_pos);
+    return b->block + (pos - b->block_pos);
+}
+
+/* The line at pos, whole in the block; the block only grows for a line longer than it. */
+static const char *whole_line(Batch *b, size_t *len, int *newline) {
+    while (1) {
+        size_t avail;
+        const char *text = at(b, b->pos, &avail), *nl;
+        if (!text) return NULL;
+        nl = memchr(text, '\n', avail);
+        if (nl || b->pos + (off_t)avail == b->size) {
+            *len = nl ? (size_t)(nl - text) : avail;
+            *newline = nl != NULL;
+            return text;
+        }
+        if (b->pos == b->block_pos) {
+            b->block_cap *= 2;
+            b->block = realloc(b->block, b->block_cap);
+        }
+        if (load(b, b->pos) < 0) return NULL;
+    }
+}
+
+/* Moves past up to count lines no command applies to, stopping at the last line. */
+static int skip(Batch *b, size_t count) {
+    off_t scan = b->pos;
+    while (count > 0 && scan < b->size) {
+        size_t avail;
+        const char *text = at(b, scan, &avail), *nl;
+        if (!text) return -1;
+        nl = memchr(text, '\n', avail);
+        if (!nl) {
+            scan += avail;
+            continue;
+        }
+        scan += nl - text + 1;
+        if (scan >= b->size) break;
+        b->pos = scan;
+        b->line++;
+        count--;
+    }
+    return 0;
+}
+
+/* Replaces matches of cmd in text into scratch buffer which; returns how many. */
+static size_t substitute(Batch *b, const BatchCommand *cmd, const char *text, size_t len,
+                         int which, size_t *out_len) {
+    size_t from = 0, copied = 0, start, end, count = 0, n = 0;
+    while (from <= len && re_search(cmd->regex, text, len, from, &start, &end)) {
+        size_t need;
+        /* As in sed, an empty match right after a match is not replaced. */
+        if (start == end && count && start == copied) {
+            from = end + 1;
+            continue;
+        }
+        need = n + (start - copied) + cmd->text_len + len - end;
+        if (need > b->scratch_cap[which]) {
+            b->scratch_cap[which] = need * 2;
+            b->scratch[which] = realloc(b->scratch[which], b->scratch_cap[which]);
+        }
+        memcpy(b->scratch[which] + n, text + copied, start - copied);
+        n += start - copied;
+        memcpy(b->scratch[which] + n, cmd->text, cmd->text_len);
+        n += cmd->text_len;
+        copied = end;
+        count++;
+        if (!cmd->global) break;
+        from = end > start ? end : end + 1;
+    }
+    if (count) {
+        if (n + len - copied > b->scratch_cap[which]) {
+            b->scratch_cap[which] = n + len - copied;
+            b->scratch[which] = realloc(b->scratch[which], b->scratch_cap[which]);
+        }
+        memcpy(b->scratch[which] + n, text + copied, len - copied);
+        n += len - copied;
+    }
+    *out_len = n;
+    return count;
+}
+
+/* Applies every command to the line at pos, in script order, and moves past it. */
+static int edit_line(Batch *b) {
+    const BatchScript *script = b->script;
+    size_t len, line_len;
+    int newline, deleted = 0, changed = 0, which = 0;
+    const char *text = whole_line(b, &len, &newline), *line = text;
+    off_t start = b->pos, end = start + len + newline;
+    int last = end >= b->size;
+    if (!text) return -1;
+    line_len = len;
+    for (size_t i = 0; i < script->count; i++) {
+        const BatchCommand *cmd = &script->commands[i];
+        size_t count, out_len;
+        if (!applies(cmd, b->line, last)) continue;
+        if (cmd->type == BATCH_INSERT) {
+            if (copy_to(b, start) < 0 || emit(b, cmd->text, cmd->text_len) < 0 ||
+                emit(b, "\n", 1) < 0) {
+                return -1;
+            }
+            b->stats->inserted++;
+        } else if (cmd->type == BATCH_DELETE) {
+            deleted = 1;
+        } else if (cmd->type == BATCH_SUBSTITUTE && !deleted) {
+            count = substitute(b, cmd, line, line_len, which, &out_len);
+            if (count) {
+                line = b->scratch[which];
+                line_len = out_len;
+                which ^= 1;
+                changed = 1;
+                b->stats->substituted += count;
+            }
+        }
+    }
+    if (deleted) {
+        if (copy_to(b, start) < 0) return -1;
+        b->copy_from = end;
+        b->stats->deleted++;
+    } else if (changed) {
+        if (copy_to(b, start) < 0 || emit(b, line, line_len) < 0) return -1;
+        b->copy_from = start + len;
+    }
+    for (size_t i = 0; i < script->count; i++) {
+        const BatchCommand *cmd = &script->commands[i];
+        if (cmd->type != BATCH_APPEND || !applies(cmd, b->line, last)) continue;
+        if (copy_to(b, end) < 0 || (!newline && !deleted && emit(b, "\n", 1) < 0) ||
+            emit(b, cmd->text, cmd->text_len) < 0 || emit(b, "\n", 1) < 0) {
+            return -1;
+        }
+        newline = 1;
+        b->stats->inserted++;
+    }
+    b->pos = end;
+    b->line++;
+    return 0;
+}
+
+/*
+ * Runs one substitution, the only command in force until line stop, over
+ * all the whole lines in the block at once rather than line by line.
+ */
+static int substitute_lines(Batch *b, const BatchCommand *cmd, size_t stop) {
+    size_t len, lines = 0, from = 0, start, end, last = (size_t)-1;
+    int newline;
+    const char *text = whole_line(b, &len, &newline), *p = text, *limit, *nl;
+    off_t base = b->pos;
+    if (!text) return -1;
+    limit = b->block + b->block_len;
+    while (b->line + lines < stop && (nl = memchr(p, '\n', limit - p)) != NULL &&
+           base + (nl + 1 - text) < b->size) {
+        p = nl + 1;
+        lines++;
+    }
+    if (lines == 0) return edit_line(b);
+    len = p - text - 1;
+    while (from <= len && re_search(cmd->regex, text, len, from, &start, &end)) {
+        if (start == end && start == last) {
+            from = end + 1;
+            continue;
+        }
+        if (copy_to(b, base + start) < 0 || emit(b, cmd->text, cmd->text_len) < 0) return -1;
+        b->copy_from = base + end;
+        b->stats->substituted++;
+        last = end;
+        if (cmd->global) {
+            from = end > start ? end : end + 1;
+        } else {
+            if (!(nl = memchr(text + end, '\n', len - end))) break;
+            from = nl - text + 1;
+        }
+    }
+    b->pos = base + (p - text);
+    b->line += lines;
+    return 0;
+}
+
+static int run(Batch *b) {
+    const BatchScript *script = b->script;
+    int at_last = 0;
+    for (size_t i = 0; i < script->count; i++) at_last |= script->commands[i].at_last;
+    while (b->pos < b->size) {
+        size_t event = next_event(script, b->line), active = 0;
+        const BatchCommand *only = NULL;
+        for (size_t i = 0; i < script->count; i++) {
+            if (!script->commands[i].at_last && applies(&script->commands[i], b->line, 0)) {
+                only = &script->commands[i];
+                active++;
+            }
+        }
+        if (active == 0) {
+            off_t pos = b->pos;
+            if (event == BATCH_END && !at_last) break;
+            if (skip(b, event - b->line) < 0) return -1;
+            if (b->pos == pos && edit_line(b) < 0) return -1;
+        } else if (active == 1 && only->type == BATCH_SUBSTITUTE) {
+            if (substitute_lines(b, only, event) < 0) return -1;
+        } else if (edit_line(b) < 0) {
+            return -1;
+        }
+    }
+    b->stats->lines = b->line - 1;
+    return 0;
+}
+
+int batch_run(const BatchScript *script, const char *input, const char *output,
+              BatchStats *stats) {
+    char target[PATH_MAX], temp[PATH_MAX + 16], dir[PATH_MAX];
+    const char *path = output ? output : input;
+    struct stat st;
+    Batch b;
+    int status = 0, saved;
+    memset(stats, 0, sizeof(BatchStats));
+    memset(&b, 0, sizeof(Batch));
+    b.script = script;
+    b.stats = stats;
+    b.in = open(input, O_RDONLY);
+    if (b.in < 0) return -1;
+    if (fstat(b.in, &st) < 0) {
+        saved = errno;
+        close(b.in);
+        errno = saved;
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        close(b.in);
+        errno = EINVAL;
+        return -1;
+    }
+    if (!realpath(path, target)) {
+        if (errno != ENOENT || strlen(path) >= sizeof(target)) {
+            close(b.in);
+            return -1;
+        }
+        strcpy(target, path);
+    }
+    snprintf(temp, sizeof(temp), "%s.XXXXXX", target);
+    b.out = mkstemp(temp);
+    if (b.out < 0) {
+        close(b.in);
+        return -1;
+    }
+    b.size = st.st_size;
+    b.line = 1;
+    b.block_cap = BATCH_BLOCK;
+    b.block = malloc(b.block_cap);
+    b.out_buf = malloc(BATCH_OUT);
+    if (fchmod(b.out, st.st_mode & 07777) < 0 || run(&b) < 0 || copy_to(&b, b.size) < 0 ||
+        flush(&b) < 0 || fsync(b.out) < 0) {
+        status = -1;
+    }
+    saved = errno;
+    if (close(b.out) < 0 && status == 0) {
+        status = -1;
+        saved = errno;
+    }
+    close(b.in);
+    if (status == 0 && rename(temp, target) < 0) {
+        status = -1;
+        saved = errno;
+    }
+    if (status < 0) {
+        unlink(temp);
+    } else {
+        strcpy(dir, target);
+        int dir_fd = open(dirname(dir), O_RDONLY | O_DIRECTORY);
+        if (dir_fd >= 0) {
+            fsync(dir_fd);
+            close(dir_fd);
+        }
+    }
+    free(b.block);
+    free(b.out_buf);
+    free(b.scratch[0]);
+    free(b.scratch[1]);
+    errno = saved;
+    return status;
+}
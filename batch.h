@@ -0,0 +1,68 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+
+#include "re.h"
+
+#define BATCH_BLOCK (1u << 20)
+#define BATCH_OUT (256u << 10)
+#define BATCH_COPY_MIN (64u << 10)
+#define BATCH_END ((size_t)-1)
+
+enum { BATCH_DELETE, BATCH_INSERT, BATCH_APPEND, BATCH_SUBSTITUTE };
+
+/*
+ * One command, sed style: [first[,last]]d deletes lines, i text and
+ * a text put a line before or after them, s/regex/text/[gi] replaces the
+ * first (with g, every) match on them.  Lines count from 1; last may be
+ * BATCH_END for $, and a lone $ (at_last) is the last line.  Without an
+ * address a command applies to every line.
+ */
+typedef struct {
+    int type;
+    size_t first;
+    size_t last;
+    int at_last;
+    int global;
+    Regex *regex;
+    char *text;
+    size_t text_len;
+} BatchCommand;
+
+typedef struct {
+    BatchCommand *commands;
+    size_t count;
+    size_t capacity;
+} BatchScript;
+
+typedef struct {
+    size_t lines;
+    size_t deleted;
+    size_t inserted;
+    size_t substituted;
+    long long copied;
+    long long written;
+} BatchStats;
+
+/*
+ * Applies a script to a file without loading it.  The input is read a
+ * block at a time, only as far as the commands reach: lines no command
+ * applies to are counted, not copied out, and every unchanged stretch of
+ * at least BATCH_COPY_MIN bytes is copied from the input to the output by
+ * the kernel with copy_file_range(), so whatever follows the last
+ * addressed line is never read at all.  Memory stays at one block and an
+ * output buffer, however large the file; a substitution needs its line
+ * whole, so only a longer line grows the block.
+ *
+ * The output goes to a temporary file next to the target, which is synced
+ * and renamed over it, so the target (output, or the input itself if
+ * output is NULL) is either untouched or fully edited.  Returns -1 with
+ * errno set on failure.
+ */
+int batch_parse(BatchScript *script, const char *command, const char **error);
+void batch_free(BatchScript *script);
+int batch_run(const BatchScript *script, const char *input, const char *output,
+              BatchStats *stats);
+
+#endif
@@ -0,0 +1,647 @@
+/*
+ * Benchmarks for the editor's engines, built separately from the editor:
+ *
+ *   cc -O2 -pthread -o bench bench.c search.c syntax.c language.c buffer.c screen.c pool.c \
+ *      grep.c re.c trigram.c batch.c arena.c diff.c trace.c utf8.c
+ *   ./bench search [file] [pattern]
+ *   ./bench lex [file] [language]
+ *   ./bench grep [directory] [pattern]
+ *   ./bench index [directory] [pattern]
+ *   ./bench batch [file]
+ *   ./bench diff [file]
+ *   ./bench utf8 [file]
+ *
+ * Without a file a synthetic log, for lex a corpus made of the editor's
+ * own sources, or for grep a tree of files cut from the log, is generated
+ * in /tmp.  Run grep twice so the page cache is warm.  index builds the
+ * trigram index of the tree from scratch, updates it with nothing
+ * changed, and compares an indexed query with a full grep.  batch edits a
+ * copy of the file near its start, where the rest is copied by the kernel,
+ * and then substitutes on every line, after checking a few substitutions
+ * against sed's output.  diff compares the first million
+ * lines of the file with copies edited every thousand lines, every ten
+ * lines, and with its two halves swapped.  utf8 counts the screen columns
+ * of the file a character at a time and with the vector fast path.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "diff.h"
+#include "grep.h"
+#include "language.h"
+#include "screen.h"
+#include "search.h"
+#include "syntax.h"
+#include "trigram.h"
+#include "utf8.h"
+
+#define SYNTHETIC_SIZE (256u << 20)
+#define CORPUS_SIZE (64u << 20)
+#define DIFF_LINES 1000000
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *make_log(void) {
+    static const char *path = "/tmp/texteditor-bench.log";
+    static const char *words[] = {
+        "INFO", "WARN", "request", "served", "cache", "miss", "user", "session",
+        "GET", "/api/v1/items", "latency", "ms", "worker", "queue", "retry", "ok"
+    };
+    FILE *file = fopen(path, "w");
+    size_t written = 0;
+    unsigned seed = 12345;
+    if (!file) return NULL;
+    while (written < SYNTHETIC_SIZE) {
+        char line[512];
+        int len = snprintf(line, sizeof(line), "2024-01-01T00:00:%02u", seed % 60);
+        int words_in_line = 4 + seed % 12;
+        for (int i = 0; i < words_in_line; i++) {
+            seed = seed * 1103515245 + 12345;
+            len += snprintf(line + len, sizeof(line) - len, " %s", words[(seed >> 16) % 16]);
+        }
+        if (seed % 5000 == 0) len += snprintf(line + len, sizeof(line) - len, " needle-found");
+        line[len++] = '\n';
+        fwrite(line, 1, len, file);
+        written += len;
+    }
+    fclose(file);
+    return path;
+}
+
+static size_t file_size(const char *path) {
+    FILE *file = fopen(path, "r");
+    long size;
+    if (!file) return 0;
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+/* The scan search_in_file used to do: fgets into 256 bytes, strstr per chunk. */
+static long long strstr_loop(const char *path, const char *word) {
+    FILE *file = fopen(path, "r");
+    char line[256];
+    long long found = 0;
+    if (!file) return -1;
+    while (fgets(line, sizeof(line), file)) {
+        if (strstr(line, word)) found++;
+    }
+    fclose(file);
+    return found;
+}
+
+static int count_match(const SearchMatch *match, void *arg) {
+    (void)match;
+    (*(long long *)arg)++;
+    return 0;
+}
+
+static long long engine(const char *path, const char *word, int flags, int report) {
+    SearchPattern sp;
+    long long found, reported = 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    search_compile(&sp, word, strlen(word), flags);
+    found = search_fd(&sp, fd, report ? count_match : NULL, &reported);
+    search_free(&sp);
+    close(fd);
+    return found;
+}
+
+static void report(const char *name, double seconds, size_t bytes, long long found,
+                   const char *unit) {
+    printf("  %-28s %8.1f ms %9.1f MB/s  %lld %s\n", name, seconds * 1e3,
+           bytes / seconds / 1e6, found, unit);
+}
+
+static int bench_search(int argc, char **argv) {
+    const char *path = argc > 2 ? argv[2] : make_log();
+    const char *word = argc > 3 ? argv[3] : "needle-found";
+    size_t bytes = file_size(path);
+    SearchPattern probe;
+    double start;
+    long long found;
+    if (!path || bytes == 0) {
+        fprintf(stderr, "bench: cannot read input\n");
+        return 1;
+    }
+    search_compile(&probe, word, strlen(word), 0);
+    printf("search '%s' in %s (%.1f MB, %s kernel)\n", word, path, bytes / 1e6, probe.isa);
+    search_free(&probe);
+    engine(path, word, 0, 0);
+
+    start = now();
+    found = strstr_loop(path, word);
+    report("fgets + strstr (old)", now() - start, bytes, found, "matches");
+    start = now();
+    found = engine(path, word, SEARCH_SCALAR, 1);
+    report("horspool, line numbers", now() - start, bytes, found, "matches");
+    start = now();
+    found = engine(path, word, 0, 1);
+    report("simd, line numbers", now() - start, bytes, found, "matches");
+    start = now();
+    found = engine(path, word, SEARCH_COUNT_ONLY, 0);
+    report("simd, count only", now() - start, bytes, found, "matches");
+    start = now();
+    found = engine(path, word, SEARCH_IGNORE_CASE | SEARCH_COUNT_ONLY, 0);
+    report("simd, ignore case", now() - start, bytes, found, "matches");
+    return 0;
+}
+
+static const char *make_corpus(void) {
+    static const char *path = "/tmp/texteditor-bench.c";
+    static const char *sources[] = {
+        "buffer.c", "editor.c", "input.c", "language.c", "main.c", "screen.c", "search.c",
+        "syntax.c", "undo.c", "viewer.c", "buffer.h", "search.h", "syntax.h", NULL
+    };
+    FILE *file = fopen(path, "w");
+    size_t written = 0;
+    char chunk[65536];
+    if (!file) return NULL;
+    while (written < CORPUS_SIZE) {
+        size_t before = written;
+        for (int i = 0; sources[i]; i++) {
+            FILE *source = fopen(sources[i], "r");
+            size_t n;
+            if (!source) continue;
+            while ((n = fread(chunk, 1, sizeof(chunk), source)) > 0) {
+                fwrite(chunk, 1, n, file);
+                written += n;
+            }
+            fclose(source);
+        }
+        if (written == before) break;
+    }
+    fclose(file);
+    return written ? path : NULL;
+}
+
+static char *read_file(const char *path, size_t *size) {
+    FILE *file = fopen(path, "r");
+    char *data;
+    *size = file_size(path);
+    if (!file) return NULL;
+    data = malloc(*size + 1);
+    *size = fread(data, 1, *size, file);
+    fclose(file);
+    return data;
+}
+
+/* The highlighter print_syntax_highlighted used before the table-driven lexer. */
+static const char *old_keywords[] = {
+    "auto", "break", "case", "char", "const", "continue", "default", "do",
+    "double", "else", "enum", "extern", "float", "for", "goto", "if",
+    "int", "long", "register", "return", "short", "signed", "sizeof", "static",
+    "struct", "switch", "typedef", "union", "unsigned", "void", "volatile", "while",
+    NULL
+};
+
+static int old_is_keyword(const char *word, int len) {
+    for (int i = 0; old_keywords[i] != NULL; i++) {
+        if (strncmp(word, old_keywords[i], len) == 0 && old_keywords[i][len] == '\0') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int old_is_word_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static void old_highlight_line(const char *line, size_t len, unsigned char *attrs) {
+    int in_string = 0;
+    size_t i = 0;
+    while (i < len) {
+        if (in_string) {
+            if (line[i] == '"') in_string = 0;
+            attrs[i++] = ATTR_STRING;
+        } else if (line[i] == '"') {
+            in_string = 1;
+            attrs[i++] = ATTR_STRING;
+        } else if (line[i] == '/' && i + 1 < len && line[i + 1] == '/') {
+            memset(attrs + i, ATTR_COMMENT, len - i);
+            return;
+        } else if (old_is_word_char(line[i])) {
+            size_t start = i;
+            while (i < len && old_is_word_char(line[i])) i++;
+            memset(attrs + start, old_is_keyword(line + start, i - start) ? ATTR_KEYWORD : ATTR_NORMAL,
+                   i - start);
+        } else {
+            attrs[i++] = ATTR_NORMAL;
+        }
+    }
+}
+
+/* Lexes every line of data, returning a checksum so the work is not optimised away. */
+static unsigned long lex_corpus(const Language *lang, const char *data, size_t size,
+                                unsigned char *attrs) {
+    unsigned long sum = 0;
+    size_t pos = 0;
+    int state = SYNTAX_NORMAL;
+    while (pos < size) {
+        const char *nl = memchr(data + pos, '\n', size - pos);
+        size_t len = (nl ? (size_t)(nl - data) : size) - pos;
+        if (lang) {
+            state = syntax_lex(lang, data + pos, len, state, attrs);
+        } else {
+            old_highlight_line(data + pos, len, attrs);
+        }
+        if (len) sum += attrs[len / 2] + attrs[len - 1];
+        pos += len + 1;
+    }
+    return sum;
+}
+
+static int bench_lex(int argc, char **argv) {
+    const char *path = argc > 2 ? argv[2] : make_corpus();
+    const Language *lang = language_by_name(argc > 3 ? argv[3] : "c");
+    size_t bytes;
+    char *data = path ? read_file(path, &bytes) : NULL;
+    unsigned char *attrs;
+    unsigned long sum;
+    double start;
+    if (!data || bytes == 0 || !lang) {
+        fprintf(stderr, "bench: cannot read input or unknown language\n");
+        return 1;
+    }
+    attrs = malloc(bytes);
+    printf("lex %s as %s (%.1f MB)\n", path, lang->name, bytes / 1e6);
+    lex_corpus(lang, data, bytes, attrs);
+
+    start = now();
+    sum = lex_corpus(NULL, data, bytes, attrs);
+    report("strncmp keywords (old)", now() - start, bytes, (long long)sum, "checksum");
+    start = now();
+    sum = lex_corpus(lang, data, bytes, attrs);
+    report("table-driven lexer", now() - start, bytes, (long long)sum, "checksum");
+    free(attrs);
+    free(data);
+    return 0;
+}
+
+/* 64 directories of 64 files of 32 KB each, plus one large file: the rest of the log. */
+static const char *make_tree(void) {
+    static const char *root = "/tmp/texteditor-bench-tree";
+    const char *log = make_log();
+    char path[256], *block = malloc(32768);
+    FILE *in = log ? fopen(log, "r") : NULL, *out;
+    size_t n;
+    if (!in) {
+        free(block);
+        return NULL;
+    }
+    mkdir(root, 0777);
+    for (int d = 0; d < 64; d++) {
+        snprintf(path, sizeof(path), "%s/dir%02d", root, d);
+        mkdir(path, 0777);
+        for (int f = 0; f < 64; f++) {
+            snprintf(path, sizeof(path), "%s/dir%02d/part%02d.log", root, d, f);
+            n = fread(block, 1, 32768, in);
+            if ((out = fopen(path, "w")) != NULL) {
+                fwrite(block, 1, n, out);
+                fclose(out);
+            }
+        }
+    }
+    snprintf(path, sizeof(path), "%s/large.log", root);
+    if ((out = fopen(path, "w")) != NULL) {
+        while ((n = fread(block, 1, 32768, in)) > 0) fwrite(block, 1, n, out);
+        fclose(out);
+    }
+    fclose(in);
+    free(block);
+    return root;
+}
+
+static int count_tree_match(const char *path, const SearchMatch *match, void *arg) {
+    (void)path;
+    (void)match;
+    (*(long long *)arg)++;
+    return 0;
+}
+
+static size_t tree_bytes;
+
+static int add_size(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)path;
+    (void)ftw;
+    if (type == FTW_F) tree_bytes += st->st_size;
+    return 0;
+}
+
+static void grep_with(Pool *pool, const char *name, const SearchPattern *sp, const char *root) {
+    long long reported = 0, found;
+    double start = now();
+    found = grep_tree(pool, sp, root, NULL, count_tree_match, &reported);
+    report(name, now() - start, tree_bytes, found, "matches");
+}
+
+static int bench_grep(int argc, char **argv) {
+    const char *root = argc > 2 ? argv[2] : make_tree();
+    const char *word = argc > 3 ? argv[3] : "needle-found";
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    SearchPattern sp;
+    char name[64];
+    if (cpus < 1) cpus = 1;
+    if (!root || nftw(root, add_size, 16, FTW_PHYS) < 0 || tree_bytes == 0) {
+        fprintf(stderr, "bench: cannot read input\n");
+        return 1;
+    }
+    search_compile(&sp, word, strlen(word), 0);
+    printf("grep '%s' in %s (%.1f MB, %ld cpus)\n", word, root, tree_bytes / 1e6, cpus);
+    grep_tree(NULL, &sp, root, NULL, NULL, NULL);
+    grep_with(NULL, "calling thread only", &sp, root);
+    for (long threads = 1; threads <= cpus; threads *= 2) {
+        Pool *pool;
+        if (threads * 2 > cpus) threads = cpus;
+        pool = pool_new((int)threads);
+        snprintf(name, sizeof(name), "pool, %ld threads", threads);
+        grep_with(pool, name, &sp, root);
+        pool_free(pool);
+    }
+    search_free(&sp);
+    return 0;
+}
+
+static int bench_index(int argc, char **argv) {
+    const char *root = argc > 2 ? argv[2] : make_tree();
+    const char *word = argc > 3 ? argv[3] : "needle-found";
+    char path[4096];
+    long long reported = 0, found;
+    SearchPattern sp;
+    TrigramStats stats;
+    TrigramQuery query;
+    double start;
+    if (root) {
+        snprintf(path, sizeof(path), "%s/%s", root, TRIGRAM_INDEX_NAME);
+        unlink(path);
+    }
+    if (!root || nftw(root, add_size, 16, FTW_PHYS) < 0 || tree_bytes == 0) {
+        fprintf(stderr, "bench: cannot read input\n");
+        return 1;
+    }
+    search_compile(&sp, word, strlen(word), 0);
+    printf("index '%s' in %s (%.1f MB)\n", word, root, tree_bytes / 1e6);
+    grep_tree(NULL, &sp, root, NULL, NULL, NULL);
+    start = now();
+    if (trigram_update(pool_default(), root, &stats) < 0) {
+        fprintf(stderr, "bench: cannot write the index\n");
+        search_free(&sp);
+        return 1;
+    }
+    report("build", now() - start, tree_bytes, (long long)stats.trigrams, "trigrams");
+    printf("  %zu files, index %.1f MB\n", stats.files, stats.bytes / 1e6);
+    start = now();
+    trigram_update(pool_default(), root, &stats);
+    report("update, nothing changed", now() - start, tree_bytes, (long long)stats.reused,
+           "files reused");
+    grep_with(pool_default(), "grep, default pool", &sp, root);
+    start = now();
+    found = trigram_search(pool_default(), root, &sp, NULL, count_tree_match, &reported, &query);
+    report("indexed query", now() - start, tree_bytes, found, "matches");
+    printf("  %zu of %zu files searched\n", query.candidates, query.files);
+    search_free(&sp);
+    return 0;
+}
+
+static int batch_with(const char *name, const char *path, const char *output, size_t bytes,
+                      const char *command) {
+    BatchScript script = { 0 };
+    BatchStats stats;
+    const char *error;
+    double start;
+    if (batch_parse(&script, command, &error) < 0) {
+        fprintf(stderr, "bench: %s: %s\n", command, error);
+        return -1;
+    }
+    start = now();
+    if (batch_run(&script, path, output, &stats) < 0) {
+        perror("bench");
+        batch_free(&script);
+        return -1;
+    }
+    report(name, now() - start, bytes, (long long)(stats.deleted + stats.substituted), "edits");
+    printf("  %lld bytes copied by the kernel, %lld written\n", stats.copied, stats.written);
+    batch_free(&script);
+    return 0;
+}
+
+/* Scripts checked against what sed prints for the same input; the second runs line by line. */
+static const char *batch_input = "baaac\nxaay\n\naaa\n";
+static const struct {
+    const char *commands[2];
+    const char *expected;
+} batch_checks[] = {
+    { { "s/a*/Y/g" }, "YbYcY\nYxYyY\nY\nY\n" },
+    { { "s/a*/Y/g", "s/q/q/" }, "YbYcY\nYxYyY\nY\nY\n" },
+    { { "s/b*/-/g" }, "-a-a-a-c-\n-x-a-a-y-\n-\n-a-a-a-\n" },
+    { { "s/a*/Y/" }, "Ybaaac\nYxaay\nY\nY\n" },
+};
+
+static int check_batch(void) {
+    const char *input = "/tmp/texteditor-bench-check.in";
+    const char *output = "/tmp/texteditor-bench-check.out";
+    FILE *file = fopen(input, "w");
+    int failed = 0;
+    if (!file) return -1;
+    fputs(batch_input, file);
+    fclose(file);
+    for (size_t i = 0; i < sizeof(batch_checks) / sizeof(batch_checks[0]); i++) {
+        BatchScript script = { 0 };
+        BatchStats stats;
+        const char *error;
+        char *got = NULL;
+        size_t len = 0;
+        for (int j = 0; j < 2 && batch_checks[i].commands[j]; j++) {
+            batch_parse(&script, batch_checks[i].commands[j], &error);
+        }
+        if (batch_run(&script, input, output, &stats) == 0) got = read_file(output, &len);
+        if (!got || len != strlen(batch_checks[i].expected) ||
+            memcmp(got, batch_checks[i].expected, len) != 0) {
+            fprintf(stderr, "bench: %s gives %.*s", batch_checks[i].commands[0], (int)len,
+                    got ? got : "nothing\n");
+            failed = 1;
+        }
+        free(got);
+        batch_free(&script);
+    }
+    unlink(input);
+    unlink(output);
+    return failed ? -1 : 0;
+}
+
+static int bench_batch(int argc, char **argv) {
+    const char *path = argc > 2 ? argv[2] : make_log();
+    const char *output = "/tmp/texteditor-bench-batch.out";
+    size_t bytes = file_size(path);
+    int status = 0;
+    if (!path || bytes == 0) {
+        fprintf(stderr, "bench: cannot read input\n");
+        return 1;
+    }
+    printf("batch %s (%.1f MB)\n", path, bytes / 1e6);
+    if (check_batch() < 0 || batch_with("delete lines 10-20", path, output, bytes, "10,20d") < 0 ||
+        batch_with("substitute on every line", path, output, bytes, "s/ms/us/g") < 0) {
+        status = 1;
+    }
+    unlink(output);
+    return status;
+}
+
+/* A copy of text where every nth line is changed, every 3nth dropped and every 5nth doubled. */
+static char *edit_lines(const char *text, size_t len, size_t n, size_t *out_len) {
+    char *out = malloc(len * 2 + 1), *q = out;
+    const char *p = text, *end = text + len;
+    for (size_t line = 1; p < end; line++) {
+        const char *newline = memchr(p, '\n', end - p);
+        size_t line_len = (newline ? newline + 1 : end) - p;
+        if (line % (3 * n) != 0) {
+            if (line % n == 0) *q++ = '~';
+            memcpy(q, p, line_len);
+            q += line_len;
+            if (line % (5 * n) == 0) {
+                memcpy(q, p, line_len);
+                q += line_len;
+            }
+        }
+        p += line_len;
+    }
+    *out_len = q - out;
+    return out;
+}
+
+static void diff_with(const char *name, const char *a, size_t a_len, const char *b,
+                      size_t b_len) {
+    Diff diff;
+    double start = now();
+    if (diff_compute(&diff, a, a_len, b, b_len) < 0) {
+        perror("bench");
+        return;
+    }
+    report(name, now() - start, a_len + b_len, (long long)(diff.deleted + diff.inserted),
+           "lines changed");
+    diff_free(&diff);
+}
+
+static int bench_diff(int argc, char **argv) {
+    const char *path = argc > 2 ? argv[2] : make_log();
+    size_t len = 0, lines = 0, b_len, half = 0;
+    char *text = path ? diff_read_file(path, &len) : NULL, *b;
+    const char *p = text;
+    if (!text || len == 0) {
+        fprintf(stderr, "bench: cannot read input\n");
+        free(text);
+        return 1;
+    }
+    while (lines < DIFF_LINES && p < text + len) {
+        const char *newline = memchr(p, '\n', text + len - p);
+        p = newline ? newline + 1 : text + len;
+        if (++lines == DIFF_LINES / 2) half = p - text;
+    }
+    len = p - text;
+    printf("diff %s, first %zu lines (%.1f MB)\n", path, lines, len / 1e6);
+    b = edit_lines(text, len, 1000, &b_len);
+    diff_with("1 in 1000 lines edited", text, len, b, b_len);
+    free(b);
+    b = edit_lines(text, len, 10, &b_len);
+    diff_with("1 in 10 lines edited", text, len, b, b_len);
+    free(b);
+    b = malloc(len);
+    memcpy(b, text + half, len - half);
+    memcpy(b + len - half, text, half);
+    diff_with("halves swapped", text, len, b, len);
+    free(b);
+    free(text);
+    return 0;
+}
+
+static size_t columns_slow(const char *text, size_t len) {
+    size_t columns = 0;
+    for (size_t i = 0; i < len;) {
+        unsigned int cp;
+        i += utf8_decode(text + i, len - i, &cp);
+        columns += utf8_width(cp);
+    }
+    return columns;
+}
+
+static size_t columns_fast(const char *text, size_t len) {
+    size_t columns = 0, count;
+    for (size_t i = 0; i < len;) {
+        unsigned int cp;
+        size_t n = utf8_narrow(text + i, len - i, &count);
+        i += n;
+        columns += count;
+        if (n == 0) {
+            i += utf8_decode(text + i, len - i, &cp);
+            columns += utf8_width(cp);
+        }
+    }
+    return columns;
+}
+
+static int bench_utf8(int argc, char **argv) {
+    const char *path = argc > 2 ? argv[2] : make_log();
+    size_t len = 0, columns;
+    char *text = path ? read_file(path, &len) : NULL;
+    double start;
+    if (!text) {
+        fprintf(stderr, "bench: cannot read input\n");
+        return 1;
+    }
+    printf("utf8 %s (%.1f MB)\n", path, len / 1e6);
+    start = now();
+    columns = columns_slow(text, len);
+    report("one character at a time", now() - start, len, (long long)columns, "columns");
+    start = now();
+    columns = columns_fast(text, len);
+    report("narrow runs", now() - start, len, (long long)columns, "columns");
+    free(text);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "search") == 0) {
+        return bench_search(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "lex") == 0) {
+        return bench_lex(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "grep") == 0) {
+        return bench_grep(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "index") == 0) {
+        return bench_index(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "batch") == 0) {
+        return bench_batch(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "diff") == 0) {
+        return bench_diff(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "utf8") == 0) {
+        return bench_utf8(argc, argv);
+    }
+    fprintf(stderr, "usage: %s search [file] [pattern]\n", argv[0]);
+    fprintf(stderr, "       %s lex [file] [language]\n", argv[0]);
+    fprintf(stderr, "       %s grep [directory] [pattern]\n", argv[0]);
+    fprintf(stderr, "       %s index [directory] [pattern]\n", argv[0]);
+    fprintf(stderr, "       %s batch [file]\n", argv[0]);
+    fprintf(stderr, "       %s diff [file]\n", argv[0]);
+    fprintf(stderr, "       %s utf8 [file]\n", argv[0]);
+    return 1;
+}
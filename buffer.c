@@ -0,0 +1,528 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "buffer.h"
+
+/* Upper bound on a single piece, which keeps in-piece newline scans cheap. */
+#define PIECE_MAX 4096
+#define MAX_LISTENERS 8
+
+enum { SOURCE_ORIGINAL, SOURCE_ADDED };
+
+typedef struct Piece {
+    struct Piece *left;
+    struct Piece *right;
+    unsigned priority;
+    int source;
+    size_t start;
+    size_t length;
+    size_t newlines;
+    size_t tree_length;
+    size_t tree_newlines;
+} Piece;
+
+struct Buffer {
+    Piece *root;
+    char *original;
+    size_t original_len;
+    char *added;
+    size_t added_len;
+    size_t added_cap;
+    unsigned seed;
+    Arena arena;
+    buffer_listener listeners[MAX_LISTENERS];
+    void *listener_args[MAX_LISTENERS];
+    int listener_count;
+};
+
+static size_t count_newlines(const char *text, size_t len) {
+    size_t count = 0;
+    const char *end = text + len;
+    while (text < end && (text = memchr(text, '\n', end - text)) != NULL) {
+        count++;
+        text++;
+    }
+    return count;
+}
+
+static size_t nth_newline(const char *text, size_t len, size_t n) {
+    const char *p = text;
+    const char *end = text + len;
+    while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+        if (--n == 0) {
+            return p - text;
+        }
+        p++;
+    }
+    return len;
+}
+
+static unsigned next_priority(Buffer *buf) {
+    buf->seed ^= buf->seed << 13;
+    buf->seed ^= buf->seed >> 17;
+    buf->seed ^= buf->seed << 5;
+    return buf->seed;
+}
+
+static const char *piece_text(const Buffer *buf, const Piece *p) {
+    return (p->source == SOURCE_ADDED ? buf->added : buf->original) + p->start;
+}
+
+static void update(Piece *p) {
+    p->tree_length = p->length;
+    p->tree_newlines = p->newlines;
+    if (p->left) {
+        p->tree_length += p->left->tree_length;
+        p->tree_newlines += p->left->tree_newlines;
+    }
+    if (p->right) {
+        p->tree_length += p->right->tree_length;
+        p->tree_newlines += p->right->tree_newlines;
+    }
+}
+
+static Piece *piece_new(Buffer *buf, int source, size_t start, size_t length, size_t newlines) {
+    Piece *p = arena_alloc(&buf->arena, sizeof(Piece));
+    p->left = NULL;
+    p->right = NULL;
+    p->priority = next_priority(buf);
+    p->source = source;
+    p->start = start;
+    p->length = length;
+    p->newlines = newlines;
+    update(p);
+    return p;
+}
+
+static void free_tree(Buffer *buf, Piece *p) {
+    while (p) {
+        Piece *right = p->right;
+        free_tree(buf, p->left);
+        arena_free(&buf->arena, p, sizeof(Piece));
+        p = right;
+    }
+}
+
+static Piece *merge(Piece *a, Piece *b) {
+    if (!a) return b;
+    if (!b) return a;
+    if (a->priority > b->priority) {
+        a->right = merge(a->right, b);
+        update(a);
+        return a;
+    }
+    b->left = merge(a, b->left);
+    update(b);
+    return b;
+}
+
+/* Splits t so that *l holds the first pos bytes and *r the rest. */
+static void split(Buffer *buf, Piece *t, size_t pos, Piece **l, Piece **r) {
+    if (!t) {
+        *l = *r = NULL;
+        return;
+    }
+    size_t left_len = t->left ? t->left->tree_length : 0;
+    if (pos <= left_len) {
+        split(buf, t->left, pos, l, &t->left);
+        update(t);
+        *r = t;
+    } else if (pos >= left_len + t->length) {
+        split(buf, t->right, pos - left_len - t->length, &t->right, r);
+        update(t);
+        *l = t;
+    } else {
+        size_t k = pos - left_len;
+        const char *text = piece_text(buf, t);
+        size_t head_newlines = k <= t->length / 2
+            ? count_newlines(text, k)
+            : t->newlines - count_newlines(text + k, t->length - k);
+        Piece *tail = piece_new(buf, t->source, t->start + k, t->length - k,
+                                t->newlines - head_newlines);
+        Piece *right = t->right;
+        t->right = NULL;
+        t->length = k;
+        t->newlines = head_newlines;
+        update(t);
+        *l = t;
+        *r = merge(tail, right);
+    }
+}
+
+static Piece *append_pieces(Buffer *buf, Piece *tree, int source, const char *base,
+                            size_t start, size_t len) {
+    size_t offset = 0;
+    while (offset < len) {
+        size_t chunk = len - offset < PIECE_MAX ? len - offset : PIECE_MAX;
+        size_t newlines = count_newlines(base + start + offset, chunk);
+        tree = merge(tree, piece_new(buf, source, start + offset, chunk, newlines));
+        offset += chunk;
+    }
+    return tree;
+}
+
+Buffer *buffer_new(void) {
+    Buffer *buf = calloc(1, sizeof(Buffer));
+    buf->seed = 2463534242u;
+    arena_init(&buf->arena);
+    return buf;
+}
+
+void buffer_free(Buffer *buf) {
+    if (!buf) return;
+    arena_release(&buf->arena);
+    free(buf->original);
+    free(buf->added);
+    free(buf);
+}
+
+int buffer_load(Buffer *buf, FILE *file) {
+    size_t cap = 65536, len = 0, n;
+    char *data = malloc(cap);
+    if (!data) return -1;
+    while ((n = fread(data + len, 1, cap - len, file)) > 0) {
+        len += n;
+        if (len == cap) {
+            char *grown = realloc(data, cap * 2);
+            if (!grown) {
+                free(data);
+                return -1;
+            }
+            data = grown;
+            cap *= 2;
+        }
+    }
+    if (len < cap) {
+        char *fitted = realloc(data, len ? len : 1);
+        if (fitted) data = fitted;
+    }
+    arena_release(&buf->arena);
+    free(buf->original);
+    buf->original = data;
+    buf->original_len = len;
+    buf->root = append_pieces(buf, NULL, SOURCE_ORIGINAL, data, 0, len);
+    return ferror(file) ? -1 : 0;
+}
+
+static int write_tree(const Buffer *buf, const Piece *p, FILE *file) {
+    while (p) {
+        if (write_tree(buf, p->left, file) < 0) return -1;
+        if (fwrite(piece_text(buf, p), 1, p->length, file) != p->length) return -1;
+        p = p->right;
+    }
+    return 0;
+}
+
+int buffer_write(const Buffer *buf, FILE *file) {
+    return write_tree(buf, buf->root, file);
+}
+
+#define SAVE_IOV 512
+
+typedef struct {
+    int fd;
+    struct iovec iov[SAVE_IOV];
+    int count;
+} Writer;
+
+static int writer_flush(Writer *w) {
+    struct iovec *iov = w->iov;
+    int count = w->count;
+    w->count = 0;
+    while (count > 0) {
+        ssize_t n = writev(w->fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+static int write_tree_fd(const Buffer *buf, const Piece *p, Writer *w) {
+    while (p) {
+        if (write_tree_fd(buf, p->left, w) < 0) return -1;
+        if (w->count == SAVE_IOV && writer_flush(w) < 0) return -1;
+        w->iov[w->count].iov_base = (void *)piece_text(buf, p);
+        w->iov[w->count].iov_len = p->length;
+        w->count++;
+        p = p->right;
+    }
+    return 0;
+}
+
+/*
+ * Writes the buffer to a temporary file next to path with vectored writes
+ * straight from the pieces, syncs it and renames it over path, so a crash
+ * leaves either the old file or the new one, never a partial one.
+ */
+int buffer_save(const Buffer *buf, const char *path) {
+    char target[PATH_MAX], temp[PATH_MAX + 16], dir[PATH_MAX];
+    struct stat st;
+    Writer w;
+    int status = 0;
+    mode_t mode;
+    if (!realpath(path, target)) {
+        if (errno != ENOENT || strlen(path) >= sizeof(target)) return -1;
+        strcpy(target, path);
+    }
+    if (stat(target, &st) == 0) {
+        mode = st.st_mode & 07777;
+    } else {
+        mode_t mask = umask(0);
+        umask(mask);
+        mode = 0666 & ~mask;
+    }
+    snprintf(temp, sizeof(temp), "%s.XXXXXX", target);
+    w.fd = mkstemp(temp);
+    w.count = 0;
+    if (w.fd < 0) return -1;
+    if (fchmod(w.fd, mode) < 0 || write_tree_fd(buf, buf->root, &w) < 0 ||
+        writer_flush(&w) < 0 || fsync(w.fd) < 0) {
+        status = -1;
+    }
+    if (close(w.fd) < 0) status = -1;
+    if (status == 0 && rename(temp, target) < 0) status = -1;
+    if (status < 0) {
+        unlink(temp);
+        return -1;
+    }
+    strcpy(dir, target);
+    int dir_fd = open(dirname(dir), O_RDONLY | O_DIRECTORY);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+    return 0;
+}
+
+size_t buffer_length(const Buffer *buf) {
+    return buf->root ? buf->root->tree_length : 0;
+}
+
+/* Bytes held for the buffer: the loaded file, the added text and the piece arena. */
+size_t buffer_memory(const Buffer *buf) {
+    return sizeof(Buffer) + buf->original_len + buf->added_cap + buf->arena.reserved;
+}
+
+size_t buffer_line_count(const Buffer *buf) {
+    return (buf->root ? buf->root->tree_newlines : 0) + 1;
+}
+
+size_t buffer_line_start(const Buffer *buf, size_t line) {
+    const Piece *p = buf->root;
+    size_t offset = 0;
+    if (line == 0) return 0;
+    while (p) {
+        size_t left_len = p->left ? p->left->tree_length : 0;
+        size_t left_newlines = p->left ? p->left->tree_newlines : 0;
+        if (line <= left_newlines) {
+            p = p->left;
+        } else if (line <= left_newlines + p->newlines) {
+            return offset + left_len +
+                   nth_newline(piece_text(buf, p), p->length, line - left_newlines) + 1;
+        } else {
+            line -= left_newlines + p->newlines;
+            offset += left_len + p->length;
+            p = p->right;
+        }
+    }
+    return buffer_length(buf);
+}
+
+size_t buffer_line_length(const Buffer *buf, size_t line) {
+    size_t start = buffer_line_start(buf, line);
+    if (line + 1 < buffer_line_count(buf)) {
+        return buffer_line_start(buf, line + 1) - 1 - start;
+    }
+    return buffer_length(buf) - start;
+}
+
+size_t buffer_line_of(const Buffer *buf, size_t pos) {
+    const Piece *p = buf->root;
+    size_t line = 0;
+    while (p) {
+        size_t left_len = p->left ? p->left->tree_length : 0;
+        if (pos < left_len) {
+            p = p->left;
+            continue;
+        }
+        line += p->left ? p->left->tree_newlines : 0;
+        pos -= left_len;
+        if (pos < p->length) {
+            return line + count_newlines(piece_text(buf, p), pos);
+        }
+        line += p->newlines;
+        pos -= p->length;
+        p = p->right;
+    }
+    return line;
+}
+
+size_t buffer_pos(const Buffer *buf, size_t line, size_t col) {
+    return buffer_line_start(buf, line) + col;
+}
+
+static size_t read_tree(const Buffer *buf, const Piece *p, size_t pos, size_t end, char *out) {
+    size_t copied = 0;
+    while (p && pos < end) {
+        size_t left_len = p->left ? p->left->tree_length : 0;
+        size_t piece_end = left_len + p->length;
+        if (pos < left_len) {
+            copied += read_tree(buf, p->left, pos, end < left_len ? end : left_len, out + copied);
+        }
+        if (end > left_len && pos < piece_end) {
+            size_t from = pos > left_len ? pos : left_len;
+            size_t to = end < piece_end ? end : piece_end;
+            memcpy(out + copied, piece_text(buf, p) + (from - left_len), to - from);
+            copied += to - from;
+        }
+        if (end <= piece_end) break;
+        pos = pos > piece_end ? pos - piece_end : 0;
+        end -= piece_end;
+        p = p->right;
+    }
+    return copied;
+}
+
+size_t buffer_read(const Buffer *buf, size_t pos, size_t len, char *out) {
+    size_t total = buffer_length(buf);
+    if (pos >= total) return 0;
+    if (len > total - pos) len = total - pos;
+    return read_tree(buf, buf->root, pos, pos + len, out);
+}
+
+static size_t append_added(Buffer *buf, const char *text, size_t len) {
+    if (buf->added_len + len > buf->added_cap) {
+        size_t cap = buf->added_cap ? buf->added_cap : 4096;
+        while (cap < buf->added_len + len) cap *= 2;
+        buf->added = realloc(buf->added, cap);
+        buf->added_cap = cap;
+    }
+    memcpy(buf->added + buf->added_len, text, len);
+    buf->added_len += len;
+    return buf->added_len - len;
+}
+
+/*
+ * Typing appends to the add buffer right after the previous insertion, so
+ * the piece ending at pos can usually just grow instead of a new piece
+ * being spliced in.
+ */
+static int extend_piece(Buffer *buf, size_t pos, size_t start, size_t len) {
+    Piece *p = buf->root;
+    size_t target = pos - 1, newlines;
+    if (pos == 0) return 0;
+    while (p) {
+        size_t left_len = p->left ? p->left->tree_length : 0;
+        if (target < left_len) {
+            p = p->left;
+        } else if (target < left_len + p->length) {
+            target -= left_len;
+            break;
+        } else {
+            target -= left_len + p->length;
+            p = p->right;
+        }
+    }
+    if (!p || target != p->length - 1 || p->source != SOURCE_ADDED ||
+        p->start + p->length != start || p->length + len > PIECE_MAX) {
+        return 0;
+    }
+    newlines = count_newlines(buf->added + start, len);
+    target = pos - 1;
+    p = buf->root;
+    while (p) {
+        size_t left_len = p->left ? p->left->tree_length : 0;
+        p->tree_length += len;
+        p->tree_newlines += newlines;
+        if (target < left_len) {
+            p = p->left;
+        } else if (target < left_len + p->length) {
+            p->length += len;
+            p->newlines += newlines;
+            break;
+        } else {
+            target -= left_len + p->length;
+            p = p->right;
+        }
+    }
+    return 1;
+}
+
+void buffer_add_listener(Buffer *buf, buffer_listener fn, void *arg) {
+    if (buf->listener_count == MAX_LISTENERS) return;
+    buf->listeners[buf->listener_count] = fn;
+    buf->listener_args[buf->listener_count] = arg;
+    buf->listener_count++;
+}
+
+void buffer_remove_listener(Buffer *buf, buffer_listener fn, void *arg) {
+    for (int i = 0; i < buf->listener_count; i++) {
+        if (buf->listeners[i] == fn && buf->listener_args[i] == arg) {
+            buf->listener_count--;
+            buf->listeners[i] = buf->listeners[buf->listener_count];
+            buf->listener_args[i] = buf->listener_args[buf->listener_count];
+            return;
+        }
+    }
+}
+
+static void notify(Buffer *buf, const BufferChange *change) {
+    for (int i = 0; i < buf->listener_count; i++) {
+        buf->listeners[i](change, buf->listener_args[i]);
+    }
+}
+
+void buffer_insert(Buffer *buf, size_t pos, const char *text, size_t len) {
+    Piece *l, *r;
+    size_t start, line = 0;
+    if (len == 0) return;
+    if (pos > buffer_length(buf)) pos = buffer_length(buf);
+    if (buf->listener_count) line = buffer_line_of(buf, pos);
+    start = append_added(buf, text, len);
+    if (!extend_piece(buf, pos, start, len)) {
+        split(buf, buf->root, pos, &l, &r);
+        l = append_pieces(buf, l, SOURCE_ADDED, buf->added, start, len);
+        buf->root = merge(l, r);
+    }
+    if (buf->listener_count) {
+        BufferChange change = { pos, 0, len, text, line, 0, count_newlines(text, len) };
+        notify(buf, &change);
+    }
+}
+
+void buffer_delete(Buffer *buf, size_t pos, size_t len) {
+    Piece *l, *m, *r;
+    size_t total = buffer_length(buf), line = 0, removed_lines;
+    if (pos >= total || len == 0) return;
+    if (len > total - pos) len = total - pos;
+    if (buf->listener_count) line = buffer_line_of(buf, pos);
+    split(buf, buf->root, pos, &l, &r);
+    split(buf, r, len, &m, &r);
+    removed_lines = m ? m->tree_newlines : 0;
+    free_tree(buf, m);
+    buf->root = merge(l, r);
+    if (buf->listener_count) {
+        BufferChange change = { pos, len, 0, NULL, line, removed_lines, 0 };
+        notify(buf, &change);
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Text storage for the editor: a piece table whose pieces live in a
+ * randomized balanced tree keyed by byte offset.  Every node caches the
+ * byte and newline totals of its subtree, so inserts, deletes, line lookups
+ * and offset/line conversions are all O(log n) in the number of pieces.
+ *
+ * Lines are separated by '\n'; a buffer always has at least one line and
+ * line lengths never include the terminating newline.
+ */
+typedef struct Buffer Buffer;
+
+/*
+ * Describes one insert or delete after it has been applied: `removed`
+ * bytes holding `removed_lines` newlines were taken out at pos, or
+ * `inserted` bytes of text holding `inserted_lines` newlines were put in.
+ * `line` is the line containing pos.
+ */
+typedef struct {
+    size_t pos;
+    size_t removed;
+    size_t inserted;
+    const char *text;
+    size_t line;
+    size_t removed_lines;
+    size_t inserted_lines;
+} BufferChange;
+
+typedef void (*buffer_listener)(const BufferChange *change, void *arg);
+
+Buffer *buffer_new(void);
+void buffer_free(Buffer *buf);
+int buffer_load(Buffer *buf, FILE *file);
+int buffer_write(const Buffer *buf, FILE *file);
+int buffer_save(const Buffer *buf, const char *path);
+
+size_t buffer_length(const Buffer *buf);
+size_t buffer_memory(const Buffer *buf);
+size_t buffer_line_count(const Buffer *buf);
+size_t buffer_line_start(const Buffer *buf, size_t line);
+size_t buffer_line_length(const Buffer *buf, size_t line);
+size_t buffer_line_of(const Buffer *buf, size_t pos);
+size_t buffer_pos(const Buffer *buf, size_t line, size_t col);
+size_t buffer_read(const Buffer *buf, size_t pos, size_t len, char *out);
+
+void buffer_insert(Buffer *buf, size_t pos, const char *text, size_t len);
+void buffer_delete(Buffer *buf, size_t pos, size_t len);
+
+void buffer_add_listener(Buffer *buf, buffer_listener fn, void *arg);
+void buffer_remove_listener(Buffer *buf, buffer_listener fn, void *arg);
+
+#endif
@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "clipboard.h"
+
+/* Reads [pos, pos + len) out of the buffer one chunk at a time. */
+Clip *clip_from_buffer(const Buffer *buf, size_t pos, size_t len) {
+    Clip *clip = calloc(1, sizeof(Clip));
+    clip->refs = 1;
+    while (len > 0) {
+        size_t n = len < CLIP_CHUNK ? len : CLIP_CHUNK;
+        ClipChunk *chunk = malloc(sizeof(ClipChunk) + n);
+        chunk->next = NULL;
+        chunk->length = buffer_read(buf, pos, n, chunk->data);
+        if (chunk->length == 0) {
+            free(chunk);
+            break;
+        }
+        if (clip->tail) {
+            clip->tail->next = chunk;
+        } else {
+            clip->head = chunk;
+        }
+        clip->tail = chunk;
+        clip->length += chunk->length;
+        pos += chunk->length;
+        len -= chunk->length;
+    }
+    return clip;
+}
+
+void clip_release(Clip *clip) {
+    if (!clip || --clip->refs > 0) return;
+    while (clip->head) {
+        ClipChunk *next = clip->head->next;
+        free(clip->head);
+        clip->head = next;
+    }
+    free(clip);
+}
+
+static int register_index(int reg) {
+    return reg >= 'a' && reg <= 'z' ? reg - 'a' : -1;
+}
+
+void clipboard_init(Clipboard *cb) {
+    memset(cb, 0, sizeof(Clipboard));
+}
+
+void clipboard_free(Clipboard *cb) {
+    for (int i = 0; i < REGISTER_COUNT; i++) clip_release(cb->registers[i]);
+    for (int i = 0; i < KILL_RING_SIZE; i++) clip_release(cb->ring[i]);
+    memset(cb, 0, sizeof(Clipboard));
+}
+
+/* Takes over the caller's reference to clip. */
+void clipboard_store(Clipboard *cb, int reg, Clip *clip) {
+    int index = register_index(reg);
+    if (index >= 0) {
+        clip_release(cb->registers[index]);
+        cb->registers[index] = clip;
+        clip->refs++;
+    }
+    cb->ring_head = (cb->ring_head + 1) % KILL_RING_SIZE;
+    clip_release(cb->ring[cb->ring_head]);
+    cb->ring[cb->ring_head] = clip;
+    if (cb->ring_count < KILL_RING_SIZE) cb->ring_count++;
+    cb->yank = 0;
+}
+
+const Clip *clipboard_get(Clipboard *cb, int reg) {
+    int index = register_index(reg);
+    if (index >= 0) return cb->registers[index];
+    cb->yank = 0;
+    return cb->ring_count ? cb->ring[cb->ring_head] : NULL;
+}
+
+/* Returns the ring entry one older than the last one pasted, wrapping around. */
+const Clip *clipboard_cycle(Clipboard *cb) {
+    if (cb->ring_count == 0) return NULL;
+    cb->yank = (cb->yank + 1) % cb->ring_count;
+    return cb->ring[(cb->ring_head + KILL_RING_SIZE - cb->yank) % KILL_RING_SIZE];
+}
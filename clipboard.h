@@ -0,0 +1,53 @@
+#ifndef CLIPBOARD_H
+#define CLIPBOARD_H
+
+#include <stddef.h>
+
+#include "buffer.h"
+
+#define CLIP_CHUNK 65536
+#define KILL_RING_SIZE 16
+#define REGISTER_COUNT 26
+
+typedef struct ClipChunk {
+    struct ClipChunk *next;
+    size_t length;
+    char data[];
+} ClipChunk;
+
+/*
+ * Copied text as a list of fixed-size chunks, so a copy of any size needs
+ * no contiguous allocation and is never truncated.  Clips are shared by
+ * reference between the registers and the kill ring.
+ */
+typedef struct {
+    ClipChunk *head;
+    ClipChunk *tail;
+    size_t length;
+    int refs;
+} Clip;
+
+/*
+ * Named registers 'a' to 'z' plus a kill ring of the most recent copies.
+ * Every copy goes on the ring; a copy into a register also keeps it there.
+ * Pasting without a register takes the newest ring entry, and
+ * clipboard_cycle() steps back to older ones.
+ */
+typedef struct {
+    Clip *registers[REGISTER_COUNT];
+    Clip *ring[KILL_RING_SIZE];
+    size_t ring_head;
+    size_t ring_count;
+    size_t yank;
+} Clipboard;
+
+Clip *clip_from_buffer(const Buffer *buf, size_t pos, size_t len);
+void clip_release(Clip *clip);
+
+void clipboard_init(Clipboard *cb);
+void clipboard_free(Clipboard *cb);
+void clipboard_store(Clipboard *cb, int reg, Clip *clip);
+const Clip *clipboard_get(Clipboard *cb, int reg);
+const Clip *clipboard_cycle(Clipboard *cb);
+
+#endif
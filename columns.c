@@ -0,0 +1,182 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "columns.h"
+#include "utf8.h"
+
+#define COLUMN_CHUNK 4096
+
+static size_t min_size(size_t a, size_t b) {
+    return a < b ? a : b;
+}
+
+static int add_mark(ColumnLine *cl, size_t byte, size_t col) {
+    if (cl->count == cl->capacity) {
+        size_t capacity = cl->capacity ? cl->capacity * 2 : 8;
+        ColumnMark *grown = realloc(cl->marks, capacity * sizeof(ColumnMark));
+        if (!grown) return -1;
+        cl->marks = grown;
+        cl->capacity = capacity;
+    }
+    cl->marks[cl->count].byte = byte;
+    cl->marks[cl->count].col = col;
+    cl->count++;
+    return 0;
+}
+
+static ColumnLine *slot(ColumnCache *cache, size_t line) {
+    ColumnLine *cl = &cache->lines[line % COLUMN_SLOTS];
+    if (cl->line != line) {
+        cl->line = line;
+        cl->count = 0;
+        cl->scanned.byte = 0;
+        cl->scanned.col = 0;
+        add_mark(cl, 0, 0);
+    }
+    return cl;
+}
+
+/*
+ * Scans on from where the last scan stopped, adding a mark at the first
+ * character boundary past each COLUMN_STEP bytes, until stop_byte or
+ * stop_col is reached or the line ends.  The scan then stops at most a
+ * step past the last mark.
+ */
+static void extend(ColumnCache *cache, ColumnLine *cl, size_t start, size_t length,
+                   size_t stop_byte, size_t stop_col) {
+    char chunk[COLUMN_CHUNK];
+    size_t pos = cl->scanned.byte, col = cl->scanned.col;
+    while (pos < length && pos < stop_byte && col < stop_col) {
+        size_t base = pos;
+        size_t got = buffer_read(cache->buffer, start + pos, min_size(length - pos, COLUMN_CHUNK),
+                                 chunk);
+        if (got == 0) return;
+        while (pos < base + got && pos < stop_byte && col < stop_col) {
+            size_t mark = cl->count * COLUMN_STEP, count, n;
+            unsigned int cp;
+            int len;
+            if (pos >= mark) {
+                if (add_mark(cl, pos, col) < 0) return;
+                continue;
+            }
+            n = utf8_narrow(chunk + (pos - base), min_size(base + got, mark) - pos, &count);
+            if (n > 0) {
+                pos += n;
+                col += count;
+                continue;
+            }
+            len = utf8_decode(chunk + (pos - base), base + got - pos, &cp);
+            /* A sequence cut off by the end of the chunk is read again whole. */
+            if (cp == UTF8_REPLACEMENT && len == 1 && base + got < length &&
+                base + got - pos < UTF8_MAX) {
+                break;
+            }
+            pos += len;
+            col += utf8_width(cp);
+        }
+        cl->scanned.byte = pos;
+        cl->scanned.col = col;
+    }
+}
+
+/* Walks from mark j to the character holding byte or covering column, whichever is first. */
+static ColumnMark walk(ColumnCache *cache, const ColumnLine *cl, size_t j, size_t start,
+                       size_t length, size_t byte, size_t column) {
+    char text[2 * COLUMN_STEP + 2 * UTF8_MAX];
+    ColumnMark at = cl->marks[j], end = j + 1 < cl->count ? cl->marks[j + 1] : cl->scanned;
+    size_t got;
+    /* Where every character up to the next mark is one byte and one column, nothing is read. */
+    if (end.byte - at.byte == end.col - at.col && (byte < end.byte || column < end.col)) {
+        size_t n = min_size(byte - at.byte, column - at.col);
+        at.byte += n;
+        at.col += n;
+        return at;
+    }
+    got = buffer_read(cache->buffer, start + at.byte,
+                             min_size(length - at.byte, sizeof(text)), text);
+    for (size_t i = 0; i < got;) {
+        unsigned int cp;
+        int n = utf8_decode(text + i, got - i, &cp), w = utf8_width(cp);
+        if (at.byte + n > byte || at.col + w > column) break;
+        at.byte += n;
+        at.col += w;
+        i += n;
+    }
+    return at;
+}
+
+size_t columns_of(ColumnCache *cache, size_t line, size_t col) {
+    ColumnLine *cl = slot(cache, line);
+    size_t start = buffer_line_start(cache->buffer, line);
+    size_t length = buffer_line_length(cache->buffer, line), j;
+    if (col > length) col = length;
+    extend(cache, cl, start, length, col + 1, SIZE_MAX);
+    j = min_size(col / COLUMN_STEP, cl->count - 1);
+    if (cl->marks[j].byte > col) j--;
+    return walk(cache, cl, j, start, length, col, SIZE_MAX).col;
+}
+
+size_t columns_byte(ColumnCache *cache, size_t line, size_t column, size_t *start_col) {
+    ColumnLine *cl = slot(cache, line);
+    size_t start = buffer_line_start(cache->buffer, line);
+    size_t length = buffer_line_length(cache->buffer, line), lo = 0, hi;
+    ColumnMark at;
+    extend(cache, cl, start, length, SIZE_MAX, column + 1);
+    hi = cl->count - 1;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo + 1) / 2;
+        if (cl->marks[mid].col <= column) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    at = walk(cache, cl, lo, start, length, SIZE_MAX, column);
+    if (start_col) *start_col = at.col;
+    return at.byte;
+}
+
+/*
+ * Marks before the edit stay right, except within a sequence's length of
+ * it, where the edit can complete or break a character.  Lines after a
+ * change in line count are renumbered, so they are dropped.
+ */
+static void on_change(const BufferChange *change, void *arg) {
+    ColumnCache *cache = arg;
+    int lines = change->removed_lines > 0 || change->inserted_lines > 0;
+    for (int i = 0; i < COLUMN_SLOTS; i++) {
+        ColumnLine *cl = &cache->lines[i];
+        size_t offset;
+        if (cl->line == SIZE_MAX || change->line > cl->line) continue;
+        if (change->line < cl->line) {
+            if (lines) cl->line = SIZE_MAX;
+            continue;
+        }
+        offset = change->pos - buffer_line_start(cache->buffer, change->line);
+        while (cl->count > 1 && cl->marks[cl->count - 1].byte + UTF8_MAX - 1 > offset) {
+            cl->count--;
+        }
+        if (cl->scanned.byte + UTF8_MAX - 1 > offset) cl->scanned = cl->marks[cl->count - 1];
+    }
+}
+
+void columns_init(ColumnCache *cache, Buffer *buffer) {
+    memset(cache, 0, sizeof(ColumnCache));
+    cache->buffer = buffer;
+    for (int i = 0; i < COLUMN_SLOTS; i++) cache->lines[i].line = SIZE_MAX;
+    buffer_add_listener(buffer, on_change, cache);
+}
+
+void columns_free(ColumnCache *cache) {
+    if (!cache->buffer) return;
+    buffer_remove_listener(cache->buffer, on_change, cache);
+    for (int i = 0; i < COLUMN_SLOTS; i++) free(cache->lines[i].marks);
+    memset(cache, 0, sizeof(ColumnCache));
+}
+
+size_t columns_memory(const ColumnCache *cache) {
+    size_t bytes = 0;
+    for (int i = 0; i < COLUMN_SLOTS; i++) bytes += cache->lines[i].capacity * sizeof(ColumnMark);
+    return bytes;
+}
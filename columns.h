@@ -0,0 +1,55 @@
+#ifndef COLUMNS_H
+#define COLUMNS_H
+
+#include <stddef.h>
+
+#include "buffer.h"
+
+#define COLUMN_SLOTS 64
+#define COLUMN_STEP 64
+
+/* Where the first character at or after a byte offset starts, and its column. */
+typedef struct {
+    size_t byte;
+    size_t col;
+} ColumnMark;
+
+typedef struct {
+    size_t line;
+    ColumnMark scanned;
+    ColumnMark *marks;
+    size_t count;
+    size_t capacity;
+} ColumnLine;
+
+/*
+ * Byte to screen column mapping for the lines of a buffer, which differ
+ * once a line holds multi-byte or double-width characters.  Each cached
+ * line keeps a sparse map with a mark every COLUMN_STEP bytes, so either
+ * way a lookup is a binary search and a scan of at most one step.  Marks
+ * are found only as far into the line as a lookup has needed, with runs of
+ * one-column characters taken at vector speed, and a stretch between two
+ * marks that turns out to be plain ASCII is never read again.
+ *
+ * Lines sit in COLUMN_SLOTS slots by line number.  Edits arrive through a
+ * buffer listener: one inside a cached line drops only the marks past the
+ * edit, so typing on a long line does not scan it again, and one that
+ * adds or removes lines before a cached line drops that line.
+ */
+typedef struct {
+    Buffer *buffer;
+    ColumnLine lines[COLUMN_SLOTS];
+} ColumnCache;
+
+void columns_init(ColumnCache *cache, Buffer *buffer);
+void columns_free(ColumnCache *cache);
+size_t columns_memory(const ColumnCache *cache);
+/* Column at which the character holding byte col of line starts. */
+size_t columns_of(ColumnCache *cache, size_t line, size_t col);
+/*
+ * Byte offset of the character that covers column, or the line length
+ * past its end; *start, if given, gets the column that character starts at.
+ */
+size_t columns_byte(ColumnCache *cache, size_t line, size_t column, size_t *start);
+
+#endif
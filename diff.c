@@ -0,0 +1,435 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "diff.h"
+
+#define DIFF_MAX_LINES 0x7fffffffu
+/* Edit steps spent on one range before settling for the furthest-reaching split. */
+#define DIFF_COST_LIMIT 256
+
+/* A hash table slot: the low bits of a line's hash and its id + 1, or 0 if empty. */
+typedef struct {
+    uint32_t hash;
+    uint32_t id;
+} Slot;
+
+/* Where each interned line was first seen (line * 2 + side) and on which sides it occurs. */
+typedef struct {
+    const DiffText *texts[2];
+    Slot *slots;
+    size_t mask;
+    uint32_t *refs;
+    unsigned char *sides;
+    size_t count;
+} Interner;
+
+/* The reduced sequences the search runs on, and where each of their lines came from. */
+typedef struct {
+    const uint32_t *x;
+    const uint32_t *y;
+    const uint32_t *x_map;
+    const uint32_t *y_map;
+    unsigned char *a_changed;
+    unsigned char *b_changed;
+    ptrdiff_t *fdiag;
+    ptrdiff_t *bdiag;
+} Search;
+
+static int split_lines(DiffText *text, const char *data, size_t len) {
+    size_t lines = 0, cap = 1024;
+    const char *p = data, *end = data + len;
+    text->text = data;
+    text->starts = malloc(cap * sizeof(size_t));
+    if (!text->starts) return -1;
+    while (p < end) {
+        const char *newline = memchr(p, '\n', end - p);
+        if (lines + 2 > cap) {
+            size_t *grown = realloc(text->starts, cap * 2 * sizeof(size_t));
+            if (!grown) return -1;
+            text->starts = grown;
+            cap *= 2;
+        }
+        text->starts[lines++] = p - data;
+        p = newline ? newline + 1 : end;
+    }
+    text->starts[lines] = len;
+    text->lines = lines;
+    if (lines > DIFF_MAX_LINES) {
+        errno = EFBIG;
+        return -1;
+    }
+    return 0;
+}
+
+static const char *line_text(const DiffText *text, size_t line, size_t *len) {
+    *len = text->starts[line + 1] - text->starts[line];
+    return text->text + text->starts[line];
+}
+
+static uint64_t hash_line(const char *p, size_t len) {
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ len, w;
+    while (len >= 8) {
+        memcpy(&w, p, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+        p += 8;
+        len -= 8;
+    }
+    w = 0;
+    memcpy(&w, p, len);
+    h = (h ^ w) * 0xc4ceb9fe1a85ec53ull;
+    return h ^ (h >> 29);
+}
+
+/* Returns the id of line of side, whose hash is given, adding it if no equal line has been seen. */
+static uint32_t intern(Interner *in, int side, size_t line, uint32_t hash) {
+    size_t len, other_len;
+    const char *text = line_text(in->texts[side], line, &len);
+    size_t slot = hash & in->mask;
+    while (in->slots[slot].id) {
+        if (in->slots[slot].hash == hash) {
+            uint32_t id = in->slots[slot].id - 1, ref = in->refs[id];
+            const char *other = line_text(in->texts[ref & 1], ref >> 1, &other_len);
+            if (other_len == len && memcmp(other, text, len) == 0) {
+                in->sides[id] |= 1 << side;
+                return id;
+            }
+        }
+        slot = (slot + 1) & in->mask;
+    }
+    in->refs[in->count] = (uint32_t)(line * 2 + side);
+    in->sides[in->count] = 1 << side;
+    in->slots[slot].hash = hash;
+    in->slots[slot].id = ++in->count;
+    return in->count - 1;
+}
+
+/*
+ * Hashes every line of side into ids, then replaces each hash with the
+ * line's id.  The table is too big for the cache, so the slot for a line a
+ * few lines ahead is prefetched while this one is looked up.
+ */
+static void intern_side(Interner *in, int side, uint32_t *ids) {
+    const DiffText *text = in->texts[side];
+    size_t len;
+    for (size_t i = 0; i < text->lines; i++) {
+        const char *line = line_text(text, i, &len);
+        ids[i] = (uint32_t)hash_line(line, len);
+    }
+    for (size_t i = 0; i < text->lines; i++) {
+        if (i + 8 < text->lines) __builtin_prefetch(&in->slots[ids[i + 8] & in->mask]);
+        ids[i] = intern(in, side, i, ids[i]);
+    }
+}
+
+/*
+ * Finds where an optimal path through x[xoff, xlim) and y[yoff, ylim)
+ * crosses the middle by running the forward and backward searches a step
+ * at a time until they overlap.  fdiag[d] and bdiag[d] hold the furthest
+ * x reached on diagonal d = x - y.
+ */
+static void midpoint(Search *s, ptrdiff_t xoff, ptrdiff_t xlim, ptrdiff_t yoff, ptrdiff_t ylim,
+                     ptrdiff_t *xmid, ptrdiff_t *ymid) {
+    ptrdiff_t *fd = s->fdiag, *bd = s->bdiag;
+    ptrdiff_t dmin = xoff - ylim, dmax = xlim - yoff;
+    ptrdiff_t fmid = xoff - yoff, bmid = xlim - ylim;
+    ptrdiff_t fmin = fmid, fmax = fmid, bmin = bmid, bmax = bmid, c, d;
+    int odd = (fmid - bmid) & 1;
+    fd[fmid] = xoff;
+    bd[bmid] = xlim;
+    for (c = 1;; c++) {
+        if (fmin > dmin) fd[--fmin - 1] = -1; else fmin++;
+        if (fmax < dmax) fd[++fmax + 1] = -1; else fmax--;
+        for (d = fmax; d >= fmin; d -= 2) {
+            ptrdiff_t lo = fd[d - 1], hi = fd[d + 1];
+            ptrdiff_t x = lo < hi ? hi : lo + 1, y = x - d;
+            while (x < xlim && y < ylim && s->x[x] == s->y[y]) x++, y++;
+            fd[d] = x;
+            if (odd && bmin <= d && d <= bmax && bd[d] <= x) {
+                *xmid = x;
+                *ymid = y;
+                return;
+            }
+        }
+        if (bmin > dmin) bd[--bmin - 1] = PTRDIFF_MAX; else bmin++;
+        if (bmax < dmax) bd[++bmax + 1] = PTRDIFF_MAX; else bmax--;
+        for (d = bmax; d >= bmin; d -= 2) {
+            ptrdiff_t lo = bd[d - 1], hi = bd[d + 1];
+            ptrdiff_t x = lo < hi ? lo : hi - 1, y = x - d;
+            while (x > xoff && y > yoff && s->x[x - 1] == s->y[y - 1]) x--, y--;
+            bd[d] = x;
+            if (!odd && fmin <= d && d <= fmax && x <= fd[d]) {
+                *xmid = x;
+                *ymid = y;
+                return;
+            }
+        }
+        if (c >= DIFF_COST_LIMIT) {
+            ptrdiff_t fbest = -1, fx = xoff, bbest = PTRDIFF_MAX, bx = xlim;
+            for (d = fmax; d >= fmin; d -= 2) {
+                ptrdiff_t x = fd[d] < xlim ? fd[d] : xlim, y = x - d;
+                if (y > ylim) x = ylim + d, y = ylim;
+                if (x + y > fbest) fbest = x + y, fx = x;
+            }
+            for (d = bmax; d >= bmin; d -= 2) {
+                ptrdiff_t x = bd[d] > xoff ? bd[d] : xoff, y = x - d;
+                if (y < yoff) x = yoff + d, y = yoff;
+                if (x + y < bbest) bbest = x + y, bx = x;
+            }
+            if ((xlim + ylim) - bbest < fbest - (xoff + yoff)) {
+                *xmid = fx;
+                *ymid = fbest - fx;
+            } else {
+                *xmid = bx;
+                *ymid = bbest - bx;
+            }
+            return;
+        }
+    }
+}
+
+static void compare(Search *s, ptrdiff_t xoff, ptrdiff_t xlim, ptrdiff_t yoff, ptrdiff_t ylim) {
+    while (xoff < xlim && yoff < ylim && s->x[xoff] == s->y[yoff]) xoff++, yoff++;
+    while (xlim > xoff && ylim > yoff && s->x[xlim - 1] == s->y[ylim - 1]) xlim--, ylim--;
+    if (xoff == xlim) {
+        while (yoff < ylim) s->b_changed[s->y_map[yoff++]] = 1;
+    } else if (yoff == ylim) {
+        while (xoff < xlim) s->a_changed[s->x_map[xoff++]] = 1;
+    } else {
+        ptrdiff_t xmid, ymid;
+        midpoint(s, xoff, xlim, yoff, ylim, &xmid, &ymid);
+        compare(s, xoff, xmid, yoff, ymid);
+        compare(s, xmid, xlim, ymid, ylim);
+    }
+}
+
+/*
+ * Keeps the lines of ids[first, last) whose id also occurs on the other
+ * side, with their line numbers; the rest are marked changed straight away.
+ */
+static size_t reduce(const uint32_t *ids, size_t first, size_t last, const unsigned char *sides,
+                     int other, uint32_t *kept, uint32_t *map, unsigned char *changed) {
+    size_t n = 0;
+    for (size_t i = first; i < last; i++) {
+        if (sides[ids[i]] & (1 << other)) {
+            kept[n] = ids[i];
+            map[n++] = (uint32_t)i;
+        } else {
+            changed[i] = 1;
+        }
+    }
+    return n;
+}
+
+static int add_change(Diff *diff, size_t a, size_t a_count, size_t b, size_t b_count) {
+    if (diff->count == diff->capacity) {
+        size_t capacity = diff->capacity ? diff->capacity * 2 : 64;
+        DiffChange *grown = realloc(diff->changes, capacity * sizeof(DiffChange));
+        if (!grown) return -1;
+        diff->changes = grown;
+        diff->capacity = capacity;
+    }
+    diff->changes[diff->count].a = a;
+    diff->changes[diff->count].a_count = a_count;
+    diff->changes[diff->count].b = b;
+    diff->changes[diff->count].b_count = b_count;
+    diff->count++;
+    diff->deleted += a_count;
+    diff->inserted += b_count;
+    return 0;
+}
+
+/* Pairs the unchanged lines of both sides in order; what lies between them is a change. */
+static int collect(Diff *diff, const unsigned char *a_changed, const unsigned char *b_changed) {
+    size_t n = diff->a.lines, m = diff->b.lines, i = 0, j = 0;
+    while (i < n || j < m) {
+        size_t a = i, b = j;
+        if (i < n && j < m && !a_changed[i] && !b_changed[j]) {
+            i++;
+            j++;
+            continue;
+        }
+        while (i < n && a_changed[i]) i++;
+        while (j < m && b_changed[j]) j++;
+        if (i == a && j == b) break;
+        if (add_change(diff, a, i - a, b, j - b) < 0) return -1;
+    }
+    return 0;
+}
+
+static void free_interner(Interner *in) {
+    free(in->slots);
+    free(in->refs);
+    free(in->sides);
+}
+
+char *diff_read_file(const char *path, size_t *len) {
+    struct stat st;
+    size_t cap, got = 0;
+    char *data;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    cap = fstat(fd, &st) == 0 && st.st_size > 0 ? (size_t)st.st_size + 1 : 4096;
+    data = malloc(cap);
+    while (data) {
+        ssize_t n;
+        if (got == cap) {
+            char *grown = realloc(data, cap * 2);
+            if (!grown) break;
+            data = grown;
+            cap *= 2;
+        }
+        n = read(fd, data + got, cap - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) break;
+        if (n == 0) {
+            close(fd);
+            *len = got;
+            return data;
+        }
+        got += n;
+    }
+    free(data);
+    close(fd);
+    return NULL;
+}
+
+int diff_compute(Diff *diff, const char *a, size_t a_len, const char *b, size_t b_len) {
+    Interner in = { { &diff->a, &diff->b }, NULL, 0, NULL, NULL, 0 };
+    Search s = { 0 };
+    uint32_t *a_ids = NULL, *b_ids = NULL, *x = NULL, *y = NULL, *x_map = NULL, *y_map = NULL;
+    unsigned char *a_changed = NULL, *b_changed = NULL;
+    ptrdiff_t *diags = NULL;
+    size_t n, m, head = 0, a_end, b_end, xn, yn, total, size = 1024;
+    int result = -1;
+    memset(diff, 0, sizeof(Diff));
+    if (split_lines(&diff->a, a, a_len) < 0 || split_lines(&diff->b, b, b_len) < 0) goto done;
+    n = diff->a.lines;
+    m = diff->b.lines;
+    total = n + m;
+    while (size < total * 2) size *= 2;
+    in.mask = size - 1;
+    in.slots = calloc(size, sizeof(Slot));
+    in.refs = malloc((total ? total : 1) * sizeof(uint32_t));
+    in.sides = malloc(total ? total : 1);
+    a_ids = malloc((n ? n : 1) * sizeof(uint32_t));
+    b_ids = malloc((m ? m : 1) * sizeof(uint32_t));
+    a_changed = calloc(n ? n : 1, 1);
+    b_changed = calloc(m ? m : 1, 1);
+    if (!in.slots || !in.refs || !in.sides || !a_ids || !b_ids || !a_changed || !b_changed) {
+        goto done;
+    }
+    intern_side(&in, 0, a_ids);
+    intern_side(&in, 1, b_ids);
+    free(in.slots);
+    in.slots = NULL;
+    free(in.refs);
+    in.refs = NULL;
+
+    a_end = n;
+    b_end = m;
+    while (head < n && head < m && a_ids[head] == b_ids[head]) head++;
+    while (a_end > head && b_end > head && a_ids[a_end - 1] == b_ids[b_end - 1]) a_end--, b_end--;
+    x = malloc((a_end - head + 1) * sizeof(uint32_t));
+    y = malloc((b_end - head + 1) * sizeof(uint32_t));
+    x_map = malloc((a_end - head + 1) * sizeof(uint32_t));
+    y_map = malloc((b_end - head + 1) * sizeof(uint32_t));
+    if (!x || !y || !x_map || !y_map) goto done;
+    xn = reduce(a_ids, head, a_end, in.sides, 1, x, x_map, a_changed);
+    yn = reduce(b_ids, head, b_end, in.sides, 0, y, y_map, b_changed);
+    free(a_ids);
+    a_ids = NULL;
+    free(b_ids);
+    b_ids = NULL;
+
+    diags = malloc(2 * (xn + yn + 3) * sizeof(ptrdiff_t));
+    if (!diags) goto done;
+    s.x = x;
+    s.y = y;
+    s.x_map = x_map;
+    s.y_map = y_map;
+    s.a_changed = a_changed;
+    s.b_changed = b_changed;
+    s.fdiag = diags + yn + 1;
+    s.bdiag = diags + (xn + yn + 3) + yn + 1;
+    compare(&s, 0, xn, 0, yn);
+    result = collect(diff, a_changed, b_changed);
+done:
+    if (result < 0) diff_free(diff);
+    free_interner(&in);
+    free(a_ids);
+    free(b_ids);
+    free(x);
+    free(y);
+    free(x_map);
+    free(y_map);
+    free(a_changed);
+    free(b_changed);
+    free(diags);
+    return result;
+}
+
+static void write_lines(FILE *out, char prefix, const DiffText *text, size_t first, size_t last) {
+    for (size_t i = first; i < last; i++) {
+        size_t len;
+        const char *line = line_text(text, i, &len);
+        fputc(prefix, out);
+        fwrite(line, 1, len, out);
+        if (len == 0 || line[len - 1] != '\n') fputs("\n\\ No newline at end of file\n", out);
+    }
+}
+
+/* A hunk range is start,count from 1; an empty one names the line before it. */
+static void write_range(FILE *out, char sign, size_t start, size_t count) {
+    if (count == 1) {
+        fprintf(out, "%c%zu", sign, start + 1);
+    } else {
+        fprintf(out, "%c%zu,%zu", sign, count ? start + 1 : start, count);
+    }
+}
+
+int diff_write(const Diff *diff, FILE *out, const char *a_name, const char *b_name,
+               size_t context) {
+    size_t k = 0;
+    if (diff->count) fprintf(out, "--- %s\n+++ %s\n", a_name, b_name);
+    while (k < diff->count) {
+        const DiffChange *first = &diff->changes[k], *last = first;
+        size_t end = k + 1, a_start, a_end, b_start, b_end, at;
+        while (end < diff->count &&
+               diff->changes[end].a - (last->a + last->a_count) <= 2 * context) {
+            last = &diff->changes[end++];
+        }
+        a_start = first->a > context ? first->a - context : 0;
+        b_start = first->b - (first->a - a_start);
+        a_end = last->a + last->a_count + context;
+        if (a_end > diff->a.lines) a_end = diff->a.lines;
+        b_end = last->b + last->b_count + (a_end - (last->a + last->a_count));
+        fputs("@@ ", out);
+        write_range(out, '-', a_start, a_end - a_start);
+        fputc(' ', out);
+        write_range(out, '+', b_start, b_end - b_start);
+        fputs(" @@\n", out);
+        at = a_start;
+        for (; k < end; k++) {
+            const DiffChange *change = &diff->changes[k];
+            write_lines(out, ' ', &diff->a, at, change->a);
+            write_lines(out, '-', &diff->a, change->a, change->a + change->a_count);
+            write_lines(out, '+', &diff->b, change->b, change->b + change->b_count);
+            at = change->a + change->a_count;
+        }
+        write_lines(out, ' ', &diff->a, at, a_end);
+    }
+    return ferror(out) ? -1 : 0;
+}
+
+void diff_free(Diff *diff) {
+    free(diff->a.starts);
+    free(diff->b.starts);
+    free(diff->changes);
+    memset(diff, 0, sizeof(Diff));
+}
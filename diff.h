@@ -0,0 +1,59 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define DIFF_CONTEXT 3
+
+/* Lines [a, a + a_count) of the old text were replaced by [b, b + b_count) of the new. */
+typedef struct {
+    size_t a;
+    size_t a_count;
+    size_t b;
+    size_t b_count;
+} DiffChange;
+
+/* A text split into lines; line i is text[starts[i], starts[i + 1]) with its newline. */
+typedef struct {
+    const char *text;
+    size_t *starts;
+    size_t lines;
+} DiffText;
+
+/*
+ * Line diff by Myers' O(ND) algorithm in its linear-space form: the
+ * middle snake of each range is found from both ends at once and the two
+ * halves are solved recursively, so memory is O(N + M) however far apart
+ * the texts are.
+ *
+ * Lines are hashed and interned into integer ids first, so the search
+ * compares ids, never text.  The common head and tail are cut off, and
+ * lines that do not occur in the other text at all are set aside as
+ * changed before the search, since they can never be matched.  After a
+ * fixed number of edit steps in one range the search settles for the
+ * furthest-reaching split, as GNU diff does, which keeps the time near
+ * linear on texts with little in common at the price of a diff that may
+ * not be minimal.
+ *
+ * The diff points into the texts it was given, which must outlive it.
+ */
+typedef struct {
+    DiffText a;
+    DiffText b;
+    DiffChange *changes;
+    size_t count;
+    size_t capacity;
+    size_t deleted;
+    size_t inserted;
+} Diff;
+
+/* Reads a whole file into memory to diff it; NULL with errno set if it cannot be read. */
+char *diff_read_file(const char *path, size_t *len);
+int diff_compute(Diff *diff, const char *a, size_t a_len, const char *b, size_t b_len);
+/* Writes the changes in unified format with context lines around each. */
+int diff_write(const Diff *diff, FILE *out, const char *a_name, const char *b_name,
+               size_t context);
+void diff_free(Diff *diff);
+
+#endif
@@ -1,489 +1,1219 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <termios.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
-#define MAX_LINES 100
-#define MAX_LINE_LENGTH 256
-#define MAX_UNDO 100
-#define CLIPBOARD_SIZE 10000
+#include "diff.h"
+#include "editor.h"
+#include "trace.h"
+#include "utf8.h"
 
-typedef struct {
-    char lines[MAX_LINES][MAX_LINE_LENGTH];
-    int line_count;
-    int cursor_line;
-    int cursor_col;
-} EditorState;
+#define SCREEN_ROWS 24
+#define SCREEN_COLS 80
+#define TEXT_ROW 3
+#define RELOAD_CHECK 4096
 
-typedef struct {
-    char lines[MAX_LINES][MAX_LINE_LENGTH];
-    int line_count;
-    int current_line;
-    int current_col;
-    EditorState undo_stack[MAX_UNDO];
-    EditorState redo_stack[MAX_UNDO];
-    int undo_count;
-    int redo_count;
-    char clipboard[CLIPBOARD_SIZE];
-    int selection_start_line;
-    int selection_start_col;
-    int selection_end_line;
-    int selection_end_col;
-    int selection_mode;
-} Editor;
-
-#define COLOR_RESET "\033[0m"
-#define COLOR_KEYWORD "\033[1;34m"
-#define COLOR_STRING "\033[0;32m" 
-#define COLOR_NUMBER "\033[0;33m" 
-#define COLOR_COMMENT "\033[0;36m"
-
-const char *keywords[] = {
-    "auto", "break", "case", "char", "const", "continue", "default", "do",
-    "double", "else", "enum", "extern", "float", "for", "goto", "if",
-    "int", "long", "register", "return", "short", "signed", "sizeof", "static",
-    "struct", "switch", "typedef", "union", "unsigned", "void", "volatile", "while",
-    NULL
-};
-
-int getch()
-{
-    struct termios oldt, newt;
-    int ch;
-
-    tcgetattr(STDIN_FILENO, &oldt);
-    newt = oldt;
-    newt.c_lflag &= ~(ICANON | ECHO);
-    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-
-    ch = getchar();
-
-    tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-    return ch;
-}   
-
-int read_key()
-{
-    int ch = getch();
-    if (ch == 27)
-    {
-        if (getch() == '[')
-        {
-            switch (getch())
-            {
-            case 'A':
-                return 1000;
-            case 'B':
-                return 1001;
-            case 'C':
-                return 1002;
-            case 'D':
-                return 1003;
-            }
-        }
-        return 27;
+static size_t line_length(Editor *editor, size_t line) {
+    return buffer_line_length(editor->doc->buffer, line);
+}
+static size_t cursor_pos(Editor *editor) {
+    Document *doc = editor->doc;
+    return buffer_pos(doc->buffer, doc->current_line, doc->current_col);
+}
+static void set_cursor_pos(Editor *editor, size_t pos) {
+    Document *doc = editor->doc;
+    doc->current_line = buffer_line_of(doc->buffer, pos);
+    doc->current_col = pos - buffer_line_start(doc->buffer, doc->current_line);
+}
+/* The screen column of the cursor within its line. */
+static size_t cursor_column(Editor *editor) {
+    Document *doc = editor->doc;
+    return columns_of(&doc->columns, doc->current_line, doc->current_col);
+}
+/* Where the character after (direction > 0) or before the cursor starts. */
+static size_t step_char(Editor *editor, int direction) {
+    Document *doc = editor->doc;
+    size_t pos = cursor_pos(editor), n;
+    char text[UTF8_MAX];
+    unsigned int cp;
+    if (direction > 0) {
+        n = buffer_read(doc->buffer, pos, UTF8_MAX, text);
+        return n ? pos + utf8_decode(text, n, &cp) : pos;
     }
-    return ch;
+    n = pos < UTF8_MAX ? pos : UTF8_MAX;
+    buffer_read(doc->buffer, pos - n, n, text);
+    return pos - n + utf8_prev(text, n);
 }
-
-void clear_screen()
-{
-    printf("\033[H\033[J");
+static const char *get_line(Editor *editor, size_t line, size_t limit, size_t *length) {
+    Document *doc = editor->doc;
+    size_t len = line_length(editor, line);
+    if (len > limit) len = limit;
+    *length = len;
+    if (len + 1 > editor->line_cap) {
+        editor->line_cap = len + 1 > 256 ? len + 1 : 256;
+        editor->line = realloc(editor->line, editor->line_cap);
+    }
+    buffer_read(doc->buffer, buffer_line_start(doc->buffer, line), len, editor->line);
+    editor->line[len] = '\0';
+    return editor->line;
 }
-
-void move_cursor(int row, int col)
-{
-    printf("\033[%d;%dH", row, col);
+static void edit_insert(Editor *editor, size_t pos, const char *text, size_t len) {
+    Document *doc = editor->doc;
+    size_t before = cursor_pos(editor);
+    long long start = trace_begin();
+    doc->just_pasted = 0;
+    buffer_insert(doc->buffer, pos, text, len);
+    trace_end(TRACE_EDIT, start);
+    set_cursor_pos(editor, pos + len);
+    start = trace_begin();
+    undo_record(&doc->history, UNDO_INSERT, pos, text, len, before, pos + len);
+    trace_end(TRACE_UNDO, start);
 }
-
-int is_keyword(const char *word) {
-    for (int i = 0; keywords[i] != NULL; i++) {
-        if (strcmp(word, keywords[i]) == 0) {
-            return 1;
+static void edit_delete(Editor *editor, size_t pos, size_t len) {
+    Document *doc = editor->doc;
+    char small[64];
+    size_t before = cursor_pos(editor);
+    char *text = len <= sizeof(small) ? small : malloc(len);
+    long long start = trace_begin();
+    doc->just_pasted = 0;
+    len = buffer_read(doc->buffer, pos, len, text);
+    buffer_delete(doc->buffer, pos, len);
+    trace_end(TRACE_EDIT, start);
+    set_cursor_pos(editor, pos);
+    start = trace_begin();
+    undo_record(&doc->history, UNDO_DELETE, pos, text, len, before, pos);
+    trace_end(TRACE_UNDO, start);
+    if (text != small) free(text);
+}
+void undo(Editor *editor) {
+    Document *doc = editor->doc;
+    size_t pos;
+    long long start = trace_begin();
+    int applied;
+    doc->just_pasted = 0;
+    applied = undo_apply(&doc->history, doc->buffer, &pos);
+    trace_end(TRACE_UNDO, start);
+    if (applied) set_cursor_pos(editor, pos);
+}
+void redo(Editor *editor) {
+    Document *doc = editor->doc;
+    size_t pos;
+    long long start = trace_begin();
+    int applied;
+    doc->just_pasted = 0;
+    applied = redo_apply(&doc->history, doc->buffer, &pos);
+    trace_end(TRACE_UNDO, start);
+    if (applied) set_cursor_pos(editor, pos);
+}
+void copy_selection(Editor *editor) {
+    Document *doc = editor->doc;
+    if (!doc->selection_mode) return;
+    size_t start = buffer_pos(doc->buffer, doc->selection_start_line,
+                              doc->selection_start_col);
+    size_t end = buffer_pos(doc->buffer, doc->selection_end_line,
+                            doc->selection_end_col);
+    if (start > end) {
+        size_t temp = start;
+        start = end;
+        end = temp;
+    }
+    clipboard_store(&editor->clipboard, editor->pending_register,
+                    clip_from_buffer(doc->buffer, start, end - start));
+    editor->pending_register = 0;
+}
+static size_t document_index(Editor *editor, const Document *doc) {
+    size_t i = 0;
+    while (i < editor->document_count && editor->documents[i] != doc) i++;
+    return i;
+}
+static size_t document_memory(const Document *doc) {
+    return buffer_memory(doc->buffer) + undo_memory(&doc->history) +
+           syntax_memory(&doc->syntax) + matches_memory(&doc->matches) +
+           columns_memory(&doc->columns) + doc->journal.batch_cap;
+}
+static size_t editor_memory(Editor *editor) {
+    size_t total = 0;
+    for (size_t i = 0; i < editor->document_count; i++) {
+        total += document_memory(editor->documents[i]);
+    }
+    return total;
+}
+static size_t text_rows(Editor *editor) {
+    int rows = editor->screen.rows - TEXT_ROW - 1;
+    return rows > 0 ? rows : 1;
+}
+static void scroll(Editor *editor) {
+    Document *doc = editor->doc;
+    size_t rows = text_rows(editor);
+    size_t cols = editor->screen.cols;
+    size_t col;
+    if (doc->current_line < doc->row_offset) {
+        doc->row_offset = doc->current_line;
+    }
+    if (doc->current_line >= doc->row_offset + rows) {
+        doc->row_offset = doc->current_line - rows + 1;
+    }
+    col = cursor_column(editor);
+    if (col < doc->col_offset) {
+        doc->col_offset = col;
+    }
+    if (col >= doc->col_offset + cols) {
+        doc->col_offset = col - cols + 1;
+    }
+}
+/* Returns the column after the text. */
+static int draw_status(Screen *screen, int row, const char *text, unsigned char attr) {
+    int end = screen_draw_text(screen, row, 0, text, attr);
+    if (attr == ATTR_NORMAL) {
+        screen_clear_row(screen, row, end);
+    } else {
+        for (int col = end; col < screen->cols; col++) {
+            screen_draw(screen, row, col, " ", &attr, 1);
         }
     }
-    return 0;
+    return end;
 }
-void print_syntax_highlighted(const char *line, int is_selected) {
-    if (is_selected) {
-        printf("\033[7m");
-    }   
-    char word[MAX_LINE_LENGTH];
-    int word_len = 0;
-    int in_string = 0;
-    int in_comment = 0;
-    for (int i = 0; line[i] != '\0'; i++) {
-        if (in_comment) {
-            if (is_selected) printf("%s", COLOR_RESET);
-            printf("%s%c", COLOR_COMMENT, line[i]);
-            if (is_selected) printf("\033[7m");
-            continue;
+static int draw_status_bar(Editor *editor, const char *message) {
+    Document *doc = editor->doc;
+    char status[256];
+    if (message) {
+        snprintf(status, sizeof(status), "%s", message);
+    } else if (editor->overlay) {
+        TraceSummary frame;
+        trace_summary(TRACE_RENDER, &frame);
+        snprintf(status, sizeof(status), "frame %.2f ms p99 %.2f max %.1f | %zu B, %.1f MB out"
+                 " | mem %.1f MB rss %.1f MB", frame.last_ns / 1e6, frame.p99_ns / 1e6,
+                 frame.max_ns / 1e6, editor->screen.frame_bytes,
+                 editor->screen.total_bytes / 1e6, editor_memory(editor) / 1e6,
+                 trace_resident() / 1e6);
+    } else {
+        int len = snprintf(status, sizeof(status), "%s - Ln %zu/%zu, Col %zu", doc->filename,
+                           doc->current_line + 1, buffer_line_count(doc->buffer),
+                           cursor_column(editor) + 1);
+        if (editor->document_count > 1 && len > 0 && (size_t)len < sizeof(status)) {
+            len += snprintf(status + len, sizeof(status) - len, "  [%zu/%zu]",
+                            document_index(editor, doc) + 1, editor->document_count);
         }
-        if (line[i] == '"' && !in_comment) {
-            if (is_selected) printf("%s", COLOR_RESET);
-            printf("%s%c", in_string ? COLOR_RESET : COLOR_STRING, line[i]);
-            if (is_selected) printf("\033[7m");
-            in_string = !in_string;
-            continue;
+        if (editor->pending_register && len > 0 && (size_t)len < sizeof(status)) {
+            snprintf(status + len, sizeof(status) - len, editor->pending_register < 0
+                     ? "  register?" : "  register %c", editor->pending_register);
         }
-        if (in_string) {
-            if (is_selected) printf("%s", COLOR_RESET);
-            printf("%s%c", COLOR_STRING, line[i]);
-            if (is_selected) printf("\033[7m");
-            continue;
+    }
+    return draw_status(&editor->screen, editor->screen.rows - 1, status, ATTR_SELECTED);
+}
+/* One row per open file: its number, name, length and the memory its arenas and caches hold. */
+static void draw_documents(Editor *editor) {
+    size_t rows = text_rows(editor);
+    for (size_t y = 0; y < rows; y++) {
+        char row[256] = "";
+        if (y < editor->document_count) {
+            Document *doc = editor->documents[y];
+            snprintf(row, sizeof(row), "%c%zu %-40s %10zu lines %8zu KB",
+                     doc == editor->doc ? '*' : ' ', y + 1, doc->filename,
+                     buffer_line_count(doc->buffer), document_memory(doc) >> 10);
         }
-        if (line[i] == '/' && line[i + 1] == '/') {
-            if (is_selected) printf("%s", COLOR_RESET);
-            printf("%s//", COLOR_COMMENT);
-            if (is_selected) printf("\033[7m");
-            in_comment = 1;
-            i++;
+        draw_status(&editor->screen, TEXT_ROW + y, row, ATTR_NORMAL);
+    }
+}
+static void draw_rows(Editor *editor) {
+    Document *doc = editor->doc;
+    Screen *screen = &editor->screen;
+    size_t line_count = buffer_line_count(doc->buffer);
+    size_t start_line = doc->selection_start_line;
+    size_t end_line = doc->selection_end_line;
+    size_t rows = text_rows(editor);
+    size_t match_count = matches_count(&doc->matches);
+    if (start_line > end_line) {
+        size_t temp = start_line;
+        start_line = end_line;
+        end_line = temp;
+    }
+    draw_status(screen, 0, "Editor - ESC twice to save, Ctrl+U/R undo/redo, Ctrl+E replace, "
+                "Ctrl+K changes", ATTR_NORMAL);
+    draw_status(screen, 1, "Ctrl+X copy, Ctrl+V paste, Ctrl+B selection, Ctrl+F find, "
+                "Ctrl+N/P next/prev", ATTR_NORMAL);
+    draw_status(screen, 2, "Ctrl+G line, Ctrl+T<a-z> register, Ctrl+Y older copy, "
+                "Ctrl+O/L/W open/list/close", ATTR_NORMAL);
+    if (editor->listing) {
+        draw_documents(editor);
+        return;
+    }
+    for (size_t y = 0; y < rows; y++) {
+        int row = TEXT_ROW + y;
+        size_t i = doc->row_offset + y;
+        size_t len, at, from, to;
+        int col = 0;
+        if (i >= line_count) {
+            screen_clear_row(screen, row, 0);
             continue;
         }
-        if ((line[i] >= 'a' && line[i] <= 'z') || 
-            (line[i] >= 'A' && line[i] <= 'Z') || 
-            (line[i] == '_')) {
-            word[word_len++] = line[i];
+        if (doc->col_offset == 0) {
+            from = at = 0;
+            to = (size_t)screen->cols * UTF8_MAX;
         } else {
-            word[word_len] = '\0';
-            if (word_len > 0) {
-                if (is_keyword(word)) {
-                    if (is_selected) printf("%s", COLOR_RESET);
-                    printf("%s%s%s", COLOR_KEYWORD, word, COLOR_RESET);
-                    if (is_selected) printf("\033[7m");
-                } else {
-                    printf("%s", word);
+            from = columns_byte(&doc->columns, i, doc->col_offset, &at);
+            to = columns_byte(&doc->columns, i, doc->col_offset + screen->cols, NULL);
+        }
+        const char *line = get_line(editor, i, to, &len);
+        size_t span_count;
+        const SyntaxSpan *spans = syntax_line(&doc->syntax, i, &span_count);
+        if (len > editor->attrs_cap) {
+            editor->attrs_cap = len;
+            editor->attrs = realloc(editor->attrs, len);
+        }
+        syntax_fill(spans, span_count, editor->attrs, len);
+        if (doc->selection_mode && i >= start_line && i <= end_line) {
+            for (size_t j = 0; j < len; j++) editor->attrs[j] |= ATTR_SELECTED;
+        }
+        if (match_count) {
+            size_t start = buffer_line_start(doc->buffer, i);
+            for (size_t m = matches_find(&doc->matches, start); m < match_count; m++) {
+                MatchSpan span = matches_get(&doc->matches, m);
+                if (span.start - start >= len) break;
+                for (size_t j = span.start - start; j < span.start - start + span.length && j < len;
+                     j++) {
+                    editor->attrs[j] = (editor->attrs[j] & ATTR_SELECTED) | ATTR_MATCH;
                 }
             }
-            printf("%c", line[i]);
-            word_len = 0;
         }
+        if (editor->match_active && i == editor->match_line) {
+            size_t end = editor->match_col + editor->match_length;
+            for (size_t j = editor->match_col; j < end && j < len; j++) {
+                editor->attrs[j] |= ATTR_SELECTED;
+            }
+        }
+        if (at < doc->col_offset) {
+            /* The right half of a double-width character scrolled partly out of view. */
+            from = columns_byte(&doc->columns, i, doc->col_offset + 1, NULL);
+            col = screen_draw(screen, row, 0, " ", NULL, 1);
+        }
+        if (len > from) {
+            col = screen_draw(screen, row, col, line + from, editor->attrs + from, len - from);
+        }
+        screen_clear_row(screen, row, col);
     }
-    if (word_len > 0) {
-        word[word_len] = '\0';
-        if (is_keyword(word)) {
-            if (is_selected) printf("%s", COLOR_RESET);
-            printf("%s%s%s", COLOR_KEYWORD, word, COLOR_RESET);
-            if (is_selected) printf("\033[7m");
-        } else {
-            printf("%s", word);
+}
+void refresh_screen(Editor *editor) {
+    Document *doc = editor->doc;
+    long long start = trace_begin();
+    screen_update_size(&editor->screen);
+    scroll(editor);
+    draw_rows(editor);
+    draw_status_bar(editor, editor->status);
+    screen_set_cursor(&editor->screen, doc->current_line - doc->row_offset + TEXT_ROW,
+                      cursor_column(editor) - doc->col_offset);
+    screen_flush(&editor->screen);
+    trace_end(TRACE_RENDER, start);
+    trace_counter(TRACE_FRAME_BYTES, editor->screen.frame_bytes);
+    trace_counter(TRACE_MEMORY, editor_memory(editor));
+}
+static void draw_prompt(Editor *editor, const char *message) {
+    int end;
+    screen_update_size(&editor->screen);
+    scroll(editor);
+    draw_rows(editor);
+    end = draw_status_bar(editor, message);
+    screen_set_cursor(&editor->screen, editor->screen.rows - 1,
+                      end < editor->screen.cols ? end : editor->screen.cols - 1);
+    screen_flush(&editor->screen);
+}
+/* A key that types a character rather than running a command. */
+static int is_text_key(int ch) {
+    return (ch >= 32 && ch <= 126) || (ch >= 0xA0 && ch < ARROW_UP);
+}
+/* Reads a line on the status bar; update, if given, sees the input after every key. */
+static int prompt(Editor *editor, const char *label, char *input, size_t size,
+                  void (*update)(Editor *, const char *, int)) {
+    size_t len = strlen(input);
+    while (1) {
+        char message[256];
+        editor_collect(editor);
+        snprintf(message, sizeof(message), "%s%s%s%s", label, input, editor->status ? "  " : "",
+                 editor->status ? editor->status : "");
+        draw_prompt(editor, message);
+        int ch = input_read_key(&editor->input, -1);
+        if (ch == 10 || ch == KEY_EOF) {
+            return 1;
+        } else if (ch == 27) {
+            return 0;
+        } else if ((ch == 127 || ch == 8) && len > 0) {
+            len = utf8_prev(input, len);
+            input[len] = '\0';
+        } else if (is_text_key(ch) && len + UTF8_MAX < size) {
+            len += utf8_encode(ch, input + len);
+            input[len] = '\0';
         }
+        if (update && ch != KEY_NONE) update(editor, input, ch);
     }
-    if (is_selected) {
-        printf("%s", COLOR_RESET);
+}
+/* Shows a question on the status bar and returns the next key. */
+static int ask(Editor *editor, const char *question) {
+    while (1) {
+        char message[256];
+        editor_collect(editor);
+        snprintf(message, sizeof(message), "%s%s%s", question, editor->status ? "  " : "",
+                 editor->status ? editor->status : "");
+        draw_prompt(editor, message);
+        int ch = input_read_key(&editor->input, -1);
+        if (ch != KEY_NONE) return ch;
     }
 }
-void save_state(Editor *editor) {
-    if (editor->undo_count >= MAX_UNDO) {
-        memmove(editor->undo_stack, editor->undo_stack + 1, 
-                (MAX_UNDO - 1) * sizeof(EditorState));
-        editor->undo_count--;
-    }   
-    EditorState *state = &editor->undo_stack[editor->undo_count];
-    memcpy(state->lines, editor->lines, sizeof(editor->lines));
-    state->line_count = editor->line_count;
-    state->cursor_line = editor->current_line;
-    state->cursor_col = editor->current_col;
-    editor->undo_count++;
-    editor->redo_count = 0;
+/*
+ * Moves to the next match after the cursor (direction 1), before it (-1),
+ * or at it (0), from the match set.  Returns 1 if found, 2 if found after
+ * wrapping around, 0 if not, and -1 if the scan has not got that far yet;
+ * the step is then taken again by editor_collect() as matches come in.
+ */
+static int find_step(Editor *editor, int direction) {
+    Document *doc = editor->doc;
+    size_t pos = cursor_pos(editor), count, index, scanned;
+    int wrapped = 0;
+    MatchSpan span;
+    editor->find_pending = 0;
+    if (!editor->find) return 0;
+    if (!doc->matches.regex) matches_reset(&doc->matches, editor->find);
+    count = matches_count(&doc->matches);
+    scanned = matches_scanned(&doc->matches);
+    if (direction < 0) {
+        index = matches_find(&doc->matches, pos);
+        wrapped = index == 0;
+    } else {
+        index = matches_find(&doc->matches, pos + (direction > 0));
+        wrapped = index == count;
+    }
+    if (scanned < (wrapped ? SIZE_MAX : direction < 0 ? pos : 0)) {
+        editor->find_pending = 1;
+        editor->find_direction = direction;
+        editor->match_active = 0;
+        editor->status = "searching...";
+        return -1;
+    }
+    editor->match_active = count != 0;
+    if (count == 0) {
+        editor->status = "not found";
+        return 0;
+    }
+    if (direction < 0) {
+        index = (wrapped ? count : index) - 1;
+    } else if (wrapped) {
+        index = 0;
+    }
+    span = matches_get(&doc->matches, index);
+    set_cursor_pos(editor, span.start);
+    editor->match_line = doc->current_line;
+    editor->match_col = doc->current_col;
+    editor->match_length = span.length;
+    snprintf(editor->message, sizeof(editor->message), "match %zu of %zu%s%s", index + 1, count,
+             scanned < SIZE_MAX ? " so far" : "", wrapped ? ", search wrapped" : "");
+    editor->status = editor->message;
+    return 1 + wrapped;
 }
-void undo(Editor *editor) {
-    if (editor->undo_count <= 0) return;   
-    if (editor->redo_count < MAX_UNDO) {
-        EditorState *redo_state = &editor->redo_stack[editor->redo_count++];
-        memcpy(redo_state->lines, editor->lines, sizeof(editor->lines));
-        redo_state->line_count = editor->line_count;
-        redo_state->cursor_line = editor->current_line;
-        redo_state->cursor_col = editor->current_col;
-    }
-    editor->undo_count--;
-    EditorState *state = &editor->undo_stack[editor->undo_count];
-    memcpy(editor->lines, state->lines, sizeof(editor->lines));
-    editor->line_count = state->line_count;
-    editor->current_line = state->cursor_line;
-    editor->current_col = state->cursor_col;
+/* Steps as find_step() does, scanning the rest of the buffer first if the step needs it. */
+static int find_wait(Editor *editor, int direction) {
+    int found = find_step(editor, direction);
+    if (found >= 0) return found;
+    matches_finish(&editor->doc->matches);
+    return find_step(editor, direction);
 }
-void redo(Editor *editor) {
-    if (editor->redo_count <= 0) return;   
-    if (editor->undo_count < MAX_UNDO) {
-        EditorState *undo_state = &editor->undo_stack[editor->undo_count++];
-        memcpy(undo_state->lines, editor->lines, sizeof(editor->lines));
-        undo_state->line_count = editor->line_count;
-        undo_state->cursor_line = editor->current_line;
-        undo_state->cursor_col = editor->current_col;
-    }
-    editor->redo_count--;
-    EditorState *state = &editor->redo_stack[editor->redo_count];
-    memcpy(editor->lines, state->lines, sizeof(editor->lines));
-    editor->line_count = state->line_count;
-    editor->current_line = state->cursor_line;
-    editor->current_col = state->cursor_col;
+/*
+ * Searches again from where find started each time the pattern changes;
+ * while more keys are already waiting the pattern is only compiled, so
+ * typing ahead does not rescan the buffer for every key.
+ */
+static void find_update(Editor *editor, const char *input, int key) {
+    const char *error = NULL;
+    if (key == 14 || key == 16) {
+        find_step(editor, key == 14 ? 1 : -1);
+        return;
+    }
+    if (strcmp(input, editor->find_text) == 0) return;
+    snprintf(editor->find_text, sizeof(editor->find_text), "%s", input);
+    matches_reset(&editor->doc->matches, NULL);
+    editor->find_pending = 0;
+    re_free(editor->find);
+    editor->find = NULL;
+    editor->match_active = 0;
+    editor->status = NULL;
+    set_cursor_pos(editor, editor->find_origin);
+    if (!input[0]) return;
+    editor->find = re_compile(input, 0, &error);
+    if (!editor->find) {
+        editor->status = error;
+        return;
+    }
+    if (!input_pending(&editor->input)) find_step(editor, 0);
 }
-void copy_selection(Editor *editor) {
-    if (!editor->selection_mode) return;   
-    int start_line = editor->selection_start_line;
-    int start_col = editor->selection_start_col;
-    int end_line = editor->selection_end_line;
-    int end_col = editor->selection_end_col;
-    if (start_line > end_line || (start_line == end_line && start_col > end_col)) {
-        int temp = start_line;
-        start_line = end_line;
-        end_line = temp;
-        temp = start_col;
-        start_col = end_col;
-        end_col = temp;
+/*
+ * Incremental regex search on the status bar, with every match shown.
+ * Enter stays on the match and keeps the matches shown until the next
+ * ESC; ESC goes back.  Returns 1 if there is a match, or one may still
+ * turn up.
+ */
+static int find(Editor *editor, const char *label) {
+    Document *doc = editor->doc;
+    char input[sizeof(editor->find_text)];
+    snprintf(input, sizeof(input), "%s", editor->find_text);
+    editor->find_origin = cursor_pos(editor);
+    editor->status = NULL;
+    if (editor->find) find_step(editor, 0);
+    if (!prompt(editor, label, input, sizeof(input), find_update)) {
+        set_cursor_pos(editor, editor->find_origin);
+        editor->match_active = 0;
+        editor->find_pending = 0;
+        matches_reset(&doc->matches, NULL);
+        editor->status = NULL;
+        return 0;
     }
-    int clipboard_pos = 0;
-    for (int i = start_line; i <= end_line && clipboard_pos < CLIPBOARD_SIZE - 1; i++) {
-        int col_start = (i == start_line) ? start_col : 0;
-        int col_end = (i == end_line) ? end_col : strlen(editor->lines[i]);
-        for (int j = col_start; j < col_end && clipboard_pos < CLIPBOARD_SIZE - 1; j++) {
-            editor->clipboard[clipboard_pos++] = editor->lines[i][j];
+    if (editor->find && !doc->matches.regex) find_step(editor, 0);
+    if (!editor->find_pending) editor->status = NULL;
+    return editor->match_active || editor->find_pending;
+}
+/* Replaces the match at the cursor; the delete and insert are one undo step. */
+static void replace_match(Editor *editor, const char *with) {
+    Document *doc = editor->doc;
+    size_t start = cursor_pos(editor);
+    undo_begin_group(&doc->history);
+    if (editor->match_length) edit_delete(editor, start, editor->match_length);
+    if (with[0]) edit_insert(editor, start, with, strlen(with));
+    undo_end_group(&doc->history);
+}
+/*
+ * Replaces every match at once: the text from the first match to the end
+ * of the last is rebuilt in one pass and swapped in with a single delete
+ * and insert, so it is one undo step however many matches there are.
+ * The match set is emptied first rather than rescanned after the edit.
+ */
+static void replace_all(Editor *editor, const char *with) {
+    Document *doc = editor->doc;
+    size_t count, start, end, len;
+    char *text = matches_substitute(&doc->matches, with, strlen(with), &start, &end, &len);
+    if (!text) return;
+    count = matches_count(&doc->matches);
+    matches_reset(&doc->matches, NULL);
+    undo_begin_group(&doc->history);
+    edit_delete(editor, start, end - start);
+    if (len) edit_insert(editor, start, text, len);
+    undo_end_group(&doc->history);
+    free(text);
+    set_cursor_pos(editor, start);
+    snprintf(editor->message, sizeof(editor->message), "replaced %zu matches", count);
+    editor->status = editor->message;
+}
+/* Find, then go through the matches from the cursor asking what to do with each. */
+static void replace(Editor *editor) {
+    char with[256] = "";
+    int found = 0;
+    if (!find(editor, "Replace: ")) return;
+    if (!prompt(editor, "With: ", with, sizeof(with), NULL)) return;
+    if (editor->find_pending && find_wait(editor, editor->find_direction) <= 0) return;
+    editor->status = editor->message;
+    do {
+        int ch = ask(editor, "Replace? (y)es, (n)o, (a)ll, ESC to stop");
+        if (ch == 'a') {
+            replace_all(editor, with);
+            break;
+        } else if (ch == 'y') {
+            int empty = editor->match_length == 0;
+            replace_match(editor, with);
+            found = find_wait(editor, empty);
+        } else if (ch == 'n') {
+            found = find_wait(editor, 1);
+        } else {
+            editor->status = NULL;
+            break;
         }
-        if (i < end_line && clipboard_pos < CLIPBOARD_SIZE - 1) {
-            editor->clipboard[clipboard_pos++] = '\n';
+    } while (found == 1);
+    editor->match_active = 0;
+}
+/* Pages through text on the whole screen until ESC; diff lines are coloured by their sign. */
+static void page_text(Editor *editor, const char *title, const char *text, size_t len) {
+    Screen *screen = &editor->screen;
+    size_t *starts = malloc(257 * sizeof(size_t)), lines = 0, cap = 256, top = 0;
+    const char *p = text, *end = text + len;
+    int diff_header = len > 4 && memcmp(text, "--- ", 4) == 0;
+    while (p < end) {
+        const char *newline = memchr(p, '\n', end - p);
+        if (lines == cap) {
+            cap *= 2;
+            starts = realloc(starts, (cap + 1) * sizeof(size_t));
         }
+        starts[lines++] = p - text;
+        p = newline ? newline + 1 : end;
     }
-    editor->clipboard[clipboard_pos] = '\0';
-}
-void refresh_screen(Editor *editor) {
-    clear_screen();   
-    printf("Editor - ESC(2 times) to save, Ctrl+U for undo, Ctrl+R for redo\n");
-    printf("Ctrl+X to copy, Ctrl+V to paste, Ctrl+B to start/end selection\n\n");
-    if (editor->line_count == 0) {
-        editor->line_count = 1;
-        editor->lines[0][0] = '\0';
-    }
-    for (int i = 0; i < editor->line_count; i++) {
-        int is_selected = 0;
-        if (editor->selection_mode) {
-            int start_line = editor->selection_start_line;
-            int end_line = editor->selection_end_line;
-            if (start_line > end_line) {
-                int temp = start_line;
-                start_line = end_line;
-                end_line = temp;
-            }
-            if (i >= start_line && i <= end_line) {
-                is_selected = 1;
+    starts[lines] = len;
+    while (1) {
+        char status[128];
+        size_t rows;
+        editor_collect(editor);
+        screen_update_size(screen);
+        rows = screen->rows > 2 ? screen->rows - 2 : 1;
+        draw_status(screen, 0, title, ATTR_SELECTED);
+        for (size_t y = 0; y < rows; y++) {
+            size_t i = top + y, n = 0;
+            int col = 0;
+            if (i < lines) {
+                const char *line = text + starts[i];
+                unsigned char attr = i < 2 && diff_header ? ATTR_KEYWORD
+                                   : line[0] == '+' ? ATTR_INSERTED
+                                   : line[0] == '-' ? ATTR_DELETED
+                                   : line[0] == '@' ? ATTR_COMMENT : ATTR_NORMAL;
+                n = starts[i + 1] - starts[i];
+                if (line[n - 1] == '\n') n--;
+                if (n > (size_t)screen->cols * UTF8_MAX) n = (size_t)screen->cols * UTF8_MAX;
+                if (n > editor->attrs_cap) {
+                    editor->attrs_cap = n;
+                    editor->attrs = realloc(editor->attrs, n);
+                }
+                memset(editor->attrs, attr, n);
+                col = screen_draw(screen, 1 + y, 0, line, editor->attrs, n);
             }
-        }   
-        print_syntax_highlighted(editor->lines[i], is_selected);
-        if (i < editor->line_count - 1 && 
-            (strlen(editor->lines[i]) == 0 || 
-             editor->lines[i][strlen(editor->lines[i]) - 1] != '\n')) {
-            printf("\n");
+            screen_clear_row(screen, 1 + y, col);
+        }
+        snprintf(status, sizeof(status), "Ln %zu/%zu - arrows, PgUp/PgDn to scroll, ESC to go back",
+                 top + 1, lines);
+        draw_status(screen, screen->rows - 1, status, ATTR_SELECTED);
+        screen_set_cursor(screen, screen->rows - 1, 0);
+        screen_flush(screen);
+        int ch = input_read_key(&editor->input, -1);
+        size_t last = lines > rows ? lines - rows : 0;
+        if (ch == KEY_ESC || ch == KEY_EOF) {
+            break;
+        } else if (ch == ARROW_UP && top > 0) {
+            top--;
+        } else if (ch == ARROW_DOWN && top < last) {
+            top++;
+        } else if (ch == PAGE_UP) {
+            top = top > rows ? top - rows : 0;
+        } else if (ch == PAGE_DOWN) {
+            top = top + rows < last ? top + rows : last;
+        } else if (ch == HOME_KEY) {
+            top = 0;
+        } else if (ch == END_KEY) {
+            top = last;
         }
     }
-    move_cursor(editor->current_line + 4, editor->current_col + 1);
-    fflush(stdout);
+    free(starts);
 }
-void paste_text(Editor *editor) {
-    if (!editor->clipboard[0]) return;   
-    save_state(editor);
-    editor->selection_mode = 0;
-    char temp_buffer[CLIPBOARD_SIZE];
-    strcpy(temp_buffer, editor->clipboard);
-    char *line = strtok(temp_buffer, "\n");
-    int first_line = 1;
-    while (line != NULL) {
-        if (!first_line) {
-            if (editor->line_count < MAX_LINES - 1) {
-                for (int i = editor->line_count; i > editor->current_line + 1; i--) {
-                    strcpy(editor->lines[i], editor->lines[i-1]);
-                }
-                editor->line_count++;
-                editor->current_line++;
-                editor->current_col = 0;
-            }
+/* Diffs the file on disk against the buffer; a file not written yet counts as empty. */
+static int diff_document(Document *doc, Diff *diff, char **disk, char **text) {
+    size_t disk_len = 0, len = buffer_length(doc->buffer);
+    long long start = trace_begin();
+    *disk = diff_read_file(doc->filename, &disk_len);
+    trace_end(TRACE_IO, start);
+    if (!*disk && errno != ENOENT) return -1;
+    *text = malloc(len ? len : 1);
+    len = buffer_read(doc->buffer, 0, len, *text);
+    if (diff_compute(diff, *disk ? *disk : "", disk_len, *text, len) < 0) {
+        free(*disk);
+        free(*text);
+        return -1;
+    }
+    return 0;
+}
+/* Shows what saving would change, as a unified diff of the file on disk against the buffer. */
+static void show_changes(Editor *editor) {
+    Document *doc = editor->doc;
+    char *disk, *text, *out = NULL, title[256];
+    size_t out_len = 0;
+    Diff diff;
+    if (diff_document(doc, &diff, &disk, &text) < 0) {
+        snprintf(editor->message, sizeof(editor->message), "Cannot compare with %s: %s",
+                 doc->filename, strerror(errno));
+        editor->status = editor->message;
+        return;
+    }
+    if (diff.count == 0) {
+        editor->status = "No unsaved changes";
+    } else {
+        FILE *stream = open_memstream(&out, &out_len);
+        if (stream) {
+            diff_write(&diff, stream, doc->filename, "(unsaved)", DIFF_CONTEXT);
+            fclose(stream);
         }
-        int available_space = MAX_LINE_LENGTH - 1 - editor->current_col;
-        int line_len = strlen(line);
-        if (line_len > available_space) {
-            line_len = available_space;
-        }
-        if (!first_line || editor->current_col < strlen(editor->lines[editor->current_line])) {
-            memmove(&editor->lines[editor->current_line][editor->current_col + line_len],
-                   &editor->lines[editor->current_line][editor->current_col],
-                   strlen(&editor->lines[editor->current_line][editor->current_col]) + 1);
-        }
-        strncpy(&editor->lines[editor->current_line][editor->current_col], line, line_len);
-        editor->current_col += line_len;
-        first_line = 0;
-        line = strtok(NULL, "\n");
-    }    
-    editor->lines[editor->current_line][MAX_LINE_LENGTH - 1] = '\0';
-    clear_screen();
-    refresh_screen(editor);
+        snprintf(title, sizeof(title), "Unsaved changes to %s: %zu lines removed, %zu added",
+                 doc->filename, diff.deleted, diff.inserted);
+        if (out_len) page_text(editor, title, out, out_len);
+        free(out);
+    }
+    diff_free(&diff);
+    free(disk);
+    free(text);
+}
+static void go_to_line(Editor *editor, size_t line) {
+    Document *doc = editor->doc;
+    size_t line_count = buffer_line_count(doc->buffer);
+    size_t rows = text_rows(editor);
+    if (line >= line_count) line = line_count - 1;
+    doc->current_line = line;
+    doc->current_col = 0;
+    doc->col_offset = 0;
+    doc->row_offset = line > rows / 2 ? line - rows / 2 : 0;
+}
+static void page(Editor *editor, int direction) {
+    Document *doc = editor->doc;
+    size_t rows = text_rows(editor);
+    size_t line_count = buffer_line_count(doc->buffer);
+    if (direction < 0) {
+        doc->current_line = doc->current_line > rows ? doc->current_line - rows : 0;
+        doc->row_offset = doc->row_offset > rows ? doc->row_offset - rows : 0;
+    } else {
+        doc->current_line = doc->current_line + rows < line_count
+            ? doc->current_line + rows : line_count - 1;
+        if (doc->row_offset + rows < line_count) doc->row_offset += rows;
+    }
+    size_t line_len = line_length(editor, doc->current_line);
+    if (doc->current_col > line_len) doc->current_col = line_len;
+}
+static void paste_input(Editor *editor) {
+    Document *doc = editor->doc;
+    doc->selection_mode = 0;
+    undo_break(&doc->history);
+    edit_insert(editor, cursor_pos(editor), editor->input.paste, editor->input.paste_len);
+    undo_break(&doc->history);
+}
+/* Splices a clip in at the cursor chunk by chunk; the whole paste is one undo record. */
+static void insert_clip(Editor *editor, size_t pos, const Clip *clip) {
+    for (const ClipChunk *chunk = clip->head; chunk; chunk = chunk->next) {
+        edit_insert(editor, pos, chunk->data, chunk->length);
+        pos += chunk->length;
+    }
+    editor->doc->paste_length = clip->length;
+    editor->doc->just_pasted = 1;
+}
+void paste_text(Editor *editor) {
+    Document *doc = editor->doc;
+    const Clip *clip = clipboard_get(&editor->clipboard, editor->pending_register);
+    editor->pending_register = 0;
+    if (!clip || clip->length == 0) return;
+    doc->selection_mode = 0;
+    doc->paste_start = cursor_pos(editor);
+    undo_begin_group(&doc->history);
+    insert_clip(editor, doc->paste_start, clip);
+    undo_end_group(&doc->history);
+}
+/* Replaces the text just pasted with the next older kill ring entry. */
+static void paste_older(Editor *editor) {
+    Document *doc = editor->doc;
+    const Clip *clip = clipboard_cycle(&editor->clipboard);
+    if (!clip) return;
+    undo_begin_group(&doc->history);
+    edit_delete(editor, doc->paste_start, doc->paste_length);
+    insert_clip(editor, doc->paste_start, clip);
+    undo_end_group(&doc->history);
 }
 void handle_delete_key(Editor *editor) {
-    save_state(editor);   
-    int current_line_length = strlen(editor->lines[editor->current_line]);
-    if (editor->current_col < current_line_length) {
-        memmove(editor->lines[editor->current_line] + editor->current_col,
-                editor->lines[editor->current_line] + editor->current_col + 1,
-                current_line_length - editor->current_col);
-    } 
-    else if (editor->current_line < editor->line_count - 1) {
-        current_line_length = strlen(editor->lines[editor->current_line]);
-        if (current_line_length > 0 && 
-            editor->lines[editor->current_line][current_line_length - 1] == '\n') {
-            editor->lines[editor->current_line][current_line_length - 1] = '\0';
-            current_line_length--;
-        }
-        strcat(editor->lines[editor->current_line], editor->lines[editor->current_line + 1]);        
-        for (int i = editor->current_line + 1; i < editor->line_count - 1; i++) {
-            strcpy(editor->lines[i], editor->lines[i + 1]);
-        }
-        editor->line_count--;
+    size_t pos = cursor_pos(editor);
+    if (pos < buffer_length(editor->doc->buffer)) {
+        edit_delete(editor, pos, step_char(editor, 1) - pos);
     }
 }
-void editor(const char *filename) {
-    Editor editor = {0};
-    editor.lines[0][0] = '\0';
-    editor.line_count = 1;
-
-    FILE *file = fopen(filename, "r");
+static Document *open_document(Editor *editor, const char *filename, int *status) {
+    Document *doc = calloc(1, sizeof(Document));
+    const char *budget = getenv("EDITOR_UNDO_BUDGET_MB");
+    long long start;
+    FILE *file;
+    if (!doc) return NULL;
+    doc->filename = strdup(filename);
+    doc->buffer = buffer_new();
+    undo_init(&doc->history,
+              budget ? (size_t)strtoul(budget, NULL, 10) << 20 : UNDO_DEFAULT_BUDGET);
+    *status = 0;
+    start = trace_begin();
+    file = fopen(filename, "r");
     if (file) {
-        while (fgets(editor.lines[editor.line_count], MAX_LINE_LENGTH, file) && 
-               editor.line_count < MAX_LINES) {
-            editor.line_count++;
-        }
+        *status = buffer_load(doc->buffer, file);
         fclose(file);
     }
-    printf("Editor - ESC(2 times) to save, Ctrl+U for undo, Ctrl+R for redo\n");
-    printf("Ctrl+X to copy, Ctrl+V to paste, Ctrl+B to start/end selection\n");
+    doc->recovered = journal_open(&doc->journal, filename, doc->buffer);
+    /* Recovered edits are not in the history, so it would no longer line up with the buffer. */
+    if (doc->recovered <= 0) undo_open_history(&doc->history, filename);
+    trace_end(TRACE_IO, start);
+    doc->watch = watch_add(&editor->watch, filename);
+    syntax_init(&doc->syntax, doc->buffer, language_for_file(filename));
+    matches_init(&doc->matches, doc->buffer);
+    columns_init(&doc->columns, doc->buffer);
+    syntax_background(&doc->syntax, editor->pool);
+    matches_background(&doc->matches, editor->pool);
+    if (editor->document_count == editor->document_cap) {
+        editor->document_cap = editor->document_cap ? editor->document_cap * 2 : 4;
+        editor->documents = realloc(editor->documents,
+                                    editor->document_cap * sizeof(Document *));
+    }
+    editor->documents[editor->document_count++] = doc;
+    return doc;
+}
+/* The undo history is kept for the next session only if the file was saved with the buffer. */
+static void free_document(Document *doc) {
+    if (doc->journal.path && !doc->journal.dirty) undo_save_history(&doc->history, doc->filename);
+    journal_close(&doc->journal);
+    syntax_free(&doc->syntax);
+    matches_free(&doc->matches);
+    columns_free(&doc->columns);
+    undo_free(&doc->history);
+    buffer_free(doc->buffer);
+    free(doc->filename);
+    free(doc);
+}
+static int save_document(Document *doc) {
+    long long start = trace_begin();
+    int result = buffer_save(doc->buffer, doc->filename);
+    if (result >= 0) {
+        journal_saved(&doc->journal, doc->filename);
+        doc->disk_changed = 0;
+    }
+    trace_end(TRACE_IO, start);
+    return result < 0 ? -1 : 0;
+}
+/* Makes doc current; the find highlights belong to the one being left. */
+static void switch_document(Editor *editor, Document *doc) {
+    if (doc == editor->doc) return;
+    matches_reset(&editor->doc->matches, NULL);
+    editor->match_active = 0;
+    editor->doc = doc;
+}
+/*
+ * Saves and closes the current file and goes to the one before it.
+ * Closing the last one returns 1, leaving it to be saved on the way out.
+ */
+static int close_current(Editor *editor) {
+    Document *doc = editor->doc;
+    size_t i = document_index(editor, doc);
+    if (editor->document_count == 1) return 1;
+    if (save_document(doc) < 0) {
+        snprintf(editor->message, sizeof(editor->message),
+                 "Failed to save %s; it stays open", doc->filename);
+        editor->status = editor->message;
+        return 0;
+    }
+    switch_document(editor, editor->documents[i > 0 ? i - 1 : 1]);
+    memmove(editor->documents + i, editor->documents + i + 1,
+            (editor->document_count - i - 1) * sizeof(Document *));
+    editor->document_count--;
+    watch_remove(&editor->watch, doc->watch);
+    free_document(doc);
+    return 0;
+}
+static void open_file(Editor *editor) {
+    char input[256] = "";
+    Document *doc;
+    int status;
+    if (!prompt(editor, "Open: ", input, sizeof(input), NULL) || !input[0]) return;
+    for (size_t i = 0; i < editor->document_count; i++) {
+        if (strcmp(editor->documents[i]->filename, input) == 0) {
+            switch_document(editor, editor->documents[i]);
+            return;
+        }
+    }
+    doc = open_document(editor, input, &status);
+    if (!doc) return;
+    switch_document(editor, doc);
+    if (status < 0) {
+        snprintf(editor->message, sizeof(editor->message), "Failed to read %s", input);
+    } else if (doc->recovered > 0) {
+        snprintf(editor->message, sizeof(editor->message),
+                 "Recovered %d unsaved edits from %s", doc->recovered, doc->journal.path);
+    } else {
+        snprintf(editor->message, sizeof(editor->message), "%s: %zu lines", input,
+                 buffer_line_count(doc->buffer));
+    }
+    editor->status = editor->message;
+}
+/* Lists the open files with the memory each one holds, then switches to the one picked. */
+static void list_documents(Editor *editor) {
+    editor->listing = 1;
+    int ch = ask(editor, "Switch to buffer (1-9), any other key to stay");
+    editor->listing = 0;
+    if (ch >= '1' && ch <= '9' && (size_t)(ch - '1') < editor->document_count) {
+        switch_document(editor, editor->documents[ch - '1']);
+    }
+}
+void editor_close(Editor *editor) {
+    for (size_t i = 0; i < editor->document_count; i++) {
+        free_document(editor->documents[i]);
+    }
+    free(editor->documents);
+    watch_free(&editor->watch);
+    clipboard_free(&editor->clipboard);
+    re_free(editor->find);
+    input_free(&editor->input);
+    screen_free(&editor->screen);
+    free(editor->line);
+    free(editor->attrs);
+}
+int editor_open(Editor *editor, const char *filename) {
+    int status;
+    memset(editor, 0, sizeof(Editor));
+    editor->last_key = KEY_NONE;
+    editor->pool = pool_default();
+    watch_init(&editor->watch);
+    editor->doc = open_document(editor, filename, &status);
+    return editor->doc ? status : -1;
+}
+void editor_attach(Editor *editor, int in_fd, int out_fd) {
+    input_init(&editor->input, in_fd);
+    input_watch(&editor->input, pool_fd(editor->pool));
+    input_watch(&editor->input, watch_fd(&editor->watch));
+    screen_init(&editor->screen, out_fd, SCREEN_ROWS, SCREEN_COLS);
+}
+/*
+ * Replaces removed bytes at pos with text for an edit made outside the
+ * editor, which moves the cursor only as far as the text around it moves.
+ */
+static void external_edit(Document *doc, size_t pos, size_t removed, const char *text,
+                          size_t len, size_t *cursor) {
+    size_t before = *cursor;
+    char *old = removed ? malloc(removed) : NULL;
+    if (removed && !old) return;
+    doc->just_pasted = 0;
+    if (*cursor >= pos + removed) {
+        *cursor = *cursor - removed + len;
+    } else if (*cursor > pos) {
+        *cursor = pos;
+    }
+    if (removed) {
+        removed = buffer_read(doc->buffer, pos, removed, old);
+        buffer_delete(doc->buffer, pos, removed);
+        undo_record(&doc->history, UNDO_DELETE, pos, old, removed, before, *cursor);
+        free(old);
+    }
+    if (len) {
+        buffer_insert(doc->buffer, pos, text, len);
+        undo_record(&doc->history, UNDO_INSERT, pos, text, len, before, *cursor);
+    }
+}
+/*
+ * Whether the file holds the buffer followed by more: judged as tail -f
+ * does by its size, and also by the last few KB before the old end.
+ */
+static int grew(Document *doc, int fd, size_t len, size_t size) {
+    char disk[RELOAD_CHECK], text[RELOAD_CHECK];
+    size_t n = len < RELOAD_CHECK ? len : RELOAD_CHECK;
+    if (size <= len || pread(fd, disk, n, len - n) != (ssize_t)n) return 0;
+    return buffer_read(doc->buffer, len - n, n, text) == n && memcmp(disk, text, n) == 0;
+}
+/*
+ * Brings a document with no unsaved edits up to date with its file, as
+ * one undo step.  A file that only grew has just its new tail read and
+ * appended; any other rewrite is diffed against the buffer and only the
+ * lines that differ are replaced, from the last so that the positions of
+ * the ones before stay put.
+ */
+static int reload_document(Editor *editor, Document *doc, size_t size) {
+    size_t len = buffer_length(doc->buffer);
+    size_t cursor = buffer_pos(doc->buffer, doc->current_line, doc->current_col);
+    long long start = trace_begin();
+    int fd = open(doc->filename, O_RDONLY);
+    if (fd < 0) return -1;
+    undo_break(&doc->history);
+    undo_begin_group(&doc->history);
+    if (grew(doc, fd, len, size)) {
+        char *tail = malloc(size - len);
+        ssize_t n = tail ? pread(fd, tail, size - len, len) : -1;
+        trace_end(TRACE_IO, start);
+        if (n > 0) external_edit(doc, len, 0, tail, n, &cursor);
+        free(tail);
+    } else {
+        char *disk, *text;
+        Diff diff;
+        int result = diff_document(doc, &diff, &disk, &text);
+        trace_end(TRACE_IO, start);
+        if (result == 0 && !disk) {
+            diff_free(&diff);
+            free(text);
+        }
+        if (result < 0 || !disk) {
+            undo_end_group(&doc->history);
+            close(fd);
+            return -1;
+        }
+        for (size_t i = diff.count; i-- > 0;) {
+            const DiffChange *change = &diff.changes[i];
+            size_t pos = diff.b.starts[change->b], from = diff.a.starts[change->a];
+            external_edit(doc, pos, diff.b.starts[change->b + change->b_count] - pos,
+                          disk + from, diff.a.starts[change->a + change->a_count] - from,
+                          &cursor);
+        }
+        snprintf(editor->message, sizeof(editor->message),
+                 "%s changed on disk: %zu lines removed, %zu added", doc->filename,
+                 diff.inserted, diff.deleted);
+        editor->status = editor->message;
+        diff_free(&diff);
+        free(disk);
+        free(text);
+    }
+    undo_end_group(&doc->history);
+    close(fd);
+    doc->current_line = buffer_line_of(doc->buffer, cursor);
+    doc->current_col = cursor - buffer_line_start(doc->buffer, doc->current_line);
+    return 0;
+}
+/*
+ * Looks at the file of doc after an event for it.  Its own saves leave it
+ * as the journal last saw it; otherwise a clean buffer is reloaded and one
+ * with unsaved edits only warned about.  Returns 1 if the buffer changed.
+ */
+static int check_document(Editor *editor, Document *doc) {
+    Journal *journal = &doc->journal;
+    struct stat st;
+    if (stat(doc->filename, &st) < 0) {
+        if (!doc->disk_changed) {
+            snprintf(editor->message, sizeof(editor->message), "%s was removed on disk",
+                     doc->filename);
+            editor->status = editor->message;
+        }
+        doc->disk_changed = 1;
+        return 0;
+    }
+    if (st.st_size == journal->base_size && st.st_mtim.tv_sec == journal->base_sec &&
+        st.st_mtim.tv_nsec == journal->base_nsec &&
+        (journal->dirty || (size_t)st.st_size == buffer_length(doc->buffer))) {
+        return 0;
+    }
+    if (journal->dirty) {
+        if (!doc->disk_changed) {
+            snprintf(editor->message, sizeof(editor->message),
+                     "%s changed on disk; saving will overwrite it (Ctrl+K compares)",
+                     doc->filename);
+            editor->status = editor->message;
+        }
+        doc->disk_changed = 1;
+        return 0;
+    }
+    if (reload_document(editor, doc, st.st_size) < 0) return 0;
+    journal_saved(journal, doc->filename);
+    doc->disk_changed = 0;
+    return 1;
+}
+int editor_collect(Editor *editor) {
+    int collected = pool_collect(editor->pool);
+    if (collected && editor->find_pending) find_step(editor, editor->find_direction);
+    if (watch_poll(&editor->watch) > 0) {
+        for (size_t i = 0; i < editor->document_count; i++) {
+            Document *doc = editor->documents[i];
+            if (watch_changed(&editor->watch, doc->watch)) {
+                collected += check_document(editor, doc);
+            }
+        }
+    }
+    return collected;
+}
+int editor_save(Editor *editor) {
+    int result = 0;
+    for (size_t i = 0; i < editor->document_count; i++) {
+        if (save_document(editor->documents[i]) < 0) result = -1;
+    }
+    return result;
+}
+/* Group-commits every journal that is due. */
+static void commit_journals(Editor *editor) {
+    for (size_t i = 0; i < editor->document_count; i++) {
+        if (journal_timeout(&editor->documents[i]->journal) == 0) {
+            long long start = trace_begin();
+            journal_commit(&editor->documents[i]->journal);
+            trace_end(TRACE_IO, start);
+        }
+    }
+}
+/* The wait until the next journal is due, or -1 if none has pending edits. */
+static int journal_wait(Editor *editor) {
+    int timeout = -1;
+    for (size_t i = 0; i < editor->document_count; i++) {
+        int t = journal_timeout(&editor->documents[i]->journal);
+        if (t >= 0 && (timeout < 0 || t < timeout)) timeout = t;
+    }
+    return timeout;
+}
+int editor_process_key(Editor *editor, int ch) {
+    Document *doc = editor->doc;
+    if (ch >= ARROW_UP) {
+        undo_break(&doc->history);
+    }
+    editor->status = NULL;
+    editor->match_active = 0;
+    editor->find_pending = 0;
+    /* Ctrl+Y only cycles a paste made by the key just before. */
+    if (ch != 25) doc->just_pasted = 0;
+    if (editor->pending_register < 0) {
+        editor->pending_register = ch >= 'a' && ch <= 'z' ? ch : 0;
+        editor->last_key = KEY_NONE;
+        return 0;
+    }
+    if ((ch == KEY_ESC && editor->last_key == KEY_ESC) || ch == KEY_EOF) {
+        return 1;
+    } else if (ch == KEY_ESC) {
+        matches_reset(&doc->matches, NULL);
+    } else if (ch == 21) {
+        undo(editor);
+    } else if (ch == 18) {
+        redo(editor);
+    } else if (ch == 24) {
+        copy_selection(editor);
+        doc->selection_mode = 0;
+    } else if (ch == 22) {
+        paste_text(editor);
+    } else if (ch == 25) {
+        if (doc->just_pasted) paste_older(editor);
+    } else if (ch == 20) {
+        editor->pending_register = -1;
+    } else if (ch == PASTE_KEY) {
+        paste_input(editor);
+    } else if (ch == 2) {
+        if (!doc->selection_mode) {
+            doc->selection_mode = 1;
+            doc->selection_start_line = doc->current_line;
+            doc->selection_start_col = doc->current_col;
+            doc->selection_end_line = doc->current_line;
+            doc->selection_end_col = doc->current_col;
+        } else {
+            doc->selection_mode = 0;
+        }
+    } else if (ch == 10) {
+        edit_insert(editor, cursor_pos(editor), "\n", 1);
+    } else if (ch == 127 || ch ==8) {
+        size_t pos = cursor_pos(editor);
+        if (pos > 0) {
+            size_t prev = step_char(editor, -1);
+            edit_delete(editor, prev, pos - prev);
+        }
+    } else if (ch == DEL_KEY || ch == 4) {
+        handle_delete_key(editor);
+    } else if (ch == 7) {
+        char input[32] = "";
+        if (prompt(editor, "Go to line: ", input, sizeof(input), NULL) && atol(input) > 0) {
+            go_to_line(editor, (size_t)atol(input) - 1);
+        }
+    } else if (ch == 6) {
+        find(editor, "Find: ");
+    } else if (ch == 5) {
+        replace(editor);
+    } else if (ch == 14 || ch == 16) {
+        find_step(editor, ch == 14 ? 1 : -1);
+    } else if (ch == 15) {
+        open_file(editor);
+    } else if (ch == 12) {
+        list_documents(editor);
+    } else if (ch == 11) {
+        show_changes(editor);
+    } else if (ch == 1) {
+        editor->overlay = !editor->overlay;
+    } else if (ch == 23) {
+        if (close_current(editor)) return 1;
+    } else if (ch == PAGE_UP || ch == PAGE_DOWN) {
+        page(editor, ch == PAGE_UP ? -1 : 1);
+    } else if (ch == HOME_KEY) {
+        doc->current_col = 0;
+    } else if (ch == END_KEY) {
+        doc->current_col = line_length(editor, doc->current_line);
+    } else if (ch == ARROW_UP && doc->current_line > 0) {
+        size_t col = cursor_column(editor);
+        doc->current_line--;
+        doc->current_col = columns_byte(&doc->columns, doc->current_line, col, NULL);
+    } else if (ch == ARROW_DOWN && doc->current_line < buffer_line_count(doc->buffer) - 1) {
+        size_t col = cursor_column(editor);
+        doc->current_line++;
+        doc->current_col = columns_byte(&doc->columns, doc->current_line, col, NULL);
+    } else if (ch == ARROW_RIGHT) {
+        if (doc->current_col < line_length(editor, doc->current_line)) {
+            set_cursor_pos(editor, step_char(editor, 1));
+        } else if (doc->current_line < buffer_line_count(doc->buffer) - 1) {
+            doc->current_line++;
+            doc->current_col = 0;
+        }
+    } else if (ch == ARROW_LEFT) {
+        if (doc->current_col > 0) {
+            set_cursor_pos(editor, step_char(editor, -1));
+        } else if (doc->current_line > 0) {
+            doc->current_line--;
+            doc->current_col = line_length(editor, doc->current_line);
+        }
+    } else if (is_text_key(ch)) {
+        char text[UTF8_MAX];
+        edit_insert(editor, cursor_pos(editor), text, utf8_encode(ch, text));
+    }
+
+    doc = editor->doc;
+    if (doc->selection_mode) {
+        doc->selection_end_line = doc->current_line;
+        doc->selection_end_col = doc->current_col;
+    }
+    editor->last_key = ch;
+    return 0;
+}
+/* With EDITOR_TRACE set, the timings of the session are written to that file on the way out. */
+void editor(const char *filename) {
+    const char *trace_path = getenv("EDITOR_TRACE");
+    Editor editor;
+    if (editor_open(&editor, filename) < 0) {
+        printf("Failed to read %s.\n", filename);
+        editor_close(&editor);
+        return;
+    }
+    if (editor.doc->recovered > 0) {
+        printf("Recovered %d unsaved edits from %s.\n", editor.doc->recovered,
+               editor.doc->journal.path);
+    } else if (editor.doc->recovered < 0) {
+        printf("A swap file for %s no longer matched it and was moved aside.\n", filename);
+    }
+    printf("Editor - ESC(2 times) to save, Ctrl+U for undo, Ctrl+R for redo, Ctrl+E replace\n");
+    printf("Ctrl+X copy, Ctrl+V paste, Ctrl+B selection, Ctrl+F find, Ctrl+N/P next/prev\n");
+    printf("Ctrl+O open another file, Ctrl+L list open files, Ctrl+W save and close one\n");
+    printf("Ctrl+K shows the changes not saved yet, Ctrl+A frame times and memory\n");
     printf("Press Enter to start editing...\n");
     getchar();
+    fflush(stdout);
+    editor_attach(&editor, STDIN_FILENO, STDOUT_FILENO);
+    terminal_enable_raw(STDIN_FILENO);
+    screen_watch_resize();
     while (1) {
-        clear_screen();
-        printf("Editor - ESC(2 times) to save, Ctrl+U for undo, Ctrl+R for redo\n");
-        printf("Ctrl+X to copy, Ctrl+V to paste, Ctrl+B to start/end selection\n");
-        refresh_screen(&editor);
-        int ch = read_key();
-        if (ch == 27) {
-            file = fopen(filename, "w");
-            if (file) {
-                for (int i = 0; i < editor.line_count; i++) {
-                    fputs(editor.lines[i], file);
-                    if (i < editor.line_count - 1 && 
-                        editor.lines[i][strlen(editor.lines[i]) - 1] != '\n') {
-                        fputc('\n', file);
-                    }
-                }
-                fclose(file);
-                printf("\nFile saved successfully. Press Enter to continue...\n");
-                getchar();
-            }
-            return;
-        } else if (ch == 21) {
-            undo(&editor);
-        } else if (ch == 18) {
-            redo(&editor);
-        } else if (ch == 24) {
-            copy_selection(&editor);
-            editor.selection_mode = 0;
-        } else if (ch == 22) {
-            paste_text(&editor);
-        } else if (ch == 2) {
-            if (!editor.selection_mode) {
-                editor.selection_mode = 1;
-                editor.selection_start_line = editor.current_line;
-                editor.selection_start_col = editor.current_col;
-                editor.selection_end_line = editor.current_line;
-                editor.selection_end_col = editor.current_col;
-            } else {
-                editor.selection_mode = 0;
-            }
-        } else if (ch == 10) {
-            save_state(&editor);
-            if (editor.line_count < MAX_LINES - 1) {
-                memmove(editor.lines[editor.current_line + 1], 
-                        editor.lines[editor.current_line] + editor.current_col,
-                        strlen(editor.lines[editor.current_line]) - editor.current_col + 1);
-                editor.lines[editor.current_line][editor.current_col] = '\n';
-                editor.lines[editor.current_line][editor.current_col + 1] = '\0';
-                editor.current_line++;
-                editor.current_col = 0;
-                editor.line_count++;
-            }
-        } else if (ch == 127 || ch ==8) {
-            save_state(&editor);
-            if (editor.current_col > 0) {
-                memmove(editor.lines[editor.current_line] + editor.current_col - 1,
-                        editor.lines[editor.current_line] + editor.current_col,
-                        strlen(editor.lines[editor.current_line]) - editor.current_col + 1);
-                editor.current_col--;
-            } else if (editor.current_line > 0) {
-                int prev_length = strlen(editor.lines[editor.current_line - 1]);
-                if (prev_length > 0 && editor.lines[editor.current_line - 1][prev_length - 1] == '\n') {
-                    editor.lines[editor.current_line - 1][prev_length - 1] = '\0';
-                    prev_length--;
-                }
-                if (prev_length + strlen(editor.lines[editor.current_line]) < MAX_LINE_LENGTH) {
-                    strcat(editor.lines[editor.current_line - 1], 
-                           editor.lines[editor.current_line]);
-                    memmove(editor.lines + editor.current_line,
-                            editor.lines + editor.current_line + 1,
-                            (editor.line_count - editor.current_line) * MAX_LINE_LENGTH);
-                    editor.line_count--;
-                    editor.current_line--;
-                    editor.current_col = prev_length;
-                }
-            }
-        }else if (ch == 126 || ch == 4){
-            handle_delete_key(&editor);
-        } else if (ch == 1000 && editor.current_line > 0) {
-            editor.current_line--;
-            int line_length = strlen(editor.lines[editor.current_line]);
-            if (line_length > 0 && editor.lines[editor.current_line][line_length - 1] == '\n') {
-                line_length--;
-            }
-            editor.current_col = (editor.current_col > line_length) ? line_length : editor.current_col;
-        } else if (ch == 1001 && editor.current_line < editor.line_count - 1) {
-            editor.current_line++;
-            int line_length = strlen(editor.lines[editor.current_line]);
-            if (line_length > 0 && editor.lines[editor.current_line][line_length - 1] == '\n') {
-                line_length--;
-            }
-            editor.current_col = (editor.current_col > line_length) ? line_length : editor.current_col;
-        } else if (ch == 1002) {
-            int line_length = strlen(editor.lines[editor.current_line]);
-            if (line_length > 0 && editor.lines[editor.current_line][line_length - 1] == '\n') {
-                line_length--;
-            }
-            if (editor.current_col < line_length) {
-                editor.current_col++;
-            } else if (editor.current_line < editor.line_count - 1) {
-                editor.current_line++;
-                editor.current_col = 0;
-            }
-        } else if (ch == 1003) {
-            if (editor.current_col > 0) {
-                editor.current_col--;
-            } else if (editor.current_line > 0) {
-                editor.current_line--;
-                int line_length = strlen(editor.lines[editor.current_line]);
-                if (line_length > 0 && editor.lines[editor.current_line][line_length - 1] == '\n') {
-                    line_length--;
-                }
-                editor.current_col = line_length;
-            }
-        } else if (ch >= 32 && ch <= 126) {
-            save_state(&editor);
-            if (strlen(editor.lines[editor.current_line]) < MAX_LINE_LENGTH - 1) {
-                memmove(editor.lines[editor.current_line] + editor.current_col + 1,
-                        editor.lines[editor.current_line] + editor.current_col,
-                        strlen(editor.lines[editor.current_line]) - editor.current_col + 1);
-                editor.lines[editor.current_line][editor.current_col] = ch;
-                editor.current_col++;
-            }
+        editor_collect(&editor);
+        if (!input_pending(&editor.input)) {
+            commit_journals(&editor);
+            refresh_screen(&editor);
+        }
+        int ch = input_read_key(&editor.input, journal_wait(&editor));
+        if (ch == KEY_NONE) {
+            continue;
+        }
+        if (editor_process_key(&editor, ch)) {
+            break;
+        }
+    }
+    screen_set_cursor(&editor.screen, editor.screen.rows - 1, 0);
+    screen_flush(&editor.screen);
+    terminal_disable_raw();
+    printf("\n");
+    for (size_t i = 0; i < editor.document_count; i++) {
+        Document *doc = editor.documents[i];
+        char changes[64] = "";
+        char *disk, *text;
+        Diff diff;
+        if (diff_document(doc, &diff, &disk, &text) == 0) {
+            snprintf(changes, sizeof(changes), ": %zu lines removed, %zu added",
+                     diff.deleted, diff.inserted);
+            diff_free(&diff);
+            free(disk);
+            free(text);
         }
-        
-        if (editor.selection_mode) {
-            editor.selection_end_line = editor.current_line;
-            editor.selection_end_col = editor.current_col;
+        if (save_document(doc) == 0) {
+            printf("Saved %s%s.\n", doc->filename, changes);
+        } else {
+            printf("Failed to save %s; edits are kept in %s.\n", doc->filename,
+                   doc->journal.path);
+        }
+    }
+    if (trace_path) {
+        if (trace_dump(trace_path) == 0) {
+            printf("Timings written to %s.\n", trace_path);
+        } else {
+            printf("Failed to write timings to %s.\n", trace_path);
         }
     }
-}
\ No newline at end of file
+    printf("Press Enter to continue...\n");
+    getchar();
+    screen_unwatch_resize();
+    editor_close(&editor);
+}
@@ -0,0 +1,109 @@
+#ifndef EDITOR_H
+#define EDITOR_H
+
+#include <stddef.h>
+
+#include "buffer.h"
+#include "clipboard.h"
+#include "columns.h"
+#include "input.h"
+#include "journal.h"
+#include "matches.h"
+#include "pool.h"
+#include "re.h"
+#include "screen.h"
+#include "syntax.h"
+#include "undo.h"
+#include "watch.h"
+
+/* One open file: its text, history, highlighting, matches and view. */
+typedef struct {
+    char *filename;
+    Buffer *buffer;
+    size_t current_line;
+    size_t current_col;
+    size_t row_offset;
+    size_t col_offset;
+    UndoLog history;
+    Journal journal;
+    int recovered;
+    int watch;
+    int disk_changed;
+    SyntaxCache syntax;
+    MatchSet matches;
+    ColumnCache columns;
+    size_t paste_start;
+    size_t paste_length;
+    int just_pasted;
+    size_t selection_start_line;
+    size_t selection_start_col;
+    size_t selection_end_line;
+    size_t selection_end_col;
+    int selection_mode;
+} Document;
+
+typedef struct {
+    Document *doc;
+    Document **documents;
+    size_t document_count;
+    size_t document_cap;
+    int listing;
+    int overlay;
+    char *line;
+    size_t line_cap;
+    unsigned char *attrs;
+    size_t attrs_cap;
+    Screen screen;
+    Input input;
+    Pool *pool;
+    Watch watch;
+    int last_key;
+    Clipboard clipboard;
+    int pending_register;
+    Regex *find;
+    char find_text[256];
+    size_t find_origin;
+    size_t match_line;
+    size_t match_col;
+    size_t match_length;
+    int match_active;
+    int find_pending;
+    int find_direction;
+    const char *status;
+    char message[512];
+} Editor;
+
+/*
+ * The editor core, usable without a terminal: editor_open() loads a file,
+ * editor_attach() points key input and screen output at any pair of file
+ * descriptors, and editor_process_key() applies one decoded key, returning
+ * 1 once the user has asked to save and leave.  Work that would stall a
+ * frame runs on a thread pool; editor_collect() merges whatever has
+ * finished, and the input returns KEY_NONE early when something has.
+ *
+ * Open files are watched, and editor_collect() also takes in what other
+ * programs write to them.  A file with no unsaved edits follows its disk
+ * copy: when it only grew, just the new tail is read and appended, like
+ * tail -f, and any other rewrite is diffed against the buffer so only the
+ * lines that differ are replaced, as one undo step.  A file with unsaved
+ * edits is left alone, with a warning that saving will overwrite it.
+ * editor() wires all of this to the controlling terminal.
+ *
+ * An editor holds any number of documents; keys act on the current one,
+ * Ctrl+O opens another, Ctrl+L lists them and Ctrl+W saves and closes
+ * one.  editor_save() saves them all and editor_close() frees them all.
+ * Ctrl+K shows what saving the current one would change, as a diff.
+ * Ctrl+A puts frame times and memory on the status bar; with EDITOR_TRACE
+ * naming a file, editor() writes the session's timings there on exit.
+ */
+int editor_open(Editor *editor, const char *filename);
+void editor_attach(Editor *editor, int in_fd, int out_fd);
+int editor_process_key(Editor *editor, int ch);
+int editor_collect(Editor *editor);
+void refresh_screen(Editor *editor);
+int editor_save(Editor *editor);
+void editor_close(Editor *editor);
+
+void editor(const char *filename);
+
+#endif
@@ -0,0 +1,446 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "grep.h"
+
+#define BINARY_PROBE 8192
+#define EXTEND_BLOCK 65536
+
+typedef struct {
+    size_t file;
+    size_t line;
+    size_t column;
+    size_t offset;
+    size_t text;
+    size_t length;
+} GrepHit;
+
+typedef struct Grep Grep;
+
+/*
+ * One job: either a batch of small files, or one slice [start, end) of a
+ * large file (slice is then its 1-based index).  A slice owns the lines
+ * that start inside it and reports line numbers relative to its first
+ * line, plus how many lines it holds, so they can be made absolute when
+ * the slices are emitted in order.
+ */
+typedef struct {
+    Job job;
+    Grep *grep;
+    size_t seq;
+    char **paths;
+    size_t path_count;
+    size_t path_cap;
+    size_t bytes;
+    int slice;
+    size_t start;
+    size_t end;
+    size_t size;
+    size_t current;
+    GrepHit *hits;
+    size_t hit_count;
+    size_t hit_cap;
+    char *text;
+    size_t text_len;
+    size_t text_cap;
+    size_t lines;
+    long long count;
+    Regex *regex;
+} GrepUnit;
+
+struct Grep {
+    Pool *pool;
+    const SearchPattern *sp;
+    const GrepOptions *options;
+    grep_callback cb;
+    void *arg;
+    CancelToken token;
+    GrepUnit *batch;
+    GrepUnit *slots[GREP_IN_FLIGHT];
+    int ready[GREP_IN_FLIGHT];
+    size_t submitted;
+    size_t emitted;
+    size_t file_line;
+    long long count;
+    int stopped;
+};
+
+static int add_hit(const SearchMatch *match, void *arg) {
+    GrepUnit *unit = arg;
+    size_t length = match->line_length < GREP_LINE_MAX ? match->line_length : GREP_LINE_MAX;
+    GrepHit *hit;
+    if (job_cancelled(&unit->job)) return 1;
+    if (unit->hit_count == unit->hit_cap) {
+        unit->hit_cap = unit->hit_cap ? unit->hit_cap * 2 : 64;
+        unit->hits = realloc(unit->hits, unit->hit_cap * sizeof(GrepHit));
+    }
+    if (unit->text_len + length > unit->text_cap) {
+        unit->text_cap = (unit->text_len + length) * 2;
+        unit->text = realloc(unit->text, unit->text_cap);
+    }
+    hit = &unit->hits[unit->hit_count++];
+    hit->file = unit->current;
+    hit->line = match->line;
+    hit->column = match->column;
+    hit->offset = match->offset;
+    hit->text = unit->text_len;
+    hit->length = length;
+    memcpy(unit->text + unit->text_len, match->line_text, length);
+    unit->text_len += length;
+    return 0;
+}
+
+static void scan(GrepUnit *unit, const char *text, size_t len, const SearchPosition *at) {
+    const SearchPattern *sp = unit->grep->sp;
+    int count_only = (sp->flags & SEARCH_COUNT_ONLY) || !unit->grep->cb;
+    if (unit->regex) {
+        unit->count += re_search_buffer(unit->regex, text, len, at, count_only ? NULL : add_hit,
+                                        unit);
+    } else {
+        unit->count += search_buffer(sp, text, len, at, count_only ? NULL : add_hit, unit);
+    }
+}
+
+static int is_binary(const char *text, size_t len) {
+    return memchr(text, '\0', len < BINARY_PROBE ? len : BINARY_PROBE) != NULL;
+}
+
+/* Reads a whole file into *buf, growing it as needed; returns the length or -1. */
+static ssize_t read_file(const char *path, char **buf, size_t *cap) {
+    int fd = open(path, O_RDONLY);
+    size_t len = 0;
+    ssize_t n;
+    if (fd < 0) return -1;
+    while (1) {
+        if (len == *cap) {
+            *cap = *cap ? *cap * 2 : GREP_BATCH_BYTES;
+            *buf = realloc(*buf, *cap);
+        }
+        n = read(fd, *buf + len, *cap - len);
+        if (n <= 0) break;
+        len += n;
+    }
+    close(fd);
+    return n < 0 ? -1 : (ssize_t)len;
+}
+
+static void run_batch(GrepUnit *unit) {
+    char *buf = NULL;
+    size_t cap = 0;
+    for (size_t i = 0; i < unit->path_count && !job_cancelled(&unit->job); i++) {
+        ssize_t len = read_file(unit->paths[i], &buf, &cap);
+        if (len < 0 || is_binary(buf, len)) continue;
+        SearchPosition at = { 1, 0, 0 };
+        unit->current = i;
+        scan(unit, buf, len, &at);
+    }
+    free(buf);
+}
+
+static ssize_t read_at(int fd, char *buf, size_t len, size_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, buf + done, len - done, offset + done);
+        if (n <= 0) break;
+        done += n;
+    }
+    return done;
+}
+
+/*
+ * Reads the slice with one byte before it, so a line starting right at
+ * start is recognised, skips the tail of the line that began in the slice
+ * before, and reads on past end to finish the last line that began here.
+ */
+static void run_slice(GrepUnit *unit) {
+    size_t from = unit->start ? unit->start - 1 : 0;
+    size_t cap = unit->end - from + EXTEND_BLOCK, len, begin = 0;
+    char *buf, *newline;
+    int fd = open(unit->paths[0], O_RDONLY);
+    if (fd < 0) return;
+    buf = malloc(cap);
+    len = read_at(fd, buf, unit->end - from, from);
+    if (unit->start) {
+        newline = memchr(buf, '\n', len);
+        begin = newline ? (size_t)(newline - buf) + 1 : len;
+    }
+    while (begin < len && buf[len - 1] != '\n' && from + len < unit->size) {
+        size_t n;
+        if (len + EXTEND_BLOCK > cap) {
+            cap *= 2;
+            buf = realloc(buf, cap);
+        }
+        n = read_at(fd, buf + len, EXTEND_BLOCK, from + len);
+        if (n == 0) break;
+        newline = memchr(buf + len, '\n', n);
+        len = newline ? (size_t)(newline - buf) + 1 : len + n;
+    }
+    close(fd);
+    if (begin < len) {
+        SearchPosition at = { 1, from + begin, from + begin };
+        unit->lines = search_count_newlines(buf + begin, len - begin);
+        scan(unit, buf + begin, len - begin, &at);
+    }
+    free(buf);
+}
+
+static void run_unit(Job *job) {
+    GrepUnit *unit = job->arg;
+    const GrepOptions *options = unit->grep->options;
+    if (options && options->regex) unit->regex = re_clone(options->regex);
+    if (unit->slice) {
+        run_slice(unit);
+    } else {
+        run_batch(unit);
+    }
+    re_free(unit->regex);
+    unit->regex = NULL;
+}
+
+static void unit_done(Job *job) {
+    GrepUnit *unit = job->arg;
+    unit->grep->ready[unit->seq % GREP_IN_FLIGHT] = 1;
+}
+
+static void free_unit(GrepUnit *unit) {
+    for (size_t i = 0; i < unit->path_count; i++) free(unit->paths[i]);
+    free(unit->paths);
+    free(unit->hits);
+    free(unit->text);
+    free(unit);
+}
+
+static void report(Grep *grep, GrepUnit *unit) {
+    if (!grep->cb || (grep->sp->flags & SEARCH_COUNT_ONLY)) {
+        grep->count += unit->count;
+        return;
+    }
+    for (size_t i = 0; i < unit->hit_count; i++) {
+        const GrepHit *hit = &unit->hits[i];
+        SearchMatch match;
+        match.line = unit->slice ? grep->file_line + hit->line - 1 : hit->line;
+        match.column = hit->column;
+        match.offset = hit->offset;
+        match.line_text = unit->text + hit->text;
+        match.line_length = hit->length;
+        grep->count++;
+        if (grep->cb(unit->paths[hit->file], &match, grep->arg)) {
+            grep->stopped = 1;
+            cancel(&grep->token);
+            return;
+        }
+    }
+}
+
+/* Passes on the results of every finished job that has no unfinished job before it. */
+static void emit(Grep *grep) {
+    while (grep->emitted < grep->submitted && grep->ready[grep->emitted % GREP_IN_FLIGHT]) {
+        size_t slot = grep->emitted % GREP_IN_FLIGHT;
+        GrepUnit *unit = grep->slots[slot];
+        if (unit->slice == 1) grep->file_line = 1;
+        if (!grep->stopped) report(grep, unit);
+        grep->file_line += unit->lines;
+        free_unit(unit);
+        grep->slots[slot] = NULL;
+        grep->ready[slot] = 0;
+        grep->emitted++;
+    }
+}
+
+static void wait_one(Grep *grep) {
+    struct pollfd pfd = { pool_fd(grep->pool), POLLIN, 0 };
+    if (poll(&pfd, 1, -1) > 0) pool_collect(grep->pool);
+    emit(grep);
+}
+
+static void submit(Grep *grep, GrepUnit *unit) {
+    while (grep->submitted - grep->emitted >= GREP_IN_FLIGHT) wait_one(grep);
+    unit->seq = grep->submitted++;
+    grep->slots[unit->seq % GREP_IN_FLIGHT] = unit;
+    unit->job.run = run_unit;
+    unit->job.done = unit_done;
+    unit->job.arg = unit;
+    unit->job.token = &grep->token;
+    pool_submit(grep->pool, &unit->job);
+    pool_collect(grep->pool);
+    emit(grep);
+}
+
+static GrepUnit *new_unit(Grep *grep, const char *path) {
+    GrepUnit *unit = calloc(1, sizeof(GrepUnit));
+    unit->grep = grep;
+    if (path) {
+        unit->path_cap = 1;
+        unit->paths = malloc(sizeof(char *));
+        unit->paths[unit->path_count++] = strdup(path);
+    }
+    return unit;
+}
+
+static void flush(Grep *grep) {
+    if (!grep->batch) return;
+    submit(grep, grep->batch);
+    grep->batch = NULL;
+}
+
+static int binary_file(const char *path) {
+    char probe[BINARY_PROBE];
+    int fd = open(path, O_RDONLY);
+    ssize_t n;
+    if (fd < 0) return 1;
+    n = read_at(fd, probe, sizeof(probe), 0);
+    close(fd);
+    return is_binary(probe, n);
+}
+
+static void add_file(Grep *grep, const char *path, size_t size) {
+    GrepUnit *batch;
+    if (grep->stopped || size == 0) return;
+    if (size > GREP_CHUNK) {
+        if (binary_file(path)) return;
+        flush(grep);
+        for (size_t start = 0; start < size && !grep->stopped; start += GREP_CHUNK) {
+            GrepUnit *unit = new_unit(grep, path);
+            unit->slice = (int)(start / GREP_CHUNK) + 1;
+            unit->start = start;
+            unit->end = size - start < GREP_CHUNK ? size : start + GREP_CHUNK;
+            unit->size = size;
+            submit(grep, unit);
+        }
+        return;
+    }
+    if (!grep->batch) grep->batch = new_unit(grep, NULL);
+    batch = grep->batch;
+    if (batch->path_count == batch->path_cap) {
+        batch->path_cap = batch->path_cap ? batch->path_cap * 2 : 16;
+        batch->paths = realloc(batch->paths, batch->path_cap * sizeof(char *));
+    }
+    batch->paths[batch->path_count++] = strdup(path);
+    batch->bytes += size;
+    if (batch->bytes >= GREP_BATCH_BYTES || batch->path_count >= GREP_BATCH_FILES) flush(grep);
+}
+
+static int ignored(const GrepOptions *options, const char *name, const char *relative) {
+    for (size_t i = 0; options && i < options->ignore_count; i++) {
+        if (fnmatch(options->ignore[i], name, 0) == 0 ||
+            fnmatch(options->ignore[i], relative, FNM_PATHNAME) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static char *join(const char *dir, const char *name) {
+    size_t len = strlen(dir);
+    char *path = malloc(len + strlen(name) + 2);
+    if (len == 0) return strcpy(path, name);
+    memcpy(path, dir, len);
+    if (dir[len - 1] != '/') path[len++] = '/';
+    strcpy(path + len, name);
+    return path;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void walk(Grep *grep, const char *path, const char *relative) {
+    DIR *dir = opendir(path);
+    struct dirent *entry;
+    char **names = NULL;
+    size_t count = 0, cap = 0;
+    if (!dir) return;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        if (count == cap) {
+            cap = cap ? cap * 2 : 64;
+            names = realloc(names, cap * sizeof(char *));
+        }
+        names[count++] = strdup(entry->d_name);
+    }
+    closedir(dir);
+    qsort(names, count, sizeof(char *), compare_names);
+    for (size_t i = 0; i < count; i++) {
+        char *child = join(path, names[i]);
+        char *child_relative = join(relative, names[i]);
+        struct stat st;
+        if (!grep->stopped && !ignored(grep->options, names[i], child_relative) &&
+            lstat(child, &st) == 0) {
+            if (S_ISDIR(st.st_mode)) {
+                walk(grep, child, child_relative);
+            } else if (S_ISREG(st.st_mode)) {
+                add_file(grep, child, st.st_size);
+            }
+        }
+        free(child);
+        free(child_relative);
+        free(names[i]);
+    }
+    free(names);
+}
+
+int grep_ignored(const GrepOptions *options, const char *relative) {
+    char path[PATH_MAX];
+    size_t len = strlen(relative), start = 0;
+    if (!options || options->ignore_count == 0 || len >= sizeof(path)) return 0;
+    memcpy(path, relative, len + 1);
+    for (size_t end = 0; end <= len; end++) {
+        char c = path[end];
+        if (c != '/' && c != '\0') continue;
+        path[end] = '\0';
+        if (ignored(options, path + start, path)) return 1;
+        path[end] = c;
+        start = end + 1;
+    }
+    return 0;
+}
+
+static void grep_init(Grep *grep, Pool *pool, const SearchPattern *sp,
+                      const GrepOptions *options, grep_callback cb, void *arg) {
+    memset(grep, 0, sizeof(Grep));
+    grep->pool = pool;
+    grep->sp = sp;
+    grep->options = options;
+    grep->cb = cb;
+    grep->arg = arg;
+    cancel_init(&grep->token);
+}
+
+static long long grep_finish(Grep *grep) {
+    flush(grep);
+    while (grep->emitted < grep->submitted) wait_one(grep);
+    return grep->count;
+}
+
+long long grep_tree(Pool *pool, const SearchPattern *sp, const char *root,
+                    const GrepOptions *options, grep_callback cb, void *arg) {
+    Grep grep;
+    struct stat st;
+    if (stat(root, &st) < 0) return -1;
+    grep_init(&grep, pool, sp, options, cb, arg);
+    if (S_ISDIR(st.st_mode)) {
+        walk(&grep, root, "");
+    } else if (S_ISREG(st.st_mode)) {
+        add_file(&grep, root, st.st_size);
+    }
+    return grep_finish(&grep);
+}
+
+long long grep_files(Pool *pool, const SearchPattern *sp, const char *const *paths,
+                     size_t count, const GrepOptions *options, grep_callback cb, void *arg) {
+    Grep grep;
+    grep_init(&grep, pool, sp, options, cb, arg);
+    for (size_t i = 0; i < count && !grep.stopped; i++) {
+        struct stat st;
+        if (lstat(paths[i], &st) == 0 && S_ISREG(st.st_mode)) add_file(&grep, paths[i], st.st_size);
+    }
+    return grep_finish(&grep);
+}
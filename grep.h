@@ -0,0 +1,50 @@
+#ifndef GREP_H
+#define GREP_H
+
+#include <stddef.h>
+
+#include "pool.h"
+#include "re.h"
+#include "search.h"
+
+#define GREP_BATCH_BYTES (1u << 20)
+#define GREP_BATCH_FILES 256
+#define GREP_CHUNK (4u << 20)
+#define GREP_IN_FLIGHT 64
+#define GREP_LINE_MAX 512
+
+typedef int (*grep_callback)(const char *path, const SearchMatch *match, void *arg);
+
+typedef struct {
+    const char *const *ignore;
+    size_t ignore_count;
+    const Regex *regex;
+} GrepOptions;
+
+/*
+ * Recursive search of a directory tree (or a single file) on a thread
+ * pool.  The tree is walked in name order on the calling thread; files
+ * smaller than GREP_CHUNK are batched into jobs of about GREP_BATCH_BYTES,
+ * larger ones are split into GREP_CHUNK slices that each own the lines
+ * starting in them.  Results are passed to cb on the calling thread in
+ * walk order as soon as every job before them has finished, with line
+ * numbers made absolute across slices; at most GREP_IN_FLIGHT jobs are
+ * outstanding.  Entries whose name or path below root matches an ignore
+ * glob are skipped, as are symlinks, and files with a NUL byte in their
+ * first block.  line_text is cut to GREP_LINE_MAX bytes.
+ *
+ * With options->regex set, each job matches with its own clone of it and
+ * sp only supplies the flags.
+ *
+ * Returns the number of matches, or -1 if root cannot be read.  A
+ * non-zero return from cb stops the search.
+ */
+long long grep_tree(Pool *pool, const SearchPattern *sp, const char *root,
+                    const GrepOptions *options, grep_callback cb, void *arg);
+/* The same search over a list of files, in the order given; ignore globs are not applied. */
+long long grep_files(Pool *pool, const SearchPattern *sp, const char *const *paths,
+                     size_t count, const GrepOptions *options, grep_callback cb, void *arg);
+/* Whether any component of a path relative to the search root matches an ignore glob. */
+int grep_ignored(const GrepOptions *options, const char *relative);
+
+#endif
@@ -0,0 +1,210 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "history.h"
+#include "lz.h"
+
+#define HISTORY_MAGIC "TEUNDO01"
+#define HEADER_SIZE 32
+#define TRAILER_SIZE 48
+#define MAX_BLOCK (1u << 30)
+
+enum {
+    TRAILER_START,
+    TRAILER_RAW,
+    TRAILER_PACKED,
+    TRAILER_SUM,
+    TRAILER_GROUP,
+    TRAILER_BLOCKS,
+    TRAILER_FIELDS
+};
+
+static char *history_path(const char *filename) {
+    const char *slash = strrchr(filename, '/');
+    size_t dir_len = slash ? (size_t)(slash - filename + 1) : 0;
+    char *path = malloc(strlen(filename) + 7);
+    memcpy(path, filename, dir_len);
+    sprintf(path + dir_len, ".%s.undo", filename + dir_len);
+    return path;
+}
+
+static void read_stamp(const char *filename, int64_t stamp[3]) {
+    struct stat st;
+    stamp[0] = stamp[1] = stamp[2] = 0;
+    if (stat(filename, &st) == 0) {
+        stamp[0] = st.st_size;
+        stamp[1] = st.st_mtim.tv_sec;
+        stamp[2] = st.st_mtim.tv_nsec;
+    }
+}
+
+static unsigned long long checksum(const char *data, size_t len) {
+    uint64_t h = 14695981039346656037ull;
+    while (len--) h = (h ^ (unsigned char)*data++) * 1099511628211ull;
+    return h;
+}
+
+static int write_at(int fd, const char *data, size_t len, long long offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, data, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+/* Makes the trailer that ends at end the top of the stack. */
+static int read_trailer(History *history, long long end) {
+    uint64_t trailer[TRAILER_FIELDS];
+    if (end < HEADER_SIZE + TRAILER_SIZE ||
+        pread(history->fd, trailer, TRAILER_SIZE, end - TRAILER_SIZE) != TRAILER_SIZE) {
+        return -1;
+    }
+    if (trailer[TRAILER_START] < HEADER_SIZE || trailer[TRAILER_RAW] > MAX_BLOCK ||
+        trailer[TRAILER_PACKED] > lz_bound(trailer[TRAILER_RAW]) ||
+        trailer[TRAILER_START] + trailer[TRAILER_PACKED] + TRAILER_SIZE != (uint64_t)end ||
+        trailer[TRAILER_BLOCKS] == 0) {
+        return -1;
+    }
+    history->end = end;
+    history->top = trailer[TRAILER_START];
+    history->top_raw = trailer[TRAILER_RAW];
+    history->top_size = trailer[TRAILER_PACKED];
+    history->top_sum = trailer[TRAILER_SUM];
+    history->group = trailer[TRAILER_GROUP];
+    history->blocks = trailer[TRAILER_BLOCKS];
+    return 0;
+}
+
+/* The stack is about to change, so the header stops matching the file on disk. */
+static int unstamp(History *history) {
+    static const char zero[HEADER_SIZE - 8];
+    if (!history->stamped) return 0;
+    if (write_at(history->fd, zero, sizeof(zero), 8) < 0) return -1;
+    history->stamped = 0;
+    return 0;
+}
+
+size_t history_open(History *history, const char *filename) {
+    char header[HEADER_SIZE];
+    int64_t stamp[3];
+    struct stat st;
+    memset(history, 0, sizeof(History));
+    history->fd = -1;
+    history->path = history_path(filename);
+    history->end = HEADER_SIZE;
+    read_stamp(filename, stamp);
+    history->fd = open(history->path, O_RDWR | O_CLOEXEC);
+    if (history->fd < 0) return 0;
+    if (fstat(history->fd, &st) == 0 &&
+        pread(history->fd, header, HEADER_SIZE, 0) == HEADER_SIZE &&
+        memcmp(header, HISTORY_MAGIC, 8) == 0 && stamp[1] != 0 &&
+        memcmp(header + 8, stamp, sizeof(stamp)) == 0 &&
+        (st.st_size == HEADER_SIZE || read_trailer(history, st.st_size) == 0)) {
+        history->stamped = 1;
+        return history->blocks;
+    }
+    close(history->fd);
+    history->fd = -1;
+    unlink(history->path);
+    history->blocks = 0;
+    history->group = 0;
+    history->end = HEADER_SIZE;
+    return 0;
+}
+
+int history_push(History *history, const char *data, size_t len, unsigned long group) {
+    uint64_t trailer[TRAILER_FIELDS];
+    char *block;
+    size_t size;
+    if (history->failed || len > MAX_BLOCK) return -1;
+    if (history->fd < 0) {
+        char header[HEADER_SIZE] = HISTORY_MAGIC;
+        history->fd = open(history->path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (history->fd < 0 || write_at(history->fd, header, HEADER_SIZE, 0) < 0) {
+            history->failed = 1;
+            return -1;
+        }
+    }
+    block = malloc(lz_bound(len) + TRAILER_SIZE);
+    if (!block || unstamp(history) < 0) {
+        free(block);
+        history->failed = 1;
+        return -1;
+    }
+    size = lz_compress(data, len, block);
+    trailer[TRAILER_START] = history->end;
+    trailer[TRAILER_RAW] = len;
+    trailer[TRAILER_PACKED] = size;
+    trailer[TRAILER_SUM] = checksum(block, size);
+    trailer[TRAILER_GROUP] = group;
+    trailer[TRAILER_BLOCKS] = history->blocks + 1;
+    memcpy(block + size, trailer, TRAILER_SIZE);
+    if (write_at(history->fd, block, size + TRAILER_SIZE, history->end) < 0 ||
+        read_trailer(history, history->end + size + TRAILER_SIZE) < 0) {
+        free(block);
+        history->failed = 1;
+        return -1;
+    }
+    free(block);
+    return 0;
+}
+
+char *history_pop(History *history, size_t *len) {
+    char *block, *data;
+    int ok;
+    if (history->blocks == 0 || history->failed || unstamp(history) < 0) return NULL;
+    block = malloc(history->top_size);
+    data = malloc(history->top_raw ? history->top_raw : 1);
+    ok = block && data &&
+         pread(history->fd, block, history->top_size, history->top) ==
+             (ssize_t)history->top_size &&
+         checksum(block, history->top_size) == history->top_sum &&
+         lz_decompress(block, history->top_size, data, history->top_raw) == 0;
+    free(block);
+    *len = history->top_raw;
+    /* The block is off the stack either way; a damaged one takes everything below with it. */
+    if (!ok || history->blocks == 1 || read_trailer(history, history->top) < 0) {
+        history->blocks = 0;
+        history->group = 0;
+        history->end = HEADER_SIZE;
+    }
+    if (ftruncate(history->fd, history->end) < 0) history->failed = 1;
+    if (ok) return data;
+    free(data);
+    return NULL;
+}
+
+int history_stamp(History *history, const char *filename) {
+    int64_t stamp[3];
+    if (history->fd < 0 || history->failed) return -1;
+    read_stamp(filename, stamp);
+    if (write_at(history->fd, (const char *)stamp, sizeof(stamp), 8) < 0 ||
+        fdatasync(history->fd) < 0) {
+        return -1;
+    }
+    history->stamped = 1;
+    return 0;
+}
+
+void history_close(History *history) {
+    if (!history->path) return;
+    if (history->fd >= 0) {
+        close(history->fd);
+        if (!history->stamped) unlink(history->path);
+    }
+    free(history->path);
+    memset(history, 0, sizeof(History));
+    history->fd = -1;
+}
@@ -0,0 +1,46 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+
+/*
+ * Undo history kept on disk in ".name.undo" next to the file, as a stack
+ * of blocks compressed with lz.c.  The undo log pushes its oldest groups
+ * once it runs over its memory budget and pops them back when undo gets
+ * that far; the newest block is always the one at the end of the file.
+ *
+ * Every block is followed by a fixed-size trailer with the offset where
+ * the block starts, its sizes, checksum and last group, and the trailer
+ * of the block below ends where this block starts.  The trailers are the
+ * index: opening reads the header and the last trailer only, and each
+ * block is read when undo first needs it.
+ *
+ * The header records the size and mtime of the file that the newest
+ * block leaves behind, as the journal's does.  A push or a pop clears it
+ * until history_stamp() is called with the file saved to match again, and
+ * a history whose header does not match the file is thrown away.
+ */
+typedef struct {
+    char *path;
+    int fd;
+    long long end;
+    long long top;
+    size_t top_raw;
+    size_t top_size;
+    unsigned long long top_sum;
+    size_t blocks;
+    unsigned long group;
+    int stamped;
+    int failed;
+} History;
+
+/* Returns the number of blocks of history found for filename. */
+size_t history_open(History *history, const char *filename);
+int history_push(History *history, const char *data, size_t len, unsigned long group);
+/* The newest block, decompressed and taken off the file; NULL if there is none. */
+char *history_pop(History *history, size_t *len);
+int history_stamp(History *history, const char *filename);
+/* An unstamped history no longer matches any version of the file and is removed. */
+void history_close(History *history);
+
+#endif
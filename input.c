@@ -0,0 +1,312 @@
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "input.h"
+#include "trace.h"
+#include "utf8.h"
+
+#define ESC_TIMEOUT_MS 50
+#define PASTE_TIMEOUT_MS 1000
+
+static const char paste_end[] = "\033[201~";
+static const char terminal_on[] = "\033[?2004h";
+static const char terminal_off[] = "\033[?2004l\033[0m\033[?25h";
+
+static const int caught_signals[] = { SIGINT, SIGTERM, SIGHUP, SIGQUIT, SIGTSTP };
+#define CAUGHT_SIGNALS (sizeof(caught_signals) / sizeof(caught_signals[0]))
+
+static struct termios original_termios;
+static struct termios raw_termios;
+static struct sigaction old_actions[CAUGHT_SIGNALS];
+static int raw_fd = -1;
+static int exit_hook_installed;
+
+static void write_all(const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+/* Only async-signal-safe calls from here on: this runs from handle_signal. */
+static void restore_terminal(void) {
+    write_all(terminal_off, sizeof(terminal_off) - 1);
+    tcsetattr(raw_fd, TCSANOW, &original_termios);
+}
+
+static void handle_signal(int sig) {
+    int saved_errno = errno;
+    sigset_t set;
+    if (raw_fd < 0) return;
+    restore_terminal();
+    signal(sig, SIG_DFL);
+    sigemptyset(&set);
+    sigaddset(&set, sig);
+    sigprocmask(SIG_UNBLOCK, &set, NULL);
+    raise(sig);
+    /* Only reached when resuming after SIGTSTP. */
+    signal(sig, handle_signal);
+    tcsetattr(raw_fd, TCSANOW, &raw_termios);
+    write_all(terminal_on, sizeof(terminal_on) - 1);
+    raise(SIGWINCH);
+    errno = saved_errno;
+}
+
+int terminal_enable_raw(int fd) {
+    struct sigaction sa;
+    if (raw_fd >= 0) return 0;
+    if (!isatty(fd) || tcgetattr(fd, &original_termios) < 0) return -1;
+    raw_termios = original_termios;
+    raw_termios.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw_termios.c_cflag |= CS8;
+    raw_termios.c_lflag &= ~(ECHO | ICANON | IEXTEN);
+    raw_termios.c_cc[VMIN] = 1;
+    raw_termios.c_cc[VTIME] = 0;
+    if (tcsetattr(fd, TCSAFLUSH, &raw_termios) < 0) return -1;
+    raw_fd = fd;
+    write_all(terminal_on, sizeof(terminal_on) - 1);
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_signal;
+    sigemptyset(&sa.sa_mask);
+    for (size_t i = 0; i < CAUGHT_SIGNALS; i++) {
+        sigaction(caught_signals[i], &sa, &old_actions[i]);
+    }
+    if (!exit_hook_installed) {
+        atexit(terminal_disable_raw);
+        exit_hook_installed = 1;
+    }
+    return 0;
+}
+
+void terminal_disable_raw(void) {
+    if (raw_fd < 0) return;
+    restore_terminal();
+    for (size_t i = 0; i < CAUGHT_SIGNALS; i++) {
+        sigaction(caught_signals[i], &old_actions[i], NULL);
+    }
+    raw_fd = -1;
+}
+
+void input_init(Input *in, int fd) {
+    memset(in, 0, sizeof(Input));
+    in->fd = fd;
+}
+
+/* While waiting for a key, also wake up (returning KEY_NONE) when fd is readable. */
+void input_watch(Input *in, int fd) {
+    if (fd >= 0 && in->wake_count < INPUT_WAKE_FDS) in->wake_fds[in->wake_count++] = fd;
+}
+
+void input_free(Input *in) {
+    free(in->paste);
+    in->paste = NULL;
+    in->paste_len = in->paste_cap = 0;
+}
+
+/* Returns the number of bytes read, 0 on timeout or signal, -1 at end of input. */
+static int fill(Input *in, int timeout_ms) {
+    struct pollfd pfd;
+    ssize_t n;
+    if (in->start == in->end) {
+        in->start = in->end = 0;
+    } else if (in->end == sizeof(in->buf)) {
+        memmove(in->buf, in->buf + in->start, in->end - in->start);
+        in->end -= in->start;
+        in->start = 0;
+    }
+    if (in->eof) return -1;
+    if (in->end == sizeof(in->buf)) return 0;
+    pfd.fd = in->fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, timeout_ms) <= 0) return 0;
+    n = read(in->fd, in->buf + in->end, sizeof(in->buf) - in->end);
+    if (n < 0) {
+        if (errno == EINTR || errno == EAGAIN) return 0;
+        in->eof = 1;
+        return -1;
+    }
+    if (n == 0) {
+        in->eof = 1;
+        return -1;
+    }
+    in->end += n;
+    return (int)n;
+}
+
+static int next_byte(Input *in, int timeout_ms) {
+    if (in->start == in->end && fill(in, timeout_ms) <= 0) return -1;
+    return in->buf[in->start++];
+}
+
+int input_pending(Input *in) {
+    struct pollfd pfd;
+    if (in->start < in->end) return 1;
+    if (in->eof) return 0;
+    pfd.fd = in->fd;
+    pfd.events = POLLIN;
+    return poll(&pfd, 1, 0) > 0;
+}
+
+static void append_paste(Input *in, const unsigned char *data, size_t len) {
+    if (in->paste_len + len > in->paste_cap) {
+        size_t cap = in->paste_cap ? in->paste_cap : 4096;
+        while (cap < in->paste_len + len) cap *= 2;
+        in->paste = realloc(in->paste, cap);
+        in->paste_cap = cap;
+    }
+    memcpy(in->paste + in->paste_len, data, len);
+    in->paste_len += len;
+}
+
+static int read_paste(Input *in) {
+    size_t marker = sizeof(paste_end) - 1, out = 0;
+    in->paste_len = 0;
+    while (in->start < in->end || fill(in, PASTE_TIMEOUT_MS) > 0) {
+        unsigned char *data = in->buf + in->start;
+        unsigned char *esc = memchr(data, 27, in->end - in->start);
+        size_t take = esc ? (size_t)(esc - data) : in->end - in->start;
+        append_paste(in, data, take);
+        in->start += take;
+        if (!esc) continue;
+        while (in->end - in->start < marker && fill(in, PASTE_TIMEOUT_MS) > 0) {
+        }
+        if (in->end - in->start >= marker &&
+            memcmp(in->buf + in->start, paste_end, marker) == 0) {
+            in->start += marker;
+            break;
+        }
+        append_paste(in, in->buf + in->start++, 1);
+    }
+    for (size_t i = 0; i < in->paste_len; i++) {
+        if (in->paste[i] == '\r') {
+            if (i + 1 < in->paste_len && in->paste[i + 1] == '\n') continue;
+            in->paste[out++] = '\n';
+        } else {
+            in->paste[out++] = in->paste[i];
+        }
+    }
+    in->paste_len = out;
+    return PASTE_KEY;
+}
+
+static int read_csi(Input *in) {
+    int param = 0, first = 1, c;
+    while ((c = next_byte(in, ESC_TIMEOUT_MS)) >= 0) {
+        if (c >= '0' && c <= '9') {
+            if (first) param = param * 10 + (c - '0');
+        } else if (c == ';') {
+            first = 0;
+        } else if (c >= 0x40 && c <= 0x7e) {
+            break;
+        }
+    }
+    switch (c) {
+    case 'A':
+        return ARROW_UP;
+    case 'B':
+        return ARROW_DOWN;
+    case 'C':
+        return ARROW_RIGHT;
+    case 'D':
+        return ARROW_LEFT;
+    case 'H':
+        return HOME_KEY;
+    case 'F':
+        return END_KEY;
+    case '~':
+        switch (param) {
+        case 1:
+        case 7:
+            return HOME_KEY;
+        case 4:
+        case 8:
+            return END_KEY;
+        case 3:
+            return DEL_KEY;
+        case 5:
+            return PAGE_UP;
+        case 6:
+            return PAGE_DOWN;
+        case 200:
+            return read_paste(in);
+        }
+    }
+    return KEY_NONE;
+}
+
+/* A character typed as several bytes; an invalid sequence is dropped. */
+static int read_utf8(Input *in, int c) {
+    char bytes[UTF8_MAX] = { (char)c };
+    int len = c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : c >= 0xc0 ? 2 : 1, n = 1;
+    unsigned int cp;
+    while (n < len && (c = next_byte(in, ESC_TIMEOUT_MS)) >= 0) {
+        if ((c & 0xc0) != 0x80) {
+            in->start--;
+            break;
+        }
+        bytes[n++] = (char)c;
+    }
+    if (len == 1 || n < len || utf8_decode(bytes, n, &cp) != n) return KEY_NONE;
+    return (int)cp;
+}
+
+/* Turns the first byte of a key, and whatever escape sequence follows it, into the key. */
+static int decode_key(Input *in, int c) {
+    if (c == '\r') return '\n';
+    if (c >= 0x80) return read_utf8(in, c);
+    if (c != 27) return c;
+    c = next_byte(in, ESC_TIMEOUT_MS);
+    if (c < 0) return KEY_ESC;
+    if (c == '[') return read_csi(in);
+    if (c == 'O') {
+        switch (next_byte(in, ESC_TIMEOUT_MS)) {
+        case 'A':
+            return ARROW_UP;
+        case 'B':
+            return ARROW_DOWN;
+        case 'C':
+            return ARROW_RIGHT;
+        case 'D':
+            return ARROW_LEFT;
+        case 'H':
+            return HOME_KEY;
+        case 'F':
+            return END_KEY;
+        }
+        return KEY_NONE;
+    }
+    in->start--;
+    return KEY_ESC;
+}
+
+int input_read_key(Input *in, int timeout_ms) {
+    long long start;
+    int c, key;
+    if (in->wake_count > 0 && in->start == in->end && !in->eof) {
+        struct pollfd pfd[1 + INPUT_WAKE_FDS] = { { in->fd, POLLIN, 0 } };
+        for (int i = 0; i < in->wake_count; i++) {
+            pfd[i + 1].fd = in->wake_fds[i];
+            pfd[i + 1].events = POLLIN;
+        }
+        if (poll(pfd, 1 + in->wake_count, timeout_ms) <= 0 || !pfd[0].revents) return KEY_NONE;
+        timeout_ms = 0;
+    }
+    c = next_byte(in, timeout_ms);
+    if (c < 0) {
+        return in->eof ? KEY_EOF : KEY_NONE;
+    }
+    start = trace_begin();
+    key = decode_key(in, c);
+    trace_end(TRACE_INPUT, start);
+    return key;
+}
@@ -0,0 +1,55 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+
+enum editor_key {
+    KEY_EOF = -2,
+    KEY_NONE = -1,
+    KEY_ESC = 27,
+    ARROW_UP = 0x110000,
+    ARROW_DOWN,
+    ARROW_RIGHT,
+    ARROW_LEFT,
+    PAGE_UP,
+    PAGE_DOWN,
+    HOME_KEY,
+    END_KEY,
+    DEL_KEY,
+    PASTE_KEY
+};
+
+#define INPUT_BUFFER_SIZE 65536
+#define INPUT_WAKE_FDS 4
+
+/*
+ * Key decoder over a file descriptor.  Input is read in bulk and decoded
+ * from the buffer; a lone ESC is told apart from an escape sequence by a
+ * short timeout.  Other keys are Unicode code points, decoded from UTF-8;
+ * the special keys are numbered past the last of them.  A bracketed paste
+ * is returned as a single PASTE_KEY with the pasted text in
+ * paste/paste_len.
+ */
+typedef struct {
+    int fd;
+    int wake_fds[INPUT_WAKE_FDS];
+    int wake_count;
+    unsigned char buf[INPUT_BUFFER_SIZE];
+    size_t start;
+    size_t end;
+    int eof;
+    char *paste;
+    size_t paste_len;
+    size_t paste_cap;
+} Input;
+
+void input_init(Input *in, int fd);
+void input_watch(Input *in, int fd);
+void input_free(Input *in);
+int input_pending(Input *in);
+int input_read_key(Input *in, int timeout_ms);
+
+int terminal_enable_raw(int fd);
+void terminal_disable_raw(void);
+
+#endif
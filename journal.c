@@ -0,0 +1,266 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "journal.h"
+
+#define JOURNAL_MAGIC "TEJRNL01"
+#define HEADER_SIZE 32
+#define RECORD_HEAD 17
+#define RECORD_TAIL 4
+
+enum { RECORD_INSERT = 'I', RECORD_DELETE = 'D' };
+
+static uint32_t crc_table[256];
+
+static uint32_t crc32(const void *data, size_t len) {
+    const unsigned char *p = data;
+    uint32_t crc = 0xffffffffu;
+    if (!crc_table[1]) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            crc_table[i] = c;
+        }
+    }
+    while (len--) crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffffu;
+}
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static char *swap_path(const char *filename) {
+    const char *slash = strrchr(filename, '/');
+    size_t dir_len = slash ? (size_t)(slash - filename + 1) : 0;
+    char *path = malloc(strlen(filename) + 6);
+    memcpy(path, filename, dir_len);
+    sprintf(path + dir_len, ".%s.swp", filename + dir_len);
+    return path;
+}
+
+/* Records which version of the file the journal's edits apply to. */
+static void read_base(Journal *journal, const char *filename) {
+    struct stat st;
+    journal->base_size = journal->base_sec = journal->base_nsec = 0;
+    if (stat(filename, &st) == 0) {
+        journal->base_size = st.st_size;
+        journal->base_sec = st.st_mtim.tv_sec;
+        journal->base_nsec = st.st_mtim.tv_nsec;
+    }
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void append_record(Journal *journal, int type, size_t pos, const char *text, size_t len) {
+    size_t data_len = type == RECORD_INSERT ? len : 0;
+    size_t need = journal->batch_len + RECORD_HEAD + data_len + RECORD_TAIL;
+    uint64_t fields[2] = { pos, len };
+    uint32_t crc;
+    char *record;
+    if (need > journal->batch_cap) {
+        journal->batch_cap = need > journal->batch_cap * 2 ? need : journal->batch_cap * 2;
+        journal->batch = realloc(journal->batch, journal->batch_cap);
+    }
+    record = journal->batch + journal->batch_len;
+    record[0] = type;
+    memcpy(record + 1, fields, sizeof(fields));
+    memcpy(record + RECORD_HEAD, text, data_len);
+    crc = crc32(record, RECORD_HEAD + data_len);
+    memcpy(record + RECORD_HEAD + data_len, &crc, RECORD_TAIL);
+    journal->batch_len = need;
+}
+
+static void on_change(const BufferChange *change, void *arg) {
+    Journal *journal = arg;
+    if (journal->failed) return;
+    if (change->removed) append_record(journal, RECORD_DELETE, change->pos, NULL, change->removed);
+    if (change->inserted) {
+        append_record(journal, RECORD_INSERT, change->pos, change->text, change->inserted);
+    }
+    journal->dirty = 1;
+    if (!journal->pending_since) journal->pending_since = now_ms();
+    if (journal->batch_len >= JOURNAL_BATCH) journal_commit(journal);
+}
+
+/*
+ * Applies the records of an existing swap file to the buffer.  Returns
+ * the number applied, or -1 if the swap file belongs to another version of
+ * the file.  The file is cut back to the end of the last intact record.
+ */
+static int replay(Journal *journal, int fd) {
+    struct stat st;
+    char *data;
+    int64_t base[3];
+    size_t offset = HEADER_SIZE, size;
+    int count = 0;
+    if (fstat(fd, &st) < 0 || st.st_size < HEADER_SIZE) return 0;
+    size = st.st_size;
+    data = malloc(size);
+    if (!data || pread(fd, data, size, 0) != (ssize_t)size) {
+        free(data);
+        return 0;
+    }
+    memcpy(base, data + 8, sizeof(base));
+    if (memcmp(data, JOURNAL_MAGIC, 8) != 0 || base[0] != journal->base_size ||
+        base[1] != journal->base_sec || base[2] != journal->base_nsec) {
+        free(data);
+        return -1;
+    }
+    while (offset + RECORD_HEAD + RECORD_TAIL <= size) {
+        const char *record = data + offset;
+        uint64_t fields[2];
+        uint32_t crc;
+        size_t data_len;
+        memcpy(fields, record + 1, sizeof(fields));
+        data_len = record[0] == RECORD_INSERT ? fields[1] : 0;
+        if ((record[0] != RECORD_INSERT && record[0] != RECORD_DELETE) ||
+            data_len > size - offset - RECORD_HEAD - RECORD_TAIL) {
+            break;
+        }
+        memcpy(&crc, record + RECORD_HEAD + data_len, RECORD_TAIL);
+        if (crc != crc32(record, RECORD_HEAD + data_len) ||
+            fields[0] > buffer_length(journal->buffer)) {
+            break;
+        }
+        if (record[0] == RECORD_INSERT) {
+            buffer_insert(journal->buffer, fields[0], record + RECORD_HEAD, data_len);
+        } else {
+            buffer_delete(journal->buffer, fields[0], fields[1]);
+        }
+        offset += RECORD_HEAD + data_len + RECORD_TAIL;
+        count++;
+    }
+    free(data);
+    if (ftruncate(fd, offset) < 0) return count;
+    lseek(fd, offset, SEEK_SET);
+    return count;
+}
+
+/*
+ * Opens the journal for filename, whose contents are already loaded into
+ * buffer.  Returns the number of edits recovered from a swap file left by
+ * an earlier session, or -1 if a swap file was found that does not match
+ * the file; it is then moved aside to ".name.swp~".
+ */
+int journal_open(Journal *journal, const char *filename, Buffer *buffer) {
+    int recovered = 0, fd;
+    memset(journal, 0, sizeof(Journal));
+    journal->fd = -1;
+    journal->buffer = buffer;
+    journal->path = swap_path(filename);
+    read_base(journal, filename);
+    fd = open(journal->path, O_RDWR);
+    if (fd >= 0) {
+        recovered = replay(journal, fd);
+        if (recovered > 0) {
+            journal->fd = fd;
+            journal->dirty = 1;
+        } else {
+            close(fd);
+            if (recovered < 0) {
+                char *aside = malloc(strlen(journal->path) + 2);
+                sprintf(aside, "%s~", journal->path);
+                rename(journal->path, aside);
+                free(aside);
+            } else {
+                unlink(journal->path);
+            }
+        }
+    }
+    buffer_add_listener(buffer, on_change, journal);
+    return recovered;
+}
+
+/* Writes out the pending batch and syncs it: one group commit. */
+int journal_commit(Journal *journal) {
+    if (journal->batch_len == 0) return 0;
+    if (journal->failed) return -1;
+    if (journal->fd < 0) {
+        char header[HEADER_SIZE];
+        int64_t base[3] = { journal->base_size, journal->base_sec, journal->base_nsec };
+        memcpy(header, JOURNAL_MAGIC, 8);
+        memcpy(header + 8, base, sizeof(base));
+        journal->fd = open(journal->path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (journal->fd < 0 || write_all(journal->fd, header, HEADER_SIZE) < 0) {
+            journal->failed = 1;
+            return -1;
+        }
+    }
+    if (write_all(journal->fd, journal->batch, journal->batch_len) < 0 ||
+        fdatasync(journal->fd) < 0) {
+        journal->failed = 1;
+        return -1;
+    }
+    journal->batch_len = 0;
+    journal->pending_since = 0;
+    return 0;
+}
+
+/* Milliseconds until the pending batch is due, or -1 if nothing is pending. */
+int journal_timeout(const Journal *journal) {
+    long long left;
+    if (journal->batch_len == 0 || journal->failed) return -1;
+    left = journal->pending_since + JOURNAL_COMMIT_MS - now_ms();
+    return left > 0 ? (int)left : 0;
+}
+
+/* Called after the file was saved: the journal starts over against the new file. */
+void journal_saved(Journal *journal, const char *filename) {
+    if (journal->fd >= 0) {
+        close(journal->fd);
+        journal->fd = -1;
+    }
+    unlink(journal->path);
+    journal->batch_len = 0;
+    journal->pending_since = 0;
+    journal->dirty = 0;
+    journal->failed = 0;
+    read_base(journal, filename);
+}
+
+static void release(Journal *journal) {
+    if (journal->buffer) buffer_remove_listener(journal->buffer, on_change, journal);
+    if (journal->fd >= 0) close(journal->fd);
+    free(journal->path);
+    free(journal->batch);
+    memset(journal, 0, sizeof(Journal));
+    journal->fd = -1;
+}
+
+/* Keeps the swap file if there are unsaved edits, otherwise removes it. */
+void journal_close(Journal *journal) {
+    if (!journal->path) return;
+    if (journal->dirty) {
+        journal_commit(journal);
+    } else {
+        unlink(journal->path);
+    }
+    release(journal);
+}
+
+void journal_discard(Journal *journal) {
+    if (!journal->path) return;
+    unlink(journal->path);
+    release(journal);
+}
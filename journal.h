@@ -0,0 +1,43 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+
+#include "buffer.h"
+
+#define JOURNAL_COMMIT_MS 500
+#define JOURNAL_BATCH (1u << 20)
+
+/*
+ * Append-only edit journal kept in a swap file next to the file being
+ * edited (".name.swp").  Every buffer change is appended to an in-memory
+ * batch; the batch is written and fdatasync()ed as one group commit once
+ * it is large or old enough, so persistence costs O(edit), not O(file).
+ *
+ * The header records the size and mtime of the file the edits apply to.
+ * Opening a file whose swap file matches replays the journal on top of
+ * it; a torn record at the tail from a crash mid-write is cut off.
+ */
+typedef struct {
+    char *path;
+    int fd;
+    Buffer *buffer;
+    char *batch;
+    size_t batch_len;
+    size_t batch_cap;
+    long long pending_since;
+    long long base_size;
+    long long base_sec;
+    long long base_nsec;
+    int dirty;
+    int failed;
+} Journal;
+
+int journal_open(Journal *journal, const char *filename, Buffer *buffer);
+int journal_commit(Journal *journal);
+int journal_timeout(const Journal *journal);
+void journal_saved(Journal *journal, const char *filename);
+void journal_close(Journal *journal);
+void journal_discard(Journal *journal);
+
+#endif
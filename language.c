@@ -0,0 +1,152 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "language.h"
+
+static const char *const c_extensions[] = { ".c", ".h", NULL };
+static const char *const c_keywords[] = {
+    "auto", "break", "case", "char", "const", "continue", "default", "do",
+    "double", "else", "enum", "extern", "float", "for", "goto", "if",
+    "inline", "int", "long", "register", "restrict", "return", "short", "signed",
+    "sizeof", "static", "struct", "switch", "typedef", "union", "unsigned", "void",
+    "volatile", "while",
+    NULL
+};
+
+static const char *const cpp_extensions[] = {
+    ".cc", ".cpp", ".cxx", ".hh", ".hpp", ".hxx", NULL
+};
+static const char *const cpp_keywords[] = {
+    "alignas", "alignof", "auto", "bool", "break", "case", "catch", "char",
+    "class", "const", "const_cast", "constexpr", "continue", "decltype", "default",
+    "delete", "do", "double", "dynamic_cast", "else", "enum", "explicit", "export",
+    "extern", "false", "final", "float", "for", "friend", "goto", "if", "inline",
+    "int", "long", "mutable", "namespace", "new", "noexcept", "nullptr", "operator",
+    "override", "private", "protected", "public", "register", "reinterpret_cast",
+    "return", "short", "signed", "sizeof", "static", "static_assert", "static_cast",
+    "struct", "switch", "template", "this", "throw", "true", "try", "typedef",
+    "typeid", "typename", "union", "unsigned", "using", "virtual", "void",
+    "volatile", "while",
+    NULL
+};
+
+static const char *const python_extensions[] = { ".py", ".pyw", NULL };
+static const char *const python_keywords[] = {
+    "False", "None", "True", "and", "as", "assert", "async", "await", "break",
+    "class", "continue", "def", "del", "elif", "else", "except", "finally", "for",
+    "from", "global", "if", "import", "in", "is", "lambda", "nonlocal", "not", "or",
+    "pass", "raise", "return", "try", "while", "with", "yield",
+    NULL
+};
+
+static const char *const shell_extensions[] = { ".sh", ".bash", NULL };
+static const char *const shell_keywords[] = {
+    "case", "do", "done", "elif", "else", "esac", "export", "fi", "for", "function",
+    "if", "in", "local", "readonly", "return", "select", "then", "until", "while",
+    NULL
+};
+
+static const char *const json_extensions[] = { ".json", NULL };
+static const char *const json_keywords[] = { "false", "null", "true", NULL };
+
+static const char *const no_extensions[] = { NULL };
+static const char *const no_keywords[] = { NULL };
+
+static Language languages[] = {
+    { .name = "c", .extensions = c_extensions, .keywords = c_keywords,
+      .line_comment = "//", .block_open = "/*", .block_close = "*/", .quotes = "\"'",
+      .flags = LANG_CONTINUATION },
+    { .name = "c++", .extensions = cpp_extensions, .keywords = cpp_keywords,
+      .line_comment = "//", .block_open = "/*", .block_close = "*/", .quotes = "\"'",
+      .flags = LANG_CONTINUATION },
+    { .name = "python", .extensions = python_extensions, .keywords = python_keywords,
+      .line_comment = "#", .quotes = "\"'", .flags = LANG_CONTINUATION | LANG_TRIPLE_QUOTES },
+    { .name = "shell", .extensions = shell_extensions, .keywords = shell_keywords,
+      .line_comment = "#", .quotes = "\"'",
+      .flags = LANG_MULTILINE_STRINGS | LANG_RAW_SINGLE_QUOTES | LANG_COMMENT_AFTER_SPACE },
+    { .name = "json", .extensions = json_extensions, .keywords = json_keywords,
+      .quotes = "\"" },
+    { .name = "text", .extensions = no_extensions, .keywords = no_keywords, .quotes = "" },
+};
+
+#define LANGUAGE_COUNT (sizeof(languages) / sizeof(languages[0]))
+
+/* Tries seeds until every keyword lands in its own slot of a table of size mask + 1. */
+static int place_keywords(Language *lang, size_t count) {
+    for (unsigned seed = 1; seed < 4096; seed++) {
+        size_t i;
+        memset(lang->slots, 0, (lang->mask + 1) * sizeof(const char *));
+        memset(lang->slot_lengths, 0, lang->mask + 1);
+        for (i = 0; i < count; i++) {
+            const char *word = lang->keywords[i];
+            unsigned slot = keyword_hash(word, strlen(word), seed) & lang->mask;
+            if (lang->slots[slot]) break;
+            lang->slots[slot] = word;
+            lang->slot_lengths[slot] = strlen(word);
+        }
+        if (i == count) {
+            lang->seed = seed;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void build_keywords(Language *lang) {
+    size_t count = 0, size = 8;
+    lang->min_keyword = (size_t)-1;
+    lang->max_keyword = 0;
+    for (; lang->keywords[count]; count++) {
+        size_t len = strlen(lang->keywords[count]);
+        if (len < lang->min_keyword) lang->min_keyword = len;
+        if (len > lang->max_keyword) lang->max_keyword = len;
+    }
+    while (size < count * 2) size *= 2;
+    while (1) {
+        lang->mask = size - 1;
+        lang->slots = realloc(lang->slots, size * sizeof(const char *));
+        lang->slot_lengths = realloc(lang->slot_lengths, size);
+        if (place_keywords(lang, count)) return;
+        size *= 2;
+    }
+}
+
+static void build_classes(Language *lang) {
+    memset(lang->classes, CLASS_OTHER, sizeof(lang->classes));
+    for (int c = 'a'; c <= 'z'; c++) lang->classes[c] = CLASS_WORD;
+    for (int c = 'A'; c <= 'Z'; c++) lang->classes[c] = CLASS_WORD;
+    for (int c = '0'; c <= '9'; c++) lang->classes[c] = CLASS_DIGIT;
+    lang->classes['_'] = CLASS_WORD;
+    for (const char *q = lang->quotes; *q; q++) lang->classes[(unsigned char)*q] = CLASS_QUOTE;
+    if (lang->line_comment) lang->classes[(unsigned char)lang->line_comment[0]] = CLASS_COMMENT;
+    if (lang->block_open) lang->classes[(unsigned char)lang->block_open[0]] = CLASS_COMMENT;
+}
+
+static const Language *prepare(Language *lang) {
+    if (!lang->ready) {
+        build_keywords(lang);
+        build_classes(lang);
+        lang->ready = 1;
+    }
+    return lang;
+}
+
+/* Picks a language by file extension; anything unknown is plain text. */
+const Language *language_for_file(const char *filename) {
+    const char *dot = filename ? strrchr(filename, '.') : NULL;
+    if (dot) {
+        for (size_t i = 0; i < LANGUAGE_COUNT; i++) {
+            for (const char *const *ext = languages[i].extensions; *ext; ext++) {
+                if (strcmp(dot, *ext) == 0) return prepare(&languages[i]);
+            }
+        }
+    }
+    return prepare(&languages[LANGUAGE_COUNT - 1]);
+}
+
+const Language *language_by_name(const char *name) {
+    for (size_t i = 0; i < LANGUAGE_COUNT; i++) {
+        if (strcmp(languages[i].name, name) == 0) return prepare(&languages[i]);
+    }
+    return NULL;
+}
@@ -0,0 +1,68 @@
+#ifndef LANGUAGE_H
+#define LANGUAGE_H
+
+#include <stddef.h>
+#include <string.h>
+
+/* Character classes used by the lexer's dispatch table. */
+enum {
+    CLASS_OTHER,
+    CLASS_WORD,
+    CLASS_DIGIT,
+    CLASS_QUOTE,
+    CLASS_COMMENT
+};
+
+enum {
+    LANG_CONTINUATION = 1,      /* a trailing backslash continues a string */
+    LANG_MULTILINE_STRINGS = 2, /* strings may span lines as they are */
+    LANG_TRIPLE_QUOTES = 4,     /* """ and ''' strings */
+    LANG_RAW_SINGLE_QUOTES = 8, /* no escapes inside '...' */
+    LANG_COMMENT_AFTER_SPACE = 16
+};
+
+/*
+ * A language definition.  The keyword list is compiled into a perfect
+ * hash table and the character classes into a 256-entry table the first
+ * time the language is looked up, so the lexer never compares strings
+ * against more than one keyword.
+ */
+typedef struct {
+    const char *name;
+    const char *const *extensions;
+    const char *const *keywords;
+    const char *line_comment;
+    const char *block_open;
+    const char *block_close;
+    const char *quotes;
+    int flags;
+    int ready;
+    unsigned char classes[256];
+    const char **slots;
+    unsigned char *slot_lengths;
+    unsigned mask;
+    unsigned seed;
+    size_t min_keyword;
+    size_t max_keyword;
+} Language;
+
+const Language *language_for_file(const char *filename);
+const Language *language_by_name(const char *name);
+
+static inline unsigned keyword_hash(const char *word, size_t len, unsigned seed) {
+    unsigned h = seed ^ (unsigned)len;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)word[i]) * 0x01000193u;
+    }
+    return h ^ (h >> 15);
+}
+
+/* Called for every identifier the lexer sees, so it lives here to be inlined. */
+static inline int language_is_keyword(const Language *lang, const char *word, size_t len) {
+    unsigned slot;
+    if (len < lang->min_keyword || len > lang->max_keyword) return 0;
+    slot = keyword_hash(word, len, lang->seed) & lang->mask;
+    return lang->slot_lengths[slot] == len && memcmp(lang->slots[slot], word, len) == 0;
+}
+
+#endif
@@ -0,0 +1,112 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 0xffff
+/* The last bytes are always literals, so a match never reads past the input. */
+#define LZ_LAST_LITERALS 5
+#define LZ_MATCH_LIMIT 12
+
+static uint32_t read32(const unsigned char *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static unsigned int hash(uint32_t value) {
+    return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static unsigned char *put_length(unsigned char *out, size_t len) {
+    while (len >= 255) {
+        *out++ = 255;
+        len -= 255;
+    }
+    *out++ = (unsigned char)len;
+    return out;
+}
+
+static unsigned char *put_literals(unsigned char *out, const unsigned char *from, size_t len,
+                                   size_t match) {
+    *out++ = (unsigned char)((len >= 15 ? 15 : len) << 4 | (match >= 15 ? 15 : match));
+    if (len >= 15) out = put_length(out, len - 15);
+    memcpy(out, from, len);
+    return out + len;
+}
+
+size_t lz_bound(size_t len) {
+    return len + len / 255 + 16;
+}
+
+size_t lz_compress(const char *src, size_t len, char *dst) {
+    uint32_t table[1 << LZ_HASH_BITS] = { 0 };
+    const unsigned char *in = (const unsigned char *)src, *end = in + len;
+    const unsigned char *p = in, *anchor = in;
+    const unsigned char *limit = len > LZ_MATCH_LIMIT ? end - LZ_MATCH_LIMIT : in;
+    unsigned char *out = (unsigned char *)dst;
+    while (p < limit) {
+        uint32_t value = read32(p);
+        unsigned int h = hash(value);
+        const unsigned char *ref = in + table[h], *m;
+        table[h] = (uint32_t)(p - in);
+        if (ref >= p || p - ref > LZ_MAX_OFFSET || read32(ref) != value) {
+            p++;
+            continue;
+        }
+        for (m = p + LZ_MIN_MATCH, ref += LZ_MIN_MATCH; m < end - LZ_LAST_LITERALS && *m == *ref;
+             m++, ref++) {
+        }
+        out = put_literals(out, anchor, p - anchor, m - p - LZ_MIN_MATCH);
+        *out++ = (unsigned char)((m - ref) & 0xff);
+        *out++ = (unsigned char)((m - ref) >> 8);
+        if (m - p - LZ_MIN_MATCH >= 15) out = put_length(out, m - p - LZ_MIN_MATCH - 15);
+        p = anchor = m;
+    }
+    out = put_literals(out, anchor, end - anchor, 0);
+    return out - (unsigned char *)dst;
+}
+
+static int get_length(const unsigned char **in, const unsigned char *end, size_t *len) {
+    unsigned char byte;
+    do {
+        if (*in >= end) return -1;
+        byte = *(*in)++;
+        *len += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+int lz_decompress(const char *src, size_t len, char *dst, size_t raw) {
+    const unsigned char *in = (const unsigned char *)src, *end = in + len;
+    unsigned char *out = (unsigned char *)dst, *out_end = out + raw;
+    while (in < end) {
+        unsigned int token = *in++;
+        size_t literals = token >> 4, match = token & 15, offset;
+        if (literals == 15 && get_length(&in, end, &literals) < 0) return -1;
+        if (literals > (size_t)(end - in) || literals > (size_t)(out_end - out)) return -1;
+        memcpy(out, in, literals);
+        in += literals;
+        out += literals;
+        if (in == end) break;
+        if (end - in < 2) return -1;
+        offset = in[0] | (size_t)in[1] << 8;
+        in += 2;
+        if (match == 15 && get_length(&in, end, &match) < 0) return -1;
+        match += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(out - (unsigned char *)dst) ||
+            match > (size_t)(out_end - out)) {
+            return -1;
+        }
+        if (offset >= match) {
+            memcpy(out, out - offset, match);
+        } else {
+            /* Byte by byte, since the match overlaps the bytes it produces. */
+            for (size_t i = 0; i < match; i++) out[i] = out[i - offset];
+        }
+        out += match;
+    }
+    return out == out_end ? 0 : -1;
+}
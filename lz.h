@@ -0,0 +1,23 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+
+/*
+ * Byte-oriented LZ77 in the style of LZ4's block format: each sequence is
+ * a token holding a literal length and a match length, the literals, and
+ * a two-byte offset back into the output.  Matches are found through one
+ * hash table of four-byte prefixes, so compression is a single pass and
+ * decompression is copies only.  Undo history is mostly source text and
+ * small integers, which this halves or better at memcpy-like speed.
+ *
+ * lz_decompress() checks every length and offset against both buffers,
+ * so a corrupt block fails instead of writing out of bounds.
+ */
+size_t lz_bound(size_t len);
+/* Compresses len bytes of src into dst, which holds lz_bound(len); returns the size. */
+size_t lz_compress(const char *src, size_t len, char *dst);
+/* Returns 0 if src expands to exactly raw bytes. */
+int lz_decompress(const char *src, size_t len, char *dst, size_t raw);
+
+#endif
@@ -1,9 +1,21 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
-extern void editor(const char *filename);
-extern void print_syntax_highlighted(const char *line, int is_selected);
+#include "batch.h"
+#include "diff.h"
+#include "editor.h"
+#include "grep.h"
+#include "re.h"
+#include "search.h"
+#include "syntax.h"
+#include "trigram.h"
+#include "viewer.h"
 
 void create_file(const char *filename)
 {
@@ -20,6 +32,14 @@ void create_file(const char *filename)
 }
 void view_file(const char *filename)
 {
+    if (isatty(STDIN_FILENO) && isatty(STDOUT_FILENO))
+    {
+        if (view_large_file(filename) < 0)
+        {
+            printf("File not found.\n");
+        }
+        return;
+    }
     FILE *file = fopen(filename, "r");
     if (!file)
     {
@@ -40,38 +60,380 @@ void update_file(const char *filename)
 {
     editor(filename);
 }
+static int print_match(const SearchMatch *match, void *arg)
+{
+    printf("Found '%s' on line %zu, column %zu: %.*s\n", (const char *)arg, match->line,
+           match->column, (int)match->line_length, match->line_text);
+    return 0;
+}
+/* Reads a pattern and its options; regex may be NULL where only literals are searched. */
+static int prompt_pattern(SearchPattern *pattern, Regex **regex, char *word, size_t size)
+{
+    printf("Enter the text to search: ");
+    char options[16] = "";
+    if (!fgets(word, size, stdin))
+    {
+        word[0] = '\0';
+    }
+    word[strcspn(word, "\n")] = '\0';
+    if (regex)
+    {
+        *regex = NULL;
+        printf("Options (i = ignore case, w = whole word, c = count only, "
+               "r = regular expression, Enter for none): ");
+    }
+    else
+    {
+        printf("Options (i = ignore case, w = whole word, c = count only, Enter for none): ");
+    }
+    if (fgets(options, sizeof(options), stdin))
+    {
+        options[strcspn(options, "\n")] = '\0';
+    }
+    int flags = 0;
+    if (strchr(options, 'i')) flags |= SEARCH_IGNORE_CASE;
+    if (strchr(options, 'w')) flags |= SEARCH_WHOLE_WORD;
+    if (strchr(options, 'c')) flags |= SEARCH_COUNT_ONLY;
+    if (regex && strchr(options, 'r') && word[0])
+    {
+        const char *error = "";
+        if (flags & SEARCH_WHOLE_WORD)
+        {
+            printf("Whole word cannot be combined with a regular expression.\n");
+            return 0;
+        }
+        *regex = re_compile(word, flags & SEARCH_IGNORE_CASE ? RE_IGNORE_CASE : 0, &error);
+        if (!*regex)
+        {
+            printf("Bad regular expression: %s.\n", error);
+            return 0;
+        }
+        memset(pattern, 0, sizeof(*pattern));
+        pattern->flags = flags;
+        return 1;
+    }
+    if (search_compile(pattern, word, strlen(word), flags) < 0)
+    {
+        printf("Nothing to search for.\n");
+        return 0;
+    }
+    return 1;
+}
+static void free_pattern(SearchPattern *pattern, Regex *regex)
+{
+    if (regex)
+    {
+        re_free(regex);
+    }
+    else
+    {
+        search_free(pattern);
+    }
+}
 void search_in_file(const char *filename)
 {
-    FILE *file = fopen(filename, "r");
-    if (!file)
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
     {
         printf("File not found.\n");
         return;
     }
-    printf("Enter the word to search: ");
-    char word[100], line[256];
-    scanf("%s", word);
+    char word[1024];
+    SearchPattern pattern;
+    Regex *regex;
+    if (prompt_pattern(&pattern, &regex, word, sizeof(word)))
+    {
+        long long found;
+        if (regex)
+        {
+            found = re_search_fd(regex, fd,
+                                 pattern.flags & SEARCH_COUNT_ONLY ? NULL : print_match, word);
+        }
+        else
+        {
+            found = search_fd(&pattern, fd, print_match, word);
+        }
+        if (found < 0)
+        {
+            printf("Failed to read %s.\n", filename);
+        }
+        else if (found == 0)
+        {
+            printf("'%s' not found in the file.\n", word);
+        }
+        else if (pattern.flags & SEARCH_COUNT_ONLY)
+        {
+            printf("'%s' found %lld times.\n", word, found);
+        }
+        free_pattern(&pattern, regex);
+    }
+    close(fd);
+    printf("Press Enter to continue...\n");
+    getchar();
+}
+static int print_tree_match(const char *path, const SearchMatch *match, void *arg)
+{
+    (void)arg;
+    printf("%s:%zu:%zu: %.*s\n", path, match->line, match->column, (int)match->line_length,
+           match->line_text);
+    return 0;
+}
+static void prompt_ignore(GrepOptions *options, const char **ignore, char *globs, size_t size)
+{
+    printf("Skip names matching (globs separated by spaces, Enter for none): ");
+    if (fgets(globs, size, stdin))
+    {
+        for (char *glob = strtok(globs, " \t\n"); glob && options->ignore_count < 64;
+             glob = strtok(NULL, " \t\n"))
+        {
+            ignore[options->ignore_count++] = glob;
+        }
+    }
+}
+static void print_tree_result(long long found, const SearchPattern *pattern, const char *word,
+                              const char *path)
+{
+    if (found < 0)
+    {
+        printf("%s not found.\n", path);
+    }
+    else if (found == 0)
+    {
+        printf("'%s' not found under %s.\n", word, path);
+    }
+    else if (pattern->flags & SEARCH_COUNT_ONLY)
+    {
+        printf("'%s' found %lld times.\n", word, found);
+    }
+}
+static double elapsed_ms(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+void search_in_directory(const char *path)
+{
+    char word[1024], globs[1024] = "";
+    const char *ignore[64];
+    GrepOptions options = { ignore, 0, NULL };
+    SearchPattern pattern;
+    Regex *regex;
+    if (!prompt_pattern(&pattern, &regex, word, sizeof(word)))
+    {
+        printf("Press Enter to continue...\n");
+        getchar();
+        return;
+    }
+    options.regex = regex;
+    prompt_ignore(&options, ignore, globs, sizeof(globs));
+    long long found = grep_tree(pool_default(), &pattern, path, &options, print_tree_match, NULL);
+    print_tree_result(found, &pattern, word, path);
+    free_pattern(&pattern, regex);
+    printf("Press Enter to continue...\n");
+    getchar();
+}
+void indexed_search(const char *path)
+{
+    char word[1024], globs[1024] = "";
+    const char *ignore[64];
+    GrepOptions options = { ignore, 0, NULL };
+    SearchPattern pattern;
+    Regex *regex;
+    TrigramStats stats;
+    TrigramQuery query;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (trigram_update(pool_default(), path, &stats) < 0)
+    {
+        printf("Failed to index %s.\n", path);
+        printf("Press Enter to continue...\n");
+        getchar();
+        return;
+    }
+    printf("Indexed %zu files (%zu read, %zu unchanged, %zu removed), %zu trigrams, "
+           "%zu bytes in %.1f ms.\n", stats.files, stats.indexed, stats.reused, stats.removed,
+           stats.trigrams, stats.bytes, elapsed_ms(&start));
+    if (!prompt_pattern(&pattern, &regex, word, sizeof(word)))
+    {
+        printf("Press Enter to continue...\n");
+        getchar();
+        return;
+    }
+    options.regex = regex;
+    prompt_ignore(&options, ignore, globs, sizeof(globs));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long long found = trigram_search(pool_default(), path, &pattern, &options, print_tree_match,
+                                     NULL, &query);
+    print_tree_result(found, &pattern, word, path);
+    if (found >= 0)
+    {
+        printf("%zu of %zu files searched in %.1f ms.\n", query.candidates, query.files,
+               elapsed_ms(&start));
+    }
+    free_pattern(&pattern, regex);
+    printf("Press Enter to continue...\n");
     getchar();
-    int found = 0, line_number = 1;
+}
+static void print_batch_stats(const char *filename, const BatchStats *stats, double ms)
+{
+    printf("Edited %s: %zu lines read, %zu deleted, %zu inserted, %zu substitutions; "
+           "%lld bytes copied by the kernel, %lld written, in %.1f ms.\n", filename,
+           stats->lines, stats->deleted, stats->inserted, stats->substituted, stats->copied,
+           stats->written, ms);
+}
+/* Reads one command per line, skipping # comments; with stop_at_blank an empty line ends it. */
+static int read_script(BatchScript *script, FILE *file, int stop_at_blank)
+{
+    char line[4096];
+    int errors = 0;
     while (fgets(line, sizeof(line), file))
     {
-        if (strstr(line, word))
+        const char *error;
+        const char *p = line + strspn(line, " \t");
+        if (*p == '\n' || *p == '\0')
         {
-            printf("Found '%s' on line %d: %s", word, line_number, line);
-            found = 1;
+            if (stop_at_blank) break;
+            continue;
+        }
+        if (*p == '#') continue;
+        if (batch_parse(script, p, &error) < 0)
+        {
+            fprintf(stderr, "Bad command %.*s: %s.\n", (int)strcspn(p, "\n"), p, error);
+            errors++;
         }
-        line_number++;
     }
-    if (!found)
+    return errors;
+}
+void batch_edit(const char *filename)
+{
+    char output[256] = "";
+    BatchScript script = { 0 };
+    BatchStats stats;
+    struct timespec start;
+    printf("Write to (Enter to edit the file in place): ");
+    if (fgets(output, sizeof(output), stdin))
     {
-        printf("'%s' not found in the file.\n", word);
+        output[strcspn(output, "\n")] = '\0';
     }
-    fclose(file);
+    printf("Enter commands, one per line, then an empty line:\n"
+           "  [n[,m]]d delete, [n]i text insert before, [n]a text append after,\n"
+           "  [n[,m]]s/regex/text/[gi] substitute; n and m are line numbers or $ for the last\n");
+    if (read_script(&script, stdin, 1) == 0 && script.count > 0)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (batch_run(&script, filename, output[0] ? output : NULL, &stats) < 0)
+        {
+            printf("Failed to edit %s: %s.\n", filename, strerror(errno));
+        }
+        else
+        {
+            print_batch_stats(output[0] ? output : filename, &stats, elapsed_ms(&start));
+        }
+    }
+    batch_free(&script);
+    printf("Press Enter to continue...\n");
+    getchar();
+}
+void compare_files(const char *filename)
+{
+    char other[256] = "";
+    char *a = NULL, *b = NULL;
+    size_t a_len, b_len;
+    struct timespec start;
+    Diff diff;
+    printf("Compare with: ");
+    if (fgets(other, sizeof(other), stdin))
+    {
+        other[strcspn(other, "\n")] = '\0';
+    }
+    if (!(a = diff_read_file(filename, &a_len)) || !(b = diff_read_file(other, &b_len)))
+    {
+        printf("Cannot read %s: %s.\n", a ? other : filename, strerror(errno));
+    }
+    else
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (diff_compute(&diff, a, a_len, b, b_len) < 0)
+        {
+            printf("Failed to compare the files: %s.\n", strerror(errno));
+        }
+        else
+        {
+            double ms = elapsed_ms(&start);
+            diff_write(&diff, stdout, filename, other, DIFF_CONTEXT);
+            printf("%zu lines removed and %zu added in %zu places, compared in %.1f ms.\n",
+                   diff.deleted, diff.inserted, diff.count, ms);
+            diff_free(&diff);
+        }
+    }
+    free(a);
+    free(b);
     printf("Press Enter to continue...\n");
     getchar();
 }
-int main()
+/* texteditor [-e command]... [-f script] input [output] runs a batch edit without the menu. */
+static int batch_main(int argc, char **argv)
 {
+    BatchScript script = { 0 };
+    BatchStats stats;
+    struct timespec start;
+    const char *error;
+    int opt, errors = 0;
+    while ((opt = getopt(argc, argv, "e:f:")) != -1)
+    {
+        if (opt == 'e')
+        {
+            if (batch_parse(&script, optarg, &error) < 0)
+            {
+                fprintf(stderr, "Bad command %s: %s.\n", optarg, error);
+                errors++;
+            }
+        }
+        else if (opt == 'f')
+        {
+            FILE *file = fopen(optarg, "r");
+            if (!file)
+            {
+                fprintf(stderr, "%s: %s.\n", optarg, strerror(errno));
+                errors++;
+                continue;
+            }
+            errors += read_script(&script, file, 0);
+            fclose(file);
+        }
+        else
+        {
+            errors++;
+        }
+    }
+    if (errors || optind >= argc || argc - optind > 2 || script.count == 0)
+    {
+        if (!errors)
+        {
+            fprintf(stderr, "usage: %s [-e command]... [-f script] input [output]\n", argv[0]);
+        }
+        batch_free(&script);
+        return 2;
+    }
+    const char *output = optind + 1 < argc ? argv[optind + 1] : NULL;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (batch_run(&script, argv[optind], output, &stats) < 0)
+    {
+        fprintf(stderr, "Failed to edit %s: %s.\n", argv[optind], strerror(errno));
+        batch_free(&script);
+        return 1;
+    }
+    print_batch_stats(output ? output : argv[optind], &stats, elapsed_ms(&start));
+    batch_free(&script);
+    return 0;
+}
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+    {
+        return batch_main(argc, argv);
+    }
     while (1)
     {
         printf("Basic Text Editor\n");
@@ -80,6 +442,10 @@ int main()
         printf("3. Update File\n");
         printf("4. Search in File\n");
         printf("5. Exit\n");
+        printf("6. Search in Directory\n");
+        printf("7. Indexed Search in Directory\n");
+        printf("8. Batch Edit File\n");
+        printf("9. Compare Files\n");
         printf("Enter your choice: ");
         int choice;
         scanf("%d", &choice);
@@ -113,6 +479,30 @@ int main()
             break;
         case 5:
             exit(0);
+        case 6:
+            printf("Enter directory to search: ");
+            scanf("%s", filename);
+            getchar();
+            search_in_directory(filename);
+            break;
+        case 7:
+            printf("Enter directory to index and search: ");
+            scanf("%s", filename);
+            getchar();
+            indexed_search(filename);
+            break;
+        case 8:
+            printf("Enter file name to edit: ");
+            scanf("%s", filename);
+            getchar();
+            batch_edit(filename);
+            break;
+        case 9:
+            printf("Enter file name to compare: ");
+            scanf("%s", filename);
+            getchar();
+            compare_files(filename);
+            break;
         default:
             printf("Invalid choice. Try again.\n");
         }
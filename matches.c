@@ -0,0 +1,305 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+
+#include "matches.h"
+
+/* A background scan: one block at a time is copied into text and searched with its own regex. */
+typedef struct MatchJob {
+    Job job;
+    MatchSet *set;
+    Regex *regex;
+    char *text;
+    size_t text_cap;
+    size_t len;
+    size_t taken;
+    int last;
+    MatchSpan *spans;
+    size_t count;
+    size_t capacity;
+} MatchJob;
+
+size_t matches_count(const MatchSet *set) {
+    return set->capacity - (set->gap_end - set->gap_start);
+}
+
+size_t matches_memory(const MatchSet *set) {
+    size_t bytes = set->capacity * sizeof(MatchSpan) + set->text_cap;
+    if (set->job) bytes += set->job->text_cap + set->job->capacity * sizeof(MatchSpan);
+    return bytes;
+}
+
+static const MatchSpan *slot(const MatchSet *set, size_t index) {
+    return &set->spans[index < set->gap_start ? index : index + set->gap_end - set->gap_start];
+}
+
+static size_t span_start(const MatchSet *set, size_t index) {
+    if (index < set->gap_start) return set->spans[index].start;
+    return set->length - slot(set, index)->start;
+}
+
+MatchSpan matches_get(const MatchSet *set, size_t index) {
+    MatchSpan span = *slot(set, index);
+    span.start = span_start(set, index);
+    return span;
+}
+
+size_t matches_find(const MatchSet *set, size_t pos) {
+    size_t lo = 0, hi = matches_count(set);
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (span_start(set, mid) < pos) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Spans after the gap count back from the end of the buffer, so they change form as they cross it. */
+static void move_gap(MatchSet *set, size_t index) {
+    while (set->gap_start > index) {
+        MatchSpan span = set->spans[--set->gap_start];
+        span.start = set->length - span.start;
+        set->spans[--set->gap_end] = span;
+    }
+    while (set->gap_start < index) {
+        MatchSpan span = set->spans[set->gap_end++];
+        span.start = set->length - span.start;
+        set->spans[set->gap_start++] = span;
+    }
+}
+
+static void add_span(MatchSet *set, size_t start, size_t length) {
+    if (set->gap_start == set->gap_end) {
+        size_t tail = set->capacity - set->gap_end;
+        size_t capacity = set->capacity ? set->capacity * 2 : 256;
+        set->spans = realloc(set->spans, capacity * sizeof(MatchSpan));
+        memmove(set->spans + capacity - tail, set->spans + set->gap_end, tail * sizeof(MatchSpan));
+        set->gap_end = capacity - tail;
+        set->capacity = capacity;
+    }
+    set->spans[set->gap_start].start = start;
+    set->spans[set->gap_start].length = length;
+    set->gap_start++;
+}
+
+/*
+ * Reads whole lines from pos up to to into *text, about MATCHES_BLOCK at a
+ * time; returns the bytes taken.
+ */
+static size_t read_lines(const Buffer *buffer, char **text, size_t *cap, size_t pos, size_t to,
+                         size_t *len) {
+    size_t want = MATCHES_BLOCK;
+    while (1) {
+        size_t got;
+        const char *nl;
+        if (want > to - pos) want = to - pos;
+        if (want + 1 > *cap) {
+            *cap = want + 1;
+            *text = realloc(*text, *cap);
+        }
+        got = buffer_read(buffer, pos, want, *text);
+        if (pos + got >= to) {
+            *len = got;
+            return got + 1;
+        }
+        nl = memrchr(*text, '\n', got);
+        if (nl) {
+            *len = nl - *text;
+            return *len + 1;
+        }
+        want *= 2;
+    }
+}
+
+/* Adds the matches from from, the start of a line, to to, the end of one, at the gap. */
+static void scan(MatchSet *set, size_t from, size_t to) {
+    while (1) {
+        size_t len, at = 0, s, e;
+        size_t taken = read_lines(set->buffer, &set->text, &set->text_cap, from, to, &len);
+        while (at <= len && re_search(set->regex, set->text, len, at, &s, &e)) {
+            add_span(set, from + s, e - s);
+            at = e > s ? e : e + 1;
+        }
+        if (from + len >= to) break;
+        from += taken;
+    }
+}
+
+/* Runs on a worker: the matches in the copied block, relative to its start. */
+static void search_block(Job *job) {
+    MatchJob *work = job->arg;
+    size_t at = 0, s, e;
+    work->count = 0;
+    while (at <= work->len && re_search(work->regex, work->text, work->len, at, &s, &e)) {
+        if (job_cancelled(job)) return;
+        if (work->count == work->capacity) {
+            work->capacity = work->capacity ? work->capacity * 2 : 256;
+            work->spans = realloc(work->spans, work->capacity * sizeof(MatchSpan));
+        }
+        work->spans[work->count].start = s;
+        work->spans[work->count].length = e - s;
+        work->count++;
+        at = e > s ? e : e + 1;
+    }
+}
+
+/* Copies out the block at the end of what has been scanned and hands it to the pool. */
+static void submit_block(MatchSet *set) {
+    MatchJob *work = set->job;
+    work->taken = read_lines(set->buffer, &work->text, &work->text_cap, set->scanned,
+                             set->length, &work->len);
+    work->last = set->scanned + work->len >= set->length;
+    pool_submit(set->pool, &work->job);
+}
+
+static void free_job(MatchJob *work) {
+    re_free(work->regex);
+    free(work->text);
+    free(work->spans);
+    free(work);
+}
+
+static void stop_scan(MatchSet *set) {
+    if (!set->job) return;
+    cancel(&set->token);
+    pool_wait(set->pool, &set->job->job);
+    free_job(set->job);
+    set->job = NULL;
+}
+
+/*
+ * Runs on the main thread: adds the block's matches after the others and
+ * goes on to the next block.  A block an edit has reached since it was
+ * copied is read again from where the scan now stands.
+ */
+static void merge_block(Job *job) {
+    MatchJob *work = job->arg;
+    MatchSet *set = work->set;
+    if (!job_cancelled(job)) {
+        move_gap(set, matches_count(set));
+        for (size_t i = 0; i < work->count; i++) {
+            add_span(set, set->scanned + work->spans[i].start, work->spans[i].length);
+        }
+        set->scanned += work->taken;
+        if (work->last) {
+            set->job = NULL;
+            free_job(work);
+            return;
+        }
+    }
+    submit_block(set);
+}
+
+/*
+ * Drops the matches on the lines an edit touched, in their old positions,
+ * and scans them again.  If a background scan has not got past those lines
+ * yet, it is sent back to the first of them instead.
+ */
+static void on_change(const BufferChange *change, void *arg) {
+    MatchSet *set = arg;
+    size_t last = change->line + change->inserted_lines, lo, hi;
+    size_t first = buffer_line_start(set->buffer, change->line);
+    size_t end = buffer_line_start(set->buffer, last) + buffer_line_length(set->buffer, last);
+    size_t old_end = end - change->inserted + change->removed;
+    if (!set->regex) return;
+    lo = matches_find(set, first);
+    if (set->job && old_end >= set->scanned) {
+        move_gap(set, lo);
+        set->gap_end = set->capacity;
+        set->length = buffer_length(set->buffer);
+        if (first < set->scanned) set->scanned = first;
+        cancel(&set->token);
+        return;
+    }
+    hi = matches_find(set, old_end + 1);
+    move_gap(set, lo);
+    set->gap_end += hi - lo;
+    set->length = buffer_length(set->buffer);
+    if (set->job) set->scanned = set->scanned - change->removed + change->inserted;
+    scan(set, first, end);
+}
+
+void matches_init(MatchSet *set, Buffer *buffer) {
+    memset(set, 0, sizeof(MatchSet));
+    set->buffer = buffer;
+    cancel_init(&set->token);
+    buffer_add_listener(buffer, on_change, set);
+}
+
+void matches_background(MatchSet *set, Pool *pool) {
+    set->pool = pool;
+}
+
+void matches_free(MatchSet *set) {
+    if (!set->buffer) return;
+    stop_scan(set);
+    buffer_remove_listener(set->buffer, on_change, set);
+    free(set->spans);
+    free(set->text);
+    memset(set, 0, sizeof(MatchSet));
+}
+
+void matches_reset(MatchSet *set, Regex *regex) {
+    stop_scan(set);
+    set->gap_start = 0;
+    set->gap_end = set->capacity;
+    set->regex = regex;
+    set->length = buffer_length(set->buffer);
+    if (!regex) return;
+    if (!set->pool) {
+        scan(set, 0, set->length);
+        return;
+    }
+    set->job = calloc(1, sizeof(MatchJob));
+    set->job->set = set;
+    set->job->regex = re_clone(regex);
+    set->job->job.run = search_block;
+    set->job->job.done = merge_block;
+    set->job->job.arg = set->job;
+    set->job->job.token = &set->token;
+    set->scanned = 0;
+    submit_block(set);
+}
+
+size_t matches_scanned(const MatchSet *set) {
+    return set->job ? set->scanned : SIZE_MAX;
+}
+
+void matches_finish(MatchSet *set) {
+    size_t from = set->scanned;
+    if (!set->job) return;
+    stop_scan(set);
+    move_gap(set, matches_count(set));
+    scan(set, from, set->length);
+}
+
+char *matches_substitute(MatchSet *set, const char *with, size_t with_len, size_t *start,
+                         size_t *end, size_t *len) {
+    size_t count, matched = 0, pos, out_len = 0;
+    char *text, *out;
+    matches_finish(set);
+    count = matches_count(set);
+    if (count == 0) return NULL;
+    move_gap(set, count);
+    *start = set->spans[0].start;
+    *end = set->spans[count - 1].start + set->spans[count - 1].length;
+    for (size_t i = 0; i < count; i++) matched += set->spans[i].length;
+    text = malloc(*end - *start + 1);
+    out = malloc(*end - *start - matched + count * with_len + 1);
+    buffer_read(set->buffer, *start, *end - *start, text);
+    pos = *start;
+    for (size_t i = 0; i < count; i++) {
+        const MatchSpan *span = &set->spans[i];
+        memcpy(out + out_len, text + (pos - *start), span->start - pos);
+        out_len += span->start - pos;
+        memcpy(out + out_len, with, with_len);
+        out_len += with_len;
+        pos = span->start + span->length;
+    }
+    free(text);
+    *len = out_len;
+    return out;
+}
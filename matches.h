@@ -0,0 +1,73 @@
+#ifndef MATCHES_H
+#define MATCHES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "buffer.h"
+#include "pool.h"
+#include "re.h"
+
+#define MATCHES_BLOCK (1u << 20)
+
+typedef struct {
+    size_t start;
+    size_t length;
+} MatchSpan;
+
+/*
+ * Every match of a regex in a buffer, kept up to date as the buffer is
+ * edited.  Matches never span a newline, so an edit only invalidates the
+ * lines it touched: a buffer listener drops the matches on those lines
+ * and rescans just them.
+ *
+ * Spans are kept in a gap buffer positioned at the last edit.  Spans
+ * after the gap store their distance from the end of the buffer, so an
+ * edit does not touch the spans after it, and a run of edits in one place
+ * moves none of them.
+ *
+ * With a pool, a new regex is scanned for in the background a block of
+ * lines at a time: each block is copied out and searched on a worker, and
+ * its matches are merged in by pool_collect().  Until the scan is done the
+ * set holds every match that starts before matches_scanned() and no other.
+ */
+typedef struct {
+    Buffer *buffer;
+    Regex *regex;
+    MatchSpan *spans;
+    size_t capacity;
+    size_t gap_start;
+    size_t gap_end;
+    size_t length;
+    char *text;
+    size_t text_cap;
+    Pool *pool;
+    CancelToken token;
+    struct MatchJob *job;
+    size_t scanned;
+} MatchSet;
+
+void matches_init(MatchSet *set, Buffer *buffer);
+void matches_background(MatchSet *set, Pool *pool);
+void matches_free(MatchSet *set);
+/* Starts a scan of the whole buffer for regex, or empties the set if it is NULL. */
+void matches_reset(MatchSet *set, Regex *regex);
+/* The offset before which every match is known, or SIZE_MAX once the scan is done. */
+size_t matches_scanned(const MatchSet *set);
+/* Scans what the background scan has not reached yet, on the calling thread. */
+void matches_finish(MatchSet *set);
+size_t matches_count(const MatchSet *set);
+size_t matches_memory(const MatchSet *set);
+MatchSpan matches_get(const MatchSet *set, size_t index);
+/* The index of the first match starting at or after pos, or matches_count(). */
+size_t matches_find(const MatchSet *set, size_t pos);
+/*
+ * Builds, in one pass, the text from the start of the first match to the
+ * end of the last with every match replaced by with; *start and *end give
+ * the range it replaces, finishing the scan first.  Returns NULL if there
+ * are no matches.
+ */
+char *matches_substitute(MatchSet *set, const char *with, size_t with_len, size_t *start,
+                         size_t *end, size_t *len);
+
+#endif
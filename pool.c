@@ -0,0 +1,284 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "pool.h"
+
+#define POOL_MAX_THREADS 16
+
+typedef struct {
+    pthread_mutex_t lock;
+    Job **jobs;
+    size_t head;
+    size_t count;
+    size_t cap;
+} Deque;
+
+struct Pool {
+    int count;
+    int started;
+    pthread_t *threads;
+    Deque *deques;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t finished;
+    size_t queued;
+    unsigned int next;
+    int stopping;
+    Job *done_head;
+    Job *done_tail;
+    int pipe[2];
+};
+
+typedef struct {
+    Pool *pool;
+    int index;
+} Worker;
+
+static __thread Pool *worker_pool;
+static __thread int worker_index;
+
+void cancel_init(CancelToken *token) {
+    atomic_init(&token->generation, 0);
+}
+
+void cancel(CancelToken *token) {
+    atomic_fetch_add(&token->generation, 1);
+}
+
+int job_cancelled(const Job *job) {
+    return job->token && atomic_load_explicit(&job->token->generation, memory_order_relaxed) !=
+                             job->generation;
+}
+
+static void push_bottom(Deque *deque, Job *job) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count == deque->cap) {
+        size_t cap = deque->cap ? deque->cap * 2 : 64;
+        Job **jobs = malloc(cap * sizeof(Job *));
+        for (size_t i = 0; i < deque->count; i++) {
+            jobs[i] = deque->jobs[(deque->head + i) % deque->cap];
+        }
+        free(deque->jobs);
+        deque->jobs = jobs;
+        deque->head = 0;
+        deque->cap = cap;
+    }
+    deque->jobs[(deque->head + deque->count++) % deque->cap] = job;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+static Job *pop_bottom(Deque *deque) {
+    Job *job = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count > 0) job = deque->jobs[(deque->head + --deque->count) % deque->cap];
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+static Job *steal_top(Deque *deque) {
+    Job *job = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count > 0) {
+        job = deque->jobs[deque->head];
+        deque->head = (deque->head + 1) % deque->cap;
+        deque->count--;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+static Job *take(Pool *pool, int index) {
+    Job *job = pop_bottom(&pool->deques[index]);
+    for (int i = 1; !job && i < pool->count; i++) {
+        job = steal_top(&pool->deques[(index + i) % pool->count]);
+    }
+    return job;
+}
+
+static void finish(Pool *pool, Job *job) {
+    pthread_mutex_lock(&pool->lock);
+    job->state = JOB_FINISHED;
+    if (job->done) {
+        job->next = NULL;
+        if (pool->done_tail) {
+            pool->done_tail->next = job;
+        } else {
+            pool->done_head = job;
+            /* If the pipe is full the reader is awake already. */
+            (void)!write(pool->pipe[1], "", 1);
+        }
+        pool->done_tail = job;
+    }
+    pthread_cond_broadcast(&pool->finished);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void *worker(void *arg) {
+    Worker *self = arg;
+    Pool *pool = self->pool;
+    worker_pool = pool;
+    worker_index = self->index;
+    free(self);
+    while (1) {
+        Job *job = take(pool, worker_index);
+        if (job) {
+            pthread_mutex_lock(&pool->lock);
+            pool->queued--;
+            pthread_mutex_unlock(&pool->lock);
+            job->run(job);
+            finish(pool, job);
+            continue;
+        }
+        pthread_mutex_lock(&pool->lock);
+        while (pool->queued == 0 && !pool->stopping) pthread_cond_wait(&pool->work, &pool->lock);
+        if (pool->queued == 0 && pool->stopping) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+Pool *pool_new(int threads) {
+    Pool *pool = calloc(1, sizeof(Pool));
+    if (threads < 1) threads = 1;
+    if (threads > POOL_MAX_THREADS) threads = POOL_MAX_THREADS;
+    if (pipe(pool->pipe) < 0) {
+        free(pool);
+        return NULL;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(pool->pipe[i], F_SETFL, fcntl(pool->pipe[i], F_GETFL) | O_NONBLOCK);
+        fcntl(pool->pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->finished, NULL);
+    pool->threads = calloc(threads, sizeof(pthread_t));
+    pool->deques = calloc(threads, sizeof(Deque));
+    pool->count = threads;
+    for (int i = 0; i < threads; i++) pthread_mutex_init(&pool->deques[i].lock, NULL);
+    for (int i = 0; i < threads; i++) {
+        Worker *self = malloc(sizeof(Worker));
+        self->pool = pool;
+        self->index = i;
+        if (pthread_create(&pool->threads[i], NULL, worker, self) != 0) {
+            free(self);
+            pool->started = i;
+            pool_free(pool);
+            return NULL;
+        }
+    }
+    pool->started = threads;
+    return pool;
+}
+
+/* The pool shared by the editor and viewer, one worker per CPU. */
+Pool *pool_default(void) {
+    static Pool *pool;
+    static int created;
+    if (!created) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        pool = pool_new(cpus > 0 ? (int)cpus : 1);
+        created = 1;
+    }
+    return pool;
+}
+
+void pool_free(Pool *pool) {
+    if (!pool) return;
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->started; i++) pthread_join(pool->threads[i], NULL);
+    for (int i = 0; i < pool->count; i++) {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].jobs);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->finished);
+    close(pool->pipe[0]);
+    close(pool->pipe[1]);
+    free(pool->threads);
+    free(pool->deques);
+    free(pool);
+}
+
+/*
+ * Queues a job.  Jobs submitted from a worker go on that worker's own
+ * deque, where it will pick them up next unless someone steals them;
+ * others are dealt round-robin.
+ */
+void pool_submit(Pool *pool, Job *job) {
+    if (job->token) job->generation = atomic_load(&job->token->generation);
+    if (!pool) {
+        job->state = JOB_QUEUED;
+        job->run(job);
+        job->state = JOB_IDLE;
+        if (job->done) job->done(job);
+        return;
+    }
+    job->state = JOB_QUEUED;
+    /* Counted first: a worker may steal the job and count it off before this returns. */
+    pthread_mutex_lock(&pool->lock);
+    pool->queued++;
+    pthread_mutex_unlock(&pool->lock);
+    push_bottom(&pool->deques[worker_pool == pool ? worker_index
+                                                  : (int)(pool->next++ % pool->count)], job);
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+int pool_fd(const Pool *pool) {
+    return pool ? pool->pipe[0] : -1;
+}
+
+/* Calls done() for every job finished since the last call; returns how many. */
+int pool_collect(Pool *pool) {
+    char drain[64];
+    Job *job;
+    int count = 0;
+    if (!pool) return 0;
+    while (read(pool->pipe[0], drain, sizeof(drain)) > 0) continue;
+    pthread_mutex_lock(&pool->lock);
+    job = pool->done_head;
+    pool->done_head = pool->done_tail = NULL;
+    pthread_mutex_unlock(&pool->lock);
+    while (job) {
+        Job *next = job->next;
+        job->state = JOB_IDLE;
+        job->done(job);
+        job = next;
+        count++;
+    }
+    return count;
+}
+
+/*
+ * Blocks until a submitted job has run.  If it is waiting to be collected
+ * it is taken off the queue and its done() is not called; this is how an
+ * owner tears down state a job may still be using.
+ */
+void pool_wait(Pool *pool, Job *job) {
+    Job **link;
+    if (!pool) return;
+    pthread_mutex_lock(&pool->lock);
+    while (job->state == JOB_QUEUED) pthread_cond_wait(&pool->finished, &pool->lock);
+    for (link = &pool->done_head; *link; link = &(*link)->next) {
+        if (*link == job) {
+            *link = job->next;
+            if (pool->done_tail == job) {
+                pool->done_tail = NULL;
+                for (Job *p = pool->done_head; p; p = p->next) pool->done_tail = p;
+            }
+            break;
+        }
+    }
+    job->state = JOB_IDLE;
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,58 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdatomic.h>
+
+/*
+ * Shared by every job working on one piece of state.  Jobs remember the
+ * generation they were submitted under; cancel() moves it on, so jobs
+ * still running see job_cancelled() and stop, and results that arrive
+ * afterwards are known to be stale.
+ */
+typedef struct {
+    atomic_ulong generation;
+} CancelToken;
+
+enum { JOB_IDLE, JOB_QUEUED, JOB_FINISHED };
+
+/*
+ * A unit of background work.  run() is called on a worker thread and must
+ * not touch state owned by the main thread.  done(), if set, is called
+ * later from pool_collect() on the main thread, which is where results are
+ * merged.  The job belongs to its submitter and has to stay alive until
+ * done() is called or pool_wait() returns; done() may free or resubmit it.
+ */
+typedef struct Job {
+    void (*run)(struct Job *job);
+    void (*done)(struct Job *job);
+    void *arg;
+    CancelToken *token;
+    unsigned long generation;
+    int state;
+    struct Job *next;
+} Job;
+
+typedef struct Pool Pool;
+
+void cancel_init(CancelToken *token);
+void cancel(CancelToken *token);
+int job_cancelled(const Job *job);
+
+/*
+ * Work-stealing thread pool.  Each worker owns a deque: it takes its own
+ * newest job first and, when that runs dry, steals the oldest job of
+ * another worker.  Finished jobs with a done() callback are queued for
+ * pool_collect(), and pool_fd() becomes readable while any are waiting, so
+ * an input loop can sleep on it next to the terminal.
+ *
+ * A NULL pool runs jobs synchronously inside pool_submit().
+ */
+Pool *pool_new(int threads);
+Pool *pool_default(void);
+void pool_free(Pool *pool);
+void pool_submit(Pool *pool, Job *job);
+int pool_fd(const Pool *pool);
+int pool_collect(Pool *pool);
+void pool_wait(Pool *pool, Job *job);
+
+#endif
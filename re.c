@@ -0,0 +1,882 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "re.h"
+
+#define RE_BLOCK (1 << 20)
+#define RE_MAX_REPEAT 1000
+#define DFA_TABLE (RE_DFA_STATES * 2)
+#define DFA_MATCH 1
+#define DFA_DEAD 2
+#define AT_BOL 1
+#define AT_EOL 2
+#define GROUP (-1)
+#define SPAWN (-2)
+
+enum { NODE_EMPTY, NODE_SET, NODE_BOL, NODE_EOL, NODE_CAT, NODE_ALT, NODE_REPEAT };
+enum { NFA_SET, NFA_SPLIT, NFA_BOL, NFA_EOL, NFA_MATCH };
+
+typedef struct {
+    unsigned char bits[32];
+} ByteSet;
+
+typedef struct {
+    int type;
+    int left;
+    int right;
+    int min;
+    int max;
+    int set;
+} Node;
+
+typedef struct {
+    unsigned char type;
+    int out;
+    int out1;
+    int set;
+} NfaState;
+
+/*
+ * A lazily built DFA over one NFA.  A state is a list of groups of NFA
+ * states, each group sorted, separated by GROUP marks and ordered by
+ * where their threads started; an unanchored DFA ends the list with
+ * SPAWN while it still starts a new group at every byte.  Once a group
+ * reaches the match state the groups after it, and further spawning, are
+ * dropped: threads that started later can no longer give the leftmost
+ * match.  next[] holds a row of transitions per state, -1 until taken.
+ *
+ * Symbols are the byte classes plus three zero-width ones fed at line
+ * boundaries, for a line start, a line end, or both at once (an empty
+ * line); they let ^ and $ states advance while every other state stays
+ * where it is.
+ */
+typedef struct {
+    Regex *re;
+    int entry;
+    int unanchored;
+    int start;
+    int symbols;
+    int count;
+    int cap;
+    int *next;
+    unsigned char *info;
+    int *offset;
+    int *length;
+    int *members;
+    size_t member_count;
+    size_t member_cap;
+    int table[DFA_TABLE];
+    int *list;
+    int *stack;
+    unsigned int *mark;
+    unsigned int gen;
+    int flushed;
+} Dfa;
+
+struct Regex {
+    char *source;
+    int flags;
+    ByteSet *sets;
+    int set_count;
+    int set_cap;
+    NfaState *nfa;
+    int nfa_count;
+    int nfa_cap;
+    int overflow;
+    unsigned char classes[256];
+    unsigned char representative[256];
+    int class_count;
+    Dfa forward;
+    Dfa reverse;
+    SearchPattern prefix;
+    int has_prefix;
+};
+
+typedef struct {
+    Regex *re;
+    const char *p;
+    const char *end;
+    int ignore_case;
+    Node *nodes;
+    int count;
+    int cap;
+    const char *error;
+} Parser;
+
+static void set_add(ByteSet *set, int c) {
+    set->bits[c >> 3] |= 1 << (c & 7);
+}
+
+static int set_has(const ByteSet *set, int c) {
+    return set->bits[c >> 3] >> (c & 7) & 1;
+}
+
+static int is_word(int c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+           c == '_';
+}
+
+static int is_space(int c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+
+static int other_case(int c) {
+    if (c >= 'a' && c <= 'z') return c - 32;
+    if (c >= 'A' && c <= 'Z') return c + 32;
+    return c;
+}
+
+static int new_node(Parser *ps, int type, int left, int right) {
+    Node *node;
+    if (ps->count == ps->cap) {
+        ps->cap = ps->cap ? ps->cap * 2 : 64;
+        ps->nodes = realloc(ps->nodes, ps->cap * sizeof(Node));
+    }
+    node = &ps->nodes[ps->count];
+    memset(node, 0, sizeof(Node));
+    node->type = type;
+    node->left = left;
+    node->right = right;
+    node->set = -1;
+    return ps->count++;
+}
+
+/* Adds a finished set to the program: case folded if asked, never matching a newline. */
+static int set_node(Parser *ps, ByteSet *set, int negate) {
+    Regex *re = ps->re;
+    int node = new_node(ps, NODE_SET, -1, -1);
+    if (negate) {
+        for (int i = 0; i < 32; i++) set->bits[i] = ~set->bits[i];
+    }
+    if (ps->ignore_case) {
+        for (int c = 'A'; c <= 'Z'; c++) {
+            if (set_has(set, c) || set_has(set, c + 32)) {
+                set_add(set, c);
+                set_add(set, c + 32);
+            }
+        }
+    }
+    set->bits['\n' >> 3] &= ~(1 << ('\n' & 7));
+    if (re->set_count == re->set_cap) {
+        re->set_cap = re->set_cap ? re->set_cap * 2 : 16;
+        re->sets = realloc(re->sets, re->set_cap * sizeof(ByteSet));
+    }
+    re->sets[re->set_count] = *set;
+    ps->nodes[node].set = re->set_count++;
+    return node;
+}
+
+/* \d \w \s and their negations; returns 0 if c is not a class letter. */
+static int class_escape(ByteSet *set, char c) {
+    int (*test)(int) = NULL;
+    int negate = c >= 'A' && c <= 'Z';
+    switch (c) {
+    case 'd':
+    case 'D':
+        for (int b = '0'; b <= '9'; b++) set_add(set, b);
+        break;
+    case 'w':
+    case 'W':
+        test = is_word;
+        break;
+    case 's':
+    case 'S':
+        test = is_space;
+        break;
+    default:
+        return 0;
+    }
+    if (test) {
+        for (int b = 0; b < 256; b++) {
+            if (test(b)) set_add(set, b);
+        }
+    }
+    if (negate) {
+        for (int i = 0; i < 32; i++) set->bits[i] = ~set->bits[i];
+    }
+    return 1;
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/* Reads the byte an escape stands for, after the backslash; -1 for \n. */
+static int escape_byte(Parser *ps) {
+    char c = *ps->p++;
+    if (c == 't') return '\t';
+    if (c == 'n') return -1;
+    if (c == 'x' && ps->end - ps->p >= 2 && hex_digit(ps->p[0]) >= 0 &&
+        hex_digit(ps->p[1]) >= 0) {
+        int value = hex_digit(ps->p[0]) * 16 + hex_digit(ps->p[1]);
+        ps->p += 2;
+        return value;
+    }
+    return (unsigned char)c;
+}
+
+static int parse_class(Parser *ps) {
+    ByteSet set = { { 0 } };
+    int negate = 0, first = 1;
+    if (ps->p < ps->end && *ps->p == '^') {
+        negate = 1;
+        ps->p++;
+    }
+    while (ps->p < ps->end && (*ps->p != ']' || first)) {
+        int lo, hi;
+        first = 0;
+        if (*ps->p == '\\' && ps->p + 1 < ps->end) {
+            ps->p++;
+            if (class_escape(&set, *ps->p)) {
+                ps->p++;
+                continue;
+            }
+            lo = escape_byte(ps);
+        } else {
+            lo = (unsigned char)*ps->p++;
+        }
+        hi = lo;
+        if (ps->end - ps->p >= 2 && ps->p[0] == '-' && ps->p[1] != ']') {
+            ps->p++;
+            if (*ps->p == '\\' && ps->p + 1 < ps->end) {
+                ps->p++;
+                hi = escape_byte(ps);
+            } else {
+                hi = (unsigned char)*ps->p++;
+            }
+            if (hi < lo) {
+                ps->error = "bad range in []";
+                return -1;
+            }
+        }
+        for (int c = lo; c >= 0 && c <= hi; c++) set_add(&set, c);
+    }
+    if (ps->p >= ps->end) {
+        ps->error = "missing ]";
+        return -1;
+    }
+    ps->p++;
+    return set_node(ps, &set, negate);
+}
+
+static int parse_alt(Parser *ps);
+
+static int parse_atom(Parser *ps) {
+    ByteSet set = { { 0 } };
+    char c = *ps->p++;
+    int node;
+    switch (c) {
+    case '(':
+        if (ps->end - ps->p >= 2 && ps->p[0] == '?' && ps->p[1] == ':') ps->p += 2;
+        node = parse_alt(ps);
+        if (node < 0) return -1;
+        if (ps->p >= ps->end || *ps->p != ')') {
+            ps->error = "missing )";
+            return -1;
+        }
+        ps->p++;
+        return node;
+    case '[':
+        return parse_class(ps);
+    case '.':
+        return set_node(ps, &set, 1);
+    case '^':
+        return new_node(ps, NODE_BOL, -1, -1);
+    case '$':
+        return new_node(ps, NODE_EOL, -1, -1);
+    case '*':
+    case '+':
+    case '?':
+        ps->error = "nothing to repeat";
+        return -1;
+    case '\\':
+        if (ps->p >= ps->end) {
+            ps->error = "trailing \\";
+            return -1;
+        }
+        if (class_escape(&set, *ps->p)) {
+            ps->p++;
+            return set_node(ps, &set, 0);
+        }
+        node = escape_byte(ps);
+        if (node >= 0) set_add(&set, node);
+        return set_node(ps, &set, 0);
+    default:
+        set_add(&set, (unsigned char)c);
+        return set_node(ps, &set, 0);
+    }
+}
+
+/* Parses {m}, {m,} or {m,n}; leaves p alone and returns 0 if it is not one. */
+static int parse_bounds(Parser *ps, int *min, int *max) {
+    const char *p = ps->p + 1;
+    long lo = 0, hi;
+    if (p >= ps->end || *p < '0' || *p > '9') return 0;
+    while (p < ps->end && *p >= '0' && *p <= '9') {
+        lo = lo * 10 + (*p++ - '0');
+        if (lo > 100000) lo = 100000;
+    }
+    hi = lo;
+    if (p < ps->end && *p == ',') {
+        p++;
+        hi = -1;
+        if (p < ps->end && *p >= '0' && *p <= '9') {
+            hi = 0;
+            while (p < ps->end && *p >= '0' && *p <= '9') {
+                hi = hi * 10 + (*p++ - '0');
+                if (hi > 100000) hi = 100000;
+            }
+        }
+    }
+    if (p >= ps->end || *p != '}') return 0;
+    ps->p = p + 1;
+    *min = (int)lo;
+    *max = (int)hi;
+    return 1;
+}
+
+static int parse_repeat(Parser *ps) {
+    int node = parse_atom(ps);
+    while (node >= 0 && ps->p < ps->end) {
+        int min, max;
+        char c = *ps->p;
+        if (c == '*' || c == '+' || c == '?') {
+            min = c == '+';
+            max = c == '?' ? 1 : -1;
+            ps->p++;
+        } else if (c != '{' || !parse_bounds(ps, &min, &max)) {
+            break;
+        }
+        if (min > RE_MAX_REPEAT || max > RE_MAX_REPEAT || (max >= 0 && max < min)) {
+            ps->error = "bad repeat count";
+            return -1;
+        }
+        /* Leftmost-longest matching has no use for lazy forms, so x*? is x*. */
+        if (ps->p < ps->end && *ps->p == '?') ps->p++;
+        node = new_node(ps, NODE_REPEAT, node, -1);
+        ps->nodes[node].min = min;
+        ps->nodes[node].max = max;
+    }
+    return node;
+}
+
+static int parse_cat(Parser *ps) {
+    int node = -1;
+    while (ps->p < ps->end && *ps->p != '|' && *ps->p != ')') {
+        int next = parse_repeat(ps);
+        if (next < 0) return -1;
+        node = node < 0 ? next : new_node(ps, NODE_CAT, node, next);
+    }
+    return node < 0 ? new_node(ps, NODE_EMPTY, -1, -1) : node;
+}
+
+static int parse_alt(Parser *ps) {
+    int node = parse_cat(ps);
+    while (node >= 0 && ps->p < ps->end && *ps->p == '|') {
+        int right;
+        ps->p++;
+        right = parse_cat(ps);
+        if (right < 0) return -1;
+        node = new_node(ps, NODE_ALT, node, right);
+    }
+    return node;
+}
+
+static int add_state(Regex *re, int type, int out, int out1, int set) {
+    if (re->nfa_count >= RE_MAX_STATES) {
+        re->overflow = 1;
+        return 0;
+    }
+    if (re->nfa_count == re->nfa_cap) {
+        re->nfa_cap = re->nfa_cap ? re->nfa_cap * 2 : 64;
+        re->nfa = realloc(re->nfa, re->nfa_cap * sizeof(NfaState));
+    }
+    re->nfa[re->nfa_count].type = type;
+    re->nfa[re->nfa_count].out = out;
+    re->nfa[re->nfa_count].out1 = out1;
+    re->nfa[re->nfa_count].set = set;
+    return re->nfa_count++;
+}
+
+/*
+ * Compiles node so that it continues into next and returns its entry.
+ * Built back to front; with reverse set the NFA matches the reversed
+ * language, for scanning a line backwards.
+ */
+static int compile(Regex *re, const Parser *ps, int index, int next, int reverse) {
+    const Node *node = &ps->nodes[index];
+    int entry;
+    if (re->overflow) return 0;
+    switch (node->type) {
+    case NODE_SET:
+        return add_state(re, NFA_SET, next, -1, node->set);
+    case NODE_BOL:
+        return add_state(re, NFA_BOL, next, -1, -1);
+    case NODE_EOL:
+        return add_state(re, NFA_EOL, next, -1, -1);
+    case NODE_CAT:
+        if (reverse) return compile(re, ps, node->right, compile(re, ps, node->left, next, 1), 1);
+        return compile(re, ps, node->left, compile(re, ps, node->right, next, 0), 0);
+    case NODE_ALT:
+        entry = compile(re, ps, node->left, next, reverse);
+        return add_state(re, NFA_SPLIT, entry, compile(re, ps, node->right, next, reverse), -1);
+    case NODE_REPEAT:
+        entry = next;
+        if (node->max < 0) {
+            int loop = add_state(re, NFA_SPLIT, -1, next, -1);
+            int body = compile(re, ps, node->left, loop, reverse);
+            if (re->overflow) return 0;
+            re->nfa[loop].out = body;
+            entry = loop;
+        } else {
+            for (int i = node->min; i < node->max && !re->overflow; i++) {
+                int body = compile(re, ps, node->left, entry, reverse);
+                entry = add_state(re, NFA_SPLIT, body, next, -1);
+            }
+        }
+        for (int i = 0; i < node->min && !re->overflow; i++) {
+            entry = compile(re, ps, node->left, entry, reverse);
+        }
+        return entry;
+    default:
+        return next;
+    }
+}
+
+/* The bytes every match has to start with, gathered into out. */
+static int literal_prefix(const Parser *ps, int index, char *out, size_t *len, size_t cap) {
+    const Node *node = &ps->nodes[index];
+    const ByteSet *set;
+    ByteSet single = { { 0 } };
+    int c = 0;
+    switch (node->type) {
+    case NODE_EMPTY:
+    case NODE_BOL:
+        return 1;
+    case NODE_CAT:
+        return literal_prefix(ps, node->left, out, len, cap) &&
+               literal_prefix(ps, node->right, out, len, cap);
+    case NODE_SET:
+        set = &ps->re->sets[node->set];
+        while (c < 256 && !set_has(set, c)) c++;
+        if (c == 256 || *len == cap) return 0;
+        set_add(&single, c);
+        if (ps->ignore_case) set_add(&single, other_case(c));
+        if (memcmp(&single, set, sizeof(ByteSet)) != 0) return 0;
+        out[(*len)++] = c;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* Splits the bytes into runs no set tells apart, so DFA rows are narrow. */
+static void make_classes(Regex *re) {
+    re->class_count = 1;
+    re->classes[0] = 0;
+    re->representative[0] = 0;
+    for (int c = 1; c < 256; c++) {
+        int same = 1;
+        for (int i = 0; i < re->set_count && same; i++) {
+            same = set_has(&re->sets[i], c) == set_has(&re->sets[i], c - 1);
+        }
+        if (!same) re->representative[re->class_count++] = c;
+        re->classes[c] = re->class_count - 1;
+    }
+}
+
+static void dfa_flush(Dfa *dfa) {
+    dfa->count = 0;
+    dfa->member_count = 0;
+    dfa->start = -1;
+    for (int i = 0; i < DFA_TABLE; i++) dfa->table[i] = -1;
+    dfa->flushed = 1;
+}
+
+static void dfa_init(Dfa *dfa, Regex *re, int entry, int unanchored) {
+    memset(dfa, 0, sizeof(Dfa));
+    dfa->re = re;
+    dfa->entry = entry;
+    dfa->unanchored = unanchored;
+    dfa->symbols = re->class_count + 3;
+    dfa->list = malloc((re->nfa_count * 2 + 1) * sizeof(int));
+    dfa->stack = malloc((re->nfa_count * 2 + 2) * sizeof(int));
+    dfa->mark = calloc(re->nfa_count, sizeof(unsigned int));
+    dfa_flush(dfa);
+}
+
+static void dfa_free(Dfa *dfa) {
+    free(dfa->next);
+    free(dfa->info);
+    free(dfa->offset);
+    free(dfa->length);
+    free(dfa->members);
+    free(dfa->list);
+    free(dfa->stack);
+    free(dfa->mark);
+}
+
+static void next_gen(Dfa *dfa) {
+    if (++dfa->gen == 0) {
+        memset(dfa->mark, 0, dfa->re->nfa_count * sizeof(unsigned int));
+        dfa->gen = 1;
+    }
+}
+
+/*
+ * Adds state and everything reachable from it without input to the list,
+ * passing through ^ and $ when at says they hold.  States already taken
+ * in this step, by this group or an earlier one, are skipped.
+ */
+static void closure(Dfa *dfa, int state, int at, int *count) {
+    const NfaState *nfa = dfa->re->nfa;
+    int top = 0;
+    dfa->stack[top++] = state;
+    while (top > 0) {
+        state = dfa->stack[--top];
+        if (dfa->mark[state] == dfa->gen) continue;
+        dfa->mark[state] = dfa->gen;
+        if (nfa[state].type == NFA_SPLIT) {
+            dfa->stack[top++] = nfa[state].out1;
+            dfa->stack[top++] = nfa[state].out;
+            continue;
+        }
+        dfa->list[(*count)++] = state;
+        if ((nfa[state].type == NFA_BOL && (at & AT_BOL)) ||
+            (nfa[state].type == NFA_EOL && (at & AT_EOL))) {
+            dfa->stack[top++] = nfa[state].out;
+        }
+    }
+}
+
+static int compare_ints(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * Sorts the group that starts at first and closes it with a mark; returns
+ * 1 if it holds the match state.  An empty group is dropped.
+ */
+static int end_group(Dfa *dfa, int first, int *count) {
+    int matched = 0;
+    if (*count == first) return 0;
+    qsort(dfa->list + first, *count - first, sizeof(int), compare_ints);
+    for (int i = first; i < *count; i++) {
+        if (dfa->re->nfa[dfa->list[i]].type == NFA_MATCH) matched = 1;
+    }
+    dfa->list[(*count)++] = GROUP;
+    return matched;
+}
+
+/* Returns the DFA state for the list, making it if needed. */
+static int intern(Dfa *dfa, int count, int matched) {
+    unsigned int hash = 2166136261u;
+    size_t slot;
+    int id;
+    for (int i = 0; i < count; i++) hash = (hash ^ dfa->list[i]) * 16777619u;
+    for (int pass = 0; pass < 2; pass++) {
+        for (slot = hash % DFA_TABLE; (id = dfa->table[slot]) >= 0; slot = (slot + 1) % DFA_TABLE) {
+            if (dfa->length[id] == count &&
+                memcmp(dfa->members + dfa->offset[id], dfa->list, count * sizeof(int)) == 0) {
+                return id;
+            }
+        }
+        if (dfa->count < RE_DFA_STATES && dfa->member_count + count <= RE_DFA_MEMBERS) break;
+        dfa_flush(dfa);
+    }
+    if (dfa->count == dfa->cap) {
+        dfa->cap = dfa->cap ? dfa->cap * 2 : 64;
+        dfa->next = realloc(dfa->next, (size_t)dfa->cap * dfa->symbols * sizeof(int));
+        dfa->info = realloc(dfa->info, dfa->cap);
+        dfa->offset = realloc(dfa->offset, dfa->cap * sizeof(int));
+        dfa->length = realloc(dfa->length, dfa->cap * sizeof(int));
+    }
+    if (dfa->member_count + count > dfa->member_cap) {
+        dfa->member_cap = (dfa->member_count + count) * 2;
+        dfa->members = realloc(dfa->members, dfa->member_cap * sizeof(int));
+    }
+    id = dfa->count++;
+    dfa->offset[id] = dfa->member_count;
+    dfa->length[id] = count;
+    memcpy(dfa->members + dfa->member_count, dfa->list, count * sizeof(int));
+    dfa->member_count += count;
+    dfa->info[id] = (count == 0 ? DFA_DEAD : 0) | (matched ? DFA_MATCH : 0);
+    for (int i = 0; i < dfa->symbols; i++) dfa->next[(size_t)id * dfa->symbols + i] = -1;
+    dfa->table[slot] = id;
+    return id;
+}
+
+static int start_state(Dfa *dfa) {
+    if (dfa->start < 0) {
+        int count = 0, matched, id;
+        next_gen(dfa);
+        closure(dfa, dfa->entry, 0, &count);
+        matched = end_group(dfa, 0, &count);
+        if (dfa->unanchored && !matched) dfa->list[count++] = SPAWN;
+        id = intern(dfa, count, matched);
+        dfa->start = id;
+    }
+    return dfa->start;
+}
+
+static int compute(Dfa *dfa, int id, int symbol) {
+    const Regex *re = dfa->re;
+    const int *set = dfa->members + dfa->offset[id];
+    int length = dfa->length[id], count = 0, first = 0, matched = 0, next;
+    int at = symbol >= re->class_count ? symbol - re->class_count + 1 : 0;
+    unsigned char byte = re->representative[at ? 0 : symbol];
+    next_gen(dfa);
+    for (int i = 0; i < length && !matched; i++) {
+        if (set[i] == GROUP) {
+            matched = end_group(dfa, first, &count);
+            first = count;
+        } else if (set[i] == SPAWN) {
+            if (!at) closure(dfa, dfa->entry, 0, &count);
+            matched = end_group(dfa, first, &count);
+            if (!matched) dfa->list[count++] = SPAWN;
+        } else if (at) {
+            closure(dfa, set[i], at, &count);
+        } else if (re->nfa[set[i]].type == NFA_SET &&
+                   set_has(&re->sets[re->nfa[set[i]].set], byte)) {
+            closure(dfa, re->nfa[set[i]].out, 0, &count);
+        }
+    }
+    dfa->flushed = 0;
+    next = intern(dfa, count, matched);
+    if (!dfa->flushed) dfa->next[(size_t)id * dfa->symbols + symbol] = next;
+    return next;
+}
+
+static inline int step(Dfa *dfa, int id, int symbol) {
+    int next = dfa->next[(size_t)id * dfa->symbols + symbol];
+    return next >= 0 ? next : compute(dfa, id, symbol);
+}
+
+Regex *re_compile(const char *pattern, int flags, const char **error) {
+    Regex *re = calloc(1, sizeof(Regex));
+    Parser ps = { 0 };
+    char prefix[256];
+    size_t prefix_len = 0;
+    int root, match, forward, reverse;
+    ps.re = re;
+    ps.p = pattern;
+    ps.end = pattern + strlen(pattern);
+    ps.ignore_case = flags & RE_IGNORE_CASE;
+    if (ps.end - ps.p >= 4 && memcmp(ps.p, "(?i)", 4) == 0) {
+        ps.ignore_case = 1;
+        ps.p += 4;
+    }
+    root = parse_alt(&ps);
+    if (root >= 0 && ps.p < ps.end) ps.error = "unmatched )";
+    if (!ps.error) {
+        match = add_state(re, NFA_MATCH, -1, -1, -1);
+        forward = compile(re, &ps, root, match, 0);
+        reverse = compile(re, &ps, root, match, 1);
+        if (re->overflow) ps.error = "pattern too large";
+        if (!ps.error) {
+            make_classes(re);
+            dfa_init(&re->forward, re, forward, 1);
+            dfa_init(&re->reverse, re, reverse, 0);
+            literal_prefix(&ps, root, prefix, &prefix_len, sizeof(prefix));
+            re->has_prefix = prefix_len > 0 &&
+                search_compile(&re->prefix, prefix, prefix_len,
+                               ps.ignore_case ? SEARCH_IGNORE_CASE : 0) == 0;
+        }
+    }
+    free(ps.nodes);
+    if (ps.error) {
+        if (error) *error = ps.error;
+        free(re->sets);
+        free(re->nfa);
+        free(re);
+        return NULL;
+    }
+    re->source = strdup(pattern);
+    re->flags = flags;
+    return re;
+}
+
+/* A fresh copy with its own DFA caches, for use on another thread. */
+Regex *re_clone(const Regex *re) {
+    return re_compile(re->source, re->flags, NULL);
+}
+
+/* The literal every match starts with; returns its length, 0 if there is none. */
+size_t re_literal(const Regex *re, const char **literal) {
+    if (!re->has_prefix) return 0;
+    *literal = (const char *)re->prefix.pattern;
+    return re->prefix.length;
+}
+
+void re_free(Regex *re) {
+    if (!re) return;
+    dfa_free(&re->forward);
+    dfa_free(&re->reverse);
+    if (re->has_prefix) search_free(&re->prefix);
+    free(re->source);
+    free(re->sets);
+    free(re->nfa);
+    free(re);
+}
+
+/* Which line boundaries pos is at, as a zero-width symbol, or -1 for none. */
+static inline int boundary(const Regex *re, const char *text, size_t len, size_t pos) {
+    int at = 0;
+    if (pos == 0 || text[pos - 1] == '\n') at |= AT_BOL;
+    if (pos == len || text[pos] == '\n') at |= AT_EOL;
+    return at ? re->class_count + at - 1 : -1;
+}
+
+static inline int at_boundary(Dfa *dfa, int s, const char *text, size_t len, size_t pos) {
+    int symbol = boundary(dfa->re, text, len, pos);
+    return symbol < 0 ? s : step(dfa, s, symbol);
+}
+
+/*
+ * Scans forward from pos until no thread is left; returns the end of the
+ * leftmost-longest match, or SEARCH_NONE.  With one_line set the scan
+ * gives up at the end of the line if nothing matched, leaving *stop there.
+ */
+static size_t forward_end(Regex *re, const char *text, size_t len, size_t pos, int one_line,
+                          size_t *stop) {
+    Dfa *dfa = &re->forward;
+    const unsigned char *classes = re->classes;
+    int s = at_boundary(dfa, start_state(dfa), text, len, pos);
+    size_t end = dfa->info[s] & DFA_MATCH ? pos : SEARCH_NONE;
+    *stop = len;
+    for (size_t i = pos; i < len && !(dfa->info[s] & DFA_DEAD); i++) {
+        if (one_line && text[i] == '\n' && end == SEARCH_NONE) {
+            *stop = i;
+            break;
+        }
+        s = step(dfa, s, classes[(unsigned char)text[i]]);
+        if (text[i] == '\n' || i + 1 == len || text[i + 1] == '\n') {
+            s = at_boundary(dfa, s, text, len, i + 1);
+        }
+        if (dfa->info[s] & DFA_MATCH) end = i + 1;
+    }
+    return end;
+}
+
+/* Scans back from a match end to the leftmost start, no further than lo. */
+static size_t reverse_start(Regex *re, const char *text, size_t len, size_t lo, size_t end) {
+    Dfa *dfa = &re->reverse;
+    const unsigned char *classes = re->classes;
+    int s = at_boundary(dfa, start_state(dfa), text, len, end);
+    size_t start = end;
+    for (size_t i = end; i > lo && !(dfa->info[s] & DFA_DEAD); i--) {
+        s = step(dfa, s, classes[(unsigned char)text[i - 1]]);
+        if (i - 1 == 0 || text[i - 2] == '\n') s = at_boundary(dfa, s, text, len, i - 1);
+        if (dfa->info[s] & DFA_MATCH) start = i - 1;
+    }
+    return start;
+}
+
+/*
+ * Finds the leftmost-longest match starting at or after from.  The text
+ * is taken as whole lines: its start and end are line boundaries.  The
+ * forward DFA finds where that match ends, the reverse one where it
+ * starts.  With a literal prefix, scans only run on lines where it occurs.
+ */
+int re_search(Regex *re, const char *text, size_t len, size_t from, size_t *start,
+              size_t *end) {
+    size_t pos = from;
+    while (pos <= len) {
+        size_t e, stop;
+        if (re->has_prefix) {
+            pos = search_next(&re->prefix, text, len, pos);
+            if (pos == SEARCH_NONE) return 0;
+        }
+        e = forward_end(re, text, len, pos, re->has_prefix, &stop);
+        if (e != SEARCH_NONE) {
+            *start = reverse_start(re, text, len, pos, e);
+            *end = e;
+            return 1;
+        }
+        pos = stop + 1;
+    }
+    return 0;
+}
+
+/*
+ * Every match in text, which holds whole lines, reported as search_buffer()
+ * does with positions counted from at.
+ */
+size_t re_search_buffer(Regex *re, const char *text, size_t len, const SearchPosition *at,
+                        search_callback cb, void *arg) {
+    size_t from = 0, start, end, line = at->line, line_start = at->line_start, counted = 0;
+    size_t count = 0;
+    if (len == 0) return 0;
+    if (text[len - 1] == '\n') len--;
+    while (from <= len && re_search(re, text, len, from, &start, &end)) {
+        count++;
+        if (cb) {
+            SearchMatch match;
+            size_t newlines = search_count_newlines(text + counted, start - counted);
+            const char *line_end;
+            if (newlines > 0) {
+                line += newlines;
+                line_start = at->offset +
+                    ((const char *)memrchr(text + counted, '\n', start - counted) - text) + 1;
+            }
+            counted = start;
+            line_end = memchr(text + start, '\n', len - start);
+            match.line = line;
+            match.column = at->offset + start - line_start + 1;
+            match.offset = at->offset + start;
+            match.line_text = line_start >= at->offset ? text + (line_start - at->offset) : text;
+            match.line_length = (line_end ? line_end : text + len) - match.line_text;
+            if (cb(&match, arg)) break;
+        }
+        from = end > start ? end : end + 1;
+    }
+    return count;
+}
+
+/*
+ * Streams fd through a block buffer cut after the last newline, like
+ * search_fd(); a line longer than the buffer makes the buffer grow, since
+ * a regex match cannot be found with a fixed overlap.
+ */
+long long re_search_fd(Regex *re, int fd, search_callback cb, void *arg) {
+    size_t cap = RE_BLOCK, have = 0;
+    SearchPosition at = { 1, 0, 0 };
+    long long count = 0;
+    int eof = 0;
+    char *buf = malloc(cap);
+    if (!buf) return -1;
+    while (!eof) {
+        size_t end;
+        ssize_t n = read(fd, buf + have, cap - have);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            free(buf);
+            return -1;
+        }
+        eof = n == 0;
+        have += n;
+        if (!eof && have < cap) continue;
+        end = have;
+        if (!eof) {
+            char *nl = memrchr(buf, '\n', have);
+            if (!nl) {
+                cap *= 2;
+                buf = realloc(buf, cap);
+                continue;
+            }
+            end = nl - buf + 1;
+        }
+        count += re_search_buffer(re, buf, end, &at, cb, arg);
+        search_advance(&at, buf, end);
+        memmove(buf, buf + end, have - end);
+        have -= end;
+    }
+    free(buf);
+    return count;
+}
@@ -0,0 +1,46 @@
+#ifndef RE_H
+#define RE_H
+
+#include <stddef.h>
+
+#include "search.h"
+
+#define RE_MAX_STATES 65536
+#define RE_DFA_STATES 4096
+#define RE_DFA_MEMBERS (1 << 20)
+
+enum { RE_IGNORE_CASE = 1 };
+
+typedef struct Regex Regex;
+
+/*
+ * Regular expressions compiled to a Thompson NFA and matched with lazily
+ * built DFAs, so a search is linear in the text it scans whatever the
+ * pattern: a forward DFA finds where the match ends, a reverse one where
+ * it starts.  DFA states are made on first use and cached; when the cache
+ * grows past RE_DFA_STATES it is dropped and rebuilt as the scan goes on.
+ *
+ * Syntax: literals, ., [...] and [^...] with ranges, \d \w \s and their
+ * negations, \t and \xHH, grouping with (...) or (?:...), |, * + ? and
+ * {m,n}, and ^ and $ for the start and end of a line.  A leading (?i)
+ * ignores case.
+ * Matches never span a newline.  Among the matches the leftmost is
+ * found, and the longest at that position.
+ *
+ * A literal the pattern must start with is looked for with the search.h
+ * scanner first, and the DFAs only run from where it occurs.
+ *
+ * A Regex caches DFA states as it searches, so it must not be shared
+ * between threads; re_clone() gives each its own.
+ */
+Regex *re_compile(const char *pattern, int flags, const char **error);
+Regex *re_clone(const Regex *re);
+void re_free(Regex *re);
+size_t re_literal(const Regex *re, const char **literal);
+int re_search(Regex *re, const char *text, size_t len, size_t from, size_t *start,
+              size_t *end);
+size_t re_search_buffer(Regex *re, const char *text, size_t len, const SearchPosition *at,
+                        search_callback cb, void *arg);
+long long re_search_fd(Regex *re, int fd, search_callback cb, void *arg);
+
+#endif
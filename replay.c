@@ -0,0 +1,332 @@
+/*
+ * Headless keystroke replay for the editor core, built as its own program:
+ *
+ *   cc -O2 -pthread -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc -o replay replay.c \
+ *      editor.c buffer.c undo.c screen.c input.c syntax.c language.c clipboard.c \
+ *      journal.c pool.c re.c search.c matches.c arena.c diff.c trace.c watch.c utf8.c \
+ *      columns.c history.c lz.c
+ *   ./replay [typing|navigation|paste|undo|large|find|replace ...]
+ *
+ * Each scenario writes the raw bytes a terminal would send to a temporary
+ * file and feeds them through the editor's own input decoder; every key is
+ * followed by a frame rendered to /dev/null.  Scenarios run in a child
+ * process each, so peak RSS is per scenario.  The --wrap flags let the
+ * harness count the allocations made by the editor.
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "editor.h"
+
+#define SOURCE_LINES 10000
+#define LARGE_LINES 1000000
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    size_t keys;
+    size_t pattern_len;
+} Script;
+
+typedef struct {
+    const char *name;
+    size_t lines;
+    void (*build)(Script *script);
+} Scenario;
+
+static size_t alloc_count;
+static size_t alloc_bytes;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    alloc_count++;
+    alloc_bytes += size;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    alloc_count++;
+    alloc_bytes += count * size;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    alloc_count++;
+    alloc_bytes += size;
+    return __real_realloc(ptr, size);
+}
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void add(Script *script, const char *bytes, size_t len) {
+    if (script->len + len > script->cap) {
+        script->cap = (script->len + len) * 2;
+        script->data = realloc(script->data, script->cap);
+    }
+    memcpy(script->data + script->len, bytes, len);
+    script->len += len;
+}
+
+/* Appends one key, given as the bytes the terminal sends for it. */
+static void key(Script *script, const char *bytes) {
+    add(script, bytes, strlen(bytes));
+    script->keys++;
+}
+
+static void type(Script *script, const char *text) {
+    for (; *text; text++) {
+        char c[2] = { *text == '\n' ? '\r' : *text, '\0' };
+        key(script, c);
+    }
+}
+
+static void paste(Script *script, const char *text, size_t len) {
+    add(script, "\033[200~", 6);
+    add(script, text, len);
+    add(script, "\033[201~", 6);
+    script->keys++;
+}
+
+static void go_to_line(Script *script, size_t line) {
+    char digits[32];
+    snprintf(digits, sizeof(digits), "%zu", line);
+    key(script, "\007");
+    add(script, digits, strlen(digits));
+    add(script, "\r", 1);
+}
+
+/* The find prompt starts with the last pattern, so it is erased first. */
+static void enter_pattern(Script *script, const char *pattern) {
+    for (; script->pattern_len > 0; script->pattern_len--) add(script, "\177", 1);
+    add(script, pattern, strlen(pattern));
+    add(script, "\r", 1);
+    script->pattern_len = strlen(pattern);
+}
+
+static void find(Script *script, const char *pattern) {
+    key(script, "\006");
+    enter_pattern(script, pattern);
+}
+
+static void replace(Script *script, const char *pattern, const char *with, const char *answers) {
+    key(script, "\005");
+    enter_pattern(script, pattern);
+    add(script, with, strlen(with));
+    add(script, "\r", 1);
+    add(script, answers, strlen(answers));
+}
+
+static const char *snippet =
+    "static int sum(const int *values, size_t count) {\n"
+    "    int total = 0; /* running */\n"
+    "    for (size_t i = 0; i < count; i++) total += values[i];\n"
+    "    return total; // done\n"
+    "}\n";
+
+static void build_typing(Script *script) {
+    go_to_line(script, SOURCE_LINES / 2);
+    for (int i = 0; i < 25; i++) type(script, snippet);
+}
+
+static void build_navigation(Script *script) {
+    for (int round = 0; round < 60; round++) {
+        for (int i = 0; i < 30; i++) key(script, "\033[B");
+        for (int i = 0; i < 20; i++) key(script, "\033[C");
+        for (int i = 0; i < 10; i++) key(script, "\033[A");
+        for (int i = 0; i < 5; i++) key(script, "\033[D");
+        key(script, "\033[6~");
+        key(script, "\033[F");
+        key(script, "\033[H");
+    }
+}
+
+static void build_paste(Script *script) {
+    size_t len = strlen(snippet), block = 16384;
+    char *text = malloc(block);
+    for (size_t i = 0; i < block; i++) text[i] = snippet[i % len];
+    go_to_line(script, SOURCE_LINES / 2);
+    for (int i = 0; i < 40; i++) paste(script, text, block);
+    key(script, "\002");
+    for (int i = 0; i < 100; i++) key(script, "\033[B");
+    key(script, "\030");
+    for (int i = 0; i < 40; i++) key(script, "\026");
+    free(text);
+}
+
+static void build_undo(Script *script) {
+    go_to_line(script, SOURCE_LINES / 2);
+    for (int i = 0; i < 10; i++) type(script, snippet);
+    for (int i = 0; i < 800; i++) key(script, "\025");
+    for (int i = 0; i < 800; i++) key(script, "\022");
+}
+
+static void build_large(Script *script) {
+    go_to_line(script, LARGE_LINES / 2);
+    for (int i = 0; i < 10; i++) type(script, snippet);
+    for (int i = 0; i < 50; i++) key(script, "\033[6~");
+    go_to_line(script, LARGE_LINES);
+    for (int i = 0; i < 10; i++) type(script, snippet);
+    for (int i = 0; i < 200; i++) key(script, "\025");
+}
+
+static void build_find(Script *script) {
+    find(script, "result9[0-9]*7 = compute");
+    for (int i = 0; i < 100; i++) key(script, "\016");
+    for (int i = 0; i < 50; i++) key(script, "\020");
+    find(script, "^ \\*/ static .*\"value 99[0-9]*1\"");
+    for (int i = 0; i < 20; i++) key(script, "\016");
+    go_to_line(script, LARGE_LINES / 2);
+    for (int i = 0; i < 20; i++) key(script, "\020");
+}
+
+static void build_replace(Script *script) {
+    replace(script, "result[0-9]+7 =", "r =", "ynyyna");
+    go_to_line(script, LARGE_LINES / 2);
+    for (int i = 0; i < 5; i++) type(script, snippet);
+    for (int i = 0; i < 20; i++) key(script, "\016");
+    replace(script, "compute", "evaluate", "a");
+    for (int i = 0; i < 10; i++) type(script, snippet);
+    for (int i = 0; i < 20; i++) key(script, "\025");
+}
+
+static const Scenario scenarios[] = {
+    { "typing", SOURCE_LINES, build_typing },
+    { "navigation", SOURCE_LINES, build_navigation },
+    { "paste", SOURCE_LINES, build_paste },
+    { "undo", SOURCE_LINES, build_undo },
+    { "large", LARGE_LINES, build_large },
+    { "find", LARGE_LINES, build_find },
+    { "replace", LARGE_LINES, build_replace },
+};
+
+#define SCENARIO_COUNT (sizeof(scenarios) / sizeof(scenarios[0]))
+
+static void make_source(const char *path, size_t lines) {
+    FILE *file = fopen(path, "w");
+    for (size_t i = 0; i < lines; i++) {
+        if (i % 20 == 0) {
+            fprintf(file, "/* section %zu\n", i);
+        } else if (i % 20 == 2) {
+            fprintf(file, " */ static const char *name%zu = \"value %zu\";\n", i, i);
+        } else {
+            fprintf(file, "    result%zu = compute(result%zu, %zu); // step\n", i, i - 1, i);
+        }
+    }
+    fclose(file);
+}
+
+static int compare_ns(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const long long *sorted, size_t count, double p) {
+    return sorted[(size_t)(p * (count - 1))] / 1e3;
+}
+
+static int run(const Scenario *scenario) {
+    char source[] = "/tmp/texteditor-replay-XXXXXX.c";
+    char keys[] = "/tmp/texteditor-keys-XXXXXX";
+    Script script = { 0 };
+    Editor editor;
+    struct rusage usage;
+    long long *latency, handle_ns = 0, refresh_ns = 0;
+    size_t frames = 0, frame_bytes = 0, max_frame = 0, allocs, bytes;
+    int source_fd = mkstemps(source, 2);
+    int keys_fd = mkstemp(keys);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (source_fd < 0 || keys_fd < 0 || null_fd < 0) {
+        perror("replay");
+        return 1;
+    }
+    close(source_fd);
+    make_source(source, scenario->lines);
+    scenario->build(&script);
+    if (write(keys_fd, script.data, script.len) != (ssize_t)script.len) {
+        perror("replay");
+        return 1;
+    }
+    lseek(keys_fd, 0, SEEK_SET);
+    latency = malloc(script.keys * sizeof(long long));
+
+    long long load_start = now_ns();
+    editor_open(&editor, source);
+    editor_attach(&editor, keys_fd, null_fd);
+    refresh_screen(&editor);
+    long long load_ns = now_ns() - load_start;
+
+    alloc_count = alloc_bytes = 0;
+    while (frames < script.keys) {
+        long long start = now_ns(), handled, done;
+        int ch = input_read_key(&editor.input, -1);
+        if (ch == KEY_EOF) break;
+        if (ch == KEY_NONE) continue;
+        editor_process_key(&editor, ch);
+        editor_collect(&editor);
+        handled = now_ns();
+        refresh_screen(&editor);
+        done = now_ns();
+        handle_ns += handled - start;
+        refresh_ns += done - handled;
+        latency[frames++] = done - start;
+        frame_bytes += editor.screen.frame_bytes;
+        if (editor.screen.frame_bytes > max_frame) max_frame = editor.screen.frame_bytes;
+    }
+    allocs = alloc_count;
+    bytes = alloc_bytes;
+
+    getrusage(RUSAGE_SELF, &usage);
+    qsort(latency, frames, sizeof(long long), compare_ns);
+    printf("%-10s %6zu %7.1f %7.1f %7.1f %8.1f %8.1f %8.1f %8zu %6zu %8zu %7.1f %7.1f %6.1f\n",
+           scenario->name, frames, percentile(latency, frames, 0.5),
+           percentile(latency, frames, 0.9), percentile(latency, frames, 0.99),
+           latency[frames - 1] / 1e3, handle_ns / 1e3 / frames, refresh_ns / 1e3 / frames,
+           frame_bytes / frames, max_frame, allocs, bytes / 1e6, usage.ru_maxrss / 1024.0,
+           load_ns / 1e6);
+    journal_discard(&editor.doc->journal);
+    editor_close(&editor);
+    free(latency);
+    free(script.data);
+    close(keys_fd);
+    close(null_fd);
+    unlink(keys);
+    unlink(source);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int status = 0;
+    printf("%-10s %6s %7s %7s %7s %8s %8s %8s %8s %6s %8s %7s %7s %6s\n", "scenario", "keys",
+           "p50 us", "p90 us", "p99 us", "max us", "key us", "draw us", "B/frame", "max B",
+           "allocs", "alloc MB", "rss MB", "load ms");
+    fflush(stdout);
+    for (size_t i = 0; i < SCENARIO_COUNT; i++) {
+        int selected = argc == 1;
+        for (int j = 1; j < argc; j++) {
+            if (strcmp(argv[j], scenarios[i].name) == 0) selected = 1;
+        }
+        if (!selected) continue;
+        pid_t pid = fork();
+        if (pid == 0) {
+            exit(run(&scenarios[i]));
+        }
+        int child;
+        waitpid(pid, &child, 0);
+        if (!WIFEXITED(child) || WEXITSTATUS(child) != 0) status = 1;
+    }
+    return status;
+}
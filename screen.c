@@ -0,0 +1,300 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "screen.h"
+#include "utf8.h"
+
+/* Unchanged cells shorter than this are rewritten rather than skipped. */
+#define SKIP_THRESHOLD 4
+/* The right half of a double-width character, which is drawn with the left. */
+#define CELL_WIDE_RIGHT 0xFFFFFFFFu
+#define HIDE_CURSOR "\033[?25l"
+#define SHOW_CURSOR "\033[?25h"
+
+static volatile sig_atomic_t resize_pending;
+static struct sigaction old_winch;
+
+static const char *colors[] = {
+    "", ";1;34", ";32", ";33", ";36", ";30;43", ";32", ";31"
+};
+
+const char *screen_sgr(unsigned char attr) {
+    static char sgr[2][8][16];
+    int selected = (attr & ATTR_SELECTED) != 0;
+    int color = attr & ~ATTR_SELECTED;
+    if (color > ATTR_DELETED) color = ATTR_NORMAL;
+    if (!sgr[selected][color][0]) {
+        snprintf(sgr[selected][color], sizeof(sgr[0][0]), "\033[0%s%sm",
+                 colors[color], selected ? ";7" : "");
+    }
+    return sgr[selected][color];
+}
+
+static int is_blank(const Cell *cell) {
+    return cell->ch == ' ' && cell->attr == ATTR_NORMAL;
+}
+
+static void fill_blank(Cell *cells, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        cells[i].ch = ' ';
+        cells[i].attr = ATTR_NORMAL;
+    }
+}
+
+static void append(Screen *screen, const char *data, size_t len) {
+    if (screen->out_len + len > screen->out_cap) {
+        size_t cap = screen->out_cap ? screen->out_cap : 16384;
+        while (cap < screen->out_len + len) cap *= 2;
+        screen->out = realloc(screen->out, cap);
+        screen->out_cap = cap;
+    }
+    memcpy(screen->out + screen->out_len, data, len);
+    screen->out_len += len;
+}
+
+static void append_str(Screen *screen, const char *text) {
+    append(screen, text, strlen(text));
+}
+
+static void emit_move(Screen *screen, int row, int col) {
+    char seq[32];
+    if (screen->term_row == row && screen->term_col == col) return;
+    if (screen->term_row == row && col == 0) {
+        append(screen, "\r", 1);
+    } else {
+        append(screen, seq, snprintf(seq, sizeof(seq), "\033[%d;%dH", row + 1, col + 1));
+    }
+    screen->term_row = row;
+    screen->term_col = col;
+}
+
+static void emit_attr(Screen *screen, unsigned char attr) {
+    if (screen->term_attr == attr) return;
+    append_str(screen, screen_sgr(attr));
+    screen->term_attr = attr;
+}
+
+static void emit_cell(Screen *screen, const Cell *cell) {
+    char ch[UTF8_MAX];
+    if (cell->ch == CELL_WIDE_RIGHT) return;
+    emit_attr(screen, cell->attr);
+    append(screen, ch, utf8_encode(cell->ch, ch));
+    screen->term_col += utf8_width(cell->ch);
+    if (screen->term_col >= screen->cols) {
+        screen->term_col = -1;
+    }
+}
+
+void screen_init(Screen *screen, int fd, int rows, int cols) {
+    memset(screen, 0, sizeof(Screen));
+    screen->fd = fd;
+    screen_resize(screen, rows, cols);
+}
+
+void screen_resize(Screen *screen, int rows, int cols) {
+    if (rows < 1) rows = 1;
+    if (cols < 1) cols = 1;
+    screen->rows = rows;
+    screen->cols = cols;
+    screen->front = realloc(screen->front, (size_t)rows * cols * sizeof(Cell));
+    screen->back = realloc(screen->back, (size_t)rows * cols * sizeof(Cell));
+    screen->dirty = realloc(screen->dirty, rows);
+    fill_blank(screen->back, (size_t)rows * cols);
+    memset(screen->dirty, 1, rows);
+    screen_invalidate(screen);
+}
+
+static void handle_winch(int sig) {
+    (void)sig;
+    resize_pending = 1;
+}
+
+void screen_watch_resize(void) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_winch;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGWINCH, &sa, &old_winch);
+    resize_pending = 1;
+}
+
+void screen_unwatch_resize(void) {
+    sigaction(SIGWINCH, &old_winch, NULL);
+}
+
+/* Applies a pending SIGWINCH; returns 1 if the screen was resized. */
+int screen_update_size(Screen *screen) {
+    int rows = screen->rows, cols = screen->cols;
+    if (!resize_pending) return 0;
+    resize_pending = 0;
+    screen_query_size(screen->fd, &rows, &cols);
+    screen_resize(screen, rows, cols);
+    return 1;
+}
+
+int screen_query_size(int fd, int *rows, int *cols) {
+    struct winsize ws;
+    if (ioctl(fd, TIOCGWINSZ, &ws) < 0 || ws.ws_row == 0 || ws.ws_col == 0) {
+        return -1;
+    }
+    *rows = ws.ws_row;
+    *cols = ws.ws_col;
+    return 0;
+}
+
+void screen_free(Screen *screen) {
+    free(screen->front);
+    free(screen->back);
+    free(screen->dirty);
+    free(screen->out);
+    memset(screen, 0, sizeof(Screen));
+}
+
+void screen_invalidate(Screen *screen) {
+    screen->valid = 0;
+}
+
+/* Keeps both halves of a double-width character together when one is overwritten. */
+static void put_cell(Screen *screen, int row, int col, Cell cell) {
+    Cell *cells = screen->back + (size_t)row * screen->cols;
+    if (cells[col].ch == cell.ch && cells[col].attr == cell.attr) return;
+    if (cells[col].ch == CELL_WIDE_RIGHT && col > 0) fill_blank(&cells[col - 1], 1);
+    if (col + 1 < screen->cols && cells[col + 1].ch == CELL_WIDE_RIGHT &&
+        cell.ch != CELL_WIDE_RIGHT) {
+        fill_blank(&cells[col + 1], 1);
+    }
+    cells[col] = cell;
+    screen->dirty[row] = 1;
+}
+
+static int draw(Screen *screen, int row, int col, const char *text,
+                const unsigned char *attrs, unsigned char attr, size_t len) {
+    if (row < 0 || row >= screen->rows) return col;
+    for (size_t i = 0; i < len && col < screen->cols;) {
+        unsigned int cp = (unsigned char)text[i];
+        int n = 1, width = 1;
+        Cell cell;
+        if (cp >= 0x80) {
+            n = utf8_decode(text + i, len - i, &cp);
+            width = utf8_width(cp);
+        }
+        cell.ch = cp == '\t' ? ' ' : (cp < 32 || cp == 127) ? '?' : cp;
+        cell.attr = attrs ? attrs[i] : attr;
+        i += n;
+        if (width == 0) continue;
+        if (width == 2 && col + 1 >= screen->cols) cell.ch = ' ';
+        put_cell(screen, row, col++, cell);
+        if (width == 2 && col < screen->cols) {
+            cell.ch = CELL_WIDE_RIGHT;
+            put_cell(screen, row, col++, cell);
+        }
+    }
+    return col;
+}
+
+/* Text is UTF-8; returns the column after the last character drawn. */
+int screen_draw(Screen *screen, int row, int col, const char *text,
+                const unsigned char *attrs, size_t len) {
+    return draw(screen, row, col, text, attrs, ATTR_NORMAL, len);
+}
+
+int screen_draw_text(Screen *screen, int row, int col, const char *text, unsigned char attr) {
+    return draw(screen, row, col, text, NULL, attr, strlen(text));
+}
+
+void screen_clear_row(Screen *screen, int row, int col) {
+    Cell *cells;
+    if (row < 0 || row >= screen->rows) return;
+    cells = screen->back + (size_t)row * screen->cols;
+    if (col > 0 && col < screen->cols && cells[col].ch == CELL_WIDE_RIGHT) col--;
+    for (; col < screen->cols; col++) {
+        if (!is_blank(&cells[col])) {
+            fill_blank(&cells[col], 1);
+            screen->dirty[row] = 1;
+        }
+    }
+}
+
+void screen_set_cursor(Screen *screen, int row, int col) {
+    screen->cursor_row = row;
+    screen->cursor_col = col;
+}
+
+static void flush_row(Screen *screen, int row) {
+    Cell *back = screen->back + (size_t)row * screen->cols;
+    Cell *front = screen->front + (size_t)row * screen->cols;
+    int blank_from = screen->cols;
+    int erase = 0;
+    while (blank_from > 0 && is_blank(&back[blank_from - 1])) blank_from--;
+    for (int col = blank_from; col < screen->cols; col++) {
+        if (!is_blank(&front[col])) {
+            erase = 1;
+            break;
+        }
+    }
+    for (int col = 0; col < blank_from; col++) {
+        if (back[col].ch == front[col].ch && back[col].attr == front[col].attr) continue;
+        if (back[col].ch == CELL_WIDE_RIGHT) {
+            front[col] = back[col];
+            continue;
+        }
+        if (screen->term_row == row && screen->term_col >= 0 && screen->term_col < col &&
+            col - screen->term_col <= SKIP_THRESHOLD) {
+            for (int c = screen->term_col; c < col; c++) emit_cell(screen, &back[c]);
+        } else {
+            emit_move(screen, row, col);
+        }
+        emit_cell(screen, &back[col]);
+        front[col] = back[col];
+    }
+    if (erase) {
+        emit_move(screen, row, blank_from);
+        emit_attr(screen, ATTR_NORMAL);
+        append_str(screen, "\033[K");
+        fill_blank(front + blank_from, screen->cols - blank_from);
+    }
+    screen->dirty[row] = 0;
+}
+
+size_t screen_flush(Screen *screen) {
+    size_t written = 0;
+    screen->out_len = 0;
+    append_str(screen, HIDE_CURSOR);
+    if (!screen->valid) {
+        append_str(screen, "\033[0m\033[H\033[2J");
+        fill_blank(screen->front, (size_t)screen->rows * screen->cols);
+        memset(screen->dirty, 1, screen->rows);
+        screen->term_row = 0;
+        screen->term_col = 0;
+        screen->term_attr = ATTR_NORMAL;
+        screen->valid = 1;
+    }
+    for (int row = 0; row < screen->rows; row++) {
+        if (screen->dirty[row]) flush_row(screen, row);
+    }
+    /* Nothing changed, so the cursor need not be hidden either. */
+    if (screen->out_len == sizeof(HIDE_CURSOR) - 1) screen->out_len = 0;
+    if (screen->out_len > 0 || screen->term_row != screen->cursor_row ||
+        screen->term_col != screen->cursor_col) {
+        int drawn = screen->out_len > 0;
+        emit_move(screen, screen->cursor_row, screen->cursor_col);
+        if (drawn) append_str(screen, SHOW_CURSOR);
+    }
+    while (written < screen->out_len) {
+        ssize_t n = write(screen->fd, screen->out + written, screen->out_len - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        written += n;
+    }
+    screen->frame_bytes = screen->out_len;
+    screen->total_bytes += screen->out_len;
+    screen->frames++;
+    return screen->frame_bytes;
+}
@@ -0,0 +1,67 @@
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include <stddef.h>
+
+enum {
+    ATTR_NORMAL,
+    ATTR_KEYWORD,
+    ATTR_STRING,
+    ATTR_NUMBER,
+    ATTR_COMMENT,
+    ATTR_MATCH,
+    ATTR_INSERTED,
+    ATTR_DELETED,
+    ATTR_SELECTED = 0x80
+};
+
+typedef struct {
+    unsigned int ch;
+    unsigned char attr;
+} Cell;
+
+/*
+ * Double-buffered terminal renderer.  Callers draw a frame into the back
+ * buffer; screen_flush() compares it with the shadow copy of what the
+ * terminal currently shows and emits only the changed cells, with cursor
+ * moves and colour changes collapsed, in a single write().  Text is drawn
+ * as UTF-8, one cell per column: a double-width character takes two.
+ */
+typedef struct {
+    int fd;
+    int rows;
+    int cols;
+    Cell *front;
+    Cell *back;
+    unsigned char *dirty;
+    int valid;
+    int cursor_row;
+    int cursor_col;
+    int term_row;
+    int term_col;
+    int term_attr;
+    char *out;
+    size_t out_len;
+    size_t out_cap;
+    size_t frame_bytes;
+    size_t total_bytes;
+    size_t frames;
+} Screen;
+
+void screen_init(Screen *screen, int fd, int rows, int cols);
+void screen_free(Screen *screen);
+void screen_resize(Screen *screen, int rows, int cols);
+int screen_query_size(int fd, int *rows, int *cols);
+void screen_watch_resize(void);
+void screen_unwatch_resize(void);
+int screen_update_size(Screen *screen);
+void screen_invalidate(Screen *screen);
+int screen_draw(Screen *screen, int row, int col, const char *text,
+                const unsigned char *attrs, size_t len);
+int screen_draw_text(Screen *screen, int row, int col, const char *text, unsigned char attr);
+void screen_clear_row(Screen *screen, int row, int col);
+void screen_set_cursor(Screen *screen, int row, int col);
+size_t screen_flush(Screen *screen);
+const char *screen_sgr(unsigned char attr);
+
+#endif
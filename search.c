@@ -0,0 +1,304 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SEARCH_X86 1
+#endif
+
+#include "search.h"
+
+#define SEARCH_BLOCK (1 << 20)
+
+static unsigned char fold(unsigned char c) {
+    return c >= 'A' && c <= 'Z' ? c + 32 : c;
+}
+
+static unsigned char upper(unsigned char c) {
+    return c >= 'a' && c <= 'z' ? c - 32 : c;
+}
+
+static int is_word_byte(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+           c == '_';
+}
+
+static int verify(const SearchPattern *sp, const unsigned char *text) {
+    if (!(sp->flags & SEARCH_IGNORE_CASE)) {
+        return memcmp(text, sp->pattern, sp->length) == 0;
+    }
+    for (size_t i = 0; i < sp->length; i++) {
+        if (fold(text[i]) != sp->folded[i]) return 0;
+    }
+    return 1;
+}
+
+static size_t scan_horspool(const SearchPattern *sp, const unsigned char *text, size_t len,
+                            size_t from) {
+    size_t n = sp->length;
+    int ignore_case = sp->flags & SEARCH_IGNORE_CASE;
+    unsigned char last = ignore_case ? sp->folded[n - 1] : sp->pattern[n - 1];
+    size_t i = from;
+    while (i + n <= len) {
+        unsigned char c = text[i + n - 1];
+        if (ignore_case) c = fold(c);
+        if (c == last && verify(sp, text + i)) return i;
+        i += sp->skip[c];
+    }
+    return SEARCH_NONE;
+}
+
+#ifdef SEARCH_X86
+/*
+ * First/last byte filter: a position is a candidate only if both the
+ * first and the last pattern byte match there, which rejects almost all
+ * positions sixteen or thirty-two at a time.
+ */
+static size_t scan_sse2(const SearchPattern *sp, const unsigned char *text, size_t len,
+                        size_t from) {
+    size_t n = sp->length, i = from;
+    const __m128i first_a = _mm_set1_epi8((char)sp->first[0]);
+    const __m128i first_b = _mm_set1_epi8((char)sp->first[1]);
+    const __m128i last_a = _mm_set1_epi8((char)sp->last[0]);
+    const __m128i last_b = _mm_set1_epi8((char)sp->last[1]);
+    for (; i + n - 1 + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(text + i + n - 1));
+        __m128i eq_a = _mm_or_si128(_mm_cmpeq_epi8(a, first_a), _mm_cmpeq_epi8(a, first_b));
+        __m128i eq_b = _mm_or_si128(_mm_cmpeq_epi8(b, last_a), _mm_cmpeq_epi8(b, last_b));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(eq_a, eq_b));
+        while (mask) {
+            size_t bit = __builtin_ctz(mask);
+            if (verify(sp, text + i + bit)) return i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return scan_horspool(sp, text, len, i);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_avx2(const SearchPattern *sp, const unsigned char *text, size_t len,
+                        size_t from) {
+    size_t n = sp->length, i = from;
+    const __m256i first_a = _mm256_set1_epi8((char)sp->first[0]);
+    const __m256i first_b = _mm256_set1_epi8((char)sp->first[1]);
+    const __m256i last_a = _mm256_set1_epi8((char)sp->last[0]);
+    const __m256i last_b = _mm256_set1_epi8((char)sp->last[1]);
+    for (; i + n - 1 + 32 <= len; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(text + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(text + i + n - 1));
+        __m256i eq_a = _mm256_or_si256(_mm256_cmpeq_epi8(a, first_a),
+                                       _mm256_cmpeq_epi8(a, first_b));
+        __m256i eq_b = _mm256_or_si256(_mm256_cmpeq_epi8(b, last_a),
+                                       _mm256_cmpeq_epi8(b, last_b));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(eq_a, eq_b));
+        while (mask) {
+            size_t bit = __builtin_ctz(mask);
+            if (verify(sp, text + i + bit)) return i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return scan_sse2(sp, text, len, i);
+}
+#endif
+
+static size_t count_newlines_scalar(const unsigned char *text, size_t len) {
+    size_t count = 0;
+    for (size_t i = 0; i < len; i++) {
+        count += text[i] == '\n';
+    }
+    return count;
+}
+
+#ifdef SEARCH_X86
+static size_t count_newlines_sse2(const unsigned char *text, size_t len) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t count = 0, i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(text + i));
+        count += __builtin_popcount((unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+    }
+    return count + count_newlines_scalar(text + i, len - i);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t count_newlines_avx2(const unsigned char *text, size_t len) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t count = 0, i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(text + i));
+        count += __builtin_popcount((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl)));
+    }
+    return count + count_newlines_scalar(text + i, len - i);
+}
+#endif
+
+size_t search_count_newlines(const char *text, size_t len) {
+    static size_t (*count)(const unsigned char *, size_t);
+    if (!count) {
+        count = count_newlines_scalar;
+#ifdef SEARCH_X86
+        __builtin_cpu_init();
+        count = __builtin_cpu_supports("avx2") ? count_newlines_avx2 : count_newlines_sse2;
+#endif
+    }
+    return count((const unsigned char *)text, len);
+}
+
+int search_compile(SearchPattern *sp, const char *pattern, size_t len, int flags) {
+    memset(sp, 0, sizeof(SearchPattern));
+    if (len == 0) return -1;
+    sp->pattern = malloc(len);
+    sp->folded = malloc(len);
+    memcpy(sp->pattern, pattern, len);
+    for (size_t i = 0; i < len; i++) {
+        sp->folded[i] = fold(sp->pattern[i]);
+    }
+    sp->length = len;
+    sp->flags = flags;
+    if (flags & SEARCH_IGNORE_CASE) {
+        sp->first[0] = sp->folded[0];
+        sp->first[1] = upper(sp->folded[0]);
+        sp->last[0] = sp->folded[len - 1];
+        sp->last[1] = upper(sp->folded[len - 1]);
+    } else {
+        sp->first[0] = sp->first[1] = sp->pattern[0];
+        sp->last[0] = sp->last[1] = sp->pattern[len - 1];
+    }
+    for (int c = 0; c < 256; c++) {
+        sp->skip[c] = len;
+    }
+    for (size_t i = 0; i + 1 < len; i++) {
+        unsigned char c = flags & SEARCH_IGNORE_CASE ? sp->folded[i] : sp->pattern[i];
+        sp->skip[c] = len - 1 - i;
+    }
+    sp->scan = scan_horspool;
+    sp->isa = "scalar";
+#ifdef SEARCH_X86
+    if (!(flags & SEARCH_SCALAR)) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            sp->scan = scan_avx2;
+            sp->isa = "avx2";
+        } else if (__builtin_cpu_supports("sse2")) {
+            sp->scan = scan_sse2;
+            sp->isa = "sse2";
+        }
+    }
+#endif
+    return 0;
+}
+
+void search_free(SearchPattern *sp) {
+    free(sp->pattern);
+    free(sp->folded);
+    memset(sp, 0, sizeof(SearchPattern));
+}
+
+static int whole_word_at(const SearchPattern *sp, const unsigned char *text, size_t len,
+                         size_t pos) {
+    if (pos > 0 && is_word_byte(text[pos - 1])) return 0;
+    if (pos + sp->length < len && is_word_byte(text[pos + sp->length])) return 0;
+    return 1;
+}
+
+size_t search_next(const SearchPattern *sp, const char *text, size_t len, size_t from) {
+    const unsigned char *data = (const unsigned char *)text;
+    size_t pos = from;
+    while (pos < len && (pos = sp->scan(sp, data, len, pos)) != SEARCH_NONE) {
+        if (!(sp->flags & SEARCH_WHOLE_WORD) || whole_word_at(sp, data, len, pos)) {
+            return pos;
+        }
+        pos++;
+    }
+    return SEARCH_NONE;
+}
+
+size_t search_buffer(const SearchPattern *sp, const char *text, size_t len,
+                     const SearchPosition *at, search_callback cb, void *arg) {
+    size_t count = 0, line = at->line, counted = 0, pos = 0;
+    size_t line_start = at->line_start;
+    while ((pos = search_next(sp, text, len, pos)) != SEARCH_NONE) {
+        count++;
+        if (cb) {
+            SearchMatch match;
+            size_t newlines = search_count_newlines(text + counted, pos - counted);
+            const char *line_end;
+            if (newlines > 0) {
+                line += newlines;
+                line_start = at->offset +
+                    ((const char *)memrchr(text + counted, '\n', pos - counted) - text) + 1;
+            }
+            counted = pos;
+            line_end = memchr(text + pos, '\n', len - pos);
+            match.line = line;
+            match.column = at->offset + pos - line_start + 1;
+            match.offset = at->offset + pos;
+            match.line_text = line_start >= at->offset ? text + (line_start - at->offset) : text;
+            match.line_length = (line_end ? line_end : text + len) - match.line_text;
+            if (cb(&match, arg)) break;
+        }
+        pos += sp->length;
+    }
+    return count;
+}
+
+void search_advance(SearchPosition *at, const char *text, size_t len) {
+    const char *nl = memrchr(text, '\n', len);
+    if (nl) {
+        at->line += search_count_newlines(text, len);
+        at->line_start = at->offset + (nl - text) + 1;
+    }
+    at->offset += len;
+}
+
+/*
+ * Streams fd through a block buffer.  Blocks are cut after their last
+ * newline so matches and line context never straddle two blocks; a line
+ * longer than a block is cut with an overlap of length - 1 bytes instead.
+ */
+long long search_fd(const SearchPattern *sp, int fd, search_callback cb, void *arg) {
+    size_t cap = SEARCH_BLOCK, have = 0;
+    SearchPosition at = { 1, 0, 0 };
+    long long count = 0;
+    int eof = 0;
+    char *buf;
+    if (sp->flags & SEARCH_COUNT_ONLY) cb = NULL;
+    if (sp->length * 2 > cap) cap = sp->length * 2;
+    buf = malloc(cap);
+    if (!buf) return -1;
+    while (!eof) {
+        size_t end, scan_len;
+        ssize_t n = read(fd, buf + have, cap - have);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            free(buf);
+            return -1;
+        }
+        eof = n == 0;
+        have += n;
+        if (!eof && have < cap) continue;
+        if (eof) {
+            end = scan_len = have;
+        } else {
+            char *nl = memrchr(buf, '\n', have);
+            if (nl) {
+                end = scan_len = (size_t)(nl - buf) + 1;
+            } else {
+                scan_len = have;
+                end = have - (sp->length - 1);
+            }
+        }
+        count += search_buffer(sp, buf, scan_len, &at, cb, arg);
+        if (cb) {
+            search_advance(&at, buf, end);
+        }
+        memmove(buf, buf + end, have - end);
+        have -= end;
+    }
+    free(buf);
+    return count;
+}
@@ -0,0 +1,64 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stddef.h>
+
+#define SEARCH_NONE ((size_t)-1)
+
+enum {
+    SEARCH_IGNORE_CASE = 1,
+    SEARCH_WHOLE_WORD = 2,
+    SEARCH_COUNT_ONLY = 4,
+    SEARCH_SCALAR = 8
+};
+
+typedef struct SearchPattern SearchPattern;
+
+typedef size_t (*search_scan_fn)(const SearchPattern *sp, const unsigned char *text,
+                                 size_t len, size_t from);
+
+/*
+ * A compiled literal pattern.  Candidates are found with a vectorised
+ * first/last byte filter (AVX2 or SSE2, picked at run time) and confirmed
+ * with a full compare; short tails and machines without SIMD use
+ * Boyer-Moore-Horspool.
+ */
+struct SearchPattern {
+    unsigned char *pattern;
+    unsigned char *folded;
+    size_t length;
+    int flags;
+    unsigned char first[2];
+    unsigned char last[2];
+    size_t skip[256];
+    search_scan_fn scan;
+    const char *isa;
+};
+
+typedef struct {
+    size_t line;
+    size_t column;
+    size_t offset;
+    const char *line_text;
+    size_t line_length;
+} SearchMatch;
+
+/* Where a block of text starts within its file. */
+typedef struct {
+    size_t line;
+    size_t line_start;
+    size_t offset;
+} SearchPosition;
+
+typedef int (*search_callback)(const SearchMatch *match, void *arg);
+
+int search_compile(SearchPattern *sp, const char *pattern, size_t len, int flags);
+void search_free(SearchPattern *sp);
+size_t search_next(const SearchPattern *sp, const char *text, size_t len, size_t from);
+size_t search_buffer(const SearchPattern *sp, const char *text, size_t len,
+                     const SearchPosition *at, search_callback cb, void *arg);
+void search_advance(SearchPosition *at, const char *text, size_t len);
+long long search_fd(const SearchPattern *sp, int fd, search_callback cb, void *arg);
+size_t search_count_newlines(const char *text, size_t len);
+
+#endif
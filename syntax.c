@@ -0,0 +1,502 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "screen.h"
+#include "syntax.h"
+#include "trace.h"
+
+typedef struct SyntaxJob {
+    Job job;
+    SyntaxCache *cache;
+    const Language *lang;
+    size_t first;
+    size_t count;
+    size_t done;
+    int state;
+    char *text;
+    size_t len;
+    unsigned char *states;
+} SyntaxJob;
+
+static int open_string_state(char quote, int triple) {
+    if (triple) return quote == '"' ? SYNTAX_TRIPLE : SYNTAX_TRIPLE_SINGLE;
+    return quote == '"' ? SYNTAX_STRING : SYNTAX_STRING_SINGLE;
+}
+
+/*
+ * Scans a string body from i, just past the opening quote, and returns the
+ * index after the closing quote.  If the line ends first, *state says
+ * whether the string carries on into the next line.
+ */
+static size_t lex_string(const Language *lang, const char *text, size_t len, size_t i,
+                         char quote, int triple, int *state) {
+    int escapes = !(quote == '\'' && (lang->flags & LANG_RAW_SINGLE_QUOTES));
+    while (i < len) {
+        const char *end = memchr(text + i, quote, len - i);
+        const char *escape = escapes ? memchr(text + i, '\\', (end ? end : text + len) - (text + i))
+                                     : NULL;
+        if (escape) {
+            i = escape - text + 2;
+            if (i > len) {
+                *state = lang->flags & (LANG_CONTINUATION | LANG_MULTILINE_STRINGS) || triple
+                    ? open_string_state(quote, triple) : SYNTAX_NORMAL;
+                return len;
+            }
+            continue;
+        }
+        if (!end) break;
+        i = end - text + 1;
+        if (!triple) {
+            *state = SYNTAX_NORMAL;
+            return i;
+        }
+        if (i + 1 < len && text[i] == quote && text[i + 1] == quote) {
+            *state = SYNTAX_NORMAL;
+            return i + 2;
+        }
+    }
+    *state = triple || (lang->flags & LANG_MULTILINE_STRINGS)
+        ? open_string_state(quote, triple) : SYNTAX_NORMAL;
+    return len;
+}
+
+static int starts_with(const char *text, size_t len, size_t i, const char *prefix) {
+    size_t n = strlen(prefix);
+    return n <= len - i && memcmp(text + i, prefix, n) == 0;
+}
+
+/*
+ * Lexes one line starting in the given state, writing an attribute per
+ * byte, and returns the state the line ends in.  Dispatch is on the
+ * language's character class table; block comments and unterminated
+ * strings the language allows to continue carry over to the next line.
+ */
+int syntax_lex(const Language *lang, const char *text, size_t len, int state,
+               unsigned char *attrs) {
+    const unsigned char *classes = lang->classes;
+    size_t i = 0;
+    while (i < len) {
+        size_t start = i;
+        if (state == SYNTAX_COMMENT) {
+            const char *close = lang->block_close;
+            const char *p;
+            while (close && (p = memchr(text + i, close[0], len - i)) != NULL) {
+                i = p - text;
+                if (starts_with(text, len, i, close)) break;
+                i++;
+            }
+            if (close && p) {
+                i += strlen(close);
+                state = SYNTAX_NORMAL;
+            } else {
+                i = len;
+            }
+            memset(attrs + start, ATTR_COMMENT, i - start);
+            continue;
+        }
+        if (state != SYNTAX_NORMAL) {
+            int triple = state == SYNTAX_TRIPLE || state == SYNTAX_TRIPLE_SINGLE;
+            char quote = state == SYNTAX_STRING || state == SYNTAX_TRIPLE ? '"' : '\'';
+            i = lex_string(lang, text, len, i, quote, triple, &state);
+            memset(attrs + start, ATTR_STRING, i - start);
+            continue;
+        }
+        switch (classes[(unsigned char)text[i]]) {
+        case CLASS_WORD:
+            do attrs[i++] = ATTR_NORMAL;
+            while (i < len && (classes[(unsigned char)text[i]] == CLASS_WORD ||
+                               classes[(unsigned char)text[i]] == CLASS_DIGIT));
+            if (language_is_keyword(lang, text + start, i - start)) {
+                memset(attrs + start, ATTR_KEYWORD, i - start);
+            }
+            break;
+        case CLASS_DIGIT:
+            do i++; while (i < len && (classes[(unsigned char)text[i]] == CLASS_WORD ||
+                                       classes[(unsigned char)text[i]] == CLASS_DIGIT ||
+                                       text[i] == '.'));
+            memset(attrs + start, ATTR_NUMBER, i - start);
+            break;
+        case CLASS_QUOTE: {
+            char quote = text[i];
+            int triple = (lang->flags & LANG_TRIPLE_QUOTES) && i + 2 < len &&
+                         text[i + 1] == quote && text[i + 2] == quote;
+            i = lex_string(lang, text, len, i + (triple ? 3 : 1), quote, triple, &state);
+            memset(attrs + start, ATTR_STRING, i - start);
+            break;
+        }
+        case CLASS_COMMENT:
+            if (lang->line_comment && starts_with(text, len, i, lang->line_comment) &&
+                (!(lang->flags & LANG_COMMENT_AFTER_SPACE) || i == 0 ||
+                 text[i - 1] == ' ' || text[i - 1] == '\t')) {
+                memset(attrs + i, ATTR_COMMENT, len - i);
+                i = len;
+            } else if (lang->block_open && starts_with(text, len, i, lang->block_open)) {
+                i += strlen(lang->block_open);
+                memset(attrs + start, ATTR_COMMENT, i - start);
+                state = SYNTAX_COMMENT;
+            } else {
+                attrs[i++] = ATTR_NORMAL;
+            }
+            break;
+        default:
+            do attrs[i++] = ATTR_NORMAL;
+            while (i < len && classes[(unsigned char)text[i]] == CLASS_OTHER);
+            break;
+        }
+    }
+    return state;
+}
+
+void print_syntax_highlighted(const char *line, int is_selected) {
+    size_t len = strlen(line), start = 0;
+    unsigned char *attrs = malloc(len + 1);
+    int current = ATTR_NORMAL;
+    syntax_lex(language_by_name("c"), line, len, SYNTAX_NORMAL, attrs);
+    for (size_t i = 0; i < len; i++) {
+        int attr = attrs[i] | (is_selected ? ATTR_SELECTED : 0);
+        if (attr != current) {
+            fwrite(line + start, 1, i - start, stdout);
+            fputs(screen_sgr(attr), stdout);
+            current = attr;
+            start = i;
+        }
+    }
+    fwrite(line + start, 1, len - start, stdout);
+    if (current != ATTR_NORMAL) {
+        fputs(screen_sgr(ATTR_NORMAL), stdout);
+    }
+    free(attrs);
+}
+
+static size_t line_count(const SyntaxCache *cache) {
+    return cache->capacity - (cache->gap_end - cache->gap_start);
+}
+
+static SyntaxLine *entry(SyntaxCache *cache, size_t line) {
+    if (line >= cache->gap_start) line += cache->gap_end - cache->gap_start;
+    return &cache->lines[line];
+}
+
+static size_t span_bytes(unsigned int count) {
+    return (count ? count : 1) * sizeof(SyntaxSpan);
+}
+
+static void drop_spans(SyntaxCache *cache, SyntaxLine *e) {
+    if (e->spans) arena_free(&cache->arena, e->spans, span_bytes(e->span_count));
+    e->spans = NULL;
+    e->span_count = 0;
+}
+
+static void move_gap(SyntaxCache *cache, size_t pos) {
+    size_t gap = cache->gap_end - cache->gap_start;
+    if (pos < cache->gap_start) {
+        size_t n = cache->gap_start - pos;
+        memmove(cache->lines + pos + gap, cache->lines + pos, n * sizeof(SyntaxLine));
+    } else if (pos > cache->gap_start) {
+        size_t n = pos - cache->gap_start;
+        memmove(cache->lines + cache->gap_start, cache->lines + cache->gap_end,
+                n * sizeof(SyntaxLine));
+    }
+    cache->gap_start = pos;
+    cache->gap_end = pos + gap;
+}
+
+static void reserve_gap(SyntaxCache *cache, size_t n) {
+    size_t gap = cache->gap_end - cache->gap_start;
+    size_t tail = cache->capacity - cache->gap_end;
+    size_t capacity = cache->capacity * 2;
+    if (gap >= n) return;
+    if (capacity < line_count(cache) + n + 256) capacity = line_count(cache) + n + 256;
+    cache->lines = realloc(cache->lines, capacity * sizeof(SyntaxLine));
+    memmove(cache->lines + capacity - tail, cache->lines + cache->gap_end,
+            tail * sizeof(SyntaxLine));
+    cache->gap_end = capacity - tail;
+    cache->capacity = capacity;
+}
+
+/* Replaces the entries for the lines an edit touched with fresh dirty ones. */
+static void on_change(const BufferChange *change, void *arg) {
+    SyntaxCache *cache = arg;
+    size_t line = change->line;
+    size_t removed = change->removed_lines;
+    SyntaxLine *e;
+    if (line >= line_count(cache)) return;
+    move_gap(cache, line + 1);
+    if (removed > cache->capacity - cache->gap_end) removed = cache->capacity - cache->gap_end;
+    for (size_t i = 0; i < removed; i++) drop_spans(cache, &cache->lines[cache->gap_end + i]);
+    cache->gap_end += removed;
+    reserve_gap(cache, change->inserted_lines);
+    memset(cache->lines + cache->gap_start, 0, change->inserted_lines * sizeof(SyntaxLine));
+    for (size_t i = 0; i < change->inserted_lines; i++) {
+        cache->lines[cache->gap_start + i].dirty = 1;
+    }
+    cache->gap_start += change->inserted_lines;
+    e = entry(cache, line);
+    e->dirty = 1;
+    drop_spans(cache, e);
+    if (line < cache->first_unchecked) cache->first_unchecked = line;
+    cancel(&cache->token);
+    cache->window_len = 0;
+    cache->next_line = (size_t)-1;
+}
+
+static void reserve_scratch(SyntaxCache *cache, size_t len) {
+    if (len > cache->scratch_cap) {
+        cache->scratch_cap = len;
+        cache->text = realloc(cache->text, len);
+        cache->attrs = realloc(cache->attrs, len);
+    }
+}
+
+/*
+ * Returns the text of a line.  Lines are served from a read-ahead window
+ * of the buffer, and the line after the last one read starts right after
+ * it, so walking down the file costs no tree lookups per line.
+ */
+static const char *line_text(SyntaxCache *cache, size_t line, size_t *len) {
+    size_t start = cache->next_line == line ? cache->next_start
+                                            : buffer_line_start(cache->buffer, line);
+    const char *text, *newline = NULL;
+    for (int pass = 0; pass < 2 && !newline; pass++) {
+        if (pass || start < cache->window_start ||
+            start >= cache->window_start + cache->window_len) {
+            if (!cache->window) cache->window = malloc(SYNTAX_WINDOW);
+            cache->window_start = start;
+            cache->window_len = buffer_read(cache->buffer, start, SYNTAX_WINDOW, cache->window);
+        }
+        text = cache->window + (start - cache->window_start);
+        *len = cache->window_start + cache->window_len - start;
+        newline = memchr(text, '\n', *len);
+        if (cache->window_start == start) break;
+    }
+    if (newline) {
+        *len = newline - text;
+    } else if (cache->window_len == SYNTAX_WINDOW) {
+        *len = buffer_line_length(cache->buffer, line);
+        reserve_scratch(cache, *len);
+        buffer_read(cache->buffer, start, *len, cache->text);
+        text = cache->text;
+    }
+    cache->next_line = line + 1;
+    cache->next_start = start + *len + 1;
+    return text;
+}
+
+static void relex(SyntaxCache *cache, SyntaxLine *e, size_t line, int state, int keep_spans) {
+    size_t len;
+    const char *text = line_text(cache, line, &len);
+    reserve_scratch(cache, len);
+    drop_spans(cache, e);
+    e->start_state = state;
+    e->end_state = syntax_lex(cache->lang, text, len, state, cache->attrs);
+    e->dirty = 0;
+    cache->lexed++;
+    if (!keep_spans) return;
+    for (size_t i = 0; i < len; i++) {
+        if (i == 0 || cache->attrs[i] != cache->attrs[i - 1]) e->span_count++;
+    }
+    e->spans = arena_alloc(&cache->arena, span_bytes(e->span_count));
+    e->span_count = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (i == 0 || cache->attrs[i] != cache->attrs[i - 1]) {
+            e->spans[e->span_count].start = i;
+            e->spans[e->span_count].attr = cache->attrs[i];
+            e->span_count++;
+        }
+    }
+}
+
+void syntax_init(SyntaxCache *cache, Buffer *buffer, const Language *lang) {
+    size_t count = buffer_line_count(buffer);
+    memset(cache, 0, sizeof(SyntaxCache));
+    cache->buffer = buffer;
+    cache->lang = lang;
+    cache->capacity = count + 256;
+    cache->lines = calloc(cache->capacity, sizeof(SyntaxLine));
+    for (size_t i = 0; i < count; i++) cache->lines[i].dirty = 1;
+    cache->gap_start = count;
+    cache->gap_end = cache->capacity;
+    cache->next_line = (size_t)-1;
+    arena_init(&cache->arena);
+    cancel_init(&cache->token);
+    buffer_add_listener(buffer, on_change, cache);
+}
+
+void syntax_background(SyntaxCache *cache, Pool *pool) {
+    cache->pool = pool;
+}
+
+static void free_job(SyntaxJob *work) {
+    free(work->text);
+    free(work->states);
+    free(work);
+}
+
+void syntax_free(SyntaxCache *cache) {
+    if (!cache->buffer) return;
+    if (cache->job) {
+        cancel(&cache->token);
+        pool_wait(cache->pool, &cache->job->job);
+        free_job(cache->job);
+    }
+    buffer_remove_listener(cache->buffer, on_change, cache);
+    arena_release(&cache->arena);
+    free(cache->lines);
+    free(cache->text);
+    free(cache->attrs);
+    free(cache->window);
+    memset(cache, 0, sizeof(SyntaxCache));
+}
+
+size_t syntax_memory(const SyntaxCache *cache) {
+    return cache->capacity * sizeof(SyntaxLine) + cache->scratch_cap * 2 +
+           (cache->window ? SYNTAX_WINDOW : 0) + cache->arena.reserved;
+}
+
+/* Runs on a worker: the state flowing into each line of the copied text. */
+static void lex_states(Job *job) {
+    long long start = trace_begin();
+    SyntaxJob *work = job->arg;
+    const char *p = work->text, *end = work->text + work->len;
+    size_t cap = 256, i;
+    unsigned char *attrs = malloc(cap);
+    int state = work->state;
+    for (i = 0; i < work->count; i++) {
+        const char *newline;
+        size_t len;
+        if (i % 4096 == 0 && job_cancelled(job)) break;
+        newline = memchr(p, '\n', end - p);
+        len = (newline ? newline : end) - p;
+        if (len > cap) {
+            cap = len * 2;
+            attrs = realloc(attrs, cap);
+        }
+        work->states[i] = state;
+        state = syntax_lex(work->lang, p, len, state, attrs);
+        p += len + 1;
+    }
+    work->states[i] = state;
+    work->done = i;
+    free(attrs);
+    trace_end(TRACE_SYNTAX, start);
+}
+
+/* Runs on the main thread: takes over the states unless the buffer has moved on. */
+static void merge_states(Job *job) {
+    SyntaxJob *work = job->arg;
+    SyntaxCache *cache = work->cache;
+    size_t end = work->first + work->done;
+    cache->job = NULL;
+    if (!job_cancelled(job)) {
+        for (size_t i = cache->first_unchecked; i < end; i++) {
+            SyntaxLine *e = entry(cache, i);
+            int state = work->states[i - work->first];
+            if (e->dirty || e->start_state != state) {
+                drop_spans(cache, e);
+                e->start_state = state;
+                e->end_state = work->states[i - work->first + 1];
+                e->dirty = 0;
+            }
+        }
+        if (end > cache->first_unchecked) cache->first_unchecked = end;
+    }
+    free_job(work);
+}
+
+/* Hands the walk from first_unchecked towards line to the pool, a slice at a time. */
+static void start_job(SyntaxCache *cache, size_t line) {
+    SyntaxJob *work = calloc(1, sizeof(SyntaxJob));
+    size_t total = line_count(cache), last = line + 1, start, end;
+    work->cache = cache;
+    work->lang = cache->lang;
+    work->first = cache->first_unchecked;
+    work->state = work->first ? entry(cache, work->first - 1)->end_state : SYNTAX_NORMAL;
+    start = buffer_line_start(cache->buffer, work->first);
+    if (last > total) last = total;
+    end = last < total ? buffer_line_start(cache->buffer, last) : buffer_length(cache->buffer);
+    if (end - start > SYNTAX_JOB_BYTES) {
+        last = buffer_line_of(cache->buffer, start + SYNTAX_JOB_BYTES);
+        if (last <= work->first) last = work->first + 1;
+        end = last < total ? buffer_line_start(cache->buffer, last) : buffer_length(cache->buffer);
+    }
+    work->count = last - work->first;
+    work->len = end - start;
+    work->text = malloc(work->len ? work->len : 1);
+    work->len = buffer_read(cache->buffer, start, work->len, work->text);
+    work->states = malloc(work->count + 1);
+    work->job.run = lex_states;
+    work->job.done = merge_states;
+    work->job.arg = work;
+    work->job.token = &cache->token;
+    cache->job = work;
+    pool_submit(cache->pool, &work->job);
+}
+
+/*
+ * Lexes a line the walk has not reached yet from a guessed start state:
+ * the end state of the line above if that is known, else normal.
+ */
+static const SyntaxSpan *provisional(SyntaxCache *cache, size_t line, size_t *count) {
+    SyntaxLine *e = entry(cache, line);
+    if (e->dirty) {
+        SyntaxLine *above = line > 0 ? entry(cache, line - 1) : NULL;
+        relex(cache, e, line, above && !above->dirty ? above->end_state : SYNTAX_NORMAL, 1);
+    } else if (!e->spans) {
+        relex(cache, e, line, e->start_state, 1);
+    }
+    *count = e->span_count;
+    return e->spans;
+}
+
+/*
+ * Returns the spans for a line, first bringing the states of every line
+ * above it up to date.  Only lines that are dirty or now start in a
+ * different state are lexed again.
+ */
+static const SyntaxSpan *lex_line(SyntaxCache *cache, size_t line, size_t *count) {
+    int state = SYNTAX_NORMAL;
+    SyntaxLine *e;
+    if (line >= line_count(cache)) {
+        *count = 0;
+        return NULL;
+    }
+    if (cache->pool && line > cache->first_unchecked + SYNTAX_SYNC_LINES) {
+        if (!cache->job) start_job(cache, line);
+        return provisional(cache, line, count);
+    }
+    if (cache->first_unchecked > 0) {
+        state = entry(cache, cache->first_unchecked - 1)->end_state;
+    }
+    for (size_t i = cache->first_unchecked; i < line; i++) {
+        e = entry(cache, i);
+        if (e->dirty || e->start_state != state) relex(cache, e, i, state, 0);
+        state = e->end_state;
+    }
+    if (line >= cache->first_unchecked) {
+        e = entry(cache, line);
+        if (e->dirty || e->start_state != state) relex(cache, e, line, state, 1);
+        cache->first_unchecked = line + 1;
+    }
+    e = entry(cache, line);
+    if (!e->spans) relex(cache, e, line, e->start_state, 1);
+    *count = e->span_count;
+    return e->spans;
+}
+
+/* Only calls that had to lex anything are timed. */
+const SyntaxSpan *syntax_line(SyntaxCache *cache, size_t line, size_t *count) {
+    long long start = trace_begin();
+    size_t lexed = cache->lexed;
+    const SyntaxSpan *spans = lex_line(cache, line, count);
+    if (cache->lexed != lexed) trace_end(TRACE_SYNTAX, start);
+    return spans;
+}
+
+/* Expands the first len bytes of a line's spans into per-byte attributes. */
+void syntax_fill(const SyntaxSpan *spans, size_t count, unsigned char *attrs, size_t len) {
+    for (size_t i = 0; i < count && spans[i].start < len; i++) {
+        size_t end = i + 1 < count && spans[i + 1].start < len ? spans[i + 1].start : len;
+        memset(attrs + spans[i].start, spans[i].attr, end - spans[i].start);
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef SYNTAX_H
+#define SYNTAX_H
+
+#include <stddef.h>
+
+#include "arena.h"
+#include "buffer.h"
+#include "language.h"
+#include "pool.h"
+
+#define SYNTAX_WINDOW 65536
+#define SYNTAX_SYNC_LINES 32768
+#define SYNTAX_JOB_BYTES (4u << 20)
+
+/* Lexer state carried from the end of one line to the start of the next. */
+enum {
+    SYNTAX_NORMAL,
+    SYNTAX_COMMENT,
+    SYNTAX_STRING,
+    SYNTAX_STRING_SINGLE,
+    SYNTAX_TRIPLE,
+    SYNTAX_TRIPLE_SINGLE
+};
+
+/* A run of one attribute, from start up to the next span or end of line. */
+typedef struct {
+    unsigned int start;
+    unsigned char attr;
+} SyntaxSpan;
+
+typedef struct {
+    unsigned char start_state;
+    unsigned char end_state;
+    unsigned char dirty;
+    unsigned int span_count;
+    SyntaxSpan *spans;
+} SyntaxLine;
+
+/*
+ * Per-line highlighting cache for a buffer.  Every line remembers the lexer
+ * state it was lexed from and the state it ends in; spans are kept only for
+ * lines that have been drawn.  Edits arrive through a buffer listener and
+ * mark just the touched lines dirty.  Lines are re-lexed lazily, walking
+ * down from the first edit; a line is lexed again only if it is dirty or
+ * the state flowing into it differs from the cached one, so the walk stops
+ * re-lexing as soon as an edit's end state matches what was there before.
+ *
+ * Entries are kept in a gap buffer positioned at the last edit, so a run of
+ * keystrokes on one line does not move the entries after it.  Spans come
+ * from the cache's arena.
+ *
+ * With a pool attached, a walk longer than SYNTAX_SYNC_LINES is not done
+ * while drawing: a copy of the text is handed to a worker, which works out
+ * the line states, and lines drawn meanwhile are lexed from the best state
+ * known so far.  The states are merged when the job is collected, unless
+ * the buffer changed in between, and the walk then fixes any wrong guess.
+ */
+struct SyntaxJob;
+
+typedef struct {
+    Buffer *buffer;
+    const Language *lang;
+    SyntaxLine *lines;
+    size_t gap_start;
+    size_t gap_end;
+    size_t capacity;
+    size_t first_unchecked;
+    char *text;
+    unsigned char *attrs;
+    size_t scratch_cap;
+    char *window;
+    size_t window_start;
+    size_t window_len;
+    size_t next_line;
+    size_t next_start;
+    size_t lexed;
+    Arena arena;
+    Pool *pool;
+    CancelToken token;
+    struct SyntaxJob *job;
+} SyntaxCache;
+
+int syntax_lex(const Language *lang, const char *text, size_t len, int state,
+               unsigned char *attrs);
+void print_syntax_highlighted(const char *line, int is_selected);
+
+void syntax_init(SyntaxCache *cache, Buffer *buffer, const Language *lang);
+void syntax_background(SyntaxCache *cache, Pool *pool);
+void syntax_free(SyntaxCache *cache);
+size_t syntax_memory(const SyntaxCache *cache);
+const SyntaxSpan *syntax_line(SyntaxCache *cache, size_t line, size_t *count);
+void syntax_fill(const SyntaxSpan *spans, size_t count, unsigned char *attrs, size_t len);
+
+#endif
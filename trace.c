@@ -0,0 +1,218 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+typedef unsigned long long u64;
+
+typedef struct {
+    atomic_ullong count;
+    atomic_ullong total_ns;
+    atomic_ullong max_ns;
+    atomic_ullong last_ns;
+    atomic_ullong last_at;
+    atomic_ullong buckets[TRACE_BUCKETS];
+} Histogram;
+
+/* A span of zone from start for value ns, or with counter set a sample of it. */
+typedef struct {
+    long long start;
+    long long value;
+    int zone;
+    int counter;
+} TraceEvent;
+
+typedef struct TraceThread {
+    struct TraceThread *next;
+    int tid;
+    Histogram zones[TRACE_ZONES];
+    TraceEvent events[TRACE_EVENTS];
+    atomic_ullong written;
+} TraceThread;
+
+static const char *zone_names[TRACE_ZONES] = {
+    "input", "edit", "undo", "syntax", "render", "io"
+};
+
+static const char *counter_names[TRACE_COUNTERS] = {
+    "frame bytes", "memory"
+};
+
+static _Atomic(TraceThread *) threads;
+static atomic_int thread_count;
+static __thread TraceThread *self;
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static TraceThread *thread_state(void) {
+    TraceThread *t = self;
+    if (t) return t;
+    t = calloc(1, sizeof(TraceThread));
+    if (!t) return NULL;
+    t->tid = atomic_fetch_add(&thread_count, 1) + 1;
+    t->next = atomic_load(&threads);
+    while (!atomic_compare_exchange_weak(&threads, &t->next, t)) {
+    }
+    self = t;
+    return t;
+}
+
+static int bucket_of(u64 ns) {
+    int octave, index;
+    if (ns < 4) return (int)ns;
+    octave = 63 - __builtin_clzll(ns);
+    index = octave * 4 + (int)((ns >> (octave - 2)) & 3) - 4;
+    return index < TRACE_BUCKETS ? index : TRACE_BUCKETS - 1;
+}
+
+/* The largest value that falls in bucket index. */
+static u64 bucket_limit(int index) {
+    int octave = index / 4 + 1, sub = index % 4;
+    if (index < 4) return index;
+    return ((u64)(4 + sub + 1) << (octave - 2)) - 1;
+}
+
+static void store(atomic_ullong *p, u64 value) {
+    atomic_store_explicit(p, value, memory_order_relaxed);
+}
+
+static u64 load(atomic_ullong *p) {
+    return atomic_load_explicit(p, memory_order_relaxed);
+}
+
+static void record(TraceThread *t, int zone, int counter, long long start, long long value) {
+    u64 n = load(&t->written);
+    TraceEvent *event = &t->events[n % TRACE_EVENTS];
+    event->start = start;
+    event->value = value;
+    event->zone = zone;
+    event->counter = counter;
+    atomic_store_explicit(&t->written, n + 1, memory_order_release);
+}
+
+long long trace_begin(void) {
+    return now_ns();
+}
+
+void trace_end(int zone, long long start) {
+    TraceThread *t = thread_state();
+    long long end = now_ns();
+    u64 ns = end - start;
+    int bucket = bucket_of(ns);
+    Histogram *h;
+    if (!t) return;
+    h = &t->zones[zone];
+    store(&h->count, load(&h->count) + 1);
+    store(&h->total_ns, load(&h->total_ns) + ns);
+    if (ns > load(&h->max_ns)) store(&h->max_ns, ns);
+    store(&h->last_ns, ns);
+    store(&h->last_at, end);
+    store(&h->buckets[bucket], load(&h->buckets[bucket]) + 1);
+    record(t, zone, -1, start, ns);
+}
+
+void trace_counter(int counter, long long value) {
+    TraceThread *t = thread_state();
+    if (t) record(t, -1, counter, now_ns(), value);
+}
+
+void trace_summary(int zone, TraceSummary *summary) {
+    u64 buckets[TRACE_BUCKETS] = { 0 }, last_at = 0, seen = 0;
+    summary->count = summary->total_ns = summary->max_ns = summary->last_ns = 0;
+    summary->p50_ns = summary->p99_ns = 0;
+    for (TraceThread *t = atomic_load(&threads); t; t = t->next) {
+        Histogram *h = &t->zones[zone];
+        u64 max = load(&h->max_ns), at = load(&h->last_at);
+        summary->count += load(&h->count);
+        summary->total_ns += load(&h->total_ns);
+        if (max > summary->max_ns) summary->max_ns = max;
+        if (at > last_at) {
+            last_at = at;
+            summary->last_ns = load(&h->last_ns);
+        }
+        for (int i = 0; i < TRACE_BUCKETS; i++) buckets[i] += load(&h->buckets[i]);
+    }
+    for (int i = 0; i < TRACE_BUCKETS; i++) {
+        u64 before = seen;
+        seen += buckets[i];
+        if (before * 2 < summary->count && seen * 2 >= summary->count) {
+            summary->p50_ns = bucket_limit(i);
+        }
+        if (before * 100 < summary->count * 99 && seen * 100 >= summary->count * 99) {
+            summary->p99_ns = bucket_limit(i);
+        }
+    }
+    if (summary->p50_ns > summary->max_ns) summary->p50_ns = summary->max_ns;
+    if (summary->p99_ns > summary->max_ns) summary->p99_ns = summary->max_ns;
+}
+
+static void write_events(FILE *out, TraceThread *t, long long epoch, int pid, int *first) {
+    u64 written = atomic_load_explicit(&t->written, memory_order_acquire);
+    u64 n = written > TRACE_EVENTS ? written - TRACE_EVENTS : 0;
+    fprintf(out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+            "\"args\":{\"name\":\"%s %d\"}}", *first ? "" : ",", pid, t->tid,
+            t == self ? "main" : "thread", t->tid);
+    *first = 0;
+    for (; n < written; n++) {
+        const TraceEvent *e = &t->events[n % TRACE_EVENTS];
+        double ts = (e->start - epoch) / 1e3;
+        if (e->counter >= 0) {
+            fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d,"
+                    "\"args\":{\"value\":%lld}}", counter_names[e->counter], ts, pid, t->tid,
+                    e->value);
+        } else {
+            fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"editor\",\"ph\":\"X\",\"ts\":%.3f,"
+                    "\"dur\":%.3f,\"pid\":%d,\"tid\":%d}", zone_names[e->zone], ts,
+                    e->value / 1e3, pid, t->tid);
+        }
+    }
+}
+
+size_t trace_resident(void) {
+    long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (!statm) return 0;
+    if (fscanf(statm, "%*s %ld", &pages) != 1) pages = 0;
+    fclose(statm);
+    return (size_t)pages * sysconf(_SC_PAGESIZE);
+}
+
+/* The thread that dumps is named main in the trace; the others are numbered. */
+int trace_dump(const char *path) {
+    FILE *out = fopen(path, "w");
+    long long epoch = -1;
+    int pid = getpid(), first = 1, result;
+    if (!out) return -1;
+    for (TraceThread *t = atomic_load(&threads); t; t = t->next) {
+        u64 written = atomic_load_explicit(&t->written, memory_order_acquire);
+        u64 n = written > TRACE_EVENTS ? written - TRACE_EVENTS : 0;
+        for (; n < written; n++) {
+            long long start = t->events[n % TRACE_EVENTS].start;
+            if (epoch < 0 || start < epoch) epoch = start;
+        }
+    }
+    fputs("{\"traceEvents\":[", out);
+    for (TraceThread *t = atomic_load(&threads); t; t = t->next) {
+        write_events(out, t, epoch < 0 ? 0 : epoch, pid, &first);
+    }
+    fputs("\n],\n\"displayTimeUnit\":\"ms\",\n\"otherData\":{", out);
+    for (int zone = 0; zone < TRACE_ZONES; zone++) {
+        TraceSummary s;
+        trace_summary(zone, &s);
+        fprintf(out, "%s\n\"%s\":\"%llu calls, mean %.1f us, p50 %.1f us, p99 %.1f us, "
+                "max %.1f us\"", zone ? "," : "", zone_names[zone], s.count,
+                s.count ? s.total_ns / 1e3 / s.count : 0.0, s.p50_ns / 1e3, s.p99_ns / 1e3,
+                s.max_ns / 1e3);
+    }
+    fputs("\n}}\n", out);
+    result = ferror(out) ? -1 : 0;
+    if (fclose(out) != 0) result = -1;
+    return result;
+}
@@ -0,0 +1,59 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+
+enum {
+    TRACE_INPUT,
+    TRACE_EDIT,
+    TRACE_UNDO,
+    TRACE_SYNTAX,
+    TRACE_RENDER,
+    TRACE_IO,
+    TRACE_ZONES
+};
+
+enum {
+    TRACE_FRAME_BYTES,
+    TRACE_MEMORY,
+    TRACE_COUNTERS
+};
+
+#define TRACE_BUCKETS 160
+#define TRACE_EVENTS 16384
+
+typedef struct {
+    unsigned long long count;
+    unsigned long long total_ns;
+    unsigned long long max_ns;
+    unsigned long long last_ns;
+    unsigned long long p50_ns;
+    unsigned long long p99_ns;
+} TraceSummary;
+
+/*
+ * Hot-path timing.  trace_begin() reads the monotonic clock; trace_end()
+ * adds the time since then to the calling thread's histogram for the zone
+ * and appends the span to the thread's ring of its last TRACE_EVENTS
+ * events.  trace_counter() puts a sampled value in the same ring.
+ *
+ * Every thread writes only its own histograms and ring, with relaxed
+ * atomic stores and no read-modify-write, and joins a lock-free list of
+ * threads the first time it records anything.  trace_summary() adds up
+ * the histograms of all threads while they keep recording; buckets are
+ * powers of two split in four, so its percentiles are within a quarter.
+ *
+ * trace_dump() writes the rings in the trace event JSON format that
+ * chrome://tracing and Perfetto load, with a summary of every zone.  It
+ * should run once the other threads are idle; a span written while it
+ * reads may come out garbled.
+ */
+long long trace_begin(void);
+void trace_end(int zone, long long start);
+void trace_counter(int counter, long long value);
+void trace_summary(int zone, TraceSummary *summary);
+/* Resident memory of the process, from /proc, or 0 if it cannot be read. */
+size_t trace_resident(void);
+int trace_dump(const char *path);
+
+#endif
@@ -0,0 +1,799 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "trigram.h"
+
+#define INDEX_MAGIC "TRIGRAM1"
+#define BINARY_PROBE 8192
+#define FILE_BINARY 1
+#define NO_FILE UINT32_MAX
+#define NO_TRIGRAM UINT32_MAX
+#define WRITE_BLOCK (1u << 20)
+
+/*
+ * On disk, in native byte order: the header, one IndexFile per file id,
+ * the NUL-terminated names they point into, the posting lists, and the
+ * table of trigrams sorted by value.  Each posting list holds count file
+ * ids in increasing order as LEB128 varints, each the difference from the
+ * one before (the first from zero).  The file table and the trigram table
+ * start on 8-byte boundaries so they can be used straight from the map.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t file_count;
+    uint32_t trigram_count;
+    uint64_t names;
+    uint64_t postings;
+    uint64_t table;
+    uint64_t size;
+} IndexHeader;
+
+typedef struct {
+    uint64_t size;
+    int64_t mtime;
+    uint32_t mtime_nsec;
+    uint32_t name;
+    uint32_t flags;
+    uint32_t unused;
+} IndexFile;
+
+typedef struct {
+    uint32_t trigram;
+    uint32_t count;
+    uint64_t offset;
+} IndexEntry;
+
+typedef struct {
+    void *map;
+    size_t size;
+    const IndexHeader *header;
+    const IndexFile *files;
+    const char *names;
+    size_t names_size;
+    const unsigned char *postings;
+    size_t postings_size;
+    const IndexEntry *table;
+} Index;
+
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+} Bytes;
+
+/* A file found by the walk; trigrams are filled in by a job if it has to be read. */
+typedef struct {
+    char *path;
+    uint64_t size;
+    int64_t mtime;
+    uint32_t mtime_nsec;
+    uint32_t old;
+    uint32_t id;
+    uint32_t flags;
+    uint32_t *trigrams;
+    size_t trigram_count;
+} Entry;
+
+typedef struct {
+    Job job;
+    const char *root;
+    Entry **entries;
+    size_t count;
+    int ready;
+} Batch;
+
+/* The new file ids of each trigram, delta-encoded like the lists on disk. */
+typedef struct {
+    uint32_t trigram;
+    uint32_t count;
+    uint32_t last;
+    Bytes ids;
+} Posting;
+
+typedef struct {
+    Pool *pool;
+    CancelToken token;
+    Batch *slots[TRIGRAM_IN_FLIGHT];
+    size_t submitted;
+    size_t merged;
+    Posting *postings;
+    size_t posting_cap;
+    size_t posting_count;
+} Update;
+
+typedef struct {
+    int fd;
+    Bytes buf;
+    uint64_t offset;
+    int failed;
+} Output;
+
+static char *join(const char *dir, const char *name) {
+    size_t len = strlen(dir);
+    char *path = malloc(len + strlen(name) + 2);
+    if (len == 0) return strcpy(path, name);
+    memcpy(path, dir, len);
+    if (dir[len - 1] != '/') path[len++] = '/';
+    strcpy(path + len, name);
+    return path;
+}
+
+static size_t hash_trigram(uint32_t trigram) {
+    return (size_t)(((uint64_t)trigram * 0x9e3779b97f4a7c15ull) >> 32);
+}
+
+static size_t hash_name(const char *name) {
+    uint64_t h = 14695981039346656037ull;
+    while (*name) h = (h ^ (unsigned char)*name++) * 1099511628211ull;
+    return h;
+}
+
+static void put_varint(Bytes *b, uint32_t value) {
+    if (b->len + 5 > b->cap) {
+        b->cap = b->cap ? b->cap * 2 : 16;
+        b->data = realloc(b->data, b->cap);
+    }
+    while (value >= 0x80) {
+        b->data[b->len++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    b->data[b->len++] = (unsigned char)value;
+}
+
+static const unsigned char *get_varint(const unsigned char *p, const unsigned char *end,
+                                       uint32_t *value) {
+    uint32_t v = 0;
+    for (int shift = 0; p < end && shift < 35; shift += 7) {
+        unsigned char byte = *p++;
+        v |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = v;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static void close_index(Index *index) {
+    if (index->map) munmap(index->map, index->size);
+    memset(index, 0, sizeof(Index));
+}
+
+/* Maps the index under root and checks that its sections fit; returns -1 if it is missing or bad. */
+static int open_index(const char *root, Index *index) {
+    char *path = join(root, TRIGRAM_INDEX_NAME);
+    int fd = open(path, O_RDONLY);
+    const IndexHeader *h;
+    struct stat st;
+    free(path);
+    memset(index, 0, sizeof(Index));
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(IndexHeader)) {
+        close(fd);
+        return -1;
+    }
+    index->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (index->map == MAP_FAILED) {
+        index->map = NULL;
+        return -1;
+    }
+    index->size = st.st_size;
+    h = index->header = index->map;
+    if (memcmp(h->magic, INDEX_MAGIC, 8) != 0 || h->size != index->size ||
+        sizeof(IndexHeader) + (uint64_t)h->file_count * sizeof(IndexFile) > h->names ||
+        h->names > h->postings || h->postings > h->table || h->table % 8 != 0 ||
+        h->table + (uint64_t)h->trigram_count * sizeof(IndexEntry) != h->size) {
+        close_index(index);
+        return -1;
+    }
+    index->files = (const IndexFile *)((const char *)index->map + sizeof(IndexHeader));
+    index->names = (const char *)index->map + h->names;
+    index->names_size = h->postings - h->names;
+    index->postings = (const unsigned char *)index->map + h->postings;
+    index->postings_size = h->table - h->postings;
+    index->table = (const IndexEntry *)((const char *)index->map + h->table);
+    if (h->file_count && (index->names_size == 0 || index->names[index->names_size - 1])) {
+        close_index(index);
+        return -1;
+    }
+    for (uint32_t i = 0; i < h->file_count; i++) {
+        if (index->files[i].name >= index->names_size) {
+            close_index(index);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Decodes a posting list into ids, stopping at anything out of range; returns how many. */
+static size_t decode(const Index *index, const IndexEntry *entry, uint32_t *ids) {
+    const unsigned char *p = index->postings + entry->offset;
+    const unsigned char *end = index->postings + index->postings_size;
+    uint32_t id = 0, delta;
+    size_t n = 0;
+    if (entry->offset > index->postings_size) return 0;
+    while (n < entry->count && (p = get_varint(p, end, &delta)) != NULL) {
+        if (n && delta == 0) break;
+        id += delta;
+        if (id >= index->header->file_count) break;
+        ids[n++] = id;
+    }
+    return n;
+}
+
+static int compare_trigrams(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Collects the distinct trigrams of a file, read a block at a time, into
+ * entry->trigrams.  seen is a bitmap over all 2^24 trigrams that is clear
+ * on entry and left clear.
+ */
+static void extract(const char *root, Entry *entry, unsigned char *seen, unsigned char *block) {
+    char *path = join(root, entry->path);
+    int fd = open(path, O_RDONLY);
+    uint32_t window = 0, run = 0, *trigrams = NULL;
+    size_t count = 0, cap = 0;
+    int first = 1;
+    ssize_t n;
+    free(path);
+    if (fd < 0) return;
+    while ((n = read(fd, block, TRIGRAM_BLOCK)) > 0) {
+        if (first && memchr(block, '\0', n < BINARY_PROBE ? n : BINARY_PROBE)) {
+            entry->flags |= FILE_BINARY;
+            break;
+        }
+        first = 0;
+        for (ssize_t i = 0; i < n; i++) {
+            unsigned char c = block[i];
+            if (c == '\n') {
+                run = 0;
+                continue;
+            }
+            if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+            window = (window << 8 | c) & 0xffffff;
+            if (++run < 3 || (seen[window >> 3] & (1u << (window & 7)))) continue;
+            seen[window >> 3] |= 1u << (window & 7);
+            if (count == cap) {
+                cap = cap ? cap * 2 : 1024;
+                trigrams = realloc(trigrams, cap * sizeof(uint32_t));
+            }
+            trigrams[count++] = window;
+        }
+    }
+    close(fd);
+    for (size_t i = 0; i < count; i++) seen[trigrams[i] >> 3] = 0;
+    if (entry->flags & FILE_BINARY) {
+        free(trigrams);
+        return;
+    }
+    entry->trigrams = trigrams;
+    entry->trigram_count = count;
+}
+
+static void run_batch(Job *job) {
+    Batch *batch = job->arg;
+    unsigned char *seen = calloc(1, 1u << 21);
+    unsigned char *block = malloc(TRIGRAM_BLOCK);
+    for (size_t i = 0; i < batch->count && !job_cancelled(job); i++) {
+        extract(batch->root, batch->entries[i], seen, block);
+    }
+    free(block);
+    free(seen);
+}
+
+static void batch_done(Job *job) {
+    Batch *batch = job->arg;
+    batch->ready = 1;
+}
+
+static Posting *find_posting(Update *update, uint32_t trigram) {
+    size_t mask, i;
+    if ((update->posting_count + 1) * 2 > update->posting_cap) {
+        Posting *old = update->postings;
+        size_t old_cap = update->posting_cap;
+        update->posting_cap = old_cap ? old_cap * 2 : 4096;
+        update->postings = malloc(update->posting_cap * sizeof(Posting));
+        for (size_t j = 0; j < update->posting_cap; j++) update->postings[j].trigram = NO_TRIGRAM;
+        mask = update->posting_cap - 1;
+        for (size_t j = 0; j < old_cap; j++) {
+            if (old[j].trigram == NO_TRIGRAM) continue;
+            for (i = hash_trigram(old[j].trigram) & mask; update->postings[i].trigram != NO_TRIGRAM;
+                 i = (i + 1) & mask) {
+            }
+            update->postings[i] = old[j];
+        }
+        free(old);
+    }
+    mask = update->posting_cap - 1;
+    for (i = hash_trigram(trigram) & mask; update->postings[i].trigram != NO_TRIGRAM;
+         i = (i + 1) & mask) {
+        if (update->postings[i].trigram == trigram) return &update->postings[i];
+    }
+    memset(&update->postings[i], 0, sizeof(Posting));
+    update->postings[i].trigram = trigram;
+    update->posting_count++;
+    return &update->postings[i];
+}
+
+/* Adds the trigrams of every finished batch that has no unfinished batch before it. */
+static void merge(Update *update) {
+    while (update->merged < update->submitted &&
+           update->slots[update->merged % TRIGRAM_IN_FLIGHT]->ready) {
+        size_t slot = update->merged % TRIGRAM_IN_FLIGHT;
+        Batch *batch = update->slots[slot];
+        for (size_t i = 0; i < batch->count; i++) {
+            Entry *entry = batch->entries[i];
+            for (size_t j = 0; j < entry->trigram_count; j++) {
+                Posting *posting = find_posting(update, entry->trigrams[j]);
+                put_varint(&posting->ids, posting->count ? entry->id - posting->last : entry->id);
+                posting->last = entry->id;
+                posting->count++;
+            }
+            free(entry->trigrams);
+            entry->trigrams = NULL;
+        }
+        free(batch);
+        update->slots[slot] = NULL;
+        update->merged++;
+    }
+}
+
+static void wait_batch(Update *update) {
+    struct pollfd pfd = { pool_fd(update->pool), POLLIN, 0 };
+    if (poll(&pfd, 1, -1) > 0) pool_collect(update->pool);
+    merge(update);
+}
+
+static void submit(Update *update, const char *root, Entry **entries, size_t count) {
+    Batch *batch;
+    while (update->submitted - update->merged >= TRIGRAM_IN_FLIGHT) wait_batch(update);
+    batch = calloc(1, sizeof(Batch));
+    batch->root = root;
+    batch->entries = entries;
+    batch->count = count;
+    batch->job.run = run_batch;
+    batch->job.done = batch_done;
+    batch->job.arg = batch;
+    batch->job.token = &update->token;
+    update->slots[update->submitted++ % TRIGRAM_IN_FLIGHT] = batch;
+    pool_submit(update->pool, &batch->job);
+    pool_collect(update->pool);
+    merge(update);
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void walk(Entry **entries, size_t *count, size_t *cap, const char *path,
+                 const char *relative) {
+    DIR *dir = opendir(path);
+    struct dirent *entry;
+    char **names = NULL;
+    size_t name_count = 0, name_cap = 0;
+    if (!dir) return;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        if (!relative[0] &&
+            strncmp(entry->d_name, TRIGRAM_INDEX_NAME, strlen(TRIGRAM_INDEX_NAME)) == 0) {
+            continue;
+        }
+        if (name_count == name_cap) {
+            name_cap = name_cap ? name_cap * 2 : 64;
+            names = realloc(names, name_cap * sizeof(char *));
+        }
+        names[name_count++] = strdup(entry->d_name);
+    }
+    closedir(dir);
+    if (name_count > 1) qsort(names, name_count, sizeof(char *), compare_names);
+    for (size_t i = 0; i < name_count; i++) {
+        char *child = join(path, names[i]);
+        char *child_relative = join(relative, names[i]);
+        struct stat st;
+        int found = lstat(child, &st) == 0;
+        if (found && S_ISDIR(st.st_mode)) {
+            walk(entries, count, cap, child, child_relative);
+        } else if (found && S_ISREG(st.st_mode) && *count < NO_FILE) {
+            Entry *e;
+            if (*count == *cap) {
+                *cap = *cap ? *cap * 2 : 1024;
+                *entries = realloc(*entries, *cap * sizeof(Entry));
+            }
+            e = &(*entries)[(*count)++];
+            memset(e, 0, sizeof(Entry));
+            e->path = child_relative;
+            e->size = st.st_size;
+            e->mtime = st.st_mtim.tv_sec;
+            e->mtime_nsec = st.st_mtim.tv_nsec;
+            e->old = NO_FILE;
+            child_relative = NULL;
+        }
+        free(child);
+        free(child_relative);
+        free(names[i]);
+    }
+    free(names);
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data = (const char *)data + n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void output_flush(Output *out) {
+    if (!out->failed && write_all(out->fd, out->buf.data, out->buf.len) < 0) out->failed = 1;
+    out->buf.len = 0;
+}
+
+static void output(Output *out, const void *data, size_t len) {
+    out->offset += len;
+    if (out->buf.len + len > WRITE_BLOCK) output_flush(out);
+    if (len >= WRITE_BLOCK) {
+        if (!out->failed && write_all(out->fd, data, len) < 0) out->failed = 1;
+        return;
+    }
+    if (!out->buf.data) {
+        out->buf.cap = WRITE_BLOCK;
+        out->buf.data = malloc(out->buf.cap);
+    }
+    memcpy(out->buf.data + out->buf.len, data, len);
+    out->buf.len += len;
+}
+
+static void output_align(Output *out) {
+    static const char zeros[8];
+    if (out->offset % 8) output(out, zeros, 8 - out->offset % 8);
+}
+
+static int compare_postings(const void *a, const void *b) {
+    return compare_trigrams(&((const Posting *)a)->trigram, &((const Posting *)b)->trigram);
+}
+
+/*
+ * Writes the new index: old posting lists with their ids renumbered by
+ * remap and dropped where it holds NO_FILE, followed for each trigram by
+ * the ids of the files read in this update, which are all higher.
+ */
+static void write_index(Output *out, const Index *old, const uint32_t *remap, Entry **files,
+                        size_t file_count, Update *update, uint32_t *trigram_count) {
+    IndexHeader header;
+    IndexEntry *table = NULL;
+    size_t table_count = 0, table_cap = 0, fresh = 0, i = 0, j = 0;
+    uint32_t name = 0, old_count = old->header ? old->header->trigram_count : 0;
+    uint32_t *ids = malloc((old->header ? old->header->file_count : 0) * sizeof(uint32_t) + 1);
+    Bytes list = { NULL, 0, 0 };
+    memset(&header, 0, sizeof(header));
+    output(out, &header, sizeof(header));
+    for (size_t k = 0; k < file_count; k++) {
+        IndexFile file = { files[k]->size, files[k]->mtime, files[k]->mtime_nsec, name,
+                           files[k]->flags, 0 };
+        output(out, &file, sizeof(file));
+        name += strlen(files[k]->path) + 1;
+    }
+    header.names = out->offset;
+    for (size_t k = 0; k < file_count; k++) output(out, files[k]->path, strlen(files[k]->path) + 1);
+    output_align(out);
+    header.postings = out->offset;
+    for (size_t k = 0; k < update->posting_cap; k++) {
+        if (update->postings[k].trigram != NO_TRIGRAM) update->postings[fresh++] = update->postings[k];
+    }
+    if (fresh > 1) qsort(update->postings, fresh, sizeof(Posting), compare_postings);
+    while (i < old_count || j < fresh) {
+        uint32_t trigram, prev = 0, count = 0;
+        if (j == fresh || (i < old_count && old->table[i].trigram < update->postings[j].trigram)) {
+            trigram = old->table[i].trigram;
+        } else {
+            trigram = update->postings[j].trigram;
+        }
+        list.len = 0;
+        if (i < old_count && old->table[i].trigram == trigram) {
+            size_t n = decode(old, &old->table[i++], ids);
+            for (size_t k = 0; k < n; k++) {
+                uint32_t id = remap[ids[k]];
+                if (id == NO_FILE) continue;
+                put_varint(&list, id - prev);
+                prev = id;
+                count++;
+            }
+        }
+        if (j < fresh && update->postings[j].trigram == trigram) {
+            const Posting *posting = &update->postings[j++];
+            const unsigned char *p = posting->ids.data, *end = p + posting->ids.len;
+            uint32_t id = 0, delta;
+            while (p < end && (p = get_varint(p, end, &delta)) != NULL) {
+                id += delta;
+                put_varint(&list, id - prev);
+                prev = id;
+                count++;
+            }
+            free(posting->ids.data);
+        }
+        if (count == 0) continue;
+        if (table_count == table_cap) {
+            table_cap = table_cap ? table_cap * 2 : 4096;
+            table = realloc(table, table_cap * sizeof(IndexEntry));
+        }
+        table[table_count].trigram = trigram;
+        table[table_count].count = count;
+        table[table_count].offset = out->offset - header.postings;
+        table_count++;
+        output(out, list.data, list.len);
+    }
+    output_align(out);
+    header.table = out->offset;
+    output(out, table, table_count * sizeof(IndexEntry));
+    output_flush(out);
+    memcpy(header.magic, INDEX_MAGIC, 8);
+    header.file_count = file_count;
+    header.trigram_count = table_count;
+    header.size = out->offset;
+    if (!out->failed && pwrite(out->fd, &header, sizeof(header), 0) != sizeof(header)) {
+        out->failed = 1;
+    }
+    *trigram_count = table_count;
+    free(list.data);
+    free(table);
+    free(ids);
+    free(out->buf.data);
+}
+
+int trigram_update(Pool *pool, const char *root, TrigramStats *stats) {
+    Index old;
+    Update update;
+    Output out;
+    Entry *entries = NULL, **files, **fresh;
+    size_t count = 0, cap = 0, kept = 0, fresh_count = 0, old_files, lookup_cap = 1;
+    uint32_t *lookup, *remap, trigram_count = 0;
+    char *path, *temp;
+    struct stat st;
+    if (stat(root, &st) < 0 || !S_ISDIR(st.st_mode)) return -1;
+    open_index(root, &old);
+    old_files = old.header ? old.header->file_count : 0;
+    walk(&entries, &count, &cap, root, "");
+
+    while (lookup_cap < old_files * 2) lookup_cap *= 2;
+    lookup = calloc(lookup_cap, sizeof(uint32_t));
+    for (uint32_t id = 0; id < old_files; id++) {
+        size_t i = hash_name(old.names + old.files[id].name) & (lookup_cap - 1);
+        while (lookup[i]) i = (i + 1) & (lookup_cap - 1);
+        lookup[i] = id + 1;
+    }
+    remap = malloc(old_files * sizeof(uint32_t) + 1);
+    for (size_t id = 0; id < old_files; id++) remap[id] = NO_FILE;
+    for (size_t k = 0; k < count && old_files; k++) {
+        Entry *e = &entries[k];
+        for (size_t i = hash_name(e->path) & (lookup_cap - 1); lookup[i]; i = (i + 1) & (lookup_cap - 1)) {
+            const IndexFile *file = &old.files[lookup[i] - 1];
+            if (strcmp(old.names + file->name, e->path) != 0) continue;
+            if (file->size == e->size && file->mtime == e->mtime &&
+                file->mtime_nsec == e->mtime_nsec) {
+                e->old = lookup[i] - 1;
+                e->flags = file->flags;
+                remap[e->old] = 0;
+            }
+            break;
+        }
+    }
+    free(lookup);
+
+    files = malloc(count * sizeof(Entry *) + 1);
+    fresh = malloc(count * sizeof(Entry *) + 1);
+    for (size_t id = 0; id < old_files; id++) {
+        if (remap[id] != NO_FILE) remap[id] = kept++;
+    }
+    for (size_t k = 0; k < count; k++) {
+        Entry *e = &entries[k];
+        if (e->old != NO_FILE) {
+            e->id = remap[e->old];
+        } else {
+            e->id = kept + fresh_count;
+            fresh[fresh_count++] = e;
+        }
+        files[e->id] = e;
+    }
+
+    memset(&update, 0, sizeof(update));
+    update.pool = pool;
+    cancel_init(&update.token);
+    for (size_t start = 0, end = 0; start < fresh_count; start = end) {
+        uint64_t bytes = 0;
+        while (end < fresh_count && end - start < TRIGRAM_BATCH_FILES && bytes < TRIGRAM_BATCH_BYTES) {
+            bytes += fresh[end++]->size;
+        }
+        submit(&update, root, fresh + start, end - start);
+    }
+    while (update.merged < update.submitted) wait_batch(&update);
+
+    path = join(root, TRIGRAM_INDEX_NAME);
+    temp = malloc(strlen(path) + 8);
+    sprintf(temp, "%s.XXXXXX", path);
+    memset(&out, 0, sizeof(out));
+    out.fd = mkstemp(temp);
+    if (out.fd < 0) {
+        out.failed = 1;
+        for (size_t k = 0; k < update.posting_cap; k++) {
+            if (update.postings[k].trigram != NO_TRIGRAM) free(update.postings[k].ids.data);
+        }
+    } else {
+        write_index(&out, &old, remap, files, count, &update, &trigram_count);
+        if (fsync(out.fd) < 0) out.failed = 1;
+        if (close(out.fd) < 0) out.failed = 1;
+        if (!out.failed && rename(temp, path) < 0) out.failed = 1;
+        if (out.failed) unlink(temp);
+    }
+    if (!out.failed) {
+        int dir_fd = open(root, O_RDONLY | O_DIRECTORY);
+        if (dir_fd >= 0) {
+            fsync(dir_fd);
+            close(dir_fd);
+        }
+    }
+    if (stats) {
+        stats->files = count;
+        stats->indexed = fresh_count;
+        stats->reused = kept;
+        stats->removed = old_files - kept;
+        stats->trigrams = trigram_count;
+        stats->bytes = out.offset;
+    }
+    close_index(&old);
+    for (size_t k = 0; k < count; k++) free(entries[k].path);
+    free(entries);
+    free(files);
+    free(fresh);
+    free(remap);
+    free(update.postings);
+    free(path);
+    free(temp);
+    return out.failed ? -1 : 0;
+}
+
+/* Sorts paths the way the walk visits them: a directory before any sibling that extends its name. */
+static int compare_paths(const void *a, const void *b) {
+    const unsigned char *x = *(const unsigned char *const *)a;
+    const unsigned char *y = *(const unsigned char *const *)b;
+    while (*x && *x == *y) {
+        x++;
+        y++;
+    }
+    return (*x == '/' ? 1 : *x ? *x + 1 : 0) - (*y == '/' ? 1 : *y ? *y + 1 : 0);
+}
+
+static int compare_counts(const void *a, const void *b) {
+    const IndexEntry *x = *(const IndexEntry *const *)a, *y = *(const IndexEntry *const *)b;
+    if (x->count != y->count) return x->count < y->count ? -1 : 1;
+    return x < y ? -1 : x > y;
+}
+
+static const IndexEntry *find_entry(const Index *index, uint32_t trigram) {
+    size_t lo = 0, hi = index->header->trigram_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->table[mid].trigram < trigram) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < index->header->trigram_count && index->table[lo].trigram == trigram
+               ? &index->table[lo]
+               : NULL;
+}
+
+/* Finds the ids of the files holding every trigram of literal; returns how many. */
+static size_t candidates(const Index *index, const unsigned char *literal, size_t len,
+                         uint32_t *ids) {
+    uint32_t file_count = index->header->file_count, window = 0, run = 0, *other;
+    const IndexEntry **entries = malloc((len + 1) * sizeof(IndexEntry *));
+    size_t entry_count = 0, n;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = literal[i];
+        const IndexEntry *entry;
+        if (c == '\n') {
+            run = 0;
+            continue;
+        }
+        if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+        window = (window << 8 | c) & 0xffffff;
+        if (++run < 3) continue;
+        if ((entry = find_entry(index, window)) == NULL) {
+            free(entries);
+            return 0;
+        }
+        entries[entry_count++] = entry;
+    }
+    if (entry_count == 0) {
+        n = 0;
+        for (uint32_t id = 0; id < file_count; id++) {
+            if (!(index->files[id].flags & FILE_BINARY)) ids[n++] = id;
+        }
+        free(entries);
+        return n;
+    }
+    qsort(entries, entry_count, sizeof(IndexEntry *), compare_counts);
+    n = decode(index, entries[0], ids);
+    other = malloc(((size_t)file_count + 1) * sizeof(uint32_t));
+    for (size_t e = 1; e < entry_count && n > 0; e++) {
+        size_t m, kept = 0;
+        if (entries[e] == entries[e - 1]) continue;
+        m = decode(index, entries[e], other);
+        for (size_t a = 0, b = 0; a < n && b < m;) {
+            if (ids[a] < other[b]) {
+                a++;
+            } else if (ids[a] > other[b]) {
+                b++;
+            } else {
+                ids[kept++] = ids[a];
+                a++;
+                b++;
+            }
+        }
+        n = kept;
+    }
+    free(other);
+    free(entries);
+    return n;
+}
+
+long long trigram_search(Pool *pool, const char *root, const SearchPattern *sp,
+                         const GrepOptions *options, grep_callback cb, void *arg,
+                         TrigramQuery *query) {
+    Index index;
+    const char *literal;
+    size_t len, n, path_count = 0;
+    uint32_t *ids;
+    const char **names;
+    char **paths;
+    long long found;
+    if (open_index(root, &index) < 0) return -1;
+    if (options && options->regex) {
+        len = re_literal(options->regex, &literal);
+    } else {
+        literal = (const char *)sp->pattern;
+        len = sp->length;
+    }
+    ids = malloc(((size_t)index.header->file_count + 1) * sizeof(uint32_t));
+    n = candidates(&index, (const unsigned char *)literal, len, ids);
+    names = malloc((n + 1) * sizeof(char *));
+    for (size_t i = 0; i < n; i++) {
+        const char *name = index.names + index.files[ids[i]].name;
+        if (!grep_ignored(options, name)) names[path_count++] = name;
+    }
+    qsort(names, path_count, sizeof(char *), compare_paths);
+    paths = malloc((path_count + 1) * sizeof(char *));
+    for (size_t i = 0; i < path_count; i++) paths[i] = join(root, names[i]);
+    if (query) {
+        query->files = index.header->file_count;
+        query->candidates = path_count;
+    }
+    close_index(&index);
+    found = grep_files(pool, sp, (const char *const *)paths, path_count, options, cb, arg);
+    for (size_t i = 0; i < path_count; i++) free(paths[i]);
+    free(paths);
+    free(names);
+    free(ids);
+    return found;
+}
@@ -0,0 +1,53 @@
+#ifndef TRIGRAM_H
+#define TRIGRAM_H
+
+#include <stddef.h>
+
+#include "grep.h"
+#include "pool.h"
+#include "search.h"
+
+#define TRIGRAM_INDEX_NAME ".texteditor-index"
+#define TRIGRAM_BATCH_BYTES (4u << 20)
+#define TRIGRAM_BATCH_FILES 256
+#define TRIGRAM_IN_FLIGHT 64
+#define TRIGRAM_BLOCK (1u << 20)
+
+typedef struct {
+    size_t files;
+    size_t indexed;
+    size_t reused;
+    size_t removed;
+    size_t trigrams;
+    size_t bytes;
+} TrigramStats;
+
+typedef struct {
+    size_t files;
+    size_t candidates;
+} TrigramQuery;
+
+/*
+ * A trigram index of a directory tree, kept in TRIGRAM_INDEX_NAME at its
+ * root.  For every trigram of case-folded text that does not cross a line
+ * the index holds the list of files containing it, as delta-encoded
+ * varints; the file is memory-mapped when read.
+ *
+ * trigram_update() walks the tree and re-reads only files whose size or
+ * mtime changed since the last update, on the pool; postings of files
+ * that did not change are carried over from the old index, and the new
+ * one replaces it atomically.  Symlinks are skipped, and binary files are
+ * listed but have no trigrams.
+ *
+ * trigram_search() takes the trigrams of the literal (for a regex, of the
+ * literal it must start with), intersects their posting lists, and runs
+ * grep_files() over the candidate files in walk order, so the results
+ * are those of grep_tree() on the tree as of the last update.  Returns
+ * the number of matches, or -1 if there is no usable index.
+ */
+int trigram_update(Pool *pool, const char *root, TrigramStats *stats);
+long long trigram_search(Pool *pool, const char *root, const SearchPattern *sp,
+                         const GrepOptions *options, grep_callback cb, void *arg,
+                         TrigramQuery *query);
+
+#endif
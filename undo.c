@@ -0,0 +1,362 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "undo.h"
+#include "utf8.h"
+
+static size_t record_bytes(const UndoRecord *record) {
+    return sizeof(UndoRecord) + record->capacity;
+}
+
+static void drop_record(UndoLog *log, UndoRecord *record) {
+    log->bytes -= record_bytes(record);
+    arena_free(&log->arena, record->text, record->capacity);
+    record->text = NULL;
+}
+
+static void drop_redo(UndoLog *log) {
+    while (log->count > log->applied) {
+        drop_record(log, &log->records[--log->count]);
+    }
+}
+
+static char *put_varint(char *p, uint64_t value) {
+    while (value >= 0x80) {
+        *p++ = (char)(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (char)value;
+    return p;
+}
+
+static const char *get_varint(const char *p, const char *end, uint64_t *value) {
+    uint64_t v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        unsigned char byte = *p++;
+        v |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = v;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/* A record as stored in the history file: its type, five varints and the text. */
+static size_t encoded_bound(const UndoRecord *record) {
+    return 1 + 5 * 10 + record->length;
+}
+
+static char *encode(char *p, const UndoRecord *record) {
+    *p++ = (char)record->type;
+    p = put_varint(p, record->pos);
+    p = put_varint(p, record->length);
+    p = put_varint(p, record->cursor_before);
+    p = put_varint(p, record->cursor_after);
+    p = put_varint(p, record->group);
+    memcpy(p, record->text, record->length);
+    return p + record->length;
+}
+
+/* Decodes one record, leaving its text in the data; returns NULL if it is damaged. */
+static const char *decode(const char *p, const char *end, UndoRecord *record) {
+    uint64_t fields[5];
+    if (p >= end || (*p != UNDO_INSERT && *p != UNDO_DELETE)) return NULL;
+    record->type = *p++;
+    for (int i = 0; i < 5; i++) {
+        if (!(p = get_varint(p, end, &fields[i]))) return NULL;
+    }
+    if (fields[1] == 0 || fields[1] > (uint64_t)(end - p)) return NULL;
+    record->pos = fields[0];
+    record->length = fields[1];
+    record->cursor_before = fields[2];
+    record->cursor_after = fields[3];
+    record->group = fields[4];
+    record->text = (char *)p;
+    return p + record->length;
+}
+
+/*
+ * Moves the oldest records, UNDO_SPILL_BLOCK bytes of them or all there
+ * are, into a new block of the history file.  A large group may be split
+ * across blocks.  The group still open for merging stays unless
+ * everything is asked for.
+ */
+static int spill(UndoLog *log, int everything) {
+    size_t end = log->first, bound = 0;
+    char *data, *p;
+    while (end < log->applied && bound < UNDO_SPILL_BLOCK &&
+           (everything || log->records[end].group != log->group)) {
+        bound += encoded_bound(&log->records[end++]);
+    }
+    if (end == log->first || !(data = malloc(bound))) return -1;
+    p = data;
+    for (size_t i = log->first; i < end; i++) p = encode(p, &log->records[i]);
+    if (history_push(&log->history, data, p - data, log->records[end - 1].group) < 0) {
+        free(data);
+        return -1;
+    }
+    free(data);
+    while (log->first < end) drop_record(log, &log->records[log->first++]);
+    return 0;
+}
+
+/* Brings the newest block of the history file back in front of the records in memory. */
+static int restore(UndoLog *log) {
+    size_t len, count = 0;
+    char *data = history_pop(&log->history, &len);
+    const char *p, *end;
+    UndoRecord record;
+    if (!data) return 0;
+    end = data + len;
+    for (p = data; p < end && (p = decode(p, end, &record)) != NULL;) count++;
+    if (!p || count == 0) {
+        free(data);
+        return 0;
+    }
+    if (log->first < count) {
+        size_t shift = count - log->first;
+        if (log->count + shift > log->capacity) {
+            log->capacity = log->count + shift > log->capacity * 2 ? log->count + shift
+                                                                   : log->capacity * 2;
+            log->records = realloc(log->records, log->capacity * sizeof(UndoRecord));
+        }
+        memmove(log->records + count, log->records + log->first,
+                (log->count - log->first) * sizeof(UndoRecord));
+        log->applied += shift;
+        log->count += shift;
+        log->first = count;
+    }
+    log->first -= count;
+    p = data;
+    for (size_t i = 0; i < count; i++) {
+        UndoRecord *restored = &log->records[log->first + i];
+        p = decode(p, end, restored);
+        restored->capacity = restored->length < 16 ? 16 : restored->length;
+        restored->text = memcpy(arena_alloc(&log->arena, restored->capacity), restored->text,
+                                restored->length);
+        log->bytes += record_bytes(restored);
+    }
+    free(data);
+    return 1;
+}
+
+/* Spills the oldest groups to the history file if there is one, and drops them if not. */
+static void trim_to_budget(UndoLog *log) {
+    while (log->bytes > log->budget && log->first < log->applied &&
+           log->records[log->first].group != log->group) {
+        unsigned long group = log->records[log->first].group;
+        if (log->history.path && !log->history.failed) {
+            if (spill(log, 0) == 0) continue;
+            /* Past a gap the steps on disk no longer apply, so they are given up. */
+            log->history.failed = 1;
+        }
+        while (log->first < log->applied && log->records[log->first].group == group) {
+            drop_record(log, &log->records[log->first++]);
+        }
+    }
+    if (log->first > log->capacity / 2) {
+        memmove(log->records, log->records + log->first,
+                (log->count - log->first) * sizeof(UndoRecord));
+        log->applied -= log->first;
+        log->count -= log->first;
+        log->first = 0;
+    }
+}
+
+/*
+ * Undoing back through the history file brings blocks back into memory,
+ * where they stay as steps to redo.  Once they take the log over its
+ * budget the steps furthest from being redone are dropped; the next one
+ * always stays.
+ */
+static void trim_redo(UndoLog *log) {
+    while (log->bytes > log->budget && log->count > log->applied &&
+           log->records[log->count - 1].group != log->records[log->applied].group) {
+        unsigned long group = log->records[log->count - 1].group;
+        while (log->records[log->count - 1].group == group) {
+            drop_record(log, &log->records[--log->count]);
+        }
+    }
+}
+
+/* One typed character, which may take several bytes. */
+static int single_char(const char *text, size_t length) {
+    unsigned int cp;
+    return length <= UTF8_MAX && text[0] != '\n' &&
+           (size_t)utf8_decode(text, length, &cp) == length;
+}
+
+static int try_merge(UndoLog *log, int type, size_t pos, const char *text, size_t length,
+                     size_t cursor_after) {
+    UndoRecord *last;
+    if (!log->coalesce || log->in_group || !single_char(text, length) ||
+        log->applied == log->first) {
+        return 0;
+    }
+    last = &log->records[log->applied - 1];
+    if (last->type != type) return 0;
+    if (type == UNDO_INSERT && pos != last->pos + last->length) return 0;
+    if (type == UNDO_DELETE && pos != last->pos && pos + length != last->pos) return 0;
+    if (last->length + length > last->capacity) {
+        size_t capacity = last->capacity * 2;
+        log->bytes += capacity - last->capacity;
+        last->text = arena_realloc(&log->arena, last->text, last->capacity, capacity);
+        last->capacity = capacity;
+    }
+    if (type == UNDO_DELETE && pos + length == last->pos) {
+        memmove(last->text + length, last->text, last->length);
+        memcpy(last->text, text, length);
+        last->pos = pos;
+    } else {
+        memcpy(last->text + last->length, text, length);
+    }
+    last->length += length;
+    last->cursor_after = cursor_after;
+    return 1;
+}
+
+/* Inserts made back to back inside one group grow a single record. */
+static int try_extend(UndoLog *log, int type, size_t pos, const char *text, size_t length,
+                      size_t cursor_after) {
+    UndoRecord *last;
+    if (!log->in_group || type != UNDO_INSERT || log->applied == log->first) return 0;
+    last = &log->records[log->applied - 1];
+    if (last->group != log->group || last->type != UNDO_INSERT ||
+        pos != last->pos + last->length) {
+        return 0;
+    }
+    if (last->length + length > last->capacity) {
+        size_t capacity = last->capacity * 2;
+        if (capacity < last->length + length) capacity = last->length + length;
+        log->bytes += capacity - last->capacity;
+        last->text = arena_realloc(&log->arena, last->text, last->capacity, capacity);
+        last->capacity = capacity;
+    }
+    memcpy(last->text + last->length, text, length);
+    last->length += length;
+    last->cursor_after = cursor_after;
+    return 1;
+}
+
+void undo_init(UndoLog *log, size_t budget) {
+    memset(log, 0, sizeof(UndoLog));
+    log->budget = budget;
+    log->history.fd = -1;
+    arena_init(&log->arena);
+}
+
+void undo_free(UndoLog *log) {
+    history_close(&log->history);
+    arena_release(&log->arena);
+    free(log->records);
+    memset(log, 0, sizeof(UndoLog));
+}
+
+size_t undo_open_history(UndoLog *log, const char *filename) {
+    size_t blocks = history_open(&log->history, filename);
+    if (log->history.group > log->group) log->group = log->history.group;
+    return blocks;
+}
+
+/* Called with the buffer saved to filename: every step that can be undone goes to disk. */
+int undo_save_history(UndoLog *log, const char *filename) {
+    if (!log->history.path) return -1;
+    while (log->first < log->applied) {
+        if (spill(log, 1) < 0) return -1;
+    }
+    return history_stamp(&log->history, filename);
+}
+
+size_t undo_memory(const UndoLog *log) {
+    return log->capacity * sizeof(UndoRecord) + log->arena.reserved;
+}
+
+void undo_break(UndoLog *log) {
+    log->coalesce = 0;
+}
+
+void undo_begin_group(UndoLog *log) {
+    log->group++;
+    log->in_group = 1;
+    log->coalesce = 0;
+}
+
+void undo_end_group(UndoLog *log) {
+    log->in_group = 0;
+    log->coalesce = 0;
+}
+
+void undo_record(UndoLog *log, int type, size_t pos, const char *text, size_t length,
+                 size_t cursor_before, size_t cursor_after) {
+    UndoRecord *record;
+    if (length == 0) return;
+    drop_redo(log);
+    if (try_merge(log, type, pos, text, length, cursor_after)) return;
+    if (try_extend(log, type, pos, text, length, cursor_after)) {
+        trim_to_budget(log);
+        return;
+    }
+    if (log->count == log->capacity) {
+        log->capacity = log->capacity ? log->capacity * 2 : 64;
+        log->records = realloc(log->records, log->capacity * sizeof(UndoRecord));
+    }
+    if (!log->in_group) log->group++;
+    record = &log->records[log->count++];
+    record->type = type;
+    record->pos = pos;
+    record->capacity = length < 16 ? 16 : length;
+    record->text = arena_alloc(&log->arena, record->capacity);
+    memcpy(record->text, text, length);
+    record->length = length;
+    record->cursor_before = cursor_before;
+    record->cursor_after = cursor_after;
+    record->group = log->group;
+    log->applied = log->count;
+    log->bytes += record_bytes(record);
+    log->coalesce = !log->in_group && single_char(text, length);
+    trim_to_budget(log);
+}
+
+int undo_apply(UndoLog *log, Buffer *buf, size_t *cursor) {
+    unsigned long group;
+    if (log->applied == log->first && !restore(log)) return 0;
+    group = log->records[log->applied - 1].group;
+    while (1) {
+        UndoRecord *record;
+        /* The rest of a group split across blocks is in the newest one on disk. */
+        if (log->applied == log->first &&
+            (log->history.blocks == 0 || log->history.group != group || !restore(log))) {
+            break;
+        }
+        if (log->records[log->applied - 1].group != group) break;
+        record = &log->records[--log->applied];
+        if (record->type == UNDO_INSERT) {
+            buffer_delete(buf, record->pos, record->length);
+        } else {
+            buffer_insert(buf, record->pos, record->text, record->length);
+        }
+        *cursor = record->cursor_before;
+    }
+    trim_redo(log);
+    log->coalesce = 0;
+    return 1;
+}
+
+int redo_apply(UndoLog *log, Buffer *buf, size_t *cursor) {
+    unsigned long group;
+    if (log->applied == log->count) return 0;
+    group = log->records[log->applied].group;
+    while (log->applied < log->count && log->records[log->applied].group == group) {
+        UndoRecord *record = &log->records[log->applied++];
+        if (record->type == UNDO_INSERT) {
+            buffer_insert(buf, record->pos, record->text, record->length);
+        } else {
+            buffer_delete(buf, record->pos, record->length);
+        }
+        *cursor = record->cursor_after;
+    }
+    log->coalesce = 0;
+    return 1;
+}
@@ -0,0 +1,80 @@
+#ifndef UNDO_H
+#define UNDO_H
+
+#include <stddef.h>
+
+#include "arena.h"
+#include "buffer.h"
+#include "history.h"
+
+#define UNDO_DEFAULT_BUDGET (64u << 20)
+#define UNDO_SPILL_BLOCK (256u << 10)
+
+enum { UNDO_INSERT, UNDO_DELETE };
+
+/*
+ * One edit as applied to the buffer.  Records that share a group number
+ * are undone and redone together as a single step.
+ */
+typedef struct {
+    int type;
+    size_t pos;
+    char *text;
+    size_t length;
+    size_t capacity;
+    size_t cursor_before;
+    size_t cursor_after;
+    unsigned long group;
+} UndoRecord;
+
+/*
+ * Operation log.  Records in [first, applied) can be undone, records in
+ * [applied, count) can be redone.  Once the memory used by the records
+ * exceeds the budget the oldest groups are dropped, or, with a history
+ * file opened by undo_open_history(), compressed and pushed to it in
+ * blocks of about UNDO_SPILL_BLOCK bytes.  Undo pops a block back when it
+ * runs out of records in memory, so history is bounded by the disk only;
+ * the steps it leaves to redo are dropped from the far end when they take
+ * the log over the budget.
+ * undo_save_history() writes out the rest once the file has been saved,
+ * and the next session for the file picks the history up from there.
+ *
+ * Single-character edits that continue the previous one (typing, repeated
+ * backspace or delete) are merged into one record until undo_break() is
+ * called.  Edits between undo_begin_group() and undo_end_group() always
+ * form a single step, and back-to-back inserts within a group share one
+ * record.
+ *
+ * Record texts come from the log's arena, so dropping the log frees them
+ * without visiting each record.
+ */
+typedef struct {
+    UndoRecord *records;
+    size_t first;
+    size_t applied;
+    size_t count;
+    size_t capacity;
+    size_t bytes;
+    size_t budget;
+    unsigned long group;
+    int in_group;
+    int coalesce;
+    Arena arena;
+    History history;
+} UndoLog;
+
+void undo_init(UndoLog *log, size_t budget);
+void undo_free(UndoLog *log);
+/* Returns the number of blocks of history left on disk by earlier sessions. */
+size_t undo_open_history(UndoLog *log, const char *filename);
+int undo_save_history(UndoLog *log, const char *filename);
+size_t undo_memory(const UndoLog *log);
+void undo_break(UndoLog *log);
+void undo_begin_group(UndoLog *log);
+void undo_end_group(UndoLog *log);
+void undo_record(UndoLog *log, int type, size_t pos, const char *text, size_t length,
+                 size_t cursor_before, size_t cursor_after);
+int undo_apply(UndoLog *log, Buffer *buf, size_t *cursor);
+int redo_apply(UndoLog *log, Buffer *buf, size_t *cursor);
+
+#endif
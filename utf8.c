@@ -0,0 +1,318 @@
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UTF8_X86 1
+#endif
+
+#include "utf8.h"
+
+typedef struct {
+    unsigned int first;
+    unsigned int last;
+} Range;
+
+/* Combining marks, format characters and variation selectors. */
+static const Range zero_width[] = {
+    { 0x0300, 0x036F }, { 0x0483, 0x0489 }, { 0x0591, 0x05BD }, { 0x05BF, 0x05BF },
+    { 0x05C1, 0x05C2 }, { 0x05C4, 0x05C5 }, { 0x05C7, 0x05C7 }, { 0x0610, 0x061A },
+    { 0x064B, 0x065F }, { 0x0670, 0x0670 }, { 0x06D6, 0x06DC }, { 0x06DF, 0x06E4 },
+    { 0x06E7, 0x06E8 }, { 0x06EA, 0x06ED }, { 0x0711, 0x0711 }, { 0x0730, 0x074A },
+    { 0x07A6, 0x07B0 }, { 0x07EB, 0x07F3 }, { 0x0816, 0x0819 }, { 0x081B, 0x0823 },
+    { 0x0825, 0x0827 }, { 0x0829, 0x082D }, { 0x0859, 0x085B }, { 0x08D3, 0x08E1 },
+    { 0x08E3, 0x0902 }, { 0x093A, 0x093A }, { 0x093C, 0x093C }, { 0x0941, 0x0948 },
+    { 0x094D, 0x094D }, { 0x0951, 0x0957 }, { 0x0962, 0x0963 }, { 0x0981, 0x0981 },
+    { 0x09BC, 0x09BC }, { 0x09C1, 0x09C4 }, { 0x09CD, 0x09CD }, { 0x09E2, 0x09E3 },
+    { 0x0A01, 0x0A02 }, { 0x0A3C, 0x0A3C }, { 0x0A41, 0x0A51 }, { 0x0A70, 0x0A71 },
+    { 0x0A75, 0x0A75 }, { 0x0A81, 0x0A82 }, { 0x0ABC, 0x0ABC }, { 0x0AC1, 0x0AC8 },
+    { 0x0ACD, 0x0ACD }, { 0x0AE2, 0x0AE3 }, { 0x0B01, 0x0B01 }, { 0x0B3C, 0x0B3C },
+    { 0x0B3F, 0x0B3F }, { 0x0B41, 0x0B44 }, { 0x0B4D, 0x0B4D }, { 0x0B56, 0x0B56 },
+    { 0x0B62, 0x0B63 }, { 0x0B82, 0x0B82 }, { 0x0BC0, 0x0BC0 }, { 0x0BCD, 0x0BCD },
+    { 0x0C00, 0x0C00 }, { 0x0C3E, 0x0C40 }, { 0x0C46, 0x0C56 }, { 0x0C62, 0x0C63 },
+    { 0x0CBC, 0x0CBC }, { 0x0CCC, 0x0CCD }, { 0x0CE2, 0x0CE3 }, { 0x0D00, 0x0D01 },
+    { 0x0D41, 0x0D44 }, { 0x0D4D, 0x0D4D }, { 0x0D62, 0x0D63 }, { 0x0DCA, 0x0DCA },
+    { 0x0DD2, 0x0DD6 }, { 0x0E31, 0x0E31 }, { 0x0E34, 0x0E3A }, { 0x0E47, 0x0E4E },
+    { 0x0EB1, 0x0EB1 }, { 0x0EB4, 0x0EBC }, { 0x0EC8, 0x0ECD }, { 0x0F18, 0x0F19 },
+    { 0x0F35, 0x0F35 }, { 0x0F37, 0x0F37 }, { 0x0F39, 0x0F39 }, { 0x0F71, 0x0F7E },
+    { 0x0F80, 0x0F84 }, { 0x0F86, 0x0F87 }, { 0x0F8D, 0x0FBC }, { 0x0FC6, 0x0FC6 },
+    { 0x102D, 0x1030 }, { 0x1032, 0x1037 }, { 0x1039, 0x103A }, { 0x103D, 0x103E },
+    { 0x1058, 0x1059 }, { 0x105E, 0x1060 }, { 0x1071, 0x1074 }, { 0x1082, 0x1082 },
+    { 0x1085, 0x1086 }, { 0x108D, 0x108D }, { 0x109D, 0x109D }, { 0x1160, 0x11FF },
+    { 0x135D, 0x135F }, { 0x1712, 0x1714 }, { 0x1732, 0x1734 }, { 0x1752, 0x1753 },
+    { 0x1772, 0x1773 }, { 0x17B4, 0x17B5 }, { 0x17B7, 0x17BD }, { 0x17C6, 0x17C6 },
+    { 0x17C9, 0x17D3 }, { 0x17DD, 0x17DD }, { 0x180B, 0x180F }, { 0x1885, 0x1886 },
+    { 0x18A9, 0x18A9 }, { 0x1920, 0x1922 }, { 0x1927, 0x1928 }, { 0x1932, 0x1932 },
+    { 0x1939, 0x193B }, { 0x1A17, 0x1A18 }, { 0x1A1B, 0x1A1B }, { 0x1A56, 0x1A56 },
+    { 0x1A58, 0x1A60 }, { 0x1A62, 0x1A62 }, { 0x1A65, 0x1A6C }, { 0x1A73, 0x1A7F },
+    { 0x1AB0, 0x1AFF }, { 0x1B00, 0x1B03 }, { 0x1B34, 0x1B34 }, { 0x1B36, 0x1B3A },
+    { 0x1B3C, 0x1B3C }, { 0x1B42, 0x1B42 }, { 0x1B6B, 0x1B73 }, { 0x1B80, 0x1B81 },
+    { 0x1BA2, 0x1BA5 }, { 0x1BA8, 0x1BA9 }, { 0x1BAB, 0x1BAD }, { 0x1BE6, 0x1BE6 },
+    { 0x1BE8, 0x1BE9 }, { 0x1BED, 0x1BED }, { 0x1BEF, 0x1BF1 }, { 0x1C2C, 0x1C33 },
+    { 0x1C36, 0x1C37 }, { 0x1CD0, 0x1CD2 }, { 0x1CD4, 0x1CE0 }, { 0x1CE2, 0x1CE8 },
+    { 0x1CED, 0x1CED }, { 0x1CF4, 0x1CF4 }, { 0x1CF8, 0x1CF9 }, { 0x1DC0, 0x1DFF },
+    { 0x200B, 0x200F }, { 0x202A, 0x202E }, { 0x2060, 0x2064 }, { 0x20D0, 0x20F0 },
+    { 0x2CEF, 0x2CF1 }, { 0x2D7F, 0x2D7F }, { 0x2DE0, 0x2DFF }, { 0x302A, 0x302D },
+    { 0x3099, 0x309A }, { 0xA66F, 0xA672 }, { 0xA674, 0xA67D }, { 0xA69E, 0xA69F },
+    { 0xA6F0, 0xA6F1 }, { 0xA802, 0xA802 }, { 0xA806, 0xA806 }, { 0xA80B, 0xA80B },
+    { 0xA825, 0xA826 }, { 0xA8C4, 0xA8C5 }, { 0xA8E0, 0xA8F1 }, { 0xA8FF, 0xA8FF },
+    { 0xA926, 0xA92D }, { 0xA947, 0xA951 }, { 0xA980, 0xA982 }, { 0xA9B3, 0xA9B3 },
+    { 0xA9B6, 0xA9B9 }, { 0xA9BC, 0xA9BD }, { 0xA9E5, 0xA9E5 }, { 0xAA29, 0xAA2E },
+    { 0xAA31, 0xAA32 }, { 0xAA35, 0xAA36 }, { 0xAA43, 0xAA43 }, { 0xAA4C, 0xAA4C },
+    { 0xAA7C, 0xAA7C }, { 0xAAB0, 0xAAB0 }, { 0xAAB2, 0xAAB4 }, { 0xAAB7, 0xAAB8 },
+    { 0xAABE, 0xAABF }, { 0xAAC1, 0xAAC1 }, { 0xAAEC, 0xAAED }, { 0xAAF6, 0xAAF6 },
+    { 0xABE5, 0xABE5 }, { 0xABE8, 0xABE8 }, { 0xABED, 0xABED }, { 0xD7B0, 0xD7FF },
+    { 0xFB1E, 0xFB1E }, { 0xFE00, 0xFE0F }, { 0xFE20, 0xFE2F }, { 0xFEFF, 0xFEFF },
+    { 0x101FD, 0x101FD }, { 0x10A01, 0x10A0F }, { 0x10A38, 0x10A3F }, { 0x11001, 0x11001 },
+    { 0x11038, 0x11046 }, { 0x1107F, 0x11081 }, { 0x110B3, 0x110B6 }, { 0x110B9, 0x110BA },
+    { 0x1D167, 0x1D169 }, { 0x1D173, 0x1D182 }, { 0x1D185, 0x1D18B }, { 0x1D1AA, 0x1D1AD },
+    { 0x1E000, 0x1E02A }, { 0x1E8D0, 0x1E8D6 }, { 0x1E944, 0x1E94A }, { 0x1F3FB, 0x1F3FF },
+    { 0xE0001, 0xE0001 }, { 0xE0020, 0xE007F }, { 0xE0100, 0xE01EF }
+};
+
+/* East Asian Wide and Fullwidth, which takes in most emoji. */
+static const Range wide[] = {
+    { 0x1100, 0x115F }, { 0x231A, 0x231B }, { 0x2329, 0x232A }, { 0x23E9, 0x23EC },
+    { 0x23F0, 0x23F0 }, { 0x23F3, 0x23F3 }, { 0x25FD, 0x25FE }, { 0x2614, 0x2615 },
+    { 0x2648, 0x2653 }, { 0x267F, 0x267F }, { 0x2693, 0x2693 }, { 0x26A1, 0x26A1 },
+    { 0x26AA, 0x26AB }, { 0x26BD, 0x26BE }, { 0x26C4, 0x26C5 }, { 0x26CE, 0x26CE },
+    { 0x26D4, 0x26D4 }, { 0x26EA, 0x26EA }, { 0x26F2, 0x26F3 }, { 0x26F5, 0x26F5 },
+    { 0x26FA, 0x26FA }, { 0x26FD, 0x26FD }, { 0x2705, 0x2705 }, { 0x270A, 0x270B },
+    { 0x2728, 0x2728 }, { 0x274C, 0x274C }, { 0x274E, 0x274E }, { 0x2753, 0x2755 },
+    { 0x2757, 0x2757 }, { 0x2795, 0x2797 }, { 0x27B0, 0x27B0 }, { 0x27BF, 0x27BF },
+    { 0x2B1B, 0x2B1C }, { 0x2B50, 0x2B50 }, { 0x2B55, 0x2B55 }, { 0x2E80, 0x303E },
+    { 0x3041, 0x33FF }, { 0x3400, 0x4DBF }, { 0x4E00, 0x9FFF }, { 0xA000, 0xA4CF },
+    { 0xA960, 0xA97F }, { 0xAC00, 0xD7A3 }, { 0xF900, 0xFAFF }, { 0xFE10, 0xFE19 },
+    { 0xFE30, 0xFE6F }, { 0xFF00, 0xFF60 }, { 0xFFE0, 0xFFE6 }, { 0x16FE0, 0x16FE4 },
+    { 0x17000, 0x18CFF }, { 0x1B000, 0x1B2FF }, { 0x1F004, 0x1F004 }, { 0x1F0CF, 0x1F0CF },
+    { 0x1F18E, 0x1F18E }, { 0x1F191, 0x1F19A }, { 0x1F200, 0x1F202 }, { 0x1F210, 0x1F23B },
+    { 0x1F240, 0x1F248 }, { 0x1F250, 0x1F251 }, { 0x1F260, 0x1F265 }, { 0x1F300, 0x1F320 },
+    { 0x1F32D, 0x1F335 }, { 0x1F337, 0x1F37C }, { 0x1F37E, 0x1F393 }, { 0x1F3A0, 0x1F3CA },
+    { 0x1F3CF, 0x1F3D3 }, { 0x1F3E0, 0x1F3F0 }, { 0x1F3F4, 0x1F3F4 }, { 0x1F3F8, 0x1F43E },
+    { 0x1F440, 0x1F440 }, { 0x1F442, 0x1F4FC }, { 0x1F4FF, 0x1F53D }, { 0x1F54B, 0x1F54E },
+    { 0x1F550, 0x1F567 }, { 0x1F57A, 0x1F57A }, { 0x1F595, 0x1F596 }, { 0x1F5A4, 0x1F5A4 },
+    { 0x1F5FB, 0x1F64F }, { 0x1F680, 0x1F6C5 }, { 0x1F6CC, 0x1F6CC }, { 0x1F6D0, 0x1F6D2 },
+    { 0x1F6D5, 0x1F6D7 }, { 0x1F6DC, 0x1F6DF }, { 0x1F6EB, 0x1F6EC }, { 0x1F6F4, 0x1F6FC },
+    { 0x1F7E0, 0x1F7EB }, { 0x1F7F0, 0x1F7F0 }, { 0x1F90C, 0x1F93A }, { 0x1F93C, 0x1F945 },
+    { 0x1F947, 0x1F9FF }, { 0x1FA70, 0x1FA7C }, { 0x1FA80, 0x1FA88 }, { 0x1FA90, 0x1FABD },
+    { 0x1FABF, 0x1FAC5 }, { 0x1FACE, 0x1FADB }, { 0x1FAE0, 0x1FAE8 }, { 0x1FAF0, 0x1FAF8 },
+    { 0x20000, 0x2FFFD }, { 0x30000, 0x3FFFD }
+};
+
+/* Widths of the Basic Multilingual Plane, two bits each. */
+static unsigned char bmp_widths[0x10000 / 4];
+static pthread_once_t bmp_once = PTHREAD_ONCE_INIT;
+
+int utf8_decode(const char *text, size_t len, unsigned int *cp) {
+    const unsigned char *s = (const unsigned char *)text;
+    unsigned int c;
+    int n;
+    *cp = UTF8_REPLACEMENT;
+    if (len == 0) return 0;
+    c = s[0];
+    if (c < 0x80) {
+        *cp = c;
+        return 1;
+    }
+    n = c < 0xC2 ? 0 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : c < 0xF5 ? 4 : 0;
+    if (n == 0 || (size_t)n > len) return 1;
+    c &= 0x3F >> (n - 1);
+    for (int i = 1; i < n; i++) {
+        if ((s[i] & 0xC0) != 0x80) return 1;
+        c = c << 6 | (s[i] & 0x3F);
+    }
+    if ((n == 3 && c < 0x800) || (n == 4 && (c < 0x10000 || c > 0x10FFFF)) ||
+        (c >= 0xD800 && c <= 0xDFFF)) {
+        return 1;
+    }
+    *cp = c;
+    return n;
+}
+
+int utf8_encode(unsigned int cp, char *out) {
+    if (cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) cp = UTF8_REPLACEMENT;
+    if (cp < 0x80) {
+        out[0] = cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = 0xC0 | cp >> 6;
+        out[1] = 0x80 | (cp & 0x3F);
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = 0xE0 | cp >> 12;
+        out[1] = 0x80 | (cp >> 6 & 0x3F);
+        out[2] = 0x80 | (cp & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | cp >> 18;
+    out[1] = 0x80 | (cp >> 12 & 0x3F);
+    out[2] = 0x80 | (cp >> 6 & 0x3F);
+    out[3] = 0x80 | (cp & 0x3F);
+    return 4;
+}
+
+static int in_ranges(const Range *ranges, size_t count, unsigned int cp) {
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (cp > ranges[mid].last) {
+            lo = mid + 1;
+        } else if (cp < ranges[mid].first) {
+            hi = mid;
+        } else {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int table_width(unsigned int cp) {
+    if (in_ranges(zero_width, sizeof(zero_width) / sizeof(Range), cp)) return 0;
+    return in_ranges(wide, sizeof(wide) / sizeof(Range), cp) ? 2 : 1;
+}
+
+static void set_widths(const Range *ranges, size_t count, int width) {
+    for (size_t i = 0; i < count; i++) {
+        for (unsigned int cp = ranges[i].first; cp <= ranges[i].last && cp < 0x10000; cp++) {
+            int shift = (cp & 3) * 2;
+            bmp_widths[cp >> 2] = (bmp_widths[cp >> 2] & ~(3 << shift)) | width << shift;
+        }
+    }
+}
+
+/* Zero widths go last: a few combining marks sit inside wide blocks. */
+static void build_bmp_widths(void) {
+    memset(bmp_widths, 0x55, sizeof(bmp_widths));
+    set_widths(wide, sizeof(wide) / sizeof(Range), 2);
+    set_widths(zero_width, sizeof(zero_width) / sizeof(Range), 0);
+}
+
+int utf8_width(unsigned int cp) {
+    if (cp < 0x300) return 1;
+    if (cp >= 0x10000) return table_width(cp);
+    pthread_once(&bmp_once, build_bmp_widths);
+    return bmp_widths[cp >> 2] >> ((cp & 3) * 2) & 3;
+}
+
+/* Leads of two-byte sequences with no combining marks: U+0080-02FF, 0380-047F, 04C0-057F. */
+static int narrow_lead(unsigned char c) {
+    return (c >= 0xC2 && c <= 0xCB) || (c >= 0xCE && c <= 0xD1) || (c >= 0xD3 && c <= 0xD5);
+}
+
+static size_t narrow_scalar(const unsigned char *text, size_t len, size_t *count) {
+    size_t i = 0;
+    while (i < len) {
+        if (text[i] < 0x80) {
+            i++;
+        } else if (narrow_lead(text[i]) && i + 1 < len && (text[i + 1] & 0xC0) == 0x80) {
+            i += 2;
+        } else {
+            break;
+        }
+        (*count)++;
+    }
+    return i;
+}
+
+#ifdef UTF8_X86
+static __m128i in_range_sse2(__m128i v, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+                         _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+}
+
+/*
+ * Sixteen bytes at a time as bit masks: every lead byte has to be a
+ * narrow one, each continuation byte has to follow a lead and each lead
+ * has to be followed by one, which is cont == lead << 1 with no lead in
+ * the last lane.  The characters are then the bytes less the
+ * continuations.  Compares are signed, so 0x80-0xBF is below -64.  A
+ * block that fails is walked byte by byte, one byte past its end for a
+ * sequence split across blocks, and the vector loop goes on after it.
+ */
+static size_t narrow_sse2(const unsigned char *text, size_t len, size_t *count) {
+    size_t i = 0;
+    while (i + 16 <= len) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(text + i));
+        unsigned high = (unsigned)_mm_movemask_epi8(v), cont, narrow;
+        if (!high) {
+            *count += 16;
+            i += 16;
+            continue;
+        }
+        cont = (unsigned)_mm_movemask_epi8(_mm_cmplt_epi8(v, _mm_set1_epi8(-64)));
+        narrow = (unsigned)_mm_movemask_epi8(
+            _mm_or_si128(_mm_or_si128(in_range_sse2(v, (char)0xC2, (char)0xCB),
+                                      in_range_sse2(v, (char)0xCE, (char)0xD1)),
+                         in_range_sse2(v, (char)0xD3, (char)0xD5)));
+        if ((high & ~cont) != narrow || cont != ((narrow << 1) & 0xFFFF) || (narrow & 0x8000)) {
+            size_t n = narrow_scalar(text + i, len - i < 17 ? len - i : 17, count);
+            if (n < 16) return i + n;
+            i += n;
+            continue;
+        }
+        *count += 16 - __builtin_popcount(cont);
+        i += 16;
+    }
+    return i + narrow_scalar(text + i, len - i, count);
+}
+
+__attribute__((target("avx2")))
+static __m256i in_range_avx2(__m256i v, char lo, char hi) {
+    return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1)),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v));
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t narrow_avx2(const unsigned char *text, size_t len, size_t *count) {
+    size_t i = 0;
+    while (i + 32 <= len) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(text + i));
+        unsigned high = (unsigned)_mm256_movemask_epi8(v), cont, narrow;
+        if (!high) {
+            *count += 32;
+            i += 32;
+            continue;
+        }
+        cont = (unsigned)_mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_set1_epi8(-64), v));
+        narrow = (unsigned)_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_or_si256(in_range_avx2(v, (char)0xC2, (char)0xCB),
+                                            in_range_avx2(v, (char)0xCE, (char)0xD1)),
+                            in_range_avx2(v, (char)0xD3, (char)0xD5)));
+        if ((high & ~cont) != narrow || cont != narrow << 1 || (narrow & 0x80000000u)) {
+            size_t n = narrow_scalar(text + i, len - i < 33 ? len - i : 33, count);
+            if (n < 32) return i + n;
+            i += n;
+            continue;
+        }
+        *count += 32 - __builtin_popcount(cont);
+        i += 32;
+    }
+    return i + narrow_sse2(text + i, len - i, count);
+}
+#endif
+
+size_t utf8_narrow(const char *text, size_t len, size_t *count) {
+    static size_t (*narrow)(const unsigned char *, size_t, size_t *);
+    if (!narrow) {
+        narrow = narrow_scalar;
+#ifdef UTF8_X86
+        __builtin_cpu_init();
+        narrow = __builtin_cpu_supports("avx2") ? narrow_avx2 : narrow_sse2;
+#endif
+    }
+    *count = 0;
+    return narrow((const unsigned char *)text, len, count);
+}
+
+size_t utf8_prev(const char *text, size_t pos) {
+    size_t start;
+    unsigned int cp;
+    if (pos == 0) return 0;
+    start = pos - 1;
+    while (start > 0 && pos - start < UTF8_MAX && ((unsigned char)text[start] & 0xC0) == 0x80) {
+        start--;
+    }
+    return utf8_decode(text + start, pos - start, &cp) == (int)(pos - start) ? start : pos - 1;
+}
@@ -0,0 +1,33 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <stddef.h>
+
+#define UTF8_MAX 4
+#define UTF8_REPLACEMENT 0xFFFD
+
+/*
+ * UTF-8 for the editor and the screen.  Text is never rejected: a byte
+ * that does not start a valid sequence decodes on its own as U+FFFD, so
+ * every byte string splits into characters the same way everywhere.
+ *
+ * Widths come from tables of the zero-width (combining and format) and
+ * the East Asian wide and fullwidth ranges; the Basic Multilingual Plane
+ * is flattened into a two-bit table the first time a width is asked for,
+ * so the common case is one lookup.  Control characters count as one
+ * column, since the screen shows them as '?'.
+ *
+ * utf8_narrow() is the fast path for long lines: it validates and counts
+ * with SSE2 or AVX2 a run of characters that are all one column wide,
+ * which is every ASCII byte and the two-byte Latin, Greek and Cyrillic
+ * sequences.  Everything else is left to utf8_decode() and utf8_width().
+ */
+int utf8_decode(const char *text, size_t len, unsigned int *cp);
+int utf8_encode(unsigned int cp, char *out);
+int utf8_width(unsigned int cp);
+/* Length of the leading run of text made of whole one-column characters; *count gets them. */
+size_t utf8_narrow(const char *text, size_t len, size_t *count);
+/* Start of the character before pos. */
+size_t utf8_prev(const char *text, size_t pos);
+
+#endif
@@ -0,0 +1,629 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "input.h"
+#include "pool.h"
+#include "screen.h"
+#include "search.h"
+#include "syntax.h"
+#include "utf8.h"
+#include "viewer.h"
+#include "watch.h"
+
+/* One index entry every LINE_CHECKPOINT lines. */
+#define LINE_CHECKPOINT 4096
+#define INDEX_BLOCK (1 << 20)
+#define INDEX_TAIL 4096
+#define VIEW_ROWS 24
+#define VIEW_COLS 80
+#define HORIZONTAL_STEP 8
+
+/*
+ * Sparse line index built by a background job.  checkpoints[k] is the
+ * byte offset of line k * LINE_CHECKPOINT, so any line is at most one
+ * checkpoint interval of scanning away.  The job carries on from
+ * indexed_offset, so a file that grows only has its new tail indexed; the
+ * last INDEX_TAIL bytes as they were are kept to tell that it only grew.
+ */
+typedef struct {
+    int fd;
+    const char *data;
+    size_t size;
+    int mapped;
+    Job job;
+    CancelToken token;
+    pthread_mutex_t lock;
+    size_t *checkpoints;
+    size_t checkpoint_count;
+    size_t checkpoint_cap;
+    size_t indexed_offset;
+    size_t indexed_lines;
+    int complete;
+    struct timespec mtime;
+    char tail[INDEX_TAIL];
+    size_t tail_len;
+} LineIndex;
+
+typedef struct {
+    const char *filename;
+    LineIndex *index;
+    Watch watch;
+    int watched;
+    Screen screen;
+    Input input;
+    size_t top;
+    size_t col_offset;
+    const Language *lang;
+    unsigned char *attrs;
+    size_t attrs_cap;
+    size_t pending_line;
+    int has_pending;
+    long long top_line;
+    int showed_end;
+    char message[128];
+} Viewer;
+
+/*
+ * A mapped file cut short by another process raises SIGBUS when the pages
+ * past its new end are read.  on_sigbus puts zero pages in their place and
+ * sets mapping_lost; draw leaves the rows from there on blank rather than
+ * show the zeros, and follow_file then opens the file again.
+ */
+static LineIndex *mapped_index;
+static size_t page_size;
+static volatile sig_atomic_t mapping_lost;
+static struct sigaction old_sigbus;
+
+static void on_sigbus(int sig, siginfo_t *info, void *context) {
+    LineIndex *index = mapped_index;
+    uintptr_t page = (uintptr_t)info->si_addr & ~(uintptr_t)(page_size - 1);
+    uintptr_t start, end;
+    (void)context;
+    if (index && index->mapped) {
+        start = (uintptr_t)index->data;
+        end = (start + index->size + page_size - 1) & ~(uintptr_t)(page_size - 1);
+        if (page >= start && page < end &&
+            mmap((void *)page, end - page, PROT_READ,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED) {
+            mapping_lost = 1;
+            return;
+        }
+    }
+    /* Not ours: fault again with the default action. */
+    signal(sig, SIG_DFL);
+}
+
+static void catch_sigbus(LineIndex *index) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = on_sigbus;
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    page_size = sysconf(_SC_PAGESIZE);
+    mapped_index = index;
+    sigaction(SIGBUS, &sa, &old_sigbus);
+}
+
+static void release_sigbus(void) {
+    sigaction(SIGBUS, &old_sigbus, NULL);
+    mapped_index = NULL;
+}
+
+static void add_checkpoint(LineIndex *index, size_t offset) {
+    if (index->checkpoint_count == index->checkpoint_cap) {
+        index->checkpoint_cap = index->checkpoint_cap ? index->checkpoint_cap * 2 : 1024;
+        index->checkpoints = realloc(index->checkpoints,
+                                     index->checkpoint_cap * sizeof(size_t));
+    }
+    index->checkpoints[index->checkpoint_count++] = offset;
+}
+
+/*
+ * Mapped files are indexed through pread() rather than the mapping, so
+ * building the index does not pull the whole file into resident memory.
+ */
+static void build_index(Job *job) {
+    LineIndex *index = job->arg;
+    char *block = index->mapped ? malloc(INDEX_BLOCK) : NULL;
+    size_t offset, lines, next;
+    pthread_mutex_lock(&index->lock);
+    offset = index->indexed_offset;
+    lines = index->indexed_lines;
+    next = index->checkpoint_count * LINE_CHECKPOINT;
+    pthread_mutex_unlock(&index->lock);
+    while (offset < index->size && !job_cancelled(job)) {
+        size_t len = index->size - offset < INDEX_BLOCK ? index->size - offset : INDEX_BLOCK;
+        const char *text = index->data + offset;
+        size_t count;
+        if (block) {
+            ssize_t n = pread(index->fd, block, len, offset);
+            if (n <= 0) break;
+            len = n;
+            text = block;
+        }
+        count = search_count_newlines(text, len);
+        pthread_mutex_lock(&index->lock);
+        if (lines + count >= next) {
+            const char *p = text, *end = text + len;
+            size_t line = lines;
+            while ((p = memchr(p, '\n', end - p)) != NULL) {
+                p++;
+                if (++line == next) {
+                    add_checkpoint(index, offset + (p - text));
+                    next += LINE_CHECKPOINT;
+                    if (lines + count < next) break;
+                }
+            }
+        }
+        lines += count;
+        offset += len;
+        index->indexed_lines = lines;
+        index->indexed_offset = offset;
+        pthread_mutex_unlock(&index->lock);
+    }
+    pthread_mutex_lock(&index->lock);
+    index->complete = offset >= index->size;
+    pthread_mutex_unlock(&index->lock);
+    free(block);
+}
+
+static int read_all(int fd, LineIndex *index) {
+    size_t cap = 1 << 20, len = 0;
+    char *data = malloc(cap);
+    ssize_t n;
+    if (!data) return -1;
+    while ((n = read(fd, data + len, cap - len)) > 0) {
+        len += n;
+        if (len == cap) {
+            char *grown = realloc(data, cap * 2);
+            if (!grown) break;
+            data = grown;
+            cap *= 2;
+        }
+    }
+    index->data = data;
+    index->size = len;
+    index->mapped = 0;
+    return 0;
+}
+
+static void keep_tail(LineIndex *index) {
+    index->tail_len = index->size < INDEX_TAIL ? index->size : INDEX_TAIL;
+    memcpy(index->tail, index->data + index->size - index->tail_len, index->tail_len);
+}
+
+static int index_open(LineIndex *index, const char *filename) {
+    struct stat st;
+    memset(index, 0, sizeof(LineIndex));
+    index->fd = open(filename, O_RDONLY);
+    if (index->fd < 0) return -1;
+    pthread_mutex_init(&index->lock, NULL);
+    add_checkpoint(index, 0);
+    if (fstat(index->fd, &st) < 0) memset(&st, 0, sizeof(st));
+    index->mtime = st.st_mtim;
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, index->fd, 0);
+        if (data != MAP_FAILED) {
+            index->data = data;
+            index->size = st.st_size;
+            index->mapped = 1;
+        }
+    }
+    if (!index->mapped && read_all(index->fd, index) < 0) {
+        close(index->fd);
+        free(index->checkpoints);
+        pthread_mutex_destroy(&index->lock);
+        memset(index, 0, sizeof(LineIndex));
+        index->fd = -1;
+        return -1;
+    }
+    keep_tail(index);
+    cancel_init(&index->token);
+    index->job.run = build_index;
+    index->job.arg = index;
+    index->job.token = &index->token;
+    pool_submit(pool_default(), &index->job);
+    return 0;
+}
+
+/* Safe on an index that failed to open or was closed already. */
+static void index_close(LineIndex *index) {
+    if (index->fd < 0) return;
+    cancel(&index->token);
+    pool_wait(pool_default(), &index->job);
+    if (index->mapped) {
+        munmap((void *)index->data, index->size);
+    } else {
+        free((void *)index->data);
+    }
+    close(index->fd);
+    free(index->checkpoints);
+    pthread_mutex_destroy(&index->lock);
+    memset(index, 0, sizeof(LineIndex));
+    index->fd = -1;
+}
+
+/*
+ * Takes in what was appended to the file, described by st: the index job
+ * is stopped, the mapping or copy extended, and the job set to go on from
+ * where it got to.  Returns -1, with the index as it was or needing to be
+ * opened again, if the file changed in any other way.
+ */
+static int index_grow(LineIndex *index, const struct stat *st) {
+    char tail[INDEX_TAIL];
+    size_t size = st->st_size;
+    off_t from = index->size - index->tail_len;
+    if (size <= index->size ||
+        pread(index->fd, tail, index->tail_len, from) != (ssize_t)index->tail_len ||
+        memcmp(tail, index->tail, index->tail_len) != 0) {
+        return -1;
+    }
+    cancel(&index->token);
+    pool_wait(pool_default(), &index->job);
+    if (index->mapped) {
+        void *data = mremap((void *)index->data, index->size, size, MREMAP_MAYMOVE);
+        if (data == MAP_FAILED) return -1;
+        index->data = data;
+    } else {
+        char *data = realloc((void *)index->data, size);
+        ssize_t n;
+        if (!data) return -1;
+        index->data = data;
+        n = pread(index->fd, data + index->size, size - index->size, index->size);
+        if (n <= 0) return -1;
+        size = index->size + n;
+    }
+    pthread_mutex_lock(&index->lock);
+    index->size = size;
+    index->complete = 0;
+    pthread_mutex_unlock(&index->lock);
+    index->mtime = st->st_mtim;
+    keep_tail(index);
+    pool_submit(pool_default(), &index->job);
+    return 0;
+}
+
+static size_t next_line(const LineIndex *index, size_t offset) {
+    const char *nl;
+    if (offset >= index->size) return index->size;
+    nl = memchr(index->data + offset, '\n', index->size - offset);
+    return nl ? (size_t)(nl - index->data) + 1 : index->size;
+}
+
+static size_t prev_line(const LineIndex *index, size_t offset) {
+    const char *nl;
+    if (offset <= 1) return 0;
+    nl = memrchr(index->data, '\n', offset - 1);
+    return nl ? (size_t)(nl - index->data) + 1 : 0;
+}
+
+static size_t last_line(const LineIndex *index) {
+    return prev_line(index, index->size);
+}
+
+/* Offset of a 0-based line, or -1 if the index has not reached it yet. */
+static int line_offset(LineIndex *index, size_t line, size_t *offset) {
+    size_t k, skip;
+    pthread_mutex_lock(&index->lock);
+    if (!index->complete && line > index->indexed_lines) {
+        pthread_mutex_unlock(&index->lock);
+        return -1;
+    }
+    k = line / LINE_CHECKPOINT;
+    if (k >= index->checkpoint_count) k = index->checkpoint_count - 1;
+    *offset = index->checkpoints[k];
+    pthread_mutex_unlock(&index->lock);
+    for (skip = line - k * LINE_CHECKPOINT; skip > 0 && *offset < index->size; skip--) {
+        *offset = next_line(index, *offset);
+    }
+    if (*offset >= index->size && index->size > 0) {
+        *offset = last_line(index);
+    }
+    return 0;
+}
+
+/* 0-based line containing offset, or -1 if not indexed yet. */
+static long long line_number(LineIndex *index, size_t offset) {
+    size_t lo = 0, hi, base;
+    pthread_mutex_lock(&index->lock);
+    if (!index->complete && offset > index->indexed_offset) {
+        pthread_mutex_unlock(&index->lock);
+        return -1;
+    }
+    hi = index->checkpoint_count;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (index->checkpoints[mid] <= offset) lo = mid; else hi = mid;
+    }
+    base = index->checkpoints[lo];
+    pthread_mutex_unlock(&index->lock);
+    return (long long)(lo * LINE_CHECKPOINT +
+                       search_count_newlines(index->data + base, offset - base));
+}
+
+static int text_rows(Viewer *viewer) {
+    return viewer->screen.rows > 1 ? viewer->screen.rows - 1 : 1;
+}
+
+static void draw(Viewer *viewer) {
+    Screen *screen = &viewer->screen;
+    LineIndex *index = viewer->index;
+    size_t offset = viewer->top;
+    char status[256];
+    long long line;
+    int rows = text_rows(viewer);
+    for (int row = 0; row < rows; row++) {
+        size_t end, len, from = viewer->col_offset;
+        size_t limit = viewer->col_offset + (size_t)screen->cols * UTF8_MAX;
+        const char *text;
+        int col = 0;
+        if (offset >= index->size) {
+            screen_clear_row(screen, row, 0);
+            continue;
+        }
+        text = index->data + offset;
+        end = next_line(index, offset);
+        if (mapping_lost) {
+            screen_clear_row(screen, row, 0);
+            offset = index->size;
+            continue;
+        }
+        len = end - offset;
+        if (len > 0 && text[len - 1] == '\n') len--;
+        if (len > limit) len = limit;
+        if (len > viewer->attrs_cap) {
+            viewer->attrs_cap = len;
+            viewer->attrs = realloc(viewer->attrs, len);
+        }
+        syntax_lex(viewer->lang, text, len, SYNTAX_NORMAL, viewer->attrs);
+        /* The view scrolls by bytes, so it may start inside a character. */
+        while (from < len && ((unsigned char)text[from] & 0xC0) == 0x80) from++;
+        if (len > from) {
+            col = screen_draw(screen, row, 0, text + from, viewer->attrs + from, len - from);
+        }
+        screen_clear_row(screen, row, col);
+        offset = end;
+    }
+    line = line_number(index, viewer->top);
+    if (!mapping_lost) {
+        viewer->top_line = line;
+        viewer->showed_end = offset >= index->size;
+    }
+    pthread_mutex_lock(&index->lock);
+    if (viewer->message[0]) {
+        snprintf(status, sizeof(status), "%s", viewer->message);
+    } else if (index->complete) {
+        snprintf(status, sizeof(status), "%s - Ln %lld of %zu (%d%%)  q: quit  g: go to",
+                 viewer->filename, line + 1,
+                 index->indexed_lines + (index->size > 0 && index->data[index->size - 1] != '\n'),
+                 index->size ? (int)(viewer->top * 100 / index->size) : 100);
+    } else {
+        char where[32] = "?";
+        if (line >= 0) snprintf(where, sizeof(where), "%lld", line + 1);
+        snprintf(status, sizeof(status), "%s - Ln %s (%d%%), indexing %d%%  q: quit  g: go to",
+                 viewer->filename, where, (int)(viewer->top * 100 / (index->size + 1)),
+                 (int)(index->indexed_offset * 100 / (index->size + 1)));
+    }
+    pthread_mutex_unlock(&index->lock);
+    for (int col = screen_draw_text(screen, screen->rows - 1, 0, status, ATTR_SELECTED);
+         col < screen->cols; col++) {
+        unsigned char attr = ATTR_SELECTED;
+        screen_draw(screen, screen->rows - 1, col, " ", &attr, 1);
+    }
+    screen_set_cursor(screen, screen->rows - 1, 0);
+    screen_flush(screen);
+}
+
+static void scroll_lines(Viewer *viewer, int count) {
+    LineIndex *index = viewer->index;
+    size_t bottom = last_line(index);
+    for (; count > 0 && viewer->top < bottom; count--) {
+        viewer->top = next_line(index, viewer->top);
+    }
+    for (; count < 0 && viewer->top > 0; count++) {
+        viewer->top = prev_line(index, viewer->top);
+    }
+}
+
+static void show_end(Viewer *viewer) {
+    viewer->top = last_line(viewer->index);
+    scroll_lines(viewer, 1 - text_rows(viewer));
+}
+
+/* Whether the end of the file is on screen. */
+static int at_end(Viewer *viewer) {
+    size_t offset = viewer->top;
+    for (int row = 0; row < text_rows(viewer) && offset < viewer->index->size; row++) {
+        offset = next_line(viewer->index, offset);
+    }
+    return offset >= viewer->index->size;
+}
+
+static void jump_to_line(Viewer *viewer, size_t line) {
+    size_t offset;
+    if (line_offset(viewer->index, line, &offset) < 0) {
+        viewer->pending_line = line;
+        viewer->has_pending = 1;
+        snprintf(viewer->message, sizeof(viewer->message),
+                 "Line %zu is not indexed yet, jumping when it is (any key cancels)", line + 1);
+        return;
+    }
+    viewer->top = offset;
+    viewer->has_pending = 0;
+    viewer->message[0] = '\0';
+}
+
+/*
+ * Takes in a change to the file.  An append is indexed from where the
+ * index got to, and a view that showed the end keeps showing it, like
+ * tail -f; a file rewritten or replaced is opened and indexed again at the
+ * same line.  The new copy is opened before the old one is let go, so a
+ * file that was removed or cannot be read stays on screen as it was, with
+ * a message, until it comes back.
+ *
+ * Nothing mapped is read until the file is known not to have shrunk: a
+ * file truncated in place is placed by the last frame drawn instead.
+ */
+static void follow_file(Viewer *viewer) {
+    LineIndex *index = viewer->index, *reopened;
+    struct stat st, opened;
+    int end;
+    long long line;
+    if (fstat(index->fd, &opened) < 0 || stat(viewer->filename, &st) < 0) {
+        snprintf(viewer->message, sizeof(viewer->message), "File removed, waiting for it");
+        return;
+    }
+    if (mapping_lost || (size_t)opened.st_size < index->size) {
+        end = viewer->showed_end;
+        line = viewer->top_line;
+    } else {
+        end = at_end(viewer);
+        if (st.st_ino == opened.st_ino && st.st_dev == opened.st_dev) {
+            if ((size_t)st.st_size == index->size &&
+                st.st_mtim.tv_sec == index->mtime.tv_sec &&
+                st.st_mtim.tv_nsec == index->mtime.tv_nsec) {
+                return;
+            }
+            if (index_grow(index, &st) == 0) {
+                if (end) show_end(viewer);
+                return;
+            }
+        }
+        line = line_number(index, viewer->top);
+    }
+    reopened = malloc(sizeof(LineIndex));
+    if (!reopened || index_open(reopened, viewer->filename) < 0) {
+        free(reopened);
+        snprintf(viewer->message, sizeof(viewer->message), "File cannot be read, waiting for it");
+        return;
+    }
+    index_close(index);
+    free(index);
+    viewer->index = mapped_index = reopened;
+    mapping_lost = 0;
+    viewer->message[0] = '\0';
+    viewer->top = 0;
+    viewer->has_pending = 0;
+    if (end) {
+        show_end(viewer);
+    } else if (line > 0) {
+        jump_to_line(viewer, line);
+    }
+}
+
+static void jump(Viewer *viewer, const char *target) {
+    char *end;
+    double value = strtod(target, &end);
+    if (end == target || value < 0) return;
+    if (*end == '%') {
+        size_t offset = (size_t)(viewer->index->size * (value > 100 ? 100 : value) / 100);
+        viewer->top = offset < viewer->index->size ? prev_line(viewer->index, offset + 1)
+                                                  : last_line(viewer->index);
+    } else if (value >= 1) {
+        jump_to_line(viewer, (size_t)value - 1);
+    }
+}
+
+static int prompt(Viewer *viewer, const char *label, char *input, size_t size) {
+    size_t len = strlen(input);
+    while (1) {
+        snprintf(viewer->message, sizeof(viewer->message), "%s%s", label, input);
+        screen_update_size(&viewer->screen);
+        draw(viewer);
+        int ch = input_read_key(&viewer->input, -1);
+        if (ch == 10 || ch == KEY_ESC || ch == KEY_EOF) {
+            viewer->message[0] = '\0';
+            return ch == 10;
+        } else if ((ch == 127 || ch == 8) && len > 0) {
+            input[--len] = '\0';
+        } else if (ch >= 32 && ch <= 126 && len + 1 < size) {
+            input[len++] = ch;
+            input[len] = '\0';
+        }
+    }
+}
+
+int view_large_file(const char *filename) {
+    Viewer viewer;
+    memset(&viewer, 0, sizeof(viewer));
+    viewer.filename = filename;
+    viewer.lang = language_for_file(filename);
+    viewer.index = malloc(sizeof(LineIndex));
+    if (!viewer.index || index_open(viewer.index, filename) < 0) {
+        free(viewer.index);
+        return -1;
+    }
+    catch_sigbus(viewer.index);
+    watch_init(&viewer.watch);
+    viewer.watched = watch_add(&viewer.watch, filename);
+    input_init(&viewer.input, STDIN_FILENO);
+    input_watch(&viewer.input, watch_fd(&viewer.watch));
+    terminal_enable_raw(STDIN_FILENO);
+    screen_init(&viewer.screen, STDOUT_FILENO, VIEW_ROWS, VIEW_COLS);
+    screen_watch_resize();
+    while (1) {
+        int ch;
+        screen_update_size(&viewer.screen);
+        if ((watch_poll(&viewer.watch) > 0 && watch_changed(&viewer.watch, viewer.watched)) ||
+            mapping_lost) {
+            follow_file(&viewer);
+        }
+        if (viewer.has_pending) jump_to_line(&viewer, viewer.pending_line);
+        if (!input_pending(&viewer.input)) draw(&viewer);
+        ch = input_read_key(&viewer.input, viewer.index->complete ? -1 : 200);
+        if (ch == KEY_NONE) continue;
+        if (viewer.has_pending) {
+            viewer.has_pending = 0;
+            viewer.message[0] = '\0';
+            continue;
+        }
+        if (ch == 'q' || ch == KEY_ESC || ch == KEY_EOF) {
+            break;
+        } else if (ch == ARROW_DOWN || ch == 'j' || ch == 10) {
+            scroll_lines(&viewer, 1);
+        } else if (ch == ARROW_UP || ch == 'k') {
+            scroll_lines(&viewer, -1);
+        } else if (ch == PAGE_DOWN || ch == ' ') {
+            scroll_lines(&viewer, text_rows(&viewer));
+        } else if (ch == PAGE_UP || ch == 'b') {
+            scroll_lines(&viewer, -text_rows(&viewer));
+        } else if (ch == HOME_KEY) {
+            viewer.top = 0;
+        } else if (ch == END_KEY) {
+            show_end(&viewer);
+        } else if (ch == ARROW_RIGHT) {
+            viewer.col_offset += HORIZONTAL_STEP;
+        } else if (ch == ARROW_LEFT) {
+            viewer.col_offset = viewer.col_offset > HORIZONTAL_STEP
+                ? viewer.col_offset - HORIZONTAL_STEP : 0;
+        } else if (ch == 'g' || ch == 7) {
+            char target[32] = "";
+            if (prompt(&viewer, "Go to line or percentage (e.g. 1200 or 50%): ", target,
+                       sizeof(target))) {
+                jump(&viewer, target);
+            }
+        }
+    }
+    screen_set_cursor(&viewer.screen, viewer.screen.rows - 1, 0);
+    screen_clear_row(&viewer.screen, viewer.screen.rows - 1, 0);
+    screen_flush(&viewer.screen);
+    screen_unwatch_resize();
+    terminal_disable_raw();
+    screen_free(&viewer.screen);
+    input_free(&viewer.input);
+    watch_free(&viewer.watch);
+    index_close(viewer.index);
+    free(viewer.index);
+    release_sigbus();
+    free(viewer.attrs);
+    return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef VIEWER_H
+#define VIEWER_H
+
+int view_large_file(const char *filename);
+
+#endif
@@ -0,0 +1,115 @@
+#define _GNU_SOURCE
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "watch.h"
+
+#define WATCH_EVENTS (IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+                      IN_MOVED_TO)
+
+int watch_init(Watch *watch) {
+    memset(watch, 0, sizeof(Watch));
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    return watch->fd < 0 ? -1 : 0;
+}
+
+/* Symlinks are resolved first, since saving writes through them to the target. */
+int watch_add(Watch *watch, const char *path) {
+    char target[PATH_MAX];
+    const char *name, *slash;
+    char *dir;
+    int wd, id;
+    if (watch->fd < 0) return -1;
+    if (!realpath(path, target)) {
+        if (strlen(path) >= sizeof(target)) return -1;
+        strcpy(target, path);
+    }
+    slash = strrchr(target, '/');
+    name = slash ? slash + 1 : target;
+    dir = slash ? strndup(target, slash > target ? (size_t)(slash - target) : 1) : strdup(".");
+    if (!dir) return -1;
+    wd = inotify_add_watch(watch->fd, dir, WATCH_EVENTS);
+    free(dir);
+    if (wd < 0) return -1;
+    for (id = 0; id < watch->count && watch->entries[id].name; id++) {
+    }
+    if (id == watch->count) {
+        WatchEntry *grown = realloc(watch->entries, (watch->count + 1) * sizeof(WatchEntry));
+        if (!grown) return -1;
+        watch->entries = grown;
+        watch->count++;
+    }
+    watch->entries[id].wd = wd;
+    watch->entries[id].name = strdup(name);
+    watch->entries[id].changed = 0;
+    return watch->entries[id].name ? id : -1;
+}
+
+/* The directory stays watched while another entry is still in it. */
+void watch_remove(Watch *watch, int id) {
+    WatchEntry *entry;
+    if (id < 0 || id >= watch->count || !watch->entries[id].name) return;
+    entry = &watch->entries[id];
+    free(entry->name);
+    entry->name = NULL;
+    for (int i = 0; i < watch->count; i++) {
+        if (watch->entries[i].name && watch->entries[i].wd == entry->wd) return;
+    }
+    inotify_rm_watch(watch->fd, entry->wd);
+}
+
+int watch_fd(const Watch *watch) {
+    return watch->fd;
+}
+
+static int mark(Watch *watch, int wd, const char *name) {
+    int marked = 0;
+    for (int i = 0; i < watch->count; i++) {
+        WatchEntry *entry = &watch->entries[i];
+        if (!entry->name || entry->changed) continue;
+        if (wd < 0 || (entry->wd == wd && strcmp(entry->name, name) == 0)) {
+            entry->changed = 1;
+            marked++;
+        }
+    }
+    return marked;
+}
+
+/* A queue overflow loses events, so every entry is marked then. */
+int watch_poll(Watch *watch) {
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int marked = 0;
+    ssize_t n;
+    if (watch->fd < 0) return 0;
+    while ((n = read(watch->fd, events, sizeof(events))) > 0) {
+        for (char *p = events; p < events + n;) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            if (event->mask & IN_Q_OVERFLOW) {
+                marked += mark(watch, -1, NULL);
+            } else if (event->len > 0) {
+                marked += mark(watch, event->wd, event->name);
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return marked;
+}
+
+int watch_changed(Watch *watch, int id) {
+    int changed;
+    if (id < 0 || id >= watch->count || !watch->entries[id].name) return 0;
+    changed = watch->entries[id].changed;
+    watch->entries[id].changed = 0;
+    return changed;
+}
+
+void watch_free(Watch *watch) {
+    for (int i = 0; i < watch->count; i++) free(watch->entries[i].name);
+    free(watch->entries);
+    if (watch->fd >= 0) close(watch->fd);
+    memset(watch, 0, sizeof(Watch));
+    watch->fd = -1;
+}
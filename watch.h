@@ -0,0 +1,37 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+/*
+ * Change notification for open files through inotify.  The directory of
+ * each file is watched rather than the file itself, so a file replaced by
+ * renaming another over it, which is how most programs save, is still
+ * seen afterwards.  watch_fd() becomes readable when events are waiting;
+ * watch_poll() drains them and marks every entry whose file was touched,
+ * and watch_changed() reports and clears the mark.
+ *
+ * An event only says the file may have changed; what changed, if
+ * anything, is for the caller to find out from the file.
+ */
+typedef struct {
+    int wd;
+    char *name;
+    int changed;
+} WatchEntry;
+
+typedef struct {
+    int fd;
+    WatchEntry *entries;
+    int count;
+} Watch;
+
+int watch_init(Watch *watch);
+/* Returns the entry id for path, or -1 if it cannot be watched. */
+int watch_add(Watch *watch, const char *path);
+void watch_remove(Watch *watch, int id);
+int watch_fd(const Watch *watch);
+/* Drains the pending events; returns the number of entries newly marked. */
+int watch_poll(Watch *watch);
+int watch_changed(Watch *watch, int id);
+void watch_free(Watch *watch);
+
+#endif